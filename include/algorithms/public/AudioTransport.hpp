@@ -58,7 +58,7 @@ public:
   {
     mWindowSize = windowSize;
     mWindow = ArrayXd::Zero(mWindowSize);
-    WindowFuncs::map()[WindowFuncs::WindowTypes::kHann](mWindowSize, mWindow);
+    WindowFuncs::make(WindowFuncs::WindowTypes::kHann, mWindowSize, mWindow);
     mWindowSquared = mWindow * mWindow;
     mFFTSize = fftSize;
     mHopSize = hopSize;
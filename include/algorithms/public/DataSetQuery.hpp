@@ -11,13 +11,19 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/FluidEigenMappings.hpp"
+#include "../../data/FluidColumnIndex.hpp"
 #include "../../data/FluidDataSet.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/FluidTensor.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -35,21 +41,6 @@ public:
     index  column;
     index  comparison;
     double value;
-
-    bool test(RealVectorView point)
-    {
-      using namespace std;
-      switch (comparison)
-      {
-      case 0: return point(column) == value;
-      case 1: return point(column) != value;
-      case 2: return point(column) < value;
-      case 3: return point(column) <= value;
-      case 4: return point(column) > value;
-      case 5: return point(column) >= value;
-      }
-      return false;
-    }
   };
 
   DataSetQuery()
@@ -68,7 +59,14 @@ public:
 
   bool hasAndConditions() { return (mAndConditions.size() > 0); }
 
-  index maxColumn() { return mColumns.empty() ? 0 : *mColumns.rbegin(); }
+  // Highest column read, either to copy or to test
+  index maxColumn()
+  {
+    index result = mColumns.empty() ? 0 : *mColumns.rbegin();
+    for (auto& c : mAndConditions) result = std::max(result, c.column);
+    for (auto& c : mOrConditions) result = std::max(result, c.column);
+    return result;
+  }
 
   bool addCondition(index column, string comparison, double value,
                     bool conjunction)
@@ -83,37 +81,80 @@ public:
     return true;
   }
 
-  void process(const DataSet& input, DataSet& current, DataSet& output)
+  // Rows are selected through a column index of the input when one narrows
+  // the conditions down to a small part of it, and otherwise by scanning: rows
+  // are taken 64 at a time, each condition is evaluated over the block into a
+  // bitmask with one bit per row, and the masks are combined bitwise. The
+  // rows selected are then gathered into the output in one go.
+  void process(const DataSet& input, const DataSet& current, DataSet& output)
   {
-    auto data = input.getData();
-    auto ids = input.getIds();
-    mTmpPoint = RealVector(asUnsigned(current.pointSize()) + mColumns.size());
-    index limit = mLimit == 0 ? input.size() : mLimit;
-    index count = 0;
-    for (index i = 0; i < input.size() && count < limit; i++)
+    using namespace std;
+    auto          data = input.getData();
+    auto          ids = input.getIds();
+    index         n = input.size();
+    index         limit = mLimit == 0 ? n : mLimit;
+    index         currentSize = current.pointSize();
+    vector<index> rows, currentRows;
+    index         count = 0;
+    auto          select = [&](index i) {
+      count++;
+      if (currentSize > 0)
+      {
+        index currentRow = current.getIndex(ids(i));
+        if (currentRow == -1) return;
+        currentRows.push_back(currentRow);
+      }
+      rows.push_back(i);
+    };
+    vector<index> candidates;
+    if (findCandidates(input, candidates))
     {
-      bool matchesAllAnd = true;
-      auto point = data.row(i);
-      for (index j = 0; j < asSigned(mAndConditions.size()); j++)
-        if (!mAndConditions[asUnsigned(j)].test(point)) matchesAllAnd = false;
-      if (matchesAllAnd)
+      for (index i : candidates)
       {
-        addRow(ids(i), point, current, output);
-        count++;
-        continue;
+        if (count >= limit) break;
+        if (matchesAll(data, i)) select(i);
       }
-      else
+    }
+    else
+    {
+      for (index start = 0; start < n && count < limit; start += mBlockSize)
       {
-        bool matchesAnyOr = false;
-        for (index k = 0; k < asSigned(mOrConditions.size()); k++)
-          if (mOrConditions[asUnsigned(k)].test(point)) matchesAnyOr = true;
-        if (matchesAnyOr)
-        {
-          addRow(ids(i), point, current, output);
-          count++;
-        }
+        index end = std::min(n, start + mBlockSize);
+        // with no AND conditions every row matches, as an empty conjunction
+        // holds
+        Word all = end - start == mBlockSize ? ~Word(0)
+                                             : (Word(1) << (end - start)) - 1;
+        Word any = 0;
+        for (auto& c : mAndConditions) all &= evaluate(c, data, start, end);
+        for (auto& c : mOrConditions) any |= evaluate(c, data, start, end);
+        Word bits = all | any;
+        for (index i = start; bits != 0 && count < limit; i++, bits >>= 1)
+          if (bits & 1) select(i);
       }
     }
+
+    vector<index>          columns(mColumns.begin(), mColumns.end());
+    index                  numRows = asSigned(rows.size());
+    index                  numCols = asSigned(columns.size());
+    FluidTensor<string, 1> outIds(numRows);
+    RealMatrix             outData(numRows, currentSize + numCols);
+    auto                   currentData = current.getData();
+    for (index r = 0; r < numRows; r++)
+    {
+      index row = rows[asUnsigned(r)];
+      outIds(r) = ids(row);
+      if (currentSize > 0)
+      {
+        outData.row(r)(Slice(0, currentSize)) =
+            currentData.row(currentRows[asUnsigned(r)]);
+      }
+      for (index c = 0; c < numCols; c++)
+        outData(r, currentSize + c) = data(row, columns[asUnsigned(c)]);
+    }
+    if (output.size() == 0)
+      output = DataSet(std::move(outIds), std::move(outData));
+    else
+      output.addRange(outIds, outData);
   }
 
   void print() const {}
@@ -128,27 +169,121 @@ public:
   }
 
 private:
-  void addRow(string id, RealVectorView point, const DataSet& current,
-              DataSet& out)
+  using Word = std::uint64_t;
+
+  // When all the conditions are ANDed, those on an indexed column bound the
+  // rows that can match to a range of its index. The narrowest such range
+  // gives the candidate rows, in ascending order, if it rules out most of the
+  // input: otherwise a scan is quicker than visiting rows out of order.
+  bool findCandidates(const DataSet& input, std::vector<index>& rows) const
   {
-    mTmpPoint.fill(0);
-    index currentSize = current.pointSize();
-    bool  shouldAdd = true;
-    if (currentSize > 0)
+    if (mAndConditions.empty() || !mOrConditions.empty()) return false;
+    index                      maxCandidates = input.size() / mMinSelectivity;
+    const ColumnIndex<double>* best = nullptr;
+    Bounds                     bestBounds;
+    for (auto& c : mAndConditions)
     {
-      RealVectorView currentData = mTmpPoint(Slice(0, currentSize));
-      shouldAdd = current.get(id, currentData);
+      auto columnIndex = input.getColumnIndex(c.column);
+      if (!columnIndex || c.comparison == 1) continue;
+      Bounds bounds;
+      for (auto& d : mAndConditions)
+        if (d.column == c.column) bounds.narrow(d);
+      index count = columnIndex->count(bounds.lo, bounds.loInclusive, bounds.hi,
+                                       bounds.hiInclusive);
+      if (count <= maxCandidates)
+      {
+        best = columnIndex;
+        bestBounds = bounds;
+        maxCandidates = count;
+      }
     }
-    if (shouldAdd)
+    if (!best) return false;
+    rows.clear();
+    rows.reserve(asUnsigned(maxCandidates));
+    best->forEach(bestBounds.lo, bestBounds.loInclusive, bestBounds.hi,
+                  bestBounds.hiInclusive,
+                  [&rows](index row) { rows.push_back(row); });
+    std::sort(rows.begin(), rows.end());
+    return true;
+  }
+
+  // Range of values that a set of conditions on one column allows. != doesn't
+  // narrow it, and a column needs at least one other condition to be bounded,
+  // as the index leaves out NaNs.
+  struct Bounds
+  {
+    double lo{-std::numeric_limits<double>::infinity()};
+    double hi{std::numeric_limits<double>::infinity()};
+    bool   loInclusive{true};
+    bool   hiInclusive{true};
+
+    void narrow(const Condition& c)
+    {
+      if (c.comparison == 0 || c.comparison >= 4)
+        raise(c.value, c.comparison != 4);
+      if (c.comparison == 0 || c.comparison == 2 || c.comparison == 3)
+        lower(c.value, c.comparison != 2);
+    }
+
+    void raise(double value, bool inclusive)
+    {
+      if (value > lo || (value == lo && !inclusive))
+      {
+        lo = value;
+        loInclusive = inclusive;
+      }
+    }
+
+    void lower(double value, bool inclusive)
+    {
+      if (value < hi || (value == hi && !inclusive))
+      {
+        hi = value;
+        hiInclusive = inclusive;
+      }
+    }
+  };
+
+  bool matchesAll(FluidTensorView<const double, 2> data, index row) const
+  {
+    for (auto& c : mAndConditions)
+      if (!evaluate(c, data, row, row + 1)) return false;
+    return true;
+  }
+
+  Word evaluate(const Condition& c, FluidTensorView<const double, 2> data,
+                index start, index end) const
+  {
+    switch (c.comparison)
     {
-      for (auto c : mColumns) mTmpPoint(currentSize++) = point(c);
-      out.add(id, mTmpPoint);
+    case 0: return compare(c, data, start, end, std::equal_to<double>{});
+    case 1: return compare(c, data, start, end, std::not_equal_to<double>{});
+    case 2: return compare(c, data, start, end, std::less<double>{});
+    case 3: return compare(c, data, start, end, std::less_equal<double>{});
+    case 4: return compare(c, data, start, end, std::greater<double>{});
+    case 5: return compare(c, data, start, end, std::greater_equal<double>{});
     }
+    return 0;
+  }
+
+  // No branches in the inner loop, so that the compiler can vectorise it
+  template <typename Compare>
+  static Word compare(const Condition& c, FluidTensorView<const double, 2> data,
+                      index start, index end, Compare op)
+  {
+    const double* column = data.data() + c.column;
+    index         stride = data.descriptor().strides[0];
+    Word          bits = 0;
+    for (index i = start; i < end; i++)
+      bits |= Word(op(column[i * stride], c.value)) << (i - start);
+    return bits;
   }
 
+  static constexpr index mBlockSize{64};
+  static constexpr index mMinSelectivity{8};
+
   index                    mLimit{0};
   std::set<index>          mColumns;
-  RealVector               mTmpPoint;
   std::vector<std::string> mComparisons;
   std::vector<Condition>   mAndConditions;
   std::vector<Condition>   mOrConditions;
@@ -29,7 +29,7 @@ public:
   using VectorXd = Eigen::VectorXd;
   using DataSet = FluidDataSet<std::string, double, 1>;
 
-  DataSet process(DataSet& in, index overSample = 1, index extent = 0,
+  DataSet process(const DataSet& in, index overSample = 1, index extent = 0,
                   index axis = 0)
   {
     using namespace Eigen;
@@ -82,7 +82,7 @@ public:
     ArrayXd  yPos = yMin + (rowPos / (numRows - 1)) * (yMax - yMin);
     ArrayXXd grid(M, 2);
     grid << xPos, yPos;
-    ArrayXXd cost = algorithm::DistanceMatrix<ArrayXXd>(data, grid, 1);
+    ArrayXXd cost = algorithm::DistanceMatrix(data, grid, 1);
     ArrayXi  assignment(N);
     bool     outcome = assign2D.process(cost, assignment);
     if (!outcome) return DataSet();
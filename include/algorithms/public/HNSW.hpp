@@ -0,0 +1,507 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "KDTree.hpp"
+#include "../util/DistanceFuncs.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../util/ParallelFor.hpp"
+#include "../../data/FluidDataSet.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/FluidTensor.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// Hierarchical navigable small world graph (Malkov & Yashunin, 2018): an
+// approximate nearest neighbour index that stays fast in high dimensions, where
+// KDTree degrades towards a linear scan. Each point is linked to its nearest
+// neighbours on layer 0 and on a random number of sparser layers above, and a
+// query descends greedily from the top layer before a wider search on layer 0.
+// Recall is traded against speed by maxLinks and buildWidth when building and
+// by the search width when querying.
+class HNSW
+{
+
+public:
+  using string = std::string;
+  using Distance = DistanceFuncs::Distance;
+
+  using DataSet = FluidDataSet<string, double, 1>;
+  using ConstRealVectorView = FluidTensorView<const double, 1>;
+  using BatchResult = KDTree::BatchResult;
+
+  // Node i is point i of the dataset. links(i, _) holds its layer 0 neighbours
+  // and, for a node with levels(i) > 0, upperLinks(upperOffsets(i) + l - 1, _)
+  // its neighbours on layer l. Rows are padded with -1.
+  struct FlatData
+  {
+    FluidTensor<index, 1>  levels;
+    FluidTensor<index, 2>  links;
+    FluidTensor<index, 1>  upperOffsets;
+    FluidTensor<index, 2>  upperLinks;
+    FluidTensor<string, 1> ids;
+    FluidTensor<double, 2> data;
+    FlatData(index n, index m, index maxLinks, index upperRows)
+        : levels(n), links(n, 2 * maxLinks), upperOffsets(n),
+          upperLinks(upperRows, maxLinks), ids(n), data(n, m)
+    {
+      links.fill(-1);
+      upperLinks.fill(-1);
+    }
+  };
+
+  // Scratch space for one search at a time: marks for visited nodes and a
+  // sorted pool of the best `width` candidates so far. Sized up front, so that
+  // queries through it don't allocate.
+  class Workspace
+  {
+  public:
+    Workspace(index size, index width)
+        : mVisited(asUnsigned(size), 0), mPool(asUnsigned(width)),
+          mWidth(width)
+    {}
+
+    index size() const { return asSigned(mVisited.size()); }
+    index width() const { return mWidth; }
+
+    // Narrows the searches made through this, up to the width it was made
+    // with, without reallocating
+    void setWidth(index width)
+    {
+      assert(width > 0 && width <= asSigned(mPool.size()));
+      mWidth = width;
+    }
+
+  private:
+    friend class HNSW;
+
+    struct Candidate
+    {
+      double distance;
+      index  node;
+      bool   expanded;
+    };
+
+    // inserts in order, dropping the furthest candidate if full, and returns
+    // the position or -1 if the candidate wasn't near enough to keep
+    index insert(double distance, index node)
+    {
+      index width = mWidth;
+      if (mSize == width &&
+          distance >= mPool[asUnsigned(width - 1)].distance)
+        return -1;
+      auto end = mPool.begin() + std::min(mSize, width - 1);
+      auto pos = std::upper_bound(
+          mPool.begin(), end, distance,
+          [](double d, const Candidate& c) { return d < c.distance; });
+      std::move_backward(pos, end, end + 1);
+      *pos = Candidate{distance, node, false};
+      mSize = std::min(mSize + 1, width);
+      return std::distance(mPool.begin(), pos);
+    }
+
+    std::vector<index>     mVisited;
+    index                  mStamp{0};
+    std::vector<Candidate> mPool;
+    index                  mWidth;
+    index                  mSize{0};
+  };
+
+  explicit HNSW() = default;
+  ~HNSW() = default;
+
+  // Searches only compare distances, so unlike the trees the graph can use
+  // any metric
+  static bool supports(Distance) { return true; }
+
+  HNSW(const DataSet& dataset, Distance metric = Distance::kEuclidean,
+       index maxLinks = 16, index buildWidth = 200)
+      : mDims(dataset.pointSize()), mMetric(metric)
+  {
+    using namespace std;
+    assert(maxLinks > 1);
+    index n = mDims > 0 ? dataset.size() : 0;
+    // the probability of a node reaching each layer falls by 1 / maxLinks
+    double                            levelScale = 1.0 / log(maxLinks);
+    mt19937                           rng{random_device{}()};
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    vector<index>                     levels(asUnsigned(n));
+    index                             upperRows = 0;
+    for (auto& l : levels)
+    {
+      l = static_cast<index>(floor(-log(1.0 - uniform(rng)) * levelScale));
+      upperRows += l;
+    }
+    mFlat = FlatData(n, mDims, maxLinks, upperRows);
+    for (index i = 0, offset = 0; i < n; i++)
+    {
+      mFlat.levels(i) = levels[asUnsigned(i)];
+      mFlat.upperOffsets(i) = offset;
+      offset += mFlat.levels(i);
+    }
+    mFlat.ids = dataset.getIds();
+    mFlat.data = dataset.getData();
+    mEntry = 0;
+    mMaxLevel = 0;
+    if (n > 0)
+    {
+      // the first point is the whole graph until others are inserted
+      mMaxLevel = mFlat.levels(0);
+      Workspace ws(n, std::max(buildWidth, maxLinks));
+      visitDistance(mMetric, [&](auto kernel) {
+        for (index i = 1; i < n; i++) insert(kernel, i, ws);
+      });
+    }
+    mInitialized = true;
+  }
+
+  // Approximate: the k nearest among those found by a search of the given
+  // width, which should be larger than k for good recall
+  DataSet kNearest(ConstRealVectorView data, index k = 1, double radius = 0,
+                   index searchWidth = 50) const
+  {
+    index                 capacity = k > 0 ? std::min(k, size()) : size();
+    Workspace             ws(size(), std::max(searchWidth, capacity));
+    FluidTensor<index, 1> nodes(capacity);
+    RealVector            distances(capacity);
+    auto                  result = DataSet(1);
+    index numFound = kNearest(data, k, radius, nodes, distances, ws);
+    for (index i = 0; i < numFound; i++)
+      result.add(mFlat.ids(nodes(i)), distances(Slice(i, 1)));
+    return result;
+  }
+
+  // Allocation free query, safe to use on the audio thread given a workspace
+  // made for this index: as KDTree::kNearest, but with the search width, and
+  // so the most results, set by that of the workspace
+  index kNearest(ConstRealVectorView data, index k, double radius,
+                 FluidTensorView<index, 1>  nodes,
+                 FluidTensorView<double, 1> distances, Workspace& ws) const
+  {
+    assert(data.size() == mDims);
+    assert(nodes.size() == distances.size());
+    assert(ws.size() == size());
+    if (size() == 0) return 0;
+    index capacity = k > 0 ? std::min(k, nodes.size()) : nodes.size();
+    visitDistance(mMetric, [&](auto kernel) { search(kernel, data, ws); });
+    index numFound = 0;
+    for (index i = 0; i < ws.mSize && numFound < capacity; i++, numFound++)
+    {
+      auto& candidate = ws.mPool[asUnsigned(i)];
+      if (radius > 0 && candidate.distance >= radius) break;
+      nodes(numFound) = candidate.node;
+      distances(numFound) = candidate.distance;
+    }
+    return numFound;
+  }
+
+  // Queries are independent, so these are spread across worker threads
+  BatchResult kNearestBatch(FluidTensorView<const double, 2> queries, index k,
+                            double radius = 0, index searchWidth = 50) const
+  {
+    assert(k > 0);
+    assert(queries.cols() == mDims);
+    BatchResult result(queries.rows(), k);
+    result.indices.fill(-1);
+    result.distances.fill(std::numeric_limits<double>::infinity());
+    parallelFor(
+        queries.rows(),
+        [&](index start, index end) {
+          Workspace ws(size(), std::max(searchWidth, k));
+          for (index i = start; i < end; i++)
+            kNearest(queries.row(i), k, radius, result.indices.row(i),
+                     result.distances.row(i), ws);
+        },
+        mMinQueriesPerThread);
+    return result;
+  }
+
+  FluidTensorView<const string, 1> getIds() const { return mFlat.ids; }
+
+  index    dims() const { return mDims; }
+  index    size() const { return mFlat.ids.size(); }
+  index    maxLinks() const { return mFlat.upperLinks.cols(); }
+  index    entryPoint() const { return mEntry; }
+  Distance metric() const { return mMetric; }
+  bool     initialized() const { return mInitialized; }
+
+  void clear()
+  {
+    mFlat = FlatData(0, mDims, maxLinks(), 0);
+    mEntry = 0;
+    mMaxLevel = 0;
+    mInitialized = false;
+  }
+
+  const FlatData& toFlat() const { return mFlat; }
+
+  // Whether a graph, e.g. one read from a file, is safe to search: every
+  // table sized for its nodes, each node's upper layers within upperLinks,
+  // and every link to a node present on the link's layer
+  static bool valid(const FlatData& graph, index entryPoint)
+  {
+    index n = graph.ids.size();
+    index maxLinks = graph.upperLinks.cols();
+    index upperRows = graph.upperLinks.rows();
+    if (graph.levels.size() != n || graph.links.rows() != n ||
+        graph.upperOffsets.size() != n || graph.data.rows() != n ||
+        graph.links.cols() != 2 * maxLinks || maxLinks < 1)
+      return false;
+    if (n == 0) return entryPoint == 0;
+    if (entryPoint < 0 || entryPoint >= n) return false;
+    for (index i = 0; i < n; i++)
+    {
+      index levels = graph.levels(i);
+      index offset = graph.upperOffsets(i);
+      if (levels < 0 || offset < 0 || levels > upperRows - offset)
+        return false;
+    }
+    auto linksValid = [&](auto row, index layer) {
+      for (index link : row)
+        if (link < -1 || link >= n || (link >= 0 && graph.levels(link) < layer))
+          return false;
+      return true;
+    };
+    for (index i = 0; i < n; i++)
+    {
+      if (!linksValid(graph.links.row(i), 0)) return false;
+      for (index layer = 1; layer <= graph.levels(i); layer++)
+      {
+        index row = graph.upperOffsets(i) + layer - 1;
+        if (!linksValid(graph.upperLinks.row(row), layer)) return false;
+      }
+    }
+    return true;
+  }
+
+  void fromFlat(FlatData vectors, index entryPoint, Distance metric)
+  {
+    assert(valid(vectors, entryPoint));
+    mDims = vectors.data.cols();
+    mMetric = metric;
+    mFlat = std::move(vectors);
+    mEntry = entryPoint;
+    mMaxLevel = size() > 0 ? mFlat.levels(mEntry) : 0;
+    mInitialized = true;
+  }
+
+private:
+  using Neighbours = std::vector<std::pair<double, index>>;
+  using Point = Eigen::Map<const Eigen::ArrayXd>;
+
+  index capacity(index layer) const
+  {
+    return layer == 0 ? mFlat.links.cols() : mFlat.upperLinks.cols();
+  }
+
+  index* links(index node, index layer)
+  {
+    return layer == 0 ? mFlat.links.data() + node * mFlat.links.cols()
+                      : mFlat.upperLinks.data() +
+                            (mFlat.upperOffsets(node) + layer - 1) *
+                                mFlat.upperLinks.cols();
+  }
+
+  const index* links(index node, index layer) const
+  {
+    return const_cast<HNSW*>(this)->links(node, layer);
+  }
+
+  Point point(index node) const
+  {
+    return {mFlat.data.data() + node * mDims, mDims};
+  }
+
+  template <typename Kernel, typename Query>
+  double distance(index node, const Query& query) const
+  {
+    return Kernel::apply(point(node), query);
+  }
+
+  // Walks to the node nearest to the query on a layer, by moving to any
+  // neighbour closer than the current one until there are none
+  template <typename Kernel, typename Query>
+  void greedySearch(const Query& query, index& current, double& dist,
+                    index layer) const
+  {
+    for (bool moved = true; moved;)
+    {
+      moved = false;
+      const index* neighbours = links(current, layer);
+      for (index i = 0; i < capacity(layer) && neighbours[i] >= 0; i++)
+      {
+        double d = distance<Kernel>(neighbours[i], query);
+        if (d < dist)
+        {
+          dist = d;
+          current = neighbours[i];
+          moved = true;
+        }
+      }
+    }
+  }
+
+  // Best first search on a layer, starting from the candidates already in the
+  // pool, until every candidate kept has had its neighbours visited
+  template <typename Kernel, typename Query>
+  void searchLayer(const Query& query, Workspace& ws, index layer) const
+  {
+    index stamp = ++ws.mStamp;
+    for (index i = 0; i < ws.mSize; i++)
+    {
+      auto& candidate = ws.mPool[asUnsigned(i)];
+      candidate.expanded = false;
+      ws.mVisited[asUnsigned(candidate.node)] = stamp;
+    }
+    for (index i = 0; i < ws.mSize;)
+    {
+      auto& candidate = ws.mPool[asUnsigned(i)];
+      if (candidate.expanded)
+      {
+        i++;
+        continue;
+      }
+      candidate.expanded = true;
+      const index* neighbours = links(candidate.node, layer);
+      index        lowest = i + 1;
+      for (index j = 0; j < capacity(layer) && neighbours[j] >= 0; j++)
+      {
+        index neighbour = neighbours[j];
+        if (ws.mVisited[asUnsigned(neighbour)] == stamp) continue;
+        ws.mVisited[asUnsigned(neighbour)] = stamp;
+        index pos = ws.insert(distance<Kernel>(neighbour, query), neighbour);
+        if (pos >= 0 && pos < lowest) lowest = pos;
+      }
+      i = lowest;
+    }
+  }
+
+  template <typename Kernel>
+  void search(Kernel, ConstRealVectorView data, Workspace& ws) const
+  {
+    auto   query = _impl::asEigen<Eigen::Array>(data);
+    index  current = mEntry;
+    double dist = distance<Kernel>(current, query);
+    for (index layer = mMaxLevel; layer > 0; layer--)
+      greedySearch<Kernel>(query, current, dist, layer);
+    ws.mSize = 0;
+    ws.insert(dist, current);
+    searchLayer<Kernel>(query, ws, 0);
+  }
+
+  // Neighbour selection heuristic: a candidate is preferred if it is nearer
+  // to the new node than to any already chosen, which keeps links spread in
+  // different directions rather than all into the nearest cluster. Any slots
+  // left are filled with the nearest of the rest, so that dense regions (and
+  // metrics such as cosine, where many points can be almost equidistant) stay
+  // well connected.
+  template <typename Kernel>
+  void selectNeighbours(const Neighbours& candidates, index count,
+                        index* out) const
+  {
+    index numSelected = 0;
+    for (auto& candidate : candidates)
+    {
+      if (numSelected == count) break;
+      bool keep = true;
+      for (index i = 0; i < numSelected && keep; i++)
+        keep = distance<Kernel>(candidate.second, point(out[i])) >
+               candidate.first;
+      if (keep) out[numSelected++] = candidate.second;
+    }
+    index numPreferred = numSelected;
+    for (auto& candidate : candidates)
+    {
+      if (numSelected == count) break;
+      if (std::find(out, out + numPreferred, candidate.second) ==
+          out + numPreferred)
+        out[numSelected++] = candidate.second;
+    }
+    std::fill(out + numSelected, out + count, -1);
+  }
+
+  template <typename Kernel>
+  void insert(Kernel, index node, Workspace& ws)
+  {
+    Point  query = point(node);
+    index  level = mFlat.levels(node);
+    index  current = mEntry;
+    double dist = distance<Kernel>(current, query);
+    for (index layer = mMaxLevel; layer > level; layer--)
+      greedySearch<Kernel>(query, current, dist, layer);
+    ws.mSize = 0;
+    ws.insert(dist, current);
+    Neighbours candidates;
+    for (index layer = std::min(level, mMaxLevel); layer >= 0; layer--)
+    {
+      searchLayer<Kernel>(query, ws, layer);
+      candidates.clear();
+      for (index i = 0; i < ws.mSize; i++)
+      {
+        auto& c = ws.mPool[asUnsigned(i)];
+        candidates.emplace_back(c.distance, c.node);
+      }
+      index* nodeLinks = links(node, layer);
+      selectNeighbours<Kernel>(candidates, maxLinks(), nodeLinks);
+      for (index i = 0; i < maxLinks() && nodeLinks[i] >= 0; i++)
+        connect<Kernel>(nodeLinks[i], node, layer, candidates);
+    }
+    if (level > mMaxLevel)
+    {
+      mEntry = node;
+      mMaxLevel = level;
+    }
+  }
+
+  // Adds a back link from node to newNode, reselecting node's links with the
+  // heuristic when it already has as many as it may
+  template <typename Kernel>
+  void connect(index node, index newNode, index layer, Neighbours& scratch)
+  {
+    index* nodeLinks = links(node, layer);
+    index  count = 0;
+    while (count < capacity(layer) && nodeLinks[count] >= 0) count++;
+    if (count < capacity(layer))
+    {
+      nodeLinks[count] = newNode;
+      return;
+    }
+    Point query = point(node);
+    scratch.clear();
+    scratch.emplace_back(distance<Kernel>(newNode, query), newNode);
+    for (index i = 0; i < count; i++)
+      scratch.emplace_back(distance<Kernel>(nodeLinks[i], query), nodeLinks[i]);
+    std::sort(scratch.begin(), scratch.end());
+    selectNeighbours<Kernel>(scratch, count, nodeLinks);
+  }
+
+  static constexpr index mMinQueriesPerThread{16};
+
+  FlatData mFlat{0, 0, 16, 0};
+  index    mDims{0};
+  Distance mMetric{Distance::kEuclidean};
+  index    mEntry{0};
+  index    mMaxLevel{0};
+  bool     mInitialized{false};
+};
+} // namespace algorithm
+} // namespace fluid
@@ -10,259 +10,563 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #pragma once
 
+#include "../util/DistanceFuncs.hpp"
 #include "../util/FluidEigenMappings.hpp"
+#include "../util/KNNHeap.hpp"
+#include "../util/ParallelFor.hpp"
 #include "../../data/FluidDataSet.hpp"
+#include "../../data/FluidIdIndex.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/FluidTensor.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
-#include <queue>
-#include <memory>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
-class KDTree
+// The tree stores points, and takes queries, with elements of type T: see
+// KDTree for double and FloatKDTree for float data. Distances are reported
+// in double precision either way.
+template <typename T>
+class BasicKDTree
 {
 
 public:
   using string = std::string;
+  using Distance = DistanceFuncs::Distance;
 
-  using DataSet = FluidDataSet<string, double, 1>;
-  using ConstRealVectorView = FluidTensorView<const double, 1>;
-  struct Node;
-  using NodePtr = std::shared_ptr<Node>;
-  using knnCandidate = std::pair<double, const Node*>;
-  using knnQueue = std::priority_queue<knnCandidate, std::vector<knnCandidate>,
-                                       std::less<knnCandidate>>;
+  using DataSet = FluidDataSet<string, T, 1>;
+  using ConstRealVectorView = FluidTensorView<const T, 1>;
   using iterator = const std::vector<index>::iterator;
 
-  struct Node
-  {
-    const string     id;
-    const RealVector data;
-    NodePtr          left{nullptr}, right{nullptr};
-  };
-
+  // Nodes are stored contiguously in preorder: node 0 is the root, and
+  // tree(i, 0) / tree(i, 1) hold the left / right child of node i (-1 if none)
   struct FlatData
   {
     FluidTensor<index, 2>  tree;
     FluidTensor<string, 1> ids;
-    FluidTensor<double, 2> data;
+    FluidTensor<T, 2>      data;
     FlatData(index n, index m) : tree(n, 2), ids(n), data(n, m) {}
   };
 
-  explicit KDTree() = default;
-  ~KDTree() = default;
+  // Dense results of kNearestBatch: row i holds the nodes nearest to query i
+  // in ascending order of distance, padded with -1 / infinity when fewer than
+  // k were found within the radius
+  struct BatchResult
+  {
+    FluidTensor<index, 2>  indices;
+    FluidTensor<double, 2> distances;
+    BatchResult(index n, index k) : indices(n, k), distances(n, k) {}
+  };
+
+  explicit BasicKDTree() = default;
+  ~BasicKDTree() = default;
 
-  KDTree(const DataSet& dataset)
+  // Pruning on the splitting planes is only valid for Minkowski metrics, see
+  // VPTree for the others
+  static bool supports(Distance metric)
   {
+    return metric == Distance::kManhattan || metric == Distance::kEuclidean ||
+           metric == Distance::kMax;
+  }
+
+  BasicKDTree(const DataSet& dataset, Distance metric = Distance::kEuclidean)
+      : mDims(dataset.pointSize()), mMetric(metric)
+  {
+    assert(supports(metric));
     using namespace std;
-    mNPoints = dataset.size();
-    mDims = dataset.pointSize();
-    if (mDims > 0 && mNPoints > 0)
+    if (mDims > 0 && dataset.size() > 0)
     {
+      mFlat = FlatData(dataset.size(), mDims);
+      mParents.resize(asUnsigned(dataset.size()));
       vector<index> indices(asUnsigned(dataset.size()));
       iota(indices.begin(), indices.end(), 0);
-      mRoot = buildTree(indices, indices.begin(), indices.end(), dataset, 0);
+      buildTree(indices.begin(), indices.end(),
+                makeSource(dataset.getData(), dataset.getIds(), nullptr), 0, 0,
+                -1);
     }
+    indexNodes();
     mInitialized = true;
   }
 
-  void addNode(string id, ConstRealVectorView data)
+  // Incremental updates keep the tree balanced scapegoat style: when a new
+  // node lands deeper than log(size) / log(1 / mBalance), the lowest ancestor
+  // with one side holding more than mBalance of its nodes is rebuilt, so that
+  // growing the tree costs O(log^2 n) amortized rather than a full rebuild
+  bool addNode(string id, ConstRealVectorView data)
   {
-    mRoot = addNode(mRoot.get(), id, data, 0);
-    mNPoints++;
+    if (size() == 0)
+    {
+      mDims = data.size();
+      mFlat = FlatData(0, mDims);
+      mSlots.clear();
+      mParents.clear();
+    }
+    assert(data.size() == mDims);
+    index newNode = size();
+    if (!mSlots.insert(mFlat.ids, id, newNode)) return false;
+    mFlat.tree.resizeDim(0, 1);
+    mFlat.ids.resizeDim(0, 1);
+    mFlat.data.resizeDim(0, 1);
+    mFlat.tree(newNode, 0) = -1;
+    mFlat.tree(newNode, 1) = -1;
+    mFlat.ids(newNode) = std::move(id);
+    mFlat.data.row(newNode) = data;
+    mParents.push_back(-1);
+    mMaxSize = std::max(mMaxSize, size());
+    mInitialized = true;
+    if (newNode > 0 && addNode(0, newNode, 0) > maxBalancedDepth())
+      rebalance(newNode);
+    return true;
   }
 
-  DataSet kNearest(ConstRealVectorView data, index k = 1,
-                   double radius = 0) const
+  // Rebuilds just the subtree below the removed node, which is O(log n) nodes
+  // on average, and the whole tree once it has shrunk by a factor of mBalance
+  bool removeNode(const string& id)
   {
-    assert(data.size() == mDims);
-    knnQueue queue;
-    auto     result = DataSet(1);
-    kNearest(mRoot.get(), data, queue, k, radius, 0);
-    index                     numFound = asSigned(queue.size());
-    std::vector<knnCandidate> sorted(asUnsigned(numFound));
-    for (index i = numFound - 1; i >= 0; i--)
+    index node = mSlots.find(mFlat.ids, id);
+    if (node == -1) return false;
+    mSlots.erase(mFlat.ids, id);
+    if (size() == 1)
+    {
+      mFlat = FlatData(0, mDims);
+      mParents.clear();
+      mMaxSize = 0;
+      return true;
+    }
+    index freed = rebuild(node, depth(node), node);
+    moveNode(size() - 1, freed);
+    mFlat.tree.resizeDim(0, -1);
+    mFlat.ids.resizeDim(0, -1);
+    mFlat.data.resizeDim(0, -1);
+    mParents.pop_back();
+    if (size() < mBalance * mMaxSize)
     {
-      sorted[asUnsigned(i)] = queue.top();
-      queue.pop();
+      rebuild(0, 0, -1);
+      mMaxSize = size();
     }
+    return true;
+  }
+
+  bool updateNode(const string& id, ConstRealVectorView data)
+  {
+    assert(data.size() == mDims);
+    if (!removeNode(id)) return false;
+    return addNode(id, data);
+  }
+
+  FluidDataSet<string, double, 1> kNearest(ConstRealVectorView data,
+                                           index k = 1, double radius = 0) const
+  {
+    index                 capacity = k > 0 ? std::min(k, size()) : size();
+    FluidTensor<index, 1> nodes(capacity);
+    RealVector            distances(capacity);
+    auto                  result = FluidDataSet<string, double, 1>(1);
+    index numFound = kNearest(data, k, radius, nodes, distances);
     for (index i = 0; i < numFound; i++)
+      result.add(mFlat.ids(nodes(i)), distances(Slice(i, 1)));
+    return result;
+  }
+
+  // Allocation free query, safe to use on the audio thread: writes the nodes
+  // nearest to data, and their distances, in ascending order into the caller's
+  // storage and returns how many were found. If k is 0 then all the points
+  // within radius are wanted, up to the size of the storage.
+  index kNearest(ConstRealVectorView data, index k, double radius,
+                 FluidTensorView<index, 1>  nodes,
+                 FluidTensorView<double, 1> distances) const
+  {
+    assert(data.size() == mDims);
+    assert(nodes.size() == distances.size());
+    index   capacity = k > 0 ? std::min(k, nodes.size()) : nodes.size();
+    KNNHeap heap{nodes, distances, capacity};
+    if (size() > 0 && capacity > 0)
     {
-      auto dist = FluidTensor<double, 1>{sorted[asUnsigned(i)].first};
-      auto id = sorted[asUnsigned(i)].second->id;
-      result.add(id, dist);
+      // a contiguous query maps to a fixed stride array, which lets Eigen
+      // vectorise the distance kernels
+      if (data.descriptor().strides[0] == 1)
+      {
+        Eigen::Map<const Column> query(data.data(), mDims);
+        visitDistance(mMetric, [&](auto kernel) {
+          kNearest(kernel, 0, query, heap, radius, 0);
+        });
+      }
+      else
+      {
+        auto query = _impl::asEigen<Eigen::Array>(data).col(0);
+        visitDistance(mMetric, [&](auto kernel) {
+          kNearest(kernel, 0, query, heap, radius, 0);
+        });
+      }
     }
+    heap.sort();
+    return heap.size;
+  }
+
+  // Queries are independent, so these are spread across worker threads
+  BatchResult kNearestBatch(FluidTensorView<const T, 2> queries, index k,
+                            double radius = 0) const
+  {
+    assert(k > 0);
+    assert(queries.cols() == mDims);
+    BatchResult result(queries.rows(), k);
+    result.indices.fill(-1);
+    result.distances.fill(std::numeric_limits<double>::infinity());
+    if (size() == 0) return result;
+    parallelFor(
+        queries.rows(),
+        [&](index start, index end) {
+          for (index i = start; i < end; i++)
+          {
+            kNearest(queries.row(i), k, radius, result.indices.row(i),
+                     result.distances.row(i));
+          }
+        },
+        mMinQueriesPerThread);
     return result;
   }
 
-  void  print() const { print(mRoot.get(), 0); }
-  index dims() const { return mDims; }
-  index size() const { return mNPoints; }
-  bool  initialized() const { return mInitialized; }
+  FluidTensorView<const string, 1> getIds() const { return mFlat.ids; }
+
+  // The node holding id, or -1 if there is none
+  index find(const string& id) const { return mSlots.find(mFlat.ids, id); }
+
+  void     print() const { print(size() > 0 ? 0 : -1, 0); }
+  index    dims() const { return mDims; }
+  Distance metric() const { return mMetric; }
+  index    size() const { return mFlat.ids.size(); }
+  bool     initialized() const { return mInitialized; }
 
   void clear()
   {
-    mRoot = nullptr;
+    mFlat = FlatData(0, mDims);
+    mSlots.clear();
+    mParents.clear();
+    mMaxSize = 0;
     mInitialized = false;
   }
 
-  FlatData toFlat() const
+  const FlatData& toFlat() const { return mFlat; }
+
+  // Whether the links of a tree, e.g. one read from a file, are safe to
+  // search and update: each child -1 or a node, and every node but the root,
+  // node 0, the child of exactly one other and so reached from the root
+  static bool valid(FluidTensorView<const index, 2> tree)
   {
-    FlatData store(mNPoints, mDims);
-    flatten(0, mRoot.get(), store);
-    return store;
+    index n = tree.rows();
+    if (tree.cols() != 2) return false;
+    if (n == 0) return true;
+    std::vector<char> hasParent(asUnsigned(n), 0);
+    for (index child : tree)
+    {
+      if (child == -1) continue;
+      if (child <= 0 || child >= n || hasParent[asUnsigned(child)])
+        return false;
+      hasParent[asUnsigned(child)] = 1;
+    }
+    // a node with one parent could still be on a loop out of reach
+    std::vector<index> stack{0};
+    index              reached = 0;
+    while (!stack.empty())
+    {
+      index node = stack.back();
+      stack.pop_back();
+      reached++;
+      for (index side = 0; side < 2; side++)
+        if (tree(node, side) != -1) stack.push_back(tree(node, side));
+    }
+    return reached == n;
   }
 
-  void fromFlat(FlatData vectors)
+  void fromFlat(FlatData vectors, Distance metric = Distance::kEuclidean)
   {
-    mRoot = unflatten(vectors, 0);
-    mNPoints = vectors.data.rows();
+    assert(supports(metric));
+    assert(valid(vectors.tree) && vectors.ids.size() == vectors.tree.rows() &&
+           vectors.data.rows() == vectors.tree.rows());
     mDims = vectors.data.cols();
+    mMetric = metric;
+    mFlat = std::move(vectors);
+    indexNodes();
     mInitialized = true;
   }
 
 private:
-  NodePtr buildTree(std::vector<index>& indices, iterator from, iterator to,
-                    const DataSet& dataset, index depth) const
+  // Rebuilds the id lookup and parent links that incremental updates need,
+  // which aren't stored in FlatData as they follow from it
+  void indexNodes()
   {
-    using namespace std;
-    if (from == to)
-      return nullptr;
-    else if (std::distance(from, to) == 1)
+    mSlots.clear();
+    mSlots.reserve(size());
+    mParents.assign(asUnsigned(size()), -1);
+    for (index i = 0; i < size(); i++)
     {
-      return makeNode(dataset.getIds()(*from), dataset.getData().row(*from));
+      mSlots.insert(mFlat.ids, mFlat.ids(i), i);
+      for (index side = 0; side < 2; side++)
+        if (mFlat.tree(i, side) != -1)
+          mParents[asUnsigned(mFlat.tree(i, side))] = i;
     }
-    const index d = depth % mDims;
-    sort(from, to, [&](index a, index b) {
-      return dataset.getData().row(a)(d) < dataset.getData().row(b)(d);
-    });
+    mMaxSize = size();
+  }
+
+  // Points to build (part of) the tree from. Median selection reads a column
+  // major copy of the data, so that comparisons along one dimension touch
+  // contiguous memory.
+  struct BuildSource
+  {
+    FluidTensorView<const T, 2>      data;
+    FluidTensorView<const string, 1> ids;
+    FluidTensor<T, 2>                columns;
+    const index*                     slots;
+    index                            spawnDepth;
+  };
+
+  BuildSource makeSource(FluidTensorView<const T, 2>      data,
+                         FluidTensorView<const string, 1> ids,
+                         const index*                     slots) const
+  {
+    using namespace Eigen;
+    FluidTensor<T, 2> columns(mDims, data.rows());
+    _impl::asEigen<Matrix>(columns) = _impl::asEigen<Matrix>(data).transpose();
+    index workers = numWorkers(data.rows(), mMinPointsPerThread);
+    index spawnDepth = static_cast<index>(std::ceil(std::log2(workers)));
+    return {data, ids, std::move(columns), slots, spawnDepth};
+  }
+
+  // Builds the subtree for the points in [from, to) in preorder from position
+  // pos, which is slot pos or, if the source has them, slots[pos]. As each
+  // subtree occupies its own run of positions, the two sides of the upper
+  // levels are built concurrently.
+  index buildTree(iterator from, iterator to, const BuildSource& source,
+                  index depth, index pos, index parent)
+  {
+    if (from == to) return -1;
+    const T* keys =
+        source.columns.data() + (depth % mDims) * source.columns.cols();
     const index range = std::distance(from, to);
     const index median = range / 2;
-    NodePtr     current = makeNode(dataset.getIds().row(*(from + median)),
-                               dataset.getData().row(*(from + median)));
-    if (median > 0)
-      current->left =
-          buildTree(indices, from, from + median, dataset, depth + 1);
-    if (range - median > 1)
-      current->right =
-          buildTree(indices, from + median + 1, to, dataset, depth + 1);
-    return current;
+    std::nth_element(from, from + median, to,
+                     [keys](index a, index b) { return keys[a] < keys[b]; });
+    const index slot = source.slots ? source.slots[pos] : pos;
+    const index point = *(from + median);
+    mFlat.ids(slot) = source.ids(point);
+    mFlat.data.row(slot) = source.data.row(point);
+    mParents[asUnsigned(slot)] = parent;
+    auto buildLeft = [&]() {
+      mFlat.tree(slot, 0) =
+          buildTree(from, from + median, source, depth + 1, pos + 1, slot);
+    };
+    auto buildRight = [&]() {
+      mFlat.tree(slot, 1) = buildTree(from + median + 1, to, source, depth + 1,
+                                      pos + median + 1, slot);
+    };
+    if (depth < source.spawnDepth)
+    {
+      std::thread left(buildLeft);
+      buildRight();
+      left.join();
+    }
+    else
+    {
+      buildLeft();
+      buildRight();
+    }
+    return slot;
   }
 
-  NodePtr makeNode(string id, ConstRealVectorView data) const
+  // Links newNode below current and returns the depth it ends up at
+  index addNode(index current, index newNode, index depth)
   {
-    return std::make_shared<Node>(Node{id, RealVector{data}, nullptr, nullptr});
+    const index d = depth % mDims;
+    const index side =
+        mFlat.data(newNode, d) < mFlat.data(current, d) ? 0 : 1;
+    if (mFlat.tree(current, side) != -1)
+      return addNode(mFlat.tree(current, side), newNode, depth + 1);
+    mFlat.tree(current, side) = newNode;
+    mParents[asUnsigned(newNode)] = current;
+    return depth + 1;
   }
 
-  NodePtr addNode(Node* current, string id, ConstRealVectorView data,
-                  const index depth) const
+  index maxBalancedDepth() const
   {
-    if (current == nullptr) { return makeNode(id, data); }
+    return static_cast<index>(std::log(size()) / std::log(1.0 / mBalance));
+  }
 
-    const index d = depth % mDims;
-    if (data(d) < current->data(d))
-    { current->left = addNode(current->left.get(), id, data, depth + 1); }
-    else
+  index depth(index node) const
+  {
+    index result = 0;
+    for (; mParents[asUnsigned(node)] != -1; result++)
+      node = mParents[asUnsigned(node)];
+    return result;
+  }
+
+  index subtreeSize(index node) const
+  {
+    if (node == -1) return 0;
+    return 1 + subtreeSize(mFlat.tree(node, 0)) +
+           subtreeSize(mFlat.tree(node, 1));
+  }
+
+  // Walks up from a node that was added too deep to find the scapegoat
+  void rebalance(index node)
+  {
+    index nodeDepth = depth(node);
+    index nodeSize = 1;
+    for (index parent = mParents[asUnsigned(node)]; parent != -1;
+         node = parent, parent = mParents[asUnsigned(node)], nodeDepth--)
     {
-      current->right = addNode(current->right.get(), id, data, depth + 1);
+      index side = mFlat.tree(parent, 0) == node ? 1 : 0;
+      index sibling = mFlat.tree(parent, side);
+      index parentSize = nodeSize + 1 + subtreeSize(sibling);
+      if (nodeSize > mBalance * parentSize)
+      {
+        rebuild(parent, nodeDepth - 1, -1);
+        return;
+      }
+      nodeSize = parentSize;
     }
-    return NodePtr(current);
   }
 
-  double distance(ConstRealVectorView p1, ConstRealVectorView p2) const
+  void collect(index node, std::vector<index>& nodes) const
   {
-    using namespace Eigen;
-    auto v1 = _impl::asEigen<Array>(p1);
-    auto v2 = _impl::asEigen<Array>(p2);
-    return (v1 - v2).matrix().norm();
+    if (node == -1) return;
+    nodes.push_back(node);
+    collect(mFlat.tree(node, 0), nodes);
+    collect(mFlat.tree(node, 1), nodes);
   }
 
-  void print(Node* current, index depth) const
+  // Rebuilds the subtree at root, which sits at the given depth, leaving out
+  // the node skip (or none if -1). The subtree is rebuilt into the same slots,
+  // lowest first, so the root of the tree stays at 0. Returns the slot left
+  // unused by skip, if any.
+  index rebuild(index root, index depth, index skip)
+  {
+    using namespace std;
+    index         parent = mParents[asUnsigned(root)];
+    vector<index> slots;
+    collect(root, slots);
+    vector<index> nodes;
+    for (index slot : slots)
+      if (slot != skip) nodes.push_back(slot);
+    index                  n = asSigned(nodes.size());
+    FluidTensor<T, 2>      data(n, mDims);
+    FluidTensor<string, 1> ids(n);
+    for (index i = 0; i < n; i++)
+    {
+      index node = nodes[asUnsigned(i)];
+      mSlots.erase(mFlat.ids, mFlat.ids(node));
+      data.row(i) = mFlat.data.row(node);
+      ids(i) = std::move(mFlat.ids(node));
+    }
+    sort(slots.begin(), slots.end());
+    index freed = -1;
+    if (skip != -1)
+    {
+      freed = slots.back();
+      slots.pop_back();
+    }
+    vector<index> order(asUnsigned(n));
+    iota(order.begin(), order.end(), 0);
+    index newRoot = buildTree(order.begin(), order.end(),
+                              makeSource(data, ids, slots.data()), depth, 0,
+                              parent);
+    for (index slot : slots) mSlots.insert(mFlat.ids, mFlat.ids(slot), slot);
+    if (parent != -1)
+      mFlat.tree(parent, mFlat.tree(parent, 0) == root ? 0 : 1) = newRoot;
+    return freed;
+  }
+
+  // Moves a node into an unused slot, relinking its parent and children
+  void moveNode(index from, index to)
+  {
+    if (from == to) return;
+    index parent = mParents[asUnsigned(from)];
+    mSlots.relocate(mFlat.ids, mFlat.ids(from), to);
+    mFlat.data.row(to) = mFlat.data.row(from);
+    mFlat.ids(to) = std::move(mFlat.ids(from));
+    mParents[asUnsigned(to)] = parent;
+    if (parent != -1)
+      mFlat.tree(parent, mFlat.tree(parent, 0) == from ? 0 : 1) = to;
+    for (index side = 0; side < 2; side++)
+    {
+      index child = mFlat.tree(from, side);
+      mFlat.tree(to, side) = child;
+      if (child != -1) mParents[asUnsigned(child)] = to;
+    }
+  }
+
+  void print(index current, index depth) const
   {
     for (index i = 0; i < depth; ++i) std::cout << "  ";
-    if (current == nullptr)
+    if (current == -1)
     {
       std::cout << " null" << std::endl;
       return;
     }
-    std::cout << " " << current->id << std::endl;
+    std::cout << " " << mFlat.ids(current) << std::endl;
     for (index i = 0; i < depth; ++i) std::cout << "  ";
     std::cout << " left" << std::endl;
-    print(current->left.get(), depth + 1);
+    print(mFlat.tree(current, 0), depth + 1);
     for (index i = 0; i < depth; ++i) std::cout << "  ";
     std::cout << " right" << std::endl;
-    print(current->right.get(), depth + 1);
+    print(mFlat.tree(current, 1), depth + 1);
   }
 
-  void kNearest(const Node* current, ConstRealVectorView data, knnQueue& knn,
-                index k, double radius, index depth) const
+  // For any Minkowski metric the distance to a splitting plane is just the
+  // difference on its axis, so the same pruning test holds for all of them
+  template <typename Kernel, typename Query>
+  void kNearest(Kernel kernel, index current, const Query& data, KNNHeap& knn,
+                double radius, index depth) const
   {
-    if (current == nullptr) return;
-    const double currentDist = distance(current->data, data);
+    if (current == -1) return;
+    Eigen::Map<const Column> point(mFlat.data.row(current).data(), mDims);
+    const double             currentDist = Kernel::apply(point, data);
     bool         withinRadius = radius > 0 ? currentDist < radius : true;
-    if (withinRadius && (knn.size() < asUnsigned(k) || k == 0))
-    { knn.push(std::make_pair(currentDist, current)); }
-    else if (withinRadius && currentDist < knn.top().first)
+    if (withinRadius && !knn.full()) { knn.push(currentDist, current); }
+    else if (withinRadius && currentDist < knn.top())
     {
-      knn.pop();
-      knn.push(std::make_pair(currentDist, current));
+      knn.replaceTop(currentDist, current);
     }
     const index  d = depth % mDims;
-    const double dimDif = current->data(d) - data(d);
-    Node*        firstBranch = current->left.get();
-    Node*        secondBranch = current->right.get();
+    const double dimDif = mFlat.data(current, d) - data(d);
+    index        firstBranch = mFlat.tree(current, 0);
+    index        secondBranch = mFlat.tree(current, 1);
     if (dimDif <= 0)
     {
-      firstBranch = current->right.get();
-      secondBranch = current->left.get();
+      firstBranch = mFlat.tree(current, 1);
+      secondBranch = mFlat.tree(current, 0);
     }
-    kNearest(firstBranch, data, knn, k, radius, depth + 1);
-    if (k == 0 || knn.size() < asUnsigned(k) ||
-        dimDif < knn.top().first) // ball centered at query with diametre
-                                  // kthDist intersects with current partition
-                                  // (or need to get more neighbors)
-    { kNearest(secondBranch, data, knn, k, radius, depth + 1); }
+    kNearest(kernel, firstBranch, data, knn, radius, depth + 1);
+    if (!knn.full() ||
+        std::abs(dimDif) <
+            knn.top()) // ball centered at query with diametre kthDist
+                       // intersects with current partition
+                       // (or need to get more neighbors)
+    { kNearest(kernel, secondBranch, data, knn, radius, depth + 1); }
   }
 
-  index flatten(index nodeId, const Node* current, FlatData& store) const
-  {
-    if (current == nullptr) { return nodeId; }
-    store.ids(nodeId) = current->id;
-    store.data.row(nodeId) = current->data;
+  using Column = Eigen::Array<T, Eigen::Dynamic, 1>;
 
-    index nextNodeId = nodeId + 1;
-    if (current->left == nullptr) { store.tree(nodeId, 0) = -1; }
-    else
-    {
-      store.tree(nodeId, 0) = nextNodeId;
-      nextNodeId = flatten(nextNodeId, current->left.get(), store);
-    }
-    if (current->right == nullptr) { store.tree(nodeId, 1) = -1; }
-    else
-    {
-      store.tree(nodeId, 1) = nextNodeId;
-      nextNodeId = flatten(nextNodeId, current->right.get(), store);
-    }
-    return nextNodeId;
-  }
+  static constexpr index  mMinQueriesPerThread{64};
+  static constexpr index  mMinPointsPerThread{1 << 16};
+  static constexpr double mBalance{0.7};
 
-  NodePtr unflatten(const FlatData& store, index index) const
-  {
-    if (index == -1) return nullptr;
-    NodePtr current = makeNode(store.ids[index], store.data[index]);
-    current->left = unflatten(store, store.tree(index, 0));
-    current->right = unflatten(store, store.tree(index, 1));
-    return current;
-  }
-
-  NodePtr mRoot{nullptr};
-  index   mDims;
-  index   mNPoints{0};
-  bool    mInitialized{false};
+  FlatData           mFlat{0, 0};
+  index              mDims{0};
+  Distance           mMetric{Distance::kEuclidean};
+  IdIndex<string>    mSlots;
+  std::vector<index> mParents;
+  index              mMaxSize{0};
+  bool               mInitialized{false};
 };
+
+using KDTree = BasicKDTree<double>;
+using FloatKDTree = BasicKDTree<float>;
+
 } // namespace algorithm
 } // namespace fluid
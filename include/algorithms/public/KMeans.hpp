@@ -12,12 +12,21 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #include "../util/DistanceFuncs.hpp"
 #include "../util/FluidEigenMappings.hpp"
+#include "../util/ModelVersion.hpp"
 #include "../../data/FluidDataSet.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/FluidTensor.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
 #include <queue>
+#include <random>
 #include <string>
 
 namespace fluid {
@@ -32,41 +41,65 @@ public:
     mMeans.setZero();
     mAssignments.setZero();
     mTrained = false;
+    mVersion.stamp();
   }
 
   bool initialized() const { return mTrained; }
 
+  // Changes whenever the means might have, so that copies of them, as in
+  // OnlineKMeans, know when they're stale: see ModelVersion
+  index version() const { return mVersion.value(); }
+
+  // How the first means are chosen: from a random partition of the points,
+  // by k-means++, or by its scalable variant k-means||
+  enum class Init { kRandomPartition, kPlusPlus, kParallel };
+
+  // Trains with Lloyd's algorithm over the whole dataset, or with mini-batches
+  // of batchSize points sampled at random when that is smaller than the
+  // dataset, in which case maxIter counts batches. Training again continues
+  // from the current means; otherwise nInit models are trained from different
+  // starting means, concurrently, and the one with the lowest inertia kept.
   void train(const FluidDataSet<std::string, double, 1>& dataset, index k,
-             index maxIter)
+             index maxIter, index batchSize = 0,
+             Init init = Init::kRandomPartition, index nInit = 1)
   {
     using namespace Eigen;
     using namespace _impl;
     assert(!mTrained || (dataset.pointSize() == mDims && mK == k));
-    auto dataPoints = asEigen<Array>(dataset.getData());
-    if (mTrained) { mAssignments = assignClusters(dataPoints); }
-    else
+    auto               dataPoints = asEigen<Array>(dataset.getData());
+    DataRef            data(dataPoints);
+    std::random_device rd;
+    if (mTrained)
     {
-      mK = k;
-      mDims = dataset.pointSize();
-      mMeans = ArrayXXd::Zero(mK, mDims);
-      mEmpty = std::vector<bool>(asUnsigned(mK), false);
-      mAssignments =
-          ((0.5 + (0.5 * ArrayXf::Random(dataPoints.rows()))) * (mK - 1))
-              .round()
-              .cast<int>();
+      std::mt19937 rng(rd());
+      assignClusters(data);
+      fit(data, maxIter, batchSize, rng);
+      mVersion.stamp();
+      return;
     }
-
-    while (maxIter-- > 0)
-    {
-      computeMeans(dataPoints);
-      auto assignments = assignClusters(dataPoints);
-      if (!changed(assignments)) { break; }
-      else
+    std::vector<KMeans>   runs(asUnsigned(std::max<index>(1, nInit)));
+    std::vector<unsigned> seeds(runs.size());
+    std::vector<double>   inertia(runs.size());
+    for (auto& seed : seeds) seed = rd();
+    // with more than one run, each is given a thread of its own
+    index pointsPerThread =
+        runs.size() > 1 ? data.rows() : mMinPointsPerThread;
+    parallelFor(asSigned(runs.size()), [&](index start, index end) {
+      for (index r = start; r < end; r++)
       {
-        mAssignments = assignments;
+        KMeans&      run = runs[asUnsigned(r)];
+        std::mt19937 rng(seeds[asUnsigned(r)]);
+        run.mK = k;
+        run.mDims = dataset.pointSize();
+        run.mPointsPerThread = pointsPerThread;
+        run.initialize(data, init, rng);
+        run.fit(data, maxIter, batchSize, rng);
+        inertia[asUnsigned(r)] = run.inertia(data);
       }
-    }
-    mTrained = true;
+    });
+    auto best = std::min_element(inertia.begin(), inertia.end());
+    *this = std::move(runs[asUnsigned(std::distance(inertia.begin(), best))]);
+    mPointsPerThread = mMinPointsPerThread;
   }
 
   index getClusterSize(index cluster) const
@@ -90,13 +123,15 @@ public:
     if (mTrained) out = _impl::asFluid(mMeans);
   }
 
-  void setMeans(RealMatrixView means)
+  void setMeans(FluidTensorView<const double, 2> means)
   {
     mMeans = _impl::asEigen<Eigen::Array>(means);
     mDims = mMeans.cols();
     mK = mMeans.rows();
     mEmpty = std::vector<bool>(asUnsigned(mK), false);
+    mCounts = Eigen::ArrayXd::Ones(mK);
     mTrained = true;
+    mVersion.stamp();
   }
 
   index dims() const { return mMeans.cols(); }
@@ -109,16 +144,163 @@ public:
     out = _impl::asFluid(mAssignments);
   }
 
-  void getDistances(RealMatrixView data, RealMatrixView out) const
+  void getDistances(FluidTensorView<const double, 2> data,
+                    RealMatrixView                  out) const
   {
     Eigen::ArrayXXd points = _impl::asEigen<Eigen::Array>(data);
-    Eigen::ArrayXXd D = fluid::algorithm::DistanceMatrix(points, 2);
-    Eigen::MatrixXd means = mMeans.matrix();
-    D = fluid::algorithm::DistanceMatrix<Eigen::ArrayXXd>(points, mMeans, 2);
+    Eigen::ArrayXXd D = fluid::algorithm::DistanceMatrix(points, mMeans, 2);
     out = _impl::asFluid(D);
   }
 
 private:
+  friend class OnlineKMeans;
+
+  using RowMajorArray =
+      Eigen::Array<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+  using DataRef = Eigen::Ref<const RowMajorArray>;
+
+  void initialize(DataRef data, Init init, std::mt19937& rng)
+  {
+    using namespace Eigen;
+    mMeans = ArrayXXd::Zero(mK, mDims);
+    mEmpty = std::vector<bool>(asUnsigned(mK), false);
+    switch (init)
+    {
+    case Init::kPlusPlus:
+      mMeans = seedPlusPlus(data, ArrayXd::Ones(data.rows()), rng);
+      assignClusters(data);
+      break;
+    case Init::kParallel:
+      seedParallel(data, rng);
+      assignClusters(data);
+      break;
+    default:
+    {
+      std::uniform_int_distribution<int> randomCluster(
+          0, static_cast<int>(mK - 1));
+      mAssignments.resize(data.rows());
+      for (index i = 0; i < data.rows(); i++)
+        mAssignments(i) = randomCluster(rng);
+      computeMeans(data);
+    }
+    }
+    mTrained = true;
+  }
+
+  void fit(DataRef data, index maxIter, index batchSize, std::mt19937& rng)
+  {
+    if (batchSize > 0 && batchSize < data.rows())
+      trainMiniBatch(data, maxIter, batchSize, rng);
+    else
+      trainFullBatch(data, maxIter);
+    mCounts = Eigen::ArrayXd::Zero(mK);
+    for (index i = 0; i < mAssignments.size(); i++)
+      mCounts(mAssignments(i)) += 1;
+    mTrained = true;
+  }
+
+  // k-means++: the first mean is a point picked at random, and each of the
+  // others a point picked with probability proportional to its weight times
+  // its squared distance to the nearest mean so far
+  Eigen::ArrayXXd seedPlusPlus(DataRef points, const Eigen::ArrayXd& weights,
+                               std::mt19937& rng) const
+  {
+    using namespace Eigen;
+    index    n = points.rows();
+    ArrayXXd means(mK, mDims);
+    ArrayXd  nearest =
+        ArrayXd::Constant(n, std::numeric_limits<double>::infinity());
+    ArrayXd  cumulative(n);
+    for (index c = 0; c < mK; c++)
+    {
+      ArrayXd p = c == 0 ? weights : ArrayXd(weights * nearest);
+      // if every point is already a mean, repeat one rather than fail
+      if (!(p.sum() > 0)) p = weights;
+      std::partial_sum(p.data(), p.data() + n, cumulative.data());
+      std::uniform_real_distribution<double> pick(0, cumulative(n - 1));
+      index row = std::upper_bound(cumulative.data(), cumulative.data() + n,
+                                   pick(rng)) -
+                  cumulative.data();
+      means.row(c) = points.row(std::min(row, n - 1));
+      parallelFor(
+          n,
+          [&](index start, index end) {
+            for (index i = start; i < end; i++)
+            {
+              double dist =
+                  SqEuclideanDistance::apply(points.row(i), means.row(c));
+              nearest(i) = std::min(nearest(i), dist);
+            }
+          },
+          mPointsPerThread);
+    }
+    return means;
+  }
+
+  // k-means||: a few rounds each pick about 2k points at once, with
+  // probability proportional to their squared distance to the nearest picked
+  // so far. The picks, weighted by the number of points nearest each, are
+  // then reduced to k means by k-means++.
+  void seedParallel(DataRef data, std::mt19937& rng)
+  {
+    using namespace Eigen;
+    index              n = data.rows();
+    double             oversampling = 2.0 * mK;
+    std::vector<index> picked{
+        std::uniform_int_distribution<index>(0, n - 1)(rng)};
+    ArrayXd nearest =
+        ArrayXd::Constant(n, std::numeric_limits<double>::infinity());
+    ArrayXi owner = ArrayXi::Zero(n);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (index round = 0, first = 0; round <= mParallelInitRounds; round++)
+    {
+      index last = asSigned(picked.size());
+      parallelFor(
+          n,
+          [&](index start, index end) {
+            for (index i = start; i < end; i++)
+              for (index c = first; c < last; c++)
+              {
+                double dist = SqEuclideanDistance::apply(
+                    data.row(i), data.row(picked[asUnsigned(c)]));
+                if (dist < nearest(i))
+                {
+                  nearest(i) = dist;
+                  owner(i) = static_cast<int>(c);
+                }
+              }
+          },
+          mPointsPerThread);
+      double total = nearest.sum();
+      if (round == mParallelInitRounds || !(total > 0)) break;
+      for (index i = 0; i < n; i++)
+        if (uniform(rng) * total < oversampling * nearest(i))
+          picked.push_back(i);
+      first = last;
+    }
+    if (asSigned(picked.size()) <= mK)
+    {
+      mMeans = seedPlusPlus(data, ArrayXd::Ones(n), rng);
+      return;
+    }
+    RowMajorArray candidates(asSigned(picked.size()), mDims);
+    ArrayXd       weights = ArrayXd::Zero(candidates.rows());
+    for (index c = 0; c < candidates.rows(); c++)
+      candidates.row(c) = data.row(picked[asUnsigned(c)]);
+    for (index i = 0; i < n; i++) weights(owner(i)) += 1;
+    mMeans = seedPlusPlus(candidates, weights, rng);
+  }
+
+  // Sum of squared distances from each point to its mean
+  double inertia(DataRef data) const
+  {
+    double total = 0;
+    for (index i = 0; i < data.rows(); i++)
+      total += SqEuclideanDistance::apply(data.row(i),
+                                          mMeans.row(mAssignments(i)));
+    return total;
+  }
+
   double distance(Eigen::ArrayXd v1, Eigen::ArrayXd v2) const
   {
     return (v1 - v2).matrix().norm();
@@ -140,52 +322,191 @@ private:
     return minK;
   }
 
-  Eigen::VectorXi assignClusters(Eigen::ArrayXXd dataPoints) const
+  // Nearest mean to a point, with its distance and that of the second nearest
+  template <typename Point>
+  index nearestTwo(const Point& point, double& nearest, double& second) const
   {
-    Eigen::VectorXi assignments = Eigen::VectorXi::Zero(dataPoints.rows());
-    for (index i = 0; i < dataPoints.rows(); i++)
-    { assignments(i) = static_cast<int>(assignPoint(dataPoints.row(i))); }
-    return assignments;
+    index minK = 0;
+    nearest = second = std::numeric_limits<double>::infinity();
+    for (index k = 0; k < mK; k++)
+    {
+      double dist = SqEuclideanDistance::apply(point, mMeans.row(k));
+      if (dist < nearest)
+      {
+        second = nearest;
+        nearest = dist;
+        minK = k;
+      }
+      else if (dist < second)
+        second = dist;
+    }
+    nearest = std::sqrt(nearest);
+    second = std::sqrt(second);
+    return minK;
   }
 
-  void computeMeans(Eigen::ArrayXXd dataPoints)
+  // Hamerly's algorithm: each point keeps an upper bound on the distance to
+  // its mean and a lower bound on the distance to any other, both updated by
+  // how far the means move. Only points whose bounds overlap, or that are
+  // closer to another mean than half the distance between the two, need their
+  // distances computed again. Assignments come out as with Lloyd's algorithm.
+  void trainFullBatch(DataRef data, index maxIter)
   {
     using namespace Eigen;
-    for (index k = 0; k < mK; k++)
+    index   n = data.rows();
+    ArrayXd upper(n), lower(n);
+    for (bool bounded = false; maxIter-- > 0; bounded = true)
     {
-      if (mEmpty[asUnsigned(k)]) continue;
-      std::vector<index> kAssignment;
-      for (index i = 0; i < mAssignments.size(); i++)
+      ArrayXd moved = computeMeans(data);
+      ArrayXd halfGap = halfDistanceToNearestMean();
+      index   furthest = 0;
+      moved.maxCoeff(&furthest);
+      double maxMoved = moved(furthest);
+      moved(furthest) = 0;
+      double maxOtherMoved = moved.maxCoeff();
+      moved(furthest) = maxMoved;
+      std::atomic<index> changes{0};
+      parallelFor(
+          n,
+          [&](index start, index end) {
+            index changed = 0;
+            for (index i = start; i < end; i++)
+            {
+              index a = mAssignments(i);
+              if (bounded)
+              {
+                upper(i) += moved(a);
+                lower(i) -= a == furthest ? maxOtherMoved : maxMoved;
+                double bound = std::max(halfGap(a), lower(i));
+                if (upper(i) <= bound) continue;
+                upper(i) = std::sqrt(
+                    SqEuclideanDistance::apply(data.row(i), mMeans.row(a)));
+                if (upper(i) <= bound) continue;
+              }
+              index nearest = nearestTwo(data.row(i), upper(i), lower(i));
+              if (nearest != a)
+              {
+                mAssignments(i) = static_cast<int>(nearest);
+                changed++;
+              }
+            }
+            changes += changed;
+          },
+          mPointsPerThread);
+      if (changes == 0) break;
+    }
+  }
+
+  // Sculley's web-scale k-means: each batch is assigned to the current means,
+  // then every mean moves towards its points at a rate of one over the number
+  // of points it has been given so far
+  void trainMiniBatch(DataRef data, index maxIter, index batchSize,
+                      std::mt19937& rng)
+  {
+    using namespace Eigen;
+    std::uniform_int_distribution<index> randomRow(0, data.rows() - 1);
+    std::vector<index>               batch(asUnsigned(batchSize));
+    std::vector<index>               batchAssignments(asUnsigned(batchSize));
+    ArrayXd                          counts = ArrayXd::Zero(mK);
+    while (maxIter-- > 0)
+    {
+      for (auto& i : batch) i = randomRow(rng);
+      parallelFor(
+          batchSize,
+          [&](index start, index end) {
+            double nearest, second;
+            for (index i = start; i < end; i++)
+              batchAssignments[asUnsigned(i)] =
+                  nearestTwo(data.row(batch[asUnsigned(i)]), nearest, second);
+          },
+          mPointsPerThread);
+      for (index i = 0; i < batchSize; i++)
       {
-        if (mAssignments(i) == k) kAssignment.push_back(i);
+        index c = batchAssignments[asUnsigned(i)];
+        counts(c) += 1;
+        mMeans.row(c) += (data.row(batch[asUnsigned(i)]) - mMeans.row(c)) /
+                         counts(c);
       }
-      if (kAssignment.size() == 0)
+    }
+    assignClusters(data);
+  }
+
+  void assignClusters(DataRef data)
+  {
+    mAssignments.resize(data.rows());
+    parallelFor(
+        data.rows(),
+        [&](index start, index end) {
+          double nearest, second;
+          for (index i = start; i < end; i++)
+            mAssignments(i) =
+                static_cast<int>(nearestTwo(data.row(i), nearest, second));
+        },
+        mPointsPerThread);
+  }
+
+  // Sets each mean to the centroid of its points, summed in one pass over the
+  // data, and returns how far each moved. A cluster left with no points keeps
+  // its mean from then on.
+  Eigen::ArrayXd computeMeans(DataRef data)
+  {
+    using namespace Eigen;
+    ArrayXXd   sums = ArrayXXd::Zero(mK, mDims);
+    ArrayXd    counts = ArrayXd::Zero(mK);
+    std::mutex lock;
+    parallelFor(
+        data.rows(),
+        [&](index start, index end) {
+          ArrayXXd partialSums = ArrayXXd::Zero(mK, mDims);
+          ArrayXd  partialCounts = ArrayXd::Zero(mK);
+          for (index i = start; i < end; i++)
+          {
+            partialSums.row(mAssignments(i)) += data.row(i);
+            partialCounts(mAssignments(i)) += 1;
+          }
+          std::lock_guard<std::mutex> guard(lock);
+          sums += partialSums;
+          counts += partialCounts;
+        },
+        mPointsPerThread);
+    ArrayXd moved = ArrayXd::Zero(mK);
+    for (index k = 0; k < mK; k++)
+    {
+      if (mEmpty[asUnsigned(k)]) continue;
+      if (counts(k) == 0)
       {
         std::cout << "Warning: empty cluster" << std::endl;
         mEmpty[asUnsigned(k)] = true;
-        return;
+        continue;
       }
-      ArrayXXd clusterPoints =
-          ArrayXXd::Zero(asSigned(kAssignment.size()), mDims);
-      for (index i = 0; asUnsigned(i) < kAssignment.size(); i++)
-      { clusterPoints.row(i) = dataPoints.row(kAssignment[asUnsigned(i)]); }
-      ArrayXd mean = clusterPoints.colwise().mean();
+      ArrayXd mean = sums.row(k) / counts(k);
+      moved(k) = (mean.transpose() - mMeans.row(k)).matrix().norm();
       mMeans.row(k) = mean;
     }
+    return moved;
   }
 
-  bool changed(Eigen::VectorXi newAssignments) const
+  // Half the distance from each mean to the nearest other one: a point closer
+  // to its mean than this can't be closer to any other
+  Eigen::ArrayXd halfDistanceToNearestMean() const
   {
-    auto dif = (newAssignments - mAssignments).cwiseAbs().sum();
-    return dif > 0;
+    Eigen::MatrixXd D = DistanceMatrix(mMeans, 1);
+    D.diagonal().setConstant(std::numeric_limits<double>::infinity());
+    return 0.5 * D.rowwise().minCoeff().array();
   }
 
+  static constexpr index mMinPointsPerThread{1024};
+  static constexpr index mParallelInitRounds{5};
+
   index             mK{0};
   index             mDims{0};
   Eigen::ArrayXXd   mMeans;
   std::vector<bool> mEmpty;
   Eigen::VectorXi   mAssignments;
+  Eigen::ArrayXd    mCounts;
   bool              mTrained{false};
+  index             mPointsPerThread{mMinPointsPerThread};
+  ModelVersion      mVersion;
 };
 } // namespace algorithm
 } // namespace fluid
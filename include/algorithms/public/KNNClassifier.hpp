@@ -18,6 +18,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/FluidTensor.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <string>
+#include <unordered_map>
 
 namespace fluid {
 namespace algorithm {
@@ -28,14 +29,35 @@ class KNNClassifier
 public:
   using LabelSet = FluidDataSet<std::string, std::string, 1>;
 
-  std::string predict(KDTree tree, RealVectorView point, LabelSet labels,
-                      index k, bool weighted) const
+  std::string predict(const KDTree& tree, RealVectorView point,
+                      const LabelSet& labels, index k, bool weighted) const
+  {
+    const auto nearest = tree.kNearest(point, k);
+    return predict(nearest.getIds(), nearest.getData().col(0), labels, k,
+                   weighted);
+  }
+
+  void predict(const KDTree& tree, FluidTensorView<const double, 2> points,
+               const LabelSet& labels, index k, bool weighted,
+               FluidTensorView<std::string, 1> out) const
+  {
+    auto                        nearest = tree.kNearestBatch(points, k);
+    auto                        treeIds = tree.getIds();
+    FluidTensor<std::string, 1> ids(k);
+    for (index i = 0; i < points.rows(); i++)
+    {
+      for (index j = 0; j < k; j++) ids(j) = treeIds(nearest.indices(i, j));
+      out(i) = predict(ids, nearest.distances.row(i), labels, k, weighted);
+    }
+  }
+
+private:
+  std::string predict(FluidTensorView<const std::string, 1> ids,
+                      FluidTensorView<const double, 1>      distances,
+                      const LabelSet& labels, index k, bool weighted) const
   {
     using namespace std;
     unordered_map<string, double> labelsMap;
-    auto                          nearest = tree.kNearest(point, k);
-    auto                          ids = nearest.getIds();
-    auto                          distances = nearest.getData();
 
     double              uniformWeight = 1.0 / k;
     std::vector<double> weights;
@@ -46,18 +68,18 @@ public:
       bool binaryWeights = false;
       for (index i = 0; i < k; i++)
       {
-        if (distances(i, 0) < epsilon)
+        if (distances(i) < epsilon)
         {
           binaryWeights = true;
           weights[asUnsigned(i)] = 1;
         }
         else
-          sum += (1.0 / distances(i, 0));
+          sum += (1.0 / distances(i));
       }
       if (!binaryWeights)
       {
         for (index i = 0; i < k; i++)
-        { weights[asUnsigned(i)] = (1.0 / distances(i, 0)) / sum; }
+        { weights[asUnsigned(i)] = (1.0 / distances(i)) / sum; }
       }
     }
     else
@@ -28,14 +28,34 @@ class KNNRegressor
 public:
   using DataSet = FluidDataSet<std::string, double, 1>;
 
-  double predict(KDTree tree, DataSet targets, RealVectorView point, index k,
-                 bool weighted) const
+  double predict(const KDTree& tree, const DataSet& targets,
+                 RealVectorView point, index k, bool weighted) const
+  {
+    const auto nearest = tree.kNearest(point, k);
+    return predict(nearest.getIds(), nearest.getData().col(0), targets, k,
+                   weighted);
+  }
+
+  void predict(const KDTree& tree, const DataSet& targets,
+               FluidTensorView<const double, 2> points, index k,
+               bool weighted, RealVectorView out) const
+  {
+    auto                        nearest = tree.kNearestBatch(points, k);
+    auto                        treeIds = tree.getIds();
+    FluidTensor<std::string, 1> ids(k);
+    for (index i = 0; i < points.rows(); i++)
+    {
+      for (index j = 0; j < k; j++) ids(j) = treeIds(nearest.indices(i, j));
+      out(i) = predict(ids, nearest.distances.row(i), targets, k, weighted);
+    }
+  }
+
+private:
+  double predict(FluidTensorView<const std::string, 1> ids,
+                 FluidTensorView<const double, 1> distances,
+                 const DataSet& targets, index k, bool weighted) const
   {
-    using namespace std;
-    auto                nearest = tree.kNearest(point, k);
     double              prediction = 0;
-    auto                ids = nearest.getIds();
-    auto                distances = nearest.getData();
     double              uniformWeight = 1.0 / k;
     std::vector<double> weights;
     double              sum = 0;
@@ -45,27 +65,27 @@ public:
       bool binaryWeights = false;
       for (index i = 0; i < k; i++)
       {
-        if (distances(i, 0) < epsilon)
+        if (distances(i) < epsilon)
         {
           binaryWeights = true;
           weights[asUnsigned(i)] = 1;
         }
         else
-          sum += (1.0 / distances(i, 0));
+          sum += (1.0 / distances(i));
       }
       if (!binaryWeights)
       {
         for (index i = 0; i < k; i++)
-        { weights[asUnsigned(i)] = (1.0 / distances(i, 0)) / sum; }
+        { weights[asUnsigned(i)] = (1.0 / distances(i)) / sum; }
       }
     }
     else
     {
       weights = std::vector<double>(asUnsigned(k), uniformWeight);
     }
+    auto point = FluidTensor<double, 1>(1);
     for (index i = 0; i < k; i++)
     {
-      auto point = FluidTensor<double, 1>(1);
       targets.get(ids(i), point);
       prediction += (weights[asUnsigned(i)] * point(0));
     }
@@ -72,6 +72,12 @@ public:
   }
 
   std::string decodeOneHot(RealVectorView in) const
+  {
+    return mLabels(decodeOneHotIndex(in));
+  }
+
+  // The index of the label decodeOneHot() would return, without copying it
+  index decodeOneHotIndex(RealVectorView in) const
   {
     double maxVal = 0;
     index  maxIndex = 0;
@@ -83,7 +89,7 @@ public:
         maxVal = in(i);
       }
     }
-    return mLabels(maxIndex);
+    return maxIndex;
   }
   index numLabels() const { return mNumLabels; }
 
@@ -27,21 +27,16 @@ public:
   using MatrixXd = Eigen::MatrixXd;
   using VectorXd = Eigen::VectorXd;
 
-  void process(RealMatrixView in, RealMatrixView out, index distance, index k)
+  void process(FluidTensorView<const double, 2> in, RealMatrixView out,
+               index distance, index k)
   {
     using namespace Eigen;
     using namespace _impl;
-    auto     dist = static_cast<DistanceFuncs::Distance>(distance);
     MatrixXd input = asEigen<Matrix>(in);
     index    n = input.rows();
-    MatrixXd D = MatrixXd::Zero(n, n);
+    MatrixXd D = DistanceMatrix(input, distance);
     MatrixXd I = MatrixXd::Identity(n, n);
     MatrixXd ones = MatrixXd::Ones(n, n);
-    for (index i = 0; i < n; i++)
-    {
-      for (index j = 0; j < n; j++)
-      { D(i, j) = DistanceFuncs::map()[dist](input.row(i), input.row(j)); }
-    }
     MatrixXd J = I - ones / n;
     D = -0.5 * J * D * J;
     BDCSVD<MatrixXd> svd(D, ComputeThinV | ComputeThinU);
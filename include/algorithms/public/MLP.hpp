@@ -11,6 +11,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/FluidEigenMappings.hpp"
+#include "../util/ModelVersion.hpp"
 #include "../util/NNFuncs.hpp"
 #include "../util/NNLayer.hpp"
 #include "../../data/FluidDataSet.hpp"
@@ -19,6 +20,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
 #include <random>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -53,6 +55,7 @@ public:
     for (auto&& l : mLayers) l.init();
     mInitialized = true;
     mTrained = false;
+    mVersion.stamp();
   }
 
   void getParameters(index layer, RealMatrixView W, RealVectorView b,
@@ -73,6 +76,7 @@ public:
     MatrixXd weights = asEigen<Matrix>(W);
     VectorXd biases = asEigen<Matrix>(b);
     mLayers[asUnsigned(layer)].init(weights, biases, layerType);
+    mVersion.stamp();
   }
 
   void clear()
@@ -80,16 +84,18 @@ public:
     for (auto&& l : mLayers) l.init();
     mInitialized = false;
     mTrained = false;
+    mVersion.stamp();
   }
 
-  double loss(ArrayXXd pred, ArrayXXd out)
+  double loss(const Eigen::Ref<const Eigen::MatrixXd>& pred,
+              const Eigen::Ref<const Eigen::MatrixXd>& out) const
   {
     assert(pred.rows() == out.rows());
-    return (pred - out).square().sum() / out.rows();
+    return (pred - out).squaredNorm() / out.rows();
   }
 
-  void process(RealMatrixView in, RealMatrixView out, index startLayer,
-               index endLayer)
+  void process(FluidTensorView<const double, 2> in, RealMatrixView out,
+               index startLayer, index endLayer)
   {
     using namespace _impl;
     using namespace Eigen;
@@ -113,9 +119,25 @@ public:
     out = asFluid(tmpOut);
   }
 
-  void forward(Eigen::Ref<ArrayXXd> in, Eigen::Ref<ArrayXXd> out)
+  // Buffers for a pass through every layer: see NNLayer::Workspace
+  using Workspace = std::vector<NNLayer::Workspace>;
+
+  // Forward pass over a batch, one example per row, for training. Each layer
+  // keeps its output in ws for backward(), and the last one's is returned.
+  const Eigen::MatrixXd& forward(const Eigen::Ref<const Eigen::MatrixXd>& in,
+                                 Workspace& ws) const
+  {
+    ws.resize(mLayers.size());
+    mLayers[0].forward(in, ws[0]);
+    for (index i = 1; i < asSigned(mLayers.size()); i++)
+      mLayers[asUnsigned(i)].forward(ws[asUnsigned(i - 1)].output,
+                                     ws[asUnsigned(i)]);
+    return ws.back().output;
+  }
+
+  const Eigen::MatrixXd& forward(const Eigen::Ref<const Eigen::MatrixXd>& in)
   {
-    forward(in, out, 0, asSigned(mLayers.size()));
+    return forward(in, mWorkspace);
   }
 
   void forward(Eigen::Ref<ArrayXXd> in, Eigen::Ref<ArrayXXd> out,
@@ -125,42 +147,71 @@ public:
         endLayer > asSigned(mLayers.size()))
       return;
     if (startLayer < 0 || endLayer <= 0) return;
-    ArrayXXd input = in;
-    ArrayXXd output;
-    for (index i = startLayer; i < endLayer; i++)
+    mWorkspace.resize(mLayers.size());
+    mLayers[asUnsigned(startLayer)].forward(in.matrix(),
+                                            mWorkspace[asUnsigned(startLayer)]);
+    for (index i = startLayer + 1; i < endLayer; i++)
+      mLayers[asUnsigned(i)].forward(mWorkspace[asUnsigned(i - 1)].output,
+                                     mWorkspace[asUnsigned(i)]);
+    out = mWorkspace[asUnsigned(endLayer - 1)].output.array();
+  }
+
+  // Adds to ws the gradients for the batch in, last passed forward with ws,
+  // given the gradient of the loss with respect to the output
+  void backward(const Eigen::Ref<const Eigen::MatrixXd>& in,
+                const Eigen::Ref<const Eigen::MatrixXd>& outGrad,
+                Workspace&                               ws) const
+  {
+    index last = asSigned(mLayers.size()) - 1;
+    if (last == 0)
     {
-      auto&& l = mLayers[asUnsigned(i)];
-      output = ArrayXXd::Zero(input.rows(), l.outputSize());
-      l.forward(input, output);
-      input = output;
+      mLayers[0].backward(in, outGrad, ws[0], false);
+      return;
     }
-    out = output;
+    const Eigen::MatrixXd* chain = &mLayers[asUnsigned(last)].backward(
+        ws[asUnsigned(last - 1)].output, outGrad, ws[asUnsigned(last)]);
+    for (index i = last - 1; i > 0; i--)
+      chain = &mLayers[asUnsigned(i)].backward(ws[asUnsigned(i - 1)].output,
+                                               *chain, ws[asUnsigned(i)]);
+    mLayers[0].backward(in, *chain, ws[0], false);
   }
 
-  void backward(Eigen::Ref<ArrayXXd> out)
+  void backward(const Eigen::Ref<const Eigen::MatrixXd>& in,
+                const Eigen::Ref<const Eigen::MatrixXd>& outGrad)
   {
-    index    nRows = out.rows();
-    ArrayXXd chain =
-        ArrayXXd::Zero(nRows, mLayers[mLayers.size() - 1].inputSize());
-    mLayers[mLayers.size() - 1].backward(out, chain);
-    for (index i = asSigned(mLayers.size() - 2); i >= 0; i--)
-    {
-      ArrayXXd tmp = ArrayXXd::Zero(nRows, mLayers[asUnsigned(i)].inputSize());
-      mLayers[asUnsigned(i)].backward(chain, tmp);
-      chain = tmp;
-    }
+    backward(in, outGrad, mWorkspace);
+  }
+
+  // Moves the gradients summed in ws to this model's own workspace
+  void reduceGradients(Workspace& ws)
+  {
+    mWorkspace.resize(mLayers.size());
+    for (index i = 0; i < asSigned(ws.size()); i++)
+      NNLayer::reduceGrads(ws[asUnsigned(i)], mWorkspace[asUnsigned(i)]);
   }
 
-  void update(double learningRate, double momentum)
+  // Steps down the gradients summed in ws, or in this model's own workspace
+  void update(const NNOptimizer& opt, Workspace& ws)
   {
-    for (auto&& l : mLayers) l.update(learningRate, momentum);
+    for (index i = 0; i < asSigned(mLayers.size()); i++)
+      mLayers[asUnsigned(i)].update(ws[asUnsigned(i)], opt);
   }
 
+  void update(const NNOptimizer& opt) { update(opt, mWorkspace); }
+
   index size() const { return asSigned(mLayers.size()); }
   bool  trained() const { return mTrained; }
-  void  setTrained(bool val) { mTrained = val; }
+  void  setTrained(bool val)
+  {
+    mTrained = val;
+    mVersion.stamp();
+  }
   index initialized() const { return mInitialized; }
 
+  // Changes whenever the parameters might have, so that copies of them, as in
+  // MLPInference, know when they're stale: see ModelVersion
+  index version() const { return mVersion.value(); }
+
   // 0 = size of the input, 1 = output size of first hidden
   index outputSize(index layer) const
   {
@@ -192,6 +243,8 @@ public:
   std::vector<NNLayer> mLayers;
   bool                 mInitialized{false};
   bool                 mTrained{false};
+  Workspace            mWorkspace;
+  ModelVersion         mVersion;
 };
 } // namespace algorithm
 } // namespace fluid
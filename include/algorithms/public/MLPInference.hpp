@@ -0,0 +1,269 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "MLP.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../util/Int8Dot.hpp"
+#include "../util/NNFuncs.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// A frozen copy of the layers of a trained MLP between two taps, for
+// predicting one point at a time in RT. Everything is allocated by init():
+// processFrame() passes the point between two buffers as wide as the widest
+// layer, adding each layer's bias as part of its activation, and doesn't
+// allocate, or keep anything for backpropagation.
+class MLPInference
+{
+  using MatrixXd = Eigen::MatrixXd;
+  using VectorXd = Eigen::VectorXd;
+  using MatrixXf = Eigen::MatrixXf;
+  using VectorXf = Eigen::VectorXf;
+  using MatrixXi8 = Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic,
+                                  Eigen::RowMajor>;
+  using VectorXi8 = Eigen::Matrix<std::int8_t, Eigen::Dynamic, 1>;
+  using Activation = NNActivations::Activation;
+
+public:
+  // How the weights are kept and applied. kFloat halves the memory of
+  // kDouble. kInt8 quarters it again, by scaling the weights for each output,
+  // and each layer's input, to 8 bit integers whose products are summed
+  // exactly by the target's int8 dot product instructions, see dotInt8(),
+  // then scaling the sums back to float for the bias and activation.
+  enum class Precision { kDouble, kFloat, kInt8 };
+
+  // Copies layers [startLayer, endLayer) of mlp. Only allocates when their
+  // sizes, or the precision, differ from those copied last time.
+  void init(const MLP& mlp, index startLayer, index endLayer,
+            Precision precision = Precision::kDouble)
+  {
+    index nLayers = endLayer - startLayer;
+    mLayers.resize(asUnsigned(std::max<index>(0, nLayers)));
+    index width = nLayers > 0 ? mlp.inputSize(startLayer) : 0;
+    for (index i = 0; i < nLayers; i++)
+    {
+      const NNLayer& src = mlp.mLayers[asUnsigned(startLayer + i)];
+      Layer&         dst = mLayers[asUnsigned(i)];
+      dst.activation = static_cast<Activation>(src.getActType());
+      dst.inputSize = src.inputSize();
+      dst.outputSize = src.outputSize();
+      if (precision == Precision::kDouble)
+      {
+        dst.weights = src.getWeights();
+        dst.biases = src.getBiases();
+      }
+      else
+      {
+        dst.weights.resize(0, 0);
+        dst.biases.resize(0);
+      }
+      if (precision == Precision::kFloat)
+        dst.weightsF = src.getWeights().cast<float>();
+      else
+        dst.weightsF.resize(0, 0);
+      if (precision == Precision::kInt8)
+        quantize(src.getWeights(), dst);
+      else
+      {
+        dst.weightsQ.resize(0, 0);
+        dst.scales.resize(0);
+      }
+      if (precision == Precision::kDouble)
+        dst.biasesF.resize(0);
+      else
+        dst.biasesF = src.getBiases().cast<float>();
+      width = std::max(width, src.outputSize());
+    }
+    index doubleWidth = precision == Precision::kDouble ? width : 0;
+    index floatWidth = precision == Precision::kDouble ? 0 : width;
+    mFront.resize(doubleWidth);
+    mBack.resize(doubleWidth);
+    mFrontF.resize(floatWidth);
+    mBackF.resize(floatWidth);
+    mQuantized.resize(precision == Precision::kInt8 ? width : 0);
+    mVersion = mlp.version();
+    mStartLayer = startLayer;
+    mEndLayer = endLayer;
+    mPrecision = precision;
+  }
+
+  // Whether this is a copy of the current parameters of mlp between these
+  // taps, at this precision
+  bool matches(const MLP& mlp, index startLayer, index endLayer,
+               Precision precision = Precision::kDouble) const
+  {
+    return mVersion == mlp.version() && mStartLayer == startLayer &&
+           mEndLayer == endLayer && mPrecision == precision;
+  }
+
+  index inputSize() const
+  {
+    return mLayers.empty() ? 0 : mLayers.front().inputSize;
+  }
+
+  index outputSize() const
+  {
+    return mLayers.empty() ? 0 : mLayers.back().outputSize;
+  }
+
+  void processFrame(FluidTensorView<const double, 1> in, RealVectorView out)
+  {
+    using namespace _impl;
+    if (mLayers.empty()) return;
+    auto inMap = asEigen<Eigen::Matrix>(in);
+    auto outMap = asEigen<Eigen::Matrix>(out);
+    auto input = inMap.col(0).head(inputSize());
+    auto output = outMap.col(0).head(outputSize());
+    switch (mPrecision)
+    {
+    case Precision::kFloat:
+      mFrontF.head(inputSize()) = input.cast<float>();
+      for (auto& l : mLayers)
+      {
+        mBackF.head(l.outputSize).noalias() =
+            l.weightsF.transpose() * mFrontF.head(l.inputSize);
+        activate<VectorXf>(l.activation, l.biasesF,
+                           mBackF.head(l.outputSize));
+        mFrontF.swap(mBackF);
+      }
+      output = mFrontF.head(outputSize()).cast<double>();
+      break;
+    case Precision::kInt8:
+      mFrontF.head(inputSize()) = input.cast<float>();
+      for (auto& l : mLayers)
+      {
+        float scale = quantize(mFrontF.head(l.inputSize));
+        for (index j = 0; j < l.outputSize; j++)
+        {
+          mBackF(j) = scale * l.scales(j) *
+                      static_cast<float>(_impl::dotInt8(
+                          l.weightsQ.row(j).data(), mQuantized.data(),
+                          l.inputSize));
+        }
+        activate<VectorXf>(l.activation, l.biasesF,
+                           mBackF.head(l.outputSize));
+        mFrontF.swap(mBackF);
+      }
+      output = mFrontF.head(outputSize()).cast<double>();
+      break;
+    default:
+      mFront.head(inputSize()) = input;
+      for (auto& l : mLayers)
+      {
+        mBack.head(l.outputSize).noalias() =
+            l.weights.transpose() * mFront.head(l.inputSize);
+        activate<VectorXd>(l.activation, l.biases, mBack.head(l.outputSize));
+        mFront.swap(mBack);
+      }
+      output = mFront.head(outputSize());
+    }
+  }
+
+  // How far this plan's predictions for the rows of in are from mlp's own, as
+  // the root mean square and largest absolute difference over every output.
+  // For choosing a precision, so NRT only.
+  void deviation(MLP& mlp, FluidTensorView<const double, 2> in, double& rms,
+                 double& maxAbs)
+  {
+    RealMatrix expected(in.rows(), outputSize());
+    RealVector predicted(outputSize());
+    mlp.process(in, expected, mStartLayer, mEndLayer);
+    double sumSquares = 0;
+    maxAbs = 0;
+    for (index i = 0; i < in.rows(); i++)
+    {
+      processFrame(in.row(i), predicted);
+      for (index j = 0; j < outputSize(); j++)
+      {
+        double diff = std::abs(predicted(j) - expected(i, j));
+        sumSquares += diff * diff;
+        maxAbs = std::max(maxAbs, diff);
+      }
+    }
+    rms = std::sqrt(sumSquares / std::max<index>(1, expected.size()));
+  }
+
+private:
+  struct Layer
+  {
+    MatrixXd   weights;  // inputSize x outputSize, for kDouble
+    VectorXd   biases;   // for kDouble
+    MatrixXf   weightsF; // as weights, for kFloat
+    MatrixXi8  weightsQ; // outputSize x inputSize, scaled by scales, for kInt8
+    VectorXf   scales;
+    VectorXf   biasesF; // for kFloat and kInt8
+    Activation activation;
+    index      inputSize;
+    index      outputSize;
+  };
+
+  template <typename Vector>
+  static void activate(Activation activation, const Vector& biases,
+                       Eigen::Ref<Vector> x)
+  {
+    visitActivation(activation, [&](auto act) {
+      act.apply(x.array() + biases.array(), x.array());
+    });
+  }
+
+  // Scales each column of weights to [-127, 127] and keeps the scales
+  static void quantize(const MatrixXd& weights, Layer& l)
+  {
+    l.weightsQ.resize(weights.cols(), weights.rows());
+    l.scales.resize(weights.cols());
+    for (index j = 0; j < weights.cols(); j++)
+    {
+      double maxAbs = weights.col(j).cwiseAbs().maxCoeff();
+      l.scales(j) = maxAbs > 0 ? static_cast<float>(maxAbs / 127) : 1.0f;
+      for (index i = 0; i < weights.rows(); i++)
+      {
+        double q = std::round(weights(i, j) / static_cast<double>(l.scales(j)));
+        l.weightsQ(j, i) =
+            static_cast<std::int8_t>(std::max(-127.0, std::min(127.0, q)));
+      }
+    }
+  }
+
+  // Scales x to [-127, 127] into mQuantized, returning the scale
+  float quantize(Eigen::Ref<const VectorXf> x)
+  {
+    float maxAbs = x.cwiseAbs().maxCoeff();
+    float scale = maxAbs > 0 ? maxAbs / 127 : 1.0f;
+    mQuantized.head(x.size()) = (x.array() / scale)
+                                    .round()
+                                    .max(-127.0f)
+                                    .min(127.0f)
+                                    .cast<std::int8_t>();
+    return scale;
+  }
+
+  std::vector<Layer> mLayers;
+  VectorXd           mFront;
+  VectorXd           mBack;
+  VectorXf           mFrontF;
+  VectorXf           mBackF;
+  VectorXi8          mQuantized;
+  index              mVersion{-1};
+  index              mStartLayer{0};
+  index              mEndLayer{0};
+  Precision          mPrecision{Precision::kDouble};
+};
+} // namespace algorithm
+} // namespace fluid
@@ -26,7 +26,7 @@ public:
   using ArrayXd = Eigen::ArrayXd;
   using ArrayXXd = Eigen::ArrayXXd;
 
-  void init(double min, double max, RealMatrixView in)
+  void init(double min, double max, FluidTensorView<const double, 2> in)
   {
     using namespace Eigen;
     using namespace _impl;
@@ -39,6 +39,20 @@ public:
     mInitialized = true;
   }
 
+  // Float data is fitted in single precision, without widening it first
+  void init(double min, double max, FluidTensorView<const float, 2> in)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    mMin = min;
+    mMax = max;
+    auto input = asEigen<Array>(in);
+    mDataMin = input.colwise().minCoeff().transpose().cast<double>();
+    mDataMax = input.colwise().maxCoeff().transpose().cast<double>();
+    mDataRange = mDataMax - mDataMin;
+    mInitialized = true;
+  }
+
   void init(double min, double max, RealVectorView dataMin,
             RealVectorView dataMax)
   {
@@ -73,7 +87,7 @@ public:
     out = asFluid(result);
   }
 
-  void process(const RealMatrixView in, RealMatrixView out,
+  void process(FluidTensorView<const double, 2> in, RealMatrixView out,
                bool inverse = false) const
   {
     using namespace Eigen;
@@ -96,6 +110,29 @@ public:
     out = asFluid(result);
   }
 
+  // Float data is scaled in single precision, without widening it first
+  void process(FluidTensorView<const float, 2> in,
+               FluidTensorView<float, 2> out, bool inverse = false) const
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    ArrayXd scale, offset;
+    if (!inverse)
+    {
+      scale = (mMax - mMin) / mDataRange.max(epsilon);
+      offset = mMin - mDataMin * scale;
+    }
+    else
+    {
+      scale = mDataRange / std::max((mMax - mMin), epsilon);
+      offset = mDataMin - mMin * scale;
+    }
+    asEigen<Array>(out) =
+        (asEigen<Array>(in).rowwise() * scale.cast<float>().transpose())
+            .rowwise() +
+        offset.cast<float>().transpose();
+  }
+
   void setMin(double min) { mMin = min; }
   void setMax(double max) { mMax = max; }
   bool initialized() const { return mInitialized; }
@@ -0,0 +1,125 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "KMeans.hpp"
+#include "../util/DistanceFuncs.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <limits>
+
+namespace fluid {
+namespace algorithm {
+
+// Sequential k-means on a copy of the means of a trained KMeans, so that the
+// copy can follow live input in RT while the model itself is only changed in
+// NRT, by apply(). Nothing allocates once init() has sized the copy.
+//
+// A copy belongs to the lineage of the model's version it was taken at (see
+// ModelVersion). apply() writes it back under a new version in that lineage,
+// so that anything else holding the old means sees that they have changed,
+// while the copy, and any copy of it, still matches the model and goes on
+// learning. Training, setting or loading means starts a new lineage, which
+// leaves copies of the old means stale. Only one copy of a lineage should be
+// learning at a time, as each apply() overwrites the means of the last.
+class OnlineKMeans
+{
+public:
+  using ConstRealVectorView = FluidTensorView<const double, 1>;
+
+  // Copies the means and cluster counts of model. Only allocates when their
+  // size differs from those copied last time, as does copy assignment.
+  void init(const KMeans& model)
+  {
+    mMeans = model.mMeans;
+    mCounts = model.mCounts;
+    mLineage = model.mVersion.lineage();
+  }
+
+  // Whether this is a copy of the means of model, or of model with this
+  // copy's updates, or those of an earlier state of it, applied
+  bool matches(const KMeans& model) const
+  {
+    return mLineage == model.mVersion.lineage();
+  }
+
+  // Likewise, whether both are copies of the same lineage of means
+  bool matches(const OnlineKMeans& other) const
+  {
+    return mLineage == other.mLineage;
+  }
+
+  index dims() const { return mMeans.cols(); }
+  index size() const { return mMeans.rows(); }
+
+  void getMeans(RealMatrixView out) const { out = _impl::asFluid(mMeans); }
+
+  // Moves the mean nearest to point towards it by one over the number of
+  // points that cluster has taken, or by minRate if that is larger, so that a
+  // cluster can follow input that drifts. Means set directly count as one
+  // point each. Costs O(k * dims). Returns the cluster of the point.
+  index update(ConstRealVectorView point, double minRate = 0)
+  {
+    assert(point.size() == mMeans.cols());
+    auto  x = _impl::asEigen<Eigen::Array>(point).transpose();
+    index cluster = nearest(x);
+    mCounts(cluster) += 1;
+    double rate = std::max(1.0 / mCounts(cluster), minRate);
+    mMeans.row(cluster) += rate * (x - mMeans.row(cluster));
+    return cluster;
+  }
+
+  index vq(ConstRealVectorView point) const
+  {
+    assert(point.size() == mMeans.cols());
+    return nearest(_impl::asEigen<Eigen::Array>(point).transpose());
+  }
+
+  // Writes these means and counts over those of model, if they're still of
+  // its lineage, and gives model a new version in that lineage. Returns
+  // whether it wrote them.
+  bool apply(KMeans& model) const
+  {
+    if (!matches(model)) return false;
+    model.mMeans = mMeans;
+    model.mCounts = mCounts;
+    model.mVersion.advance();
+    return true;
+  }
+
+private:
+  template <typename Point>
+  index nearest(const Point& x) const
+  {
+    index  cluster = 0;
+    double minDistance = std::numeric_limits<double>::infinity();
+    for (index k = 0; k < mMeans.rows(); k++)
+    {
+      double dist = SqEuclideanDistance::apply(x, mMeans.row(k));
+      if (dist < minDistance)
+      {
+        cluster = k;
+        minDistance = dist;
+      }
+    }
+    return cluster;
+  }
+
+  Eigen::ArrayXXd mMeans;
+  Eigen::ArrayXd  mCounts;
+  index           mLineage{-1};
+};
+
+} // namespace algorithm
+} // namespace fluid
@@ -48,7 +48,7 @@ public:
   void makeWindow(index windowSize)
   {
     mWindowStorage.setZero();
-    WindowFuncs::map()[mWindowType](windowSize, mWindowStorage);
+    WindowFuncs::make(mWindowType, windowSize, mWindowStorage);
     mWindow = mWindowStorage.segment(0, windowSize);
     mWindowSize = windowSize;
   }
@@ -72,12 +72,14 @@ public:
     {
       ArrayXcd frame2 =
           mFFT.process(in.segment(frameDelta, mWindowSize) * mWindow);
-      funcVal = OnsetDetectionFuncs::map()[odf](frame2, frame, frame);
+      funcVal = visitODF(
+          odf, [&](auto kernel) { return kernel.apply(frame2, frame, frame); });
     }
     else
     {
-      funcVal =
-          OnsetDetectionFuncs::map()[odf](frame, prevFrame, prevPrevFrame);
+      funcVal = visitODF(odf, [&](auto kernel) {
+        return kernel.apply(frame, prevFrame, prevPrevFrame);
+      });
     }
     if (filterSize >= 3)
       filteredFuncVal = funcVal - mFilter.processSample(funcVal);
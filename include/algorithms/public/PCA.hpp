@@ -26,7 +26,7 @@ public:
   using MatrixXd = Eigen::MatrixXd;
   using VectorXd = Eigen::VectorXd;
 
-  void init(RealMatrixView in)
+  void init(FluidTensorView<const double, 2> in)
   {
     using namespace Eigen;
     using namespace _impl;
@@ -39,6 +39,21 @@ public:
     mInitialized = true;
   }
 
+  // Float data is decomposed in single precision, without widening it first
+  void init(FluidTensorView<const float, 2> in)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    auto             input = asEigen<Matrix>(in);
+    RowVectorXf      mean = input.colwise().mean();
+    MatrixXf         X = input.rowwise() - mean;
+    BDCSVD<MatrixXf> svd(X, ComputeThinV | ComputeThinU);
+    mMean = mean.transpose().cast<double>();
+    mBases = svd.matrixV().cast<double>();
+    mValues = svd.singularValues().cast<double>();
+    mInitialized = true;
+  }
+
   void init(RealMatrixView bases, RealVectorView values, RealVectorView mean)
   {
     mBases = _impl::asEigen<Eigen::Matrix>(bases);
@@ -58,7 +73,8 @@ public:
     out = _impl::asFluid(result);
   }
 
-  double process(const RealMatrixView in, RealMatrixView out, index k) const
+  double process(FluidTensorView<const double, 2> in, RealMatrixView out,
+                 index k) const
   {
     using namespace Eigen;
     using namespace _impl;
@@ -73,6 +89,19 @@ public:
     return variance / total;
   }
 
+  // Projects float data in single precision, without widening it first
+  double process(FluidTensorView<const float, 2> in,
+                 FluidTensorView<float, 2> out, index k) const
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    if (k > mBases.cols()) return 0;
+    MatrixXf bases = mBases.leftCols(k).cast<float>();
+    RowVectorXf mean = mMean.transpose().cast<float>();
+    asEigen<Matrix>(out) = (asEigen<Matrix>(in).rowwise() - mean) * bases;
+    return mValues.head(k).sum() / mValues.sum();
+  }
+
   bool  initialized() const { return mInitialized; }
   void  getBases(RealMatrixView out) const { out = _impl::asFluid(mBases); }
   void  getValues(RealVectorView out) const { out = _impl::asFluid(mValues); }
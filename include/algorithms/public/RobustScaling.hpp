@@ -26,7 +26,7 @@ public:
   using ArrayXd = Eigen::ArrayXd;
   using ArrayXXd = Eigen::ArrayXXd;
 
-  void init(double low, double high, RealMatrixView in)
+  void init(double low, double high, FluidTensorView<const double, 2> in)
   {
     using namespace Eigen;
     using namespace _impl;
@@ -52,6 +52,35 @@ public:
     mInitialized = true;
   }
 
+  // Float data is sorted in single precision, without widening it first. As
+  // the percentiles are points of the data, they come out the same as from
+  // the data widened to double.
+  void init(double low, double high, FluidTensorView<const float, 2> in)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    const double epsilon = std::numeric_limits<double>::epsilon();
+    mLow = low;
+    mHigh = high;
+    auto input = asEigen<Array>(in);
+    mDataLow.resize(input.cols());
+    mDataHigh.resize(input.cols());
+    mMedian.resize(input.cols());
+    index   length = input.rows();
+    ArrayXf sorted(length);
+    for (index i = 0; i < input.cols(); i++)
+    {
+      sorted = input.col(i);
+      std::sort(sorted.data(), sorted.data() + length);
+      mMedian(i) = sorted(lrint(0.5 * (length - 1)));
+      mDataLow(i) = sorted(lrint((mLow / 100.0) * (length - 1)));
+      mDataHigh(i) = sorted(lrint((mHigh / 100.0) * (length - 1)));
+    }
+    mRange = mDataHigh - mDataLow;
+    mRange = mRange.max(epsilon);
+    mInitialized = true;
+  }
+
   void init(double low, double high, RealVectorView dataLow,
             RealVectorView dataHigh, RealVectorView median,
             RealVectorView range)
@@ -85,7 +114,7 @@ public:
     out = asFluid(result);
   }
 
-  void process(const RealMatrixView in, RealMatrixView out,
+  void process(FluidTensorView<const double, 2> in, RealMatrixView out,
                bool inverse = false) const
   {
     using namespace Eigen;
@@ -105,6 +134,20 @@ public:
     out = asFluid(result);
   }
 
+  // Float data is scaled in single precision, without widening it first
+  void process(FluidTensorView<const float, 2> in,
+               FluidTensorView<float, 2> out, bool inverse = false) const
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    ArrayXd scale = inverse ? mRange : ArrayXd(mRange.inverse());
+    ArrayXd offset = inverse ? mMedian : ArrayXd(-mMedian * scale);
+    asEigen<Array>(out) =
+        (asEigen<Array>(in).rowwise() * scale.cast<float>().transpose())
+            .rowwise() +
+        offset.cast<float>().transpose();
+  }
+
   void setLow(double low) { mLow = low; }
   void setHigh(double high) { mHigh = high; }
   bool initialized() const { return mInitialized; }
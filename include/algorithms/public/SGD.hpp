@@ -11,88 +11,226 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "MLP.hpp"
+#include "../util/AlgorithmUtils.hpp"
 #include "../util/FluidEigenMappings.hpp"
+#include "../util/ParallelFor.hpp"
 #include "../../data/FluidDataSet.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/FluidTensor.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <limits>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <shared_mutex>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
 class SGD
 {
-  using ArrayXd = Eigen::ArrayXd;
-  using ArrayXXd = Eigen::ArrayXXd;
-  using Permutation = Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic>;
+  using MatrixXd = Eigen::MatrixXd;
 
 public:
   explicit SGD() = default;
   ~SGD() = default;
 
-  double train(MLP& model, const RealMatrixView in, RealMatrixView out,
+  // How the learning rate changes over training: multiplied by factor every
+  // step epochs, annealed to zero along a cosine over all of them, or
+  // multiplied by factor once the loss hasn't improved on its best for the
+  // plateau patience. The loss watched is the validation loss, or the
+  // training loss when there is no validation set.
+  enum class Schedule { kConstant, kStep, kCosine, kPlateau };
+
+  void setOptimizer(NNOptimizer::Type type) { mOptimizer = type; }
+
+  void setSchedule(Schedule schedule, index step, double factor)
+  {
+    mSchedule = schedule;
+    mScheduleStep = std::max<index>(1, step);
+    mScheduleFactor = factor;
+  }
+
+  // Epochs the validation loss may fail to improve before training stops
+  void setPatience(index patience) { mInitialPatience = patience; }
+
+  // Epochs the loss may fail to improve on its best before kPlateau lowers
+  // the learning rate. Separate from the patience for stopping, which should
+  // be longer, so that a lower rate gets the chance to help.
+  void setPlateauPatience(index patience)
+  {
+    mPlateauPatience = std::max<index>(1, patience);
+  }
+
+  // Seeds the shuffling of the examples, so that training can be repeated.
+  // A negative seed, as by default, draws a new one for each call of train().
+  void setSeed(index seed) { mSeed = seed; }
+
+  // Only indices are shuffled: each batch is gathered from the data into
+  // buffers allocated once, and the layers keep their own workspaces.
+  //
+  // Each batch is split across threads, whose gradients are summed before the
+  // weights are updated. With asynchronous set, threads instead take batches
+  // of their own and step the shared weights after each one, as in Hogwild!:
+  // faster for small batches, but not reproducible. Passes share a lock that
+  // each step takes exclusively, so steps (and the optimisers' state in the
+  // layers) never overlap each other or a pass reading the weights.
+  double train(MLP& model, FluidTensorView<const double, 2> in,
+               FluidTensorView<const double, 2> out,
                index nIter, index batchSize, double learningRate,
-               double momentum, double valFrac)
+               double momentum, double valFrac, bool asynchronous = false)
   {
     using namespace _impl;
     using namespace std;
     using namespace Eigen;
-    index       nExamples = in.rows();
-    index       inputSize = in.cols();
-    index       outputSize = out.cols();
-    ArrayXXd    input = asEigen<Eigen::Array>(in);
-    ArrayXXd    output = asEigen<Eigen::Array>(out);
-    Permutation valPerm(nExamples);
-    valPerm.setIdentity();
-    shuffle(valPerm.indices().data(),
-            valPerm.indices().data() + valPerm.indices().size(),
-            mt19937{random_device{}()});
-    input = valPerm * input.matrix();
-    output = valPerm * output.matrix();
+    index nExamples = in.rows();
+    index inputSize = in.cols();
+    index outputSize = out.cols();
+    auto  input = asEigen<Eigen::Matrix>(in);
+    auto  output = asEigen<Eigen::Matrix>(out);
+    mt19937       rng{mSeed < 0 ? random_device{}()
+                                : static_cast<unsigned>(mSeed)};
+    vector<index> order(asUnsigned(nExamples));
+    iota(order.begin(), order.end(), 0);
+    shuffle(order.begin(), order.end(), rng);
     index nVal = std::lround(nExamples * valFrac);
     index nTrain = nExamples - nVal;
+    batchSize = std::max<index>(1, std::min(batchSize, nTrain));
+
+    // copied, as binding the static member to a reference, as std::max does,
+    // would need a definition outside the class for unoptimised builds to link
+    const index    minRows = mMinRowsPerThread;
+    index          blockSize = std::max(batchSize, minRows);
+    vector<Worker> workers(asUnsigned(numWorkers(nExamples)));
+    for (auto& w : workers)
+    {
+      w.in.resize(blockSize, inputSize);
+      w.out.resize(blockSize, outputSize);
+    }
+    atomic<index> nextWorker{0};
 
-    ArrayXXd trainInput = input.block(0, 0, nTrain, inputSize);
-    ArrayXXd trainOutput = output.block(0, 0, nTrain, outputSize);
-    ArrayXXd valInput = input.block(nTrain, 0, nVal, inputSize);
-    ArrayXXd valOutput = output.block(nTrain, 0, nVal, outputSize);
+    // gathers rows into a worker's buffers, and sums their gradients
+    auto step = [&](Worker& w, const index* rows, index n) {
+      auto batchIn = w.in.topRows(n);
+      auto batchOut = w.out.topRows(n);
+      gather(input, rows, batchIn);
+      gather(output, rows, batchOut);
+      w.diff = model.forward(batchIn, w.ws) - batchOut;
+      model.backward(batchIn, w.diff, w.ws);
+    };
 
-    Permutation iterPerm(nTrain);
-    iterPerm.setIdentity();
-    double error = 0;
+    // mean squared error of the examples at rows
+    auto evaluate = [&](const index* rows, index n) {
+      double sum = 0;
+      mutex  lock;
+      nextWorker = 0;
+      parallelFor(
+          n,
+          [&](index start, index end) {
+            Worker& w = workers[asUnsigned(nextWorker++)];
+            double  partial = 0;
+            for (; start < end; start += blockSize)
+            {
+              index m = std::min(blockSize, end - start);
+              auto  blockIn = w.in.topRows(m);
+              auto  blockOut = w.out.topRows(m);
+              gather(input, rows + start, blockIn);
+              gather(output, rows + start, blockOut);
+              partial +=
+                  (model.forward(blockIn, w.ws) - blockOut).squaredNorm();
+            }
+            lock_guard<mutex> guard(lock);
+            sum += partial;
+          },
+          minRows);
+      return sum / n;
+    };
+
+    NNOptimizer opt;
+    opt.type = mOptimizer;
+    opt.momentum = momentum;
     index  patience = mInitialPatience;
     double prevValLoss = std::numeric_limits<double>::max();
-    while (nIter-- > 0)
+    double bestLoss = prevValLoss;
+    index  sinceBest = 0;
+    double plateauRate = learningRate;
+    index  nBatches = (nTrain + batchSize - 1) / batchSize;
+    for (index epoch = 0; epoch < nIter; epoch++)
     {
-      shuffle(iterPerm.indices().data(),
-              iterPerm.indices().data() + iterPerm.indices().size(),
-              mt19937{random_device{}()});
-      ArrayXXd inPerm = iterPerm * trainInput.matrix();
-      ArrayXXd outPerm = iterPerm * trainOutput.matrix();
-      for (index batchStart = 0; batchStart < inPerm.rows();
-           batchStart += batchSize)
+      switch (mSchedule)
+      {
+      case Schedule::kStep:
+        opt.learningRate =
+            learningRate * std::pow(mScheduleFactor, epoch / mScheduleStep);
+        break;
+      case Schedule::kCosine:
+        opt.learningRate =
+            0.5 * learningRate * (1 + std::cos(pi * epoch / nIter));
+        break;
+      case Schedule::kPlateau: opt.learningRate = plateauRate; break;
+      default: opt.learningRate = learningRate;
+      }
+      shuffle(order.begin(), order.begin() + nTrain, rng);
+      if (asynchronous)
+      {
+        shared_timed_mutex weightsLock;
+        nextWorker = 0;
+        parallelFor(nBatches, [&](index first, index last) {
+          Worker& w = workers[asUnsigned(nextWorker++)];
+          for (index b = first; b < last; b++)
+          {
+            index batchStart = b * batchSize;
+            {
+              shared_lock<shared_timed_mutex> reading(weightsLock);
+              step(w, order.data() + batchStart,
+                   std::min(batchSize, nTrain - batchStart));
+            }
+            lock_guard<shared_timed_mutex> writing(weightsLock);
+            model.update(opt, w.ws);
+          }
+        });
+      }
+      else
+      {
+        for (index batchStart = 0; batchStart < nTrain;
+             batchStart += batchSize)
+        {
+          const index* batch = order.data() + batchStart;
+          nextWorker = 0;
+          parallelFor(
+              std::min(batchSize, nTrain - batchStart),
+              [&](index start, index end) {
+                step(workers[asUnsigned(nextWorker++)], batch + start,
+                     end - start);
+              },
+              minRows);
+          for (index i = 0; i < nextWorker; i++)
+            model.reduceGradients(workers[asUnsigned(i)].ws);
+          model.update(opt);
+        }
+      }
+      double valLoss = nVal > 0 ? evaluate(order.data() + nTrain, nVal) : 0;
+      if (mSchedule == Schedule::kPlateau)
       {
-        index thisBatchSize = (batchStart + batchSize) <= nTrain
-                                  ? batchSize
-                                  : nTrain - batchStart;
-        ArrayXXd batchIn =
-            inPerm.block(batchStart, 0, thisBatchSize, inPerm.cols());
-        ArrayXXd batchOut =
-            outPerm.block(batchStart, 0, thisBatchSize, outPerm.cols());
-        ArrayXXd batchPred = ArrayXXd::Zero(thisBatchSize, outputSize);
-        model.forward(batchIn, batchPred);
-        ArrayXXd diff = batchPred - batchOut;
-        model.backward(diff);
-        model.update(learningRate, momentum);
+        double loss = nVal > 0 ? valLoss : evaluate(order.data(), nTrain);
+        if (loss < bestLoss)
+        {
+          bestLoss = loss;
+          sinceBest = 0;
+        }
+        else if (++sinceBest >= mPlateauPatience)
+        {
+          plateauRate *= mScheduleFactor;
+          sinceBest = 0;
+        }
       }
       if (nVal > 0)
       {
-        ArrayXXd valPred = ArrayXXd::Zero(nVal, outputSize);
-        model.forward(valInput, valPred);
-        double valLoss = model.loss(valPred, valOutput);
         if (valLoss < prevValLoss)
           patience = mInitialPatience;
         else
@@ -101,21 +239,42 @@ public:
         prevValLoss = valLoss;
       }
     }
-    ArrayXXd finalPred = ArrayXXd::Zero(nExamples, outputSize);
-    model.forward(input, finalPred);
-    bool isNan = !((finalPred == finalPred)).all();
-    if (isNan)
+    double error = evaluate(order.data(), nExamples);
+    if (error != error)
     {
       model.clear();
       return -1;
     }
-    error = model.loss(finalPred, output);
     model.setTrained(true);
     return error;
   }
 
 private:
-  index mInitialPatience{10};
+  // Buffers for one thread's share of the training
+  struct Worker
+  {
+    MLP::Workspace ws;
+    MatrixXd       in;
+    MatrixXd       out;
+    MatrixXd       diff;
+  };
+
+  template <typename Source, typename Dest>
+  static void gather(const Source& source, const index* rows, Dest&& dest)
+  {
+    for (index i = 0; i < dest.rows(); i++) dest.row(i) = source.row(rows[i]);
+  }
+
+  // fewest examples worth starting a thread for
+  static constexpr index mMinRowsPerThread{32};
+
+  index             mSeed{-1};
+  index             mInitialPatience{10};
+  index             mPlateauPatience{5};
+  NNOptimizer::Type mOptimizer{NNOptimizer::Type::kSGD};
+  Schedule          mSchedule{Schedule::kConstant};
+  index             mScheduleStep{100};
+  double            mScheduleFactor{0.5};
 };
 } // namespace algorithm
 } // namespace fluid
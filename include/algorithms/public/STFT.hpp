@@ -37,7 +37,7 @@ public:
   {
     mWindow = ArrayXd::Zero(mWindowSize);
     auto windowTypeIndex = static_cast<WindowFuncs::WindowTypes>(windowType);
-    WindowFuncs::map()[windowTypeIndex](mWindowSize, mWindow);
+    WindowFuncs::make(windowTypeIndex, mWindowSize, mWindow);
   }
 
   static void magnitude(const FluidTensorView<std::complex<double>, 2> in,
@@ -129,7 +129,7 @@ public:
   {
     mWindow = ArrayXd::Zero(mWindowSize);
     auto windowTypeIndex = static_cast<WindowFuncs::WindowTypes>(windowType);
-    WindowFuncs::map()[windowTypeIndex](mWindowSize, mWindow);
+    WindowFuncs::make(windowTypeIndex, mWindowSize, mWindow);
     mWindowSquared = mWindow * mWindow;
   }
 
@@ -126,7 +126,7 @@ private:
     mWindowTransform = ArrayXd::Zero(transformSize);
     ArrayXd window = ArrayXd::Zero(windowSize);
     FFT     fft(transformSize);
-    WindowFuncs::map()[WindowFuncs::WindowTypes::kHann](windowSize, window);
+    WindowFuncs::make(WindowFuncs::WindowTypes::kHann, windowSize, window);
     ArrayXcd transform =
         fft.process(Eigen::Map<ArrayXd>(window.data(), windowSize));
     for (index i = 0; i < halfBW; i++)
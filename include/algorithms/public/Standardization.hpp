@@ -26,7 +26,7 @@ public:
   using ArrayXd = Eigen::ArrayXd;
   using ArrayXXd = Eigen::ArrayXXd;
 
-  void init(RealMatrixView in)
+  void init(FluidTensorView<const double, 2> in)
   {
     using namespace Eigen;
     using namespace _impl;
@@ -37,6 +37,20 @@ public:
     mInitialized = true;
   }
 
+  // Float data is fitted in single precision, without widening it first
+  void init(FluidTensorView<const float, 2> in)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    auto    input = asEigen<Array>(in);
+    ArrayXf mean = input.colwise().mean().transpose();
+    ArrayXf std =
+        (input.rowwise() - mean.transpose()).square().colwise().mean().sqrt();
+    mMean = mean.cast<double>();
+    mStd = std.cast<double>();
+    mInitialized = true;
+  }
+
   void init(const RealVectorView mean, const RealVectorView std)
   {
     using namespace Eigen;
@@ -61,7 +75,7 @@ public:
     out = asFluid(result);
   }
 
-  void process(const RealMatrixView in, RealMatrixView out,
+  void process(FluidTensorView<const double, 2> in, RealMatrixView out,
                bool inverse = false) const
   {
     using namespace Eigen;
@@ -82,6 +96,20 @@ public:
     out = asFluid(result);
   }
 
+  // Float data is scaled in single precision, without widening it first
+  void process(FluidTensorView<const float, 2> in,
+               FluidTensorView<float, 2> out, bool inverse = false) const
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    ArrayXd scale = inverse ? mStd : ArrayXd(mStd.max(epsilon).inverse());
+    ArrayXd offset = inverse ? mMean : ArrayXd(-mMean * scale);
+    asEigen<Array>(out) =
+        (asEigen<Array>(in).rowwise() * scale.cast<float>().transpose())
+            .rowwise() +
+        offset.cast<float>().transpose();
+  }
+
   bool initialized() const { return mInitialized; }
 
   void getMean(RealVectorView out) const { out = _impl::asFluid(mMean); }
@@ -6,11 +6,14 @@
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
 #include <Eigen/Sparse>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <random>
+#include <string>
 #include <unsupported/Eigen/NonLinearOptimization>
 #include <unsupported/Eigen/NumericalDiff>
+#include <vector>
 
 
 namespace fluid {
@@ -58,14 +61,22 @@ public:
   template <typename T>
   using Ref = Eigen::Ref<T>;
 
-  void init(RealMatrixView embedding, KDTree tree, index k, double a, double b)
+  // Returns false, leaving the model cleared, if the tree's ids aren't the
+  // rows of the embedding
+  bool init(RealMatrixView embedding, KDTree tree, index k, double a, double b)
   {
     mEmbedding = _impl::asEigen<Eigen::Array>(embedding);
-    mTree = tree;
+    mTree = std::move(tree);
+    if (!indexTreeRows(mEmbedding.rows()))
+    {
+      clear();
+      return false;
+    }
     mK = k;
     mAB = VectorXd(2);
     mAB << a, b;
     mInitialized = true;
+    return true;
   }
 
   void getEmbedding(RealMatrixView out) const
@@ -79,12 +90,37 @@ public:
 
   index getK() const { return mInitialized ? mK : 0; }
 
-  KDTree getTree() const { return mTree; }
+  const KDTree& getTree() const { return mTree; }
+
+  // Whether ids, those of the nodes of a saved tree, are each row of an
+  // embedding with that many rows, written as train() writes them, so that
+  // init() will take them. For checking a file before it's loaded.
+  static bool idsAreRows(FluidTensorView<const std::string, 1> ids, index rows)
+  {
+    if (ids.size() != rows) return false;
+    std::vector<bool> seen(asUnsigned(rows), false);
+    for (index i = 0; i < ids.size(); i++)
+    {
+      const std::string& id = ids(i);
+      if (id.empty() || id.size() > 18) return false;
+      index row = 0;
+      for (char c : id)
+      {
+        if (c < '0' || c > '9') return false;
+        row = row * 10 + (c - '0');
+      }
+      if (row >= rows || seen[asUnsigned(row)] || std::to_string(row) != id)
+        return false;
+      seen[asUnsigned(row)] = true;
+    }
+    return true;
+  }
 
   void clear()
   {
     mEmbedding.setZero();
     mTree.clear();
+    mTreeRows.clear();
     mInitialized = false;
   }
 
@@ -96,7 +132,7 @@ public:
 
   bool initialized() const { return mInitialized; }
 
-  DataSet train(DataSet& in, index k = 15, index dims = 2, double minDist = 0.1,
+  DataSet train(const DataSet& in, index k = 15, index dims = 2, double minDist = 0.1,
                 index maxIter = 200, double learningRate = 1.0)
   {
     using namespace Eigen;
@@ -104,10 +140,12 @@ public:
     using namespace std;
     SpectralEmbedding      spectralEmbedding;
     index                  n = in.size();
-    FluidTensor<string, 1> ids{in.getIds()};
     FluidTensor<string, 1> newIds(n);
     for (index i = 0; i < n; i++) newIds(i) = to_string(i);
     mTree = KDTree(DataSet(newIds, in.getData()));
+    bool indexed = indexTreeRows(n);
+    assert(indexed);
+    (void) indexed;
     SparseMatrixXd knnGraph = SparseMatrixXd(in.size(), in.size());
     ArrayXXd       dists = ArrayXXd::Zero(in.size(), k);
     mK = k;
@@ -128,12 +166,12 @@ public:
     epochsPerSample = (epochsPerSample == 0).select(-1, epochsPerSample);
     optimizeLayout(mEmbedding, mEmbedding, rowIndices, colIndices,
                    epochsPerSample, true, learningRate, maxIter);
-    DataSet out(ids, _impl::asFluid(mEmbedding));
+    DataSet out(in.getIds(), _impl::asFluid(mEmbedding));
     mInitialized = true;
     return out;
   }
 
-  DataSet transform(DataSet& in, index maxIter = 200, double learningRate = 1.0)
+  DataSet transform(const DataSet& in, index maxIter = 200, double learningRate = 1.0)
   {
     if (!mInitialized) return DataSet();
     SparseMatrixXd knnGraph(in.size(), mEmbedding.rows());
@@ -164,14 +202,14 @@ public:
     SparseMatrixXd knnGraph(1, mEmbedding.rows());
     ArrayXXd       dists = ArrayXXd::Zero(1, mK);
     knnGraph.reserve(mK);
-    auto nearest = mTree.kNearest(in, mK);
-    auto nearestIds = nearest.getIds();
-    auto distances = nearest.getData().col(0);
-    for (index j = 0; j < mK; j++)
+    FluidTensor<index, 1>  nodes(mK);
+    FluidTensor<double, 1> distances(mK);
+    index                  numFound =
+        mTree.kNearest(in, mK, 0, nodes, distances);
+    for (index j = 0; j < numFound; j++)
     {
-      index neighborIndex = stoi(nearestIds(j));
       dists(0, j) = distances(j);
-      knnGraph.insert(0, neighborIndex) = distances(j);
+      knnGraph.insert(0, mTreeRows[asUnsigned(nodes(j))]) = distances(j);
     }
     knnGraph.makeCompressed();
     ArrayXd sigma = findSigma(mK, dists);
@@ -184,6 +222,23 @@ public:
 
 
 private:
+  // The tree's ids are the rows of the embedding, kept as strings so that the
+  // tree is saved like any other. Queries return nodes, so the row of each
+  // node is found here, once, by looking up the id of each row. Fails unless
+  // each of rows has a node, which then leaves no node without a row.
+  bool indexTreeRows(index rows)
+  {
+    mTreeRows.assign(asUnsigned(mTree.size()), -1);
+    if (mTree.size() != rows) return false;
+    for (index row = 0; row < rows; row++)
+    {
+      index node = mTree.find(std::to_string(row));
+      if (node == -1) return false;
+      mTreeRows[asUnsigned(node)] = row;
+    }
+    return true;
+  }
+
   template <typename F>
   void traverseGraph(const SparseMatrixXd& graph, F func)
   {
@@ -262,22 +317,29 @@ private:
     return ab;
   }
 
+  // The k nearest neighbours of each point of in. When in is the data the
+  // tree was built from, discardSelf leaves each point out of its own
+  // neighbours, by row rather than by taking the first, which may be a
+  // duplicate of it. Slots past the neighbours found, when there are fewer
+  // than k, are left as they were.
   void makeGraph(const DataSet& in, index k, SparseMatrixXd& graph,
-                 Ref<ArrayXXd> dists, bool discardFirst)
+                 Ref<ArrayXXd> dists, bool discardSelf)
   {
     graph.reserve(in.size() * k);
-    auto data = in.getData();
+    index searched = std::min(discardSelf ? k + 1 : k, mTree.size());
+    auto  nearest = mTree.kNearestBatch(in.getData(), searched);
     for (index i = 0; i < in.size(); i++)
     {
-      auto nearest = mTree.kNearest(data.row(i), discardFirst ? k + 1 : k);
-      auto nearestIds = nearest.getIds();
-      auto distances = nearest.getData().col(0);
-      for (index j = 0; j < k; j++)
+      index j = 0;
+      for (index pos = 0; pos < searched && j < k; pos++)
       {
-        index pos = discardFirst ? j + 1 : j;
-        index neighborIndex = stoi(nearestIds(pos));
-        dists(i, j) = distances(pos);
-        graph.insert(i, neighborIndex) = distances(pos);
+        index node = nearest.indices(i, pos);
+        if (node == -1) break;
+        index row = mTreeRows[asUnsigned(node)];
+        if (discardSelf && row == i) continue;
+        dists(i, j) = nearest.distances(i, pos);
+        graph.insert(i, row) = nearest.distances(i, pos);
+        j++;
       }
     }
   }
@@ -326,7 +388,9 @@ private:
     using namespace std;
     double alpha = learningRate;
     double negativeSampleRate = 5.0;
-    auto distance = DistanceFuncs::map()[DistanceFuncs::Distance::kSqEuclidean];
+    auto distance = [](const ArrayXd& x, const ArrayXd& y) {
+      return SqEuclideanDistance::apply(x, y);
+    };
     double                          a = mAB(0);
     double                          b = mAB(1);
     random_device                   rd;
@@ -403,11 +467,12 @@ private:
   }
 
 private:
-  KDTree   mTree;
-  index    mK;
-  VectorXd mAB;
-  ArrayXXd mEmbedding;
-  bool     mInitialized{false};
+  KDTree             mTree;
+  std::vector<index> mTreeRows;
+  index              mK;
+  VectorXd           mAB;
+  ArrayXXd           mEmbedding;
+  bool               mInitialized{false};
 };
 }; // namespace algorithm
 }; // namespace fluid
@@ -0,0 +1,286 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "KDTree.hpp"
+#include "../util/AlgorithmUtils.hpp"
+#include "../util/DistanceFuncs.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../util/KNNHeap.hpp"
+#include "../util/ParallelFor.hpp"
+#include "../../data/FluidDataSet.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/FluidTensor.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// Vantage point tree: each node splits the points below it by their distance
+// to the node's own point, so pruning relies only on the triangle inequality.
+// This makes it usable with metrics where KDTree's axis aligned splits are not
+// valid, such as cosine and Jensen-Shannon distance.
+class VPTree
+{
+
+public:
+  using string = std::string;
+  using Distance = DistanceFuncs::Distance;
+
+  using DataSet = FluidDataSet<string, double, 1>;
+  using ConstRealVectorView = FluidTensorView<const double, 1>;
+  using BatchResult = KDTree::BatchResult;
+
+  // Nodes are stored contiguously in preorder: node 0 is the root, and
+  // tree(i, 0) / tree(i, 1) hold the inside / outside child of node i (-1 if
+  // none). Points in the inside subtree are no further than radii(i) from
+  // node i, those in the outside subtree no nearer.
+  struct FlatData
+  {
+    FluidTensor<index, 2>  tree;
+    FluidTensor<double, 1> radii;
+    FluidTensor<string, 1> ids;
+    FluidTensor<double, 2> data;
+    FlatData(index n, index m) : tree(n, 2), radii(n), ids(n), data(n, m) {}
+  };
+
+  // Cosine distance (1 - cos) doesn't satisfy the triangle inequality, so the
+  // tree is built and searched on the angle, which does, and is monotonic in it
+  static bool supports(Distance metric)
+  {
+    return KDTree::supports(metric) || metric == Distance::kCosine ||
+           metric == Distance::kJS;
+  }
+
+  explicit VPTree() = default;
+  ~VPTree() = default;
+
+  VPTree(const DataSet& dataset, Distance metric = Distance::kEuclidean)
+      : mDims(dataset.pointSize()), mMetric(metric)
+  {
+    using namespace std;
+    assert(supports(metric));
+    if (mDims > 0 && dataset.size() > 0)
+    {
+      mFlat = FlatData(dataset.size(), mDims);
+      vector<index>  indices(asUnsigned(dataset.size()));
+      vector<double> distances(asUnsigned(dataset.size()));
+      iota(indices.begin(), indices.end(), 0);
+      visitMetric([&](auto kernel) {
+        buildTree(kernel, indices.begin(), indices.end(), distances, dataset,
+                  0);
+      });
+    }
+    mInitialized = true;
+  }
+
+  DataSet kNearest(ConstRealVectorView data, index k = 1,
+                   double radius = 0) const
+  {
+    index                 capacity = k > 0 ? std::min(k, size()) : size();
+    FluidTensor<index, 1> nodes(capacity);
+    RealVector            distances(capacity);
+    auto                  result = DataSet(1);
+    index numFound = kNearest(data, k, radius, nodes, distances);
+    for (index i = 0; i < numFound; i++)
+      result.add(mFlat.ids(nodes(i)), distances(Slice(i, 1)));
+    return result;
+  }
+
+  // Allocation free query, as KDTree::kNearest
+  index kNearest(ConstRealVectorView data, index k, double radius,
+                 FluidTensorView<index, 1>  nodes,
+                 FluidTensorView<double, 1> distances) const
+  {
+    assert(data.size() == mDims);
+    assert(nodes.size() == distances.size());
+    index   capacity = k > 0 ? std::min(k, nodes.size()) : nodes.size();
+    KNNHeap heap{nodes, distances, capacity};
+    if (size() > 0 && capacity > 0)
+    {
+      double searchRadius = radius;
+      if (mMetric == Distance::kCosine && radius > 0)
+        searchRadius = std::acos(std::max(-1.0, 1.0 - radius));
+      visitMetric([&](auto kernel) {
+        kNearest(kernel, 0, data, heap, searchRadius);
+      });
+    }
+    heap.sort();
+    if (mMetric == Distance::kCosine)
+    {
+      for (index i = 0; i < heap.size; i++)
+        distances(i) = 1.0 - std::cos(distances(i));
+    }
+    return heap.size;
+  }
+
+  // Queries are independent, so these are spread across worker threads
+  BatchResult kNearestBatch(FluidTensorView<const double, 2> queries, index k,
+                            double radius = 0) const
+  {
+    assert(k > 0);
+    assert(queries.cols() == mDims);
+    BatchResult result(queries.rows(), k);
+    result.indices.fill(-1);
+    result.distances.fill(std::numeric_limits<double>::infinity());
+    parallelFor(
+        queries.rows(),
+        [&](index start, index end) {
+          for (index i = start; i < end; i++)
+            kNearest(queries.row(i), k, radius, result.indices.row(i),
+                     result.distances.row(i));
+        },
+        mMinQueriesPerThread);
+    return result;
+  }
+
+  FluidTensorView<const string, 1> getIds() const { return mFlat.ids; }
+
+  index    dims() const { return mDims; }
+  index    size() const { return mFlat.ids.size(); }
+  Distance metric() const { return mMetric; }
+  bool     initialized() const { return mInitialized; }
+
+  void clear()
+  {
+    mFlat = FlatData(0, mDims);
+    mInitialized = false;
+  }
+
+  const FlatData& toFlat() const { return mFlat; }
+
+  void fromFlat(FlatData vectors, Distance metric)
+  {
+    assert(supports(metric));
+    mDims = vectors.data.cols();
+    mMetric = metric;
+    mFlat = std::move(vectors);
+    mInitialized = true;
+  }
+
+private:
+  struct AngularDistance
+  {
+    template <typename X, typename Y>
+    static double apply(const X& x, const Y& y)
+    {
+      double cosine = 1.0 - CosineDistance::apply(x, y);
+      return std::acos(std::max(-1.0, std::min(1.0, cosine)));
+    }
+  };
+
+  template <typename F>
+  void visitMetric(F&& f) const
+  {
+    if (mMetric == Distance::kCosine)
+      f(AngularDistance{});
+    else
+      visitDistance(mMetric, std::forward<F>(f));
+  }
+
+  template <typename Kernel>
+  static double distance(ConstRealVectorView p1, ConstRealVectorView p2)
+  {
+    using namespace Eigen;
+    return Kernel::apply(_impl::asEigen<Array>(p1), _impl::asEigen<Array>(p2));
+  }
+
+  // Builds the subtree for [from, to) into consecutive slots starting at
+  // nodeId. The first point becomes the vantage point, and the rest are split
+  // at the median of their distances to it.
+  template <typename Kernel, typename Iter>
+  void buildTree(Kernel kernel, Iter from, Iter to,
+                 std::vector<double>& distances, const DataSet& dataset,
+                 index nodeId)
+  {
+    using namespace std;
+    index vantage = *from;
+    mFlat.ids(nodeId) = dataset.getIds()(vantage);
+    mFlat.data.row(nodeId) = dataset.getData().row(vantage);
+    mFlat.tree(nodeId, 0) = -1;
+    mFlat.tree(nodeId, 1) = -1;
+    mFlat.radii(nodeId) = 0;
+    if (to - from == 1) return;
+    for (auto it = from + 1; it != to; it++)
+    {
+      distances[asUnsigned(*it)] = distance<Kernel>(
+          dataset.getData().row(*it), dataset.getData().row(vantage));
+    }
+    auto median = from + 1 + (to - from - 1) / 2;
+    nth_element(from + 1, median, to, [&](index a, index b) {
+      return distances[asUnsigned(a)] < distances[asUnsigned(b)];
+    });
+    mFlat.radii(nodeId) = distances[asUnsigned(*median)];
+    index insideSize = std::distance(from + 1, median);
+    if (insideSize > 0)
+    {
+      mFlat.tree(nodeId, 0) = nodeId + 1;
+      buildTree(kernel, from + 1, median, distances, dataset, nodeId + 1);
+    }
+    mFlat.tree(nodeId, 1) = nodeId + insideSize + 1;
+    buildTree(kernel, median, to, distances, dataset, nodeId + insideSize + 1);
+  }
+
+  template <typename Kernel>
+  void kNearest(Kernel kernel, index current, ConstRealVectorView data,
+                KNNHeap& knn, double radius) const
+  {
+    if (current == -1) return;
+    const double currentDist = distance<Kernel>(mFlat.data.row(current), data);
+    bool         withinRadius = radius > 0 ? currentDist < radius : true;
+    if (withinRadius && !knn.full()) { knn.push(currentDist, current); }
+    else if (withinRadius && currentDist < knn.top())
+    {
+      knn.replaceTop(currentDist, current);
+    }
+    const index  inside = mFlat.tree(current, 0);
+    const index  outside = mFlat.tree(current, 1);
+    const double mu = mFlat.radii(current);
+    // descend first into the side the query falls in, then into the other
+    // only if the ball around the query of the current search radius crosses
+    // the boundary at mu
+    if (currentDist < mu)
+    {
+      kNearest(kernel, inside, data, knn, radius);
+      if (currentDist + searchRadius(knn, radius) >= mu)
+        kNearest(kernel, outside, data, knn, radius);
+    }
+    else
+    {
+      kNearest(kernel, outside, data, knn, radius);
+      if (currentDist - searchRadius(knn, radius) <= mu)
+        kNearest(kernel, inside, data, knn, radius);
+    }
+  }
+
+  static double searchRadius(const KNNHeap& knn, double radius)
+  {
+    double tau = knn.full() ? knn.top() : std::numeric_limits<double>::max();
+    return radius > 0 ? std::min(tau, radius) : tau;
+  }
+
+  static constexpr index mMinQueriesPerThread{64};
+
+  FlatData mFlat{0, 0};
+  index    mDims{0};
+  Distance mMetric{Distance::kEuclidean};
+  bool     mInitialized{false};
+};
+} // namespace algorithm
+} // namespace fluid
@@ -11,11 +11,12 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/AlgorithmUtils.hpp"
+#include "../util/KernelDispatch.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
 #include <cassert>
 #include <cmath>
-#include <map>
+#include <utility>
 
 namespace fluid {
 namespace algorithm {
@@ -30,49 +31,84 @@ public:
     kBlackmanHarris,
     kGaussian
   };
-  using WindowFuncsMap =
-      std::map<WindowTypes,
-               std::function<void(index, Eigen::Ref<Eigen::ArrayXd>)>>;
 
-  static WindowFuncsMap& map()
+  // Writes a window of size samples to the start of out
+  static void make(WindowTypes type, index size,
+                   Eigen::Ref<Eigen::ArrayXd> out);
+};
+
+// Kernels for each of WindowFuncs::WindowTypes, for visitWindow()
+struct HannWindow
+{
+  static void apply(index size, Eigen::Ref<Eigen::ArrayXd> out)
+  {
+    using namespace std;
+    for (index i = 0; i < size; i++)
+    { out(i) = 0.5 - 0.5 * cos((pi * 2 * i) / size); }
+  }
+};
+
+struct HannDWindow
+{
+  static void apply(index size, Eigen::Ref<Eigen::ArrayXd> out)
+  {
+    using namespace std;
+    double norm = pi / size;
+    for (index i = 0; i < size; i++)
+    { out(i) = norm * sin((2 * pi * i) / size); }
+  }
+};
+
+struct HammingWindow
+{
+  static void apply(index size, Eigen::Ref<Eigen::ArrayXd> out)
+  {
+    using namespace std;
+    for (index i = 0; i < size; i++)
+    { out(i) = 0.54 - 0.46 * cos((pi * 2 * i) / size); }
+  }
+};
+
+struct BlackmanHarrisWindow
+{
+  static void apply(index size, Eigen::Ref<Eigen::ArrayXd> out)
+  {
+    using namespace std;
+    for (index i = 0; i < size; i++)
+    {
+      out(i) = 0.35875 - 0.48829 * cos((pi * 2 * i) / size) +
+               0.14128 * cos((pi * 2 * i) / size) +
+               0.01168 * cos((pi * 2 * i) / size);
+    }
+  }
+};
+
+struct GaussianWindow
+{
+  static void apply(index size, Eigen::Ref<Eigen::ArrayXd> out)
   {
     using namespace std;
-    static WindowFuncsMap _funcs = {
-        {WindowTypes::kHann,
-         [](index size, Eigen::Ref<Eigen::ArrayXd> out) {
-           for (index i = 0; i < size; i++)
-           { out(i) = 0.5 - 0.5 * cos((pi * 2 * i) / size); }
-         }},
-        {WindowTypes::kHannD,
-         [](index size, Eigen::Ref<Eigen::ArrayXd> out) {
-           double norm = pi / size;
-           for (index i = 0; i < size; i++)
-           { out(i) = norm * sin((2 * pi * i) / size); }
-         }},
-        {WindowTypes::kHamming,
-         [](index size, Eigen::Ref<Eigen::ArrayXd> out) {
-           for (index i = 0; i < size; i++)
-           { out(i) = 0.54 - 0.46 * cos((pi * 2 * i) / size); }
-         }},
-        {WindowTypes::kBlackmanHarris,
-         [](index size, Eigen::Ref<Eigen::ArrayXd> out) {
-           for (index i = 0; i < size; i++)
-           {
-             out(i) = 0.35875 - 0.48829 * cos((pi * 2 * i) / size) +
-                      0.14128 * cos((pi * 2 * i) / size) +
-                      0.01168 * cos((pi * 2 * i) / size);
-           }
-         }},
-        {WindowTypes::kGaussian,
-         [](index size, Eigen::Ref<Eigen::ArrayXd> out) {
-           double sigma = size / 3; // TODO: should be argument
-           assert(size % 2);
-           index h = (size - 1) / 2;
-           for (index i = -h; i <= h; i++)
-           { out(i + h) = exp(-i * i / (2 * sigma * sigma)); }
-         }}};
-    return _funcs;
+    double sigma = size / 3; // TODO: should be argument
+    assert(size % 2);
+    index h = (size - 1) / 2;
+    for (index i = -h; i <= h; i++)
+    { out(i + h) = exp(-i * i / (2 * sigma * sigma)); }
   }
 };
+
+using WindowKernels = KernelList<HannWindow, HannDWindow, HammingWindow,
+                                 BlackmanHarrisWindow, GaussianWindow>;
+
+template <typename F>
+decltype(auto) visitWindow(WindowFuncs::WindowTypes type, F&& f)
+{
+  return visitKernel<WindowKernels>(type, std::forward<F>(f));
+}
+
+inline void WindowFuncs::make(WindowTypes type, index size,
+                              Eigen::Ref<Eigen::ArrayXd> out)
+{
+  visitWindow(type, [&](auto window) { window.apply(size, out); });
+}
 } // namespace algorithm
 } // namespace fluid
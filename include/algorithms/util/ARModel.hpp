@@ -115,7 +115,7 @@ private:
       if (mWindow.size() != size)
       {
         mWindow = ArrayXd::Zero(size);
-        WindowFuncs::map()[WindowFuncs::WindowTypes::kHann](size, mWindow);
+        WindowFuncs::make(WindowFuncs::WindowTypes::kHann, size, mWindow);
       }
 
       frame.array() *= mWindow;
@@ -11,10 +11,14 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "AlgorithmUtils.hpp"
+#include "KernelDispatch.hpp"
+#include "ParallelFor.hpp"
+#include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
-#include <map>
+#include <utility>
 
 namespace fluid {
 namespace algorithm {
@@ -34,89 +38,244 @@ public:
     kJS
   };
 
-  using ArrayXcd = Eigen::ArrayXcd;
-  using ArrayXd = Eigen::ArrayXd;
-  using MatrixXd = Eigen::MatrixXd;
-  using DistanceFuncsMap =
-      std::map<Distance, std::function<double(ArrayXd, ArrayXd)>>;
+  // Whether value, e.g. one read from a file, is a Distance
+  static bool valid(index value)
+  {
+    return value >= 0 && value <= static_cast<index>(Distance::kJS);
+  }
+};
+
+// Kernels for each Distance, for visitDistance(). Each takes two Eigen array
+// expressions of the same shape and doesn't allocate.
+struct ManhattanDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    return (x - y).abs().sum();
+  }
+};
 
-  static DistanceFuncsMap& map()
+struct EuclideanDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    return std::sqrt((x - y).square().sum());
+  }
+};
+
+struct SqEuclideanDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    return (x - y).square().sum();
+  }
+};
+
+struct MaxDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    return (x - y).abs().maxCoeff();
+  }
+};
+
+struct MinDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    return (x - y).abs().minCoeff();
+  }
+};
+
+struct KLDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
   {
-    static DistanceFuncsMap _funcs = {
-        {Distance::kManhattan,
-         [](ArrayXd x, ArrayXd y) { return (x - y).abs().sum(); }},
-        {Distance::kEuclidean,
-         [](ArrayXd x, ArrayXd y) {
-           return std::sqrt((x - y).square().sum());
-         }},
-        {Distance::kSqEuclidean,
-         [](ArrayXd x, ArrayXd y) { return (x - y).square().sum(); }},
-        {Distance::kMax,
-         [](ArrayXd x, ArrayXd y) { return (x - y).abs().maxCoeff(); }},
-        {Distance::kMin,
-         [](ArrayXd x, ArrayXd y) { return (x - y).abs().minCoeff(); }},
-        {Distance::kKL,
-         [](ArrayXd x, ArrayXd y) {
-           auto   logX = x.max(epsilon).log(), logY = y.max(epsilon).log();
-           double d1 = (x * (logX - logY)).sum();
-           double d2 = (y * (logY - logX)).sum();
-           return d1 + d2;
-         }},
-        {Distance::kCosine, [](ArrayXd x, ArrayXd y) {
-           double norm = x.matrix().norm() * y.matrix().norm();
-           double dot = x.matrix().dot(y.matrix());
-           return 1 - (dot / norm);
-         }},
-         {Distance::kJS,
-           [](ArrayXd x, ArrayXd y) {
-             x = x.max(epsilon);
-             y = y.max(epsilon);
-             x = x / x.sum();
-             y = y / y.sum();
-             ArrayXd m = (0.5 * x) + (0.5 * y);
-             ArrayXd logX = x.log(),
-              logY = y.log(),
-              logM = m.log();
-              double d1 = (x * (logX - logM)).sum();
-              double d2 =  (y * (logY - logM)).sum();
-            return std::sqrt(0.5*(d1 + d2));
-          }}
-       };
-    return _funcs;
+    auto   logX = x.max(epsilon).log();
+    auto   logY = y.max(epsilon).log();
+    double d1 = (x * (logX - logY)).sum();
+    double d2 = (y * (logY - logX)).sum();
+    return d1 + d2;
   }
 };
 
-Eigen::MatrixXd DistanceMatrix(Eigen::Ref<Eigen::MatrixXd> X, index distance)
+struct CosineDistance
 {
-  auto            dist = static_cast<DistanceFuncs::Distance>(distance);
-  Eigen::MatrixXd D = Eigen::MatrixXd::Zero(X.rows(), X.rows());
-  for (index i = 0; i < X.rows(); i++)
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
   {
-    for (index j = 0; j < X.rows(); j++)
+    double norm = std::sqrt(x.square().sum() * y.square().sum());
+    double dot = (x * y).sum();
+    return 1 - (dot / norm);
+  }
+};
+
+struct JSDistance
+{
+  template <typename X, typename Y>
+  static double apply(const X& x, const Y& y)
+  {
+    auto   px = x.max(epsilon) / x.max(epsilon).sum();
+    auto   py = y.max(epsilon) / y.max(epsilon).sum();
+    auto   m = (0.5 * px) + (0.5 * py);
+    double d1 = (px * (px.log() - m.log())).sum();
+    double d2 = (py * (py.log() - m.log())).sum();
+    return std::sqrt(0.5 * (d1 + d2));
+  }
+};
+
+using DistanceKernels =
+    KernelList<ManhattanDistance, EuclideanDistance, SqEuclideanDistance,
+               MaxDistance, MinDistance, KLDistance, CosineDistance,
+               JSDistance>;
+
+// Calls f with the kernel for a Distance, so that a whole search or loop can be
+// instantiated per metric and the choice made once, outside it
+template <typename F>
+decltype(auto) visitDistance(DistanceFuncs::Distance distance, F&& f)
+{
+  return visitKernel<DistanceKernels>(distance, std::forward<F>(f));
+}
+
+namespace _impl {
+
+// Tiles of D computed at a time: the points of a tile's rows and columns are
+// few enough to stay in cache while every pair between them is compared
+constexpr index distanceTileRows = 64;
+constexpr index distanceTileCols = 16;
+// Smallest number of pairs worth giving a thread of its own
+constexpr index minDistancesPerThread = 16384;
+
+// Squared Euclidean distances by ||x||^2 + ||y||^2 - 2xy, so that the bulk of
+// the work is a matrix product. Points are centred first, as the expansion
+// loses precision when they are far from the origin compared to each other.
+template <typename DerivedX, typename DerivedY>
+Eigen::MatrixXd sqEuclideanDistances(const Eigen::DenseBase<DerivedX>& X,
+                                     const Eigen::DenseBase<DerivedY>& Y)
+{
+  using namespace Eigen;
+  MatrixXd    x = X.derived().matrix();
+  MatrixXd    y = Y.derived().matrix();
+  RowVectorXd mean = (x.colwise().sum() + y.colwise().sum()) /
+                     std::max<index>(1, x.rows() + y.rows());
+  x.rowwise() -= mean;
+  y.rowwise() -= mean;
+  VectorXd xx = x.rowwise().squaredNorm();
+  VectorXd yy = y.rowwise().squaredNorm();
+  MatrixXd D(x.rows(), y.rows());
+  parallelFor(
+      y.rows(),
+      [&](index start, index end) {
+        auto block = D.middleCols(start, end - start);
+        block.noalias() =
+            -2.0 * x * y.middleRows(start, end - start).transpose();
+        block.colwise() += xx;
+        block.rowwise() += yy.segment(start, end - start).transpose();
+        block = block.cwiseMax(0.0);
+      },
+      std::max<index>(1, minDistancesPerThread / std::max<index>(1, x.rows())));
+  return D;
+}
+
+// Any other metric, one pair at a time through its kernel. Points are copied to
+// columns so that each is contiguous. Each task takes a strip of
+// distanceTileCols columns of D and fills it a tile of distanceTileRows rows
+// at a time. When symmetric, only pairs i < j are computed, and each strip is
+// paired with its mirror from the far end, so that threads get equal shares of
+// the triangle.
+template <typename Kernel>
+void pairwiseDistances(Kernel, const Eigen::ArrayXXd& x,
+                       const Eigen::ArrayXXd& y, bool symmetric,
+                       Eigen::MatrixXd& D)
+{
+  index nx = x.cols();
+  index ny = y.cols();
+  auto  strip = [&](index s) {
+    index first = s * distanceTileCols;
+    index end = std::min(ny, first + distanceTileCols);
+    index last = symmetric ? end - 1 : nx;
+    for (index tile = 0; tile < last; tile += distanceTileRows)
     {
-      D(i, j) = DistanceFuncs::map()[dist](X.row(i).array(), X.row(j).array());
+      index tileEnd = std::min(last, tile + distanceTileRows);
+      for (index j = first; j < end; j++)
+      {
+        index rowsEnd = symmetric ? std::min(tileEnd, j) : tileEnd;
+        for (index i = tile; i < rowsEnd; i++)
+        {
+          D(i, j) = Kernel::apply(x.col(i), y.col(j));
+          if (symmetric) D(j, i) = D(i, j);
+        }
+      }
     }
-  }
+  };
+  index nStrips = (ny + distanceTileCols - 1) / distanceTileCols;
+  index nTasks = symmetric ? (nStrips + 1) / 2 : nStrips;
+  parallelFor(
+      nTasks,
+      [&](index start, index end) {
+        for (index t = start; t < end; t++)
+        {
+          strip(t);
+          if (symmetric && nStrips - 1 - t != t) strip(nStrips - 1 - t);
+        }
+      },
+      std::max<index>(1, minDistancesPerThread /
+                             std::max<index>(1, nx * distanceTileCols)));
+  if (symmetric) D.diagonal().setZero();
+}
+
+} // namespace _impl
+
+// Distances between each row of X and each row of Y, using the metric
+// numbered as in DistanceFuncs::Distance. Multithreaded, so NRT only.
+template <typename DerivedX, typename DerivedY>
+Eigen::MatrixXd DistanceMatrix(const Eigen::DenseBase<DerivedX>& X,
+                               const Eigen::DenseBase<DerivedY>& Y,
+                               index                             distance)
+{
+  using Distance = DistanceFuncs::Distance;
+  auto dist = static_cast<Distance>(distance);
+  if (dist == Distance::kSqEuclidean) return _impl::sqEuclideanDistances(X, Y);
+  if (dist == Distance::kEuclidean)
+    return _impl::sqEuclideanDistances(X, Y).cwiseSqrt();
+  Eigen::ArrayXXd x = X.derived().array().transpose();
+  Eigen::ArrayXXd y = Y.derived().array().transpose();
+  Eigen::MatrixXd D(X.rows(), Y.rows());
+  visitDistance(dist, [&](auto kernel) {
+    _impl::pairwiseDistances(kernel, x, y, false, D);
+  });
   return D;
 }
 
+// Distances between each pair of rows of X. Only half of them are computed,
+// and the diagonal is exactly zero.
 template <typename Derived>
-Eigen::MatrixXd DistanceMatrix(const Eigen::PlainObjectBase<Derived>& X,
-                               const Eigen::PlainObjectBase<Derived>& Y,
-                               index                                  distance)
+Eigen::MatrixXd DistanceMatrix(const Eigen::DenseBase<Derived>& X,
+                               index                            distance)
 {
-  auto            dist = static_cast<DistanceFuncs::Distance>(distance);
-  Eigen::MatrixXd D = Eigen::MatrixXd::Zero(X.rows(), Y.rows());
-  for (index i = 0; i < X.rows(); i++)
+  using Distance = DistanceFuncs::Distance;
+  auto            dist = static_cast<Distance>(distance);
+  Eigen::MatrixXd D;
+  if (dist == Distance::kSqEuclidean || dist == Distance::kEuclidean)
   {
-    for (index j = 0; j < Y.rows(); j++)
-    {
-      D(i, j) = DistanceFuncs::map()[dist](X.row(i).array(), Y.row(j).array());
-    }
+    D = _impl::sqEuclideanDistances(X, X);
+    if (dist == Distance::kEuclidean) D = D.cwiseSqrt();
+    D.diagonal().setZero();
+    return D;
   }
+  Eigen::ArrayXXd x = X.derived().array().transpose();
+  D.resize(X.rows(), X.rows());
+  visitDistance(dist, [&](auto kernel) {
+    _impl::pairwiseDistances(kernel, x, x, true, D);
+  });
   return D;
 }
 
-
 } // namespace algorithm
 } // namespace fluid
@@ -0,0 +1,94 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace fluid {
+namespace algorithm {
+namespace _impl {
+
+// The products of n pairs of int8, summed exactly in int32 for fewer than
+// 2^17 pairs. Operands must be in [-127, 127]. The SIMD path is chosen when
+// compiling, by the target's flags (e.g. -mavx2, or -mcpu with dotprod on
+// ARM), and the scalar loop covers the rest of the pairs, or all of them on
+// other targets.
+inline std::int32_t dotInt8(const std::int8_t* a, const std::int8_t* b,
+                            index n)
+{
+  index        i = 0;
+  std::int32_t sum = 0;
+#if defined(__AVX2__)
+  // pmaddubsw multiplies unsigned by signed bytes: |a| by b with the sign of a
+  // gives the same products, whose sums in pairs can't saturate int16 for
+  // operands in [-127, 127]. pmaddwd by 1 then widens them to int32.
+  __m256i       acc = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (; i + 32 <= n; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    __m256i p =
+        _mm256_maddubs_epi16(_mm256_abs_epi8(x), _mm256_sign_epi8(y, x));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                            _mm256_extracti128_si256(acc, 1));
+  s = _mm_hadd_epi32(s, s);
+  s = _mm_hadd_epi32(s, s);
+  sum = _mm_cvtsi128_si32(s);
+#elif defined(__SSSE3__)
+  // as for AVX2, 16 pairs at a time
+  __m128i       acc = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i p = _mm_maddubs_epi16(_mm_abs_epi8(x), _mm_sign_epi8(y, x));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(p, ones));
+  }
+  acc = _mm_hadd_epi32(acc, acc);
+  acc = _mm_hadd_epi32(acc, acc);
+  sum = _mm_cvtsi128_si32(acc);
+#elif defined(__ARM_NEON)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (; i + 16 <= n; i += 16)
+  {
+    int8x16_t x = vld1q_s8(a + i);
+    int8x16_t y = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+    acc = vdotq_s32(acc, x, y);
+#else
+    // two products of operands in [-127, 127] fit int16
+    int16x8_t p = vmull_s8(vget_low_s8(x), vget_low_s8(y));
+    p = vmlal_s8(p, vget_high_s8(x), vget_high_s8(y));
+    acc = vpadalq_s16(acc, p);
+#endif
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  sum = vget_lane_s32(vpadd_s32(s, s), 0);
+#endif
+  for (; i < n; i++)
+    sum += static_cast<std::int32_t>(a[i]) * static_cast<std::int32_t>(b[i]);
+  return sum;
+}
+
+} // namespace _impl
+} // namespace algorithm
+} // namespace fluid
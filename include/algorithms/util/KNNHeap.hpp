@@ -0,0 +1,74 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include "../../data/FluidTensor.hpp"
+
+namespace fluid {
+namespace algorithm {
+
+// Fixed capacity max-heap of nearest neighbour candidates (keyed on distance),
+// kept in caller-owned storage so that searches never allocate
+struct KNNHeap
+{
+  FluidTensorView<index, 1>  nodes;
+  FluidTensorView<double, 1> distances;
+  index                      capacity;
+  index                      size{0};
+
+  bool   full() const { return size == capacity; }
+  double top() const { return distances(0); }
+
+  void push(double dist, index node)
+  {
+    index i = size++;
+    for (index parent = (i - 1) / 2; i > 0 && distances(parent) < dist;
+         i = parent, parent = (i - 1) / 2)
+      set(i, distances(parent), nodes(parent));
+    set(i, dist, node);
+  }
+
+  void replaceTop(double dist, index node) { siftDown(0, size, dist, node); }
+
+  // heapsort in place, leaving candidates in ascending order of distance
+  void sort()
+  {
+    for (index end = size - 1; end > 0; end--)
+    {
+      double dist = distances(end);
+      index  node = nodes(end);
+      set(end, distances(0), nodes(0));
+      siftDown(0, end, dist, node);
+    }
+  }
+
+private:
+  void set(index i, double dist, index node)
+  {
+    distances(i) = dist;
+    nodes(i) = node;
+  }
+
+  void siftDown(index i, index end, double dist, index node)
+  {
+    for (index child = 2 * i + 1; child < end; i = child, child = 2 * i + 1)
+    {
+      if (child + 1 < end && distances(child + 1) > distances(child)) child++;
+      if (distances(child) <= dist) break;
+      set(i, distances(child), nodes(child));
+    }
+    set(i, dist, node);
+  }
+};
+
+} // namespace algorithm
+} // namespace fluid
@@ -0,0 +1,58 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <cassert>
+#include <utility>
+
+namespace fluid {
+namespace algorithm {
+
+// Kernel types for the values of an enum, listed in the same order. Kernels are
+// empty structs with static functions, so a call through one can be inlined.
+template <typename... Kernels>
+struct KernelList
+{
+  static constexpr index size = sizeof...(Kernels);
+};
+
+namespace _impl {
+
+template <typename F, typename Kernel>
+decltype(auto) visitKernel(index, F&& f, KernelList<Kernel>)
+{
+  return std::forward<F>(f)(Kernel{});
+}
+
+template <typename F, typename Kernel, typename Next, typename... Rest>
+decltype(auto) visitKernel(index i, F&& f, KernelList<Kernel, Next, Rest...>)
+{
+  if (i == 0) return std::forward<F>(f)(Kernel{});
+  return visitKernel(i - 1, std::forward<F>(f), KernelList<Next, Rest...>{});
+}
+
+} // namespace _impl
+
+// Calls f with the kernel in Kernels for value, so that a loop written in f is
+// instantiated per kernel and the choice is made once, outside it, instead of
+// going through a table of std::functions per call. f must return the same
+// type for every kernel.
+template <typename Kernels, typename Enum, typename F>
+decltype(auto) visitKernel(Enum value, F&& f)
+{
+  index i = static_cast<index>(value);
+  assert(i >= 0 && i < Kernels::size);
+  return _impl::visitKernel(i, std::forward<F>(f), Kernels{});
+}
+
+} // namespace algorithm
+} // namespace fluid
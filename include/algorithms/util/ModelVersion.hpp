@@ -0,0 +1,60 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <atomic>
+
+namespace fluid {
+namespace algorithm {
+
+// Identifies the state of a model's parameters, so that copies of them taken
+// elsewhere (e.g. by an RT query) can tell when they're stale. Values are
+// drawn from a count shared by every model, and a new one is taken on
+// stamp(), and whenever the model is copied or moved, so that no two models,
+// or states of one, have the same version, even when one is loaded over
+// another.
+//
+// Versions also fall into lineages: stamp() starts a new one, for a state
+// unrelated to the last, while advance() takes a new version in the same
+// lineage, for a state that carries on from the last, e.g. one with a copy's
+// own updates written back. A copy that keeps the lineage it was taken from
+// can tell that such changes are its own rather than a replacement.
+class ModelVersion
+{
+public:
+  ModelVersion() : mValue(next()), mLineage(mValue) {}
+  ModelVersion(const ModelVersion&) : ModelVersion() {}
+
+  ModelVersion& operator=(const ModelVersion&)
+  {
+    stamp();
+    return *this;
+  }
+
+  void  stamp() { mValue = mLineage = next(); }
+  void  advance() { mValue = next(); }
+  index value() const { return mValue; }
+  index lineage() const { return mLineage; }
+
+private:
+  static index next()
+  {
+    static std::atomic<index> generation{0};
+    return ++generation;
+  }
+
+  index mValue;
+  index mLineage;
+};
+
+} // namespace algorithm
+} // namespace fluid
@@ -10,10 +10,11 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #pragma once
 
+#include "KernelDispatch.hpp"
+#include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
-#include <cassert>
 #include <cmath>
-#include <map>
+#include <utility>
 
 namespace fluid {
 namespace algorithm {
@@ -24,56 +25,96 @@ class NNActivations
 public:
   enum class Activation { kLinear, kSigmoid, kReLU, kTanh };
 
-  using ArrayXXd = Eigen::ArrayXXd;
-  using ActivationsMap =
-      std::map<Activation, std::function<void(Eigen::Ref<Eigen::ArrayXXd>,
-                                              Eigen::Ref<Eigen::ArrayXXd>)>>;
+  // Whether value, e.g. one read from a file, is an Activation
+  static bool valid(index value)
+  {
+    return value >= 0 && value <= static_cast<index>(Activation::kTanh);
+  }
+};
+
+// Kernels for each Activation, for visitActivation(). apply() writes the
+// activation of in to out, which may be the same array, and derivative() the
+// derivative given the activation's output.
+struct LinearActivation
+{
+  template <typename In, typename Out>
+  static void apply(const In& in, Out&& out)
+  {
+    out = in;
+  }
+
+  template <typename In, typename Out>
+  static void derivative(const In&, Out&& out)
+  {
+    out.setOnes();
+  }
+};
 
-  static ActivationsMap& activation()
+struct SigmoidActivation
+{
+  template <typename In, typename Out>
+  static void apply(const In& in, Out&& out)
   {
-    static ActivationsMap _funcs = {
-        {Activation::kLinear,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = in;
-         }},
-        {Activation::kSigmoid,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = 1 / (1 + (-in).exp());
-         }},
-        {Activation::kReLU,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = in.max(0);
-         }},
-        {Activation::kTanh,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = (in.exp() - (-in).exp()) / (in.exp() + (-in).exp());
-         }},
-    };
-    return _funcs;
+    out = 1 / (1 + (-in).exp());
   }
 
-  // derivative from output of activation
-  static ActivationsMap& derivative()
+  template <typename In, typename Out>
+  static void derivative(const In& in, Out&& out)
   {
-    static ActivationsMap _funcs = {
-        {Activation::kLinear,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = ArrayXXd::Ones(in.rows(), in.cols());
-         }},
-        {Activation::kSigmoid,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = in * (1 - in);
-         }},
-        {Activation::kReLU,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = (in > 0).cast<double>();
-         }},
-        {Activation::kTanh,
-         [](Eigen::Ref<Eigen::ArrayXXd> in, Eigen::Ref<Eigen::ArrayXXd> out) {
-           out = 1 - in.square();
-         }}};
-    return _funcs;
+    out = in * (1 - in);
   }
 };
+
+struct ReLUActivation
+{
+  template <typename In, typename Out>
+  static void apply(const In& in, Out&& out)
+  {
+    out = in.max(0);
+  }
+
+  template <typename In, typename Out>
+  static void derivative(const In& in, Out&& out)
+  {
+    out = (in > 0).template cast<double>();
+  }
+};
+
+struct TanhActivation
+{
+  template <typename In, typename Out>
+  static void apply(const In& in, Out&& out)
+  {
+    out = in.tanh();
+  }
+
+  template <typename In, typename Out>
+  static void derivative(const In& in, Out&& out)
+  {
+    out = 1 - in.square();
+  }
+};
+
+using ActivationKernels = KernelList<LinearActivation, SigmoidActivation,
+                                     ReLUActivation, TanhActivation>;
+
+template <typename F>
+decltype(auto) visitActivation(NNActivations::Activation activation, F&& f)
+{
+  return visitKernel<ActivationKernels>(activation, std::forward<F>(f));
+}
+
+// How NNLayer::update steps down the gradient. momentum is also Adam's decay
+// rate for the mean gradient, and decay that for the mean squared gradient.
+struct NNOptimizer
+{
+  enum class Type { kSGD, kNesterov, kRMSProp, kAdam };
+
+  Type   type{Type::kSGD};
+  double learningRate{0.01};
+  double momentum{0.9};
+  double decay{0.999};
+  double epsilon{1e-8};
+};
 } // namespace algorithm
 } // namespace fluid
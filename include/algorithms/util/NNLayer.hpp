@@ -12,7 +12,9 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #include "NNFuncs.hpp"
 #include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <cmath>
 
 namespace fluid {
 namespace algorithm {
@@ -52,70 +54,173 @@ public:
     initGrads();
   }
 
-  MatrixXd getWeights() const { return mWeights; }
-  VectorXd getBiases() const { return mBiases; }
-  index    getActType() const { return mActType; }
+  const MatrixXd& getWeights() const { return mWeights; }
+  const VectorXd& getBiases() const { return mBiases; }
+  index           getActType() const { return mActType; }
 
   void initGrads()
   {
-    mWeightsGrad = MatrixXd::Zero(mWeights.rows(), mWeights.cols());
-    mBiasesGrad = VectorXd::Zero(mWeights.cols());
     mPrevWeightsUpdate = MatrixXd::Zero(mWeights.rows(), mWeights.cols());
     mPrevBiasesUpdate = VectorXd::Zero(mWeights.cols());
+    mWeightsMeanSquare = MatrixXd::Zero(mWeights.rows(), mWeights.cols());
+    mBiasesMeanSquare = VectorXd::Zero(mWeights.cols());
+    mSteps = 0;
   }
 
   index inputSize() const { return mWeights.rows(); }
 
   index outputSize() const { return mWeights.cols(); }
 
-  void forward(Eigen::Ref<MatrixXd> in, Eigen::Ref<MatrixXd> out)
+  // Buffers for passing one batch through a layer. They're only reallocated
+  // when the batch size changes, and each thread training the layer has its
+  // own, so that passes can run concurrently against the same weights.
+  struct Workspace
   {
-    mInput = in;
-    MatrixXd WT = mWeights.transpose();
-    MatrixXd IT = mInput.transpose();
-    MatrixXd Z = ((WT * IT).colwise() + mBiases).transpose();
-    mOutput = MatrixXd::Zero(out.rows(), out.cols());
-    NNActivations::activation()[mActivation](Z, mOutput);
-    out = mOutput;
+    MatrixXd output;
+    MatrixXd actGrad;
+    MatrixXd inputGrad;
+    // summed over the rows passed backward since they were last cleared
+    MatrixXd weightsGrad;
+    VectorXd biasesGrad;
+    index    rows{0};
+  };
+
+  // Output for a batch of inputs, one per row, kept in ws for backward()
+  const MatrixXd& forward(const Eigen::Ref<const MatrixXd>& in,
+                          Workspace&                        ws) const
+  {
+    ws.output.resize(in.rows(), outputSize());
+    ws.output.noalias() = in * mWeights;
+    ws.output.rowwise() += mBiases.transpose();
+    visitActivation(mActivation, [&](auto act) {
+      act.apply(ws.output.array(), ws.output.array());
+    });
+    return ws.output;
   }
 
-  void backward(Eigen::Ref<MatrixXd> outGrad, Eigen::Ref<MatrixXd> inGrad)
-  { // going backwards, so out is in
-    MatrixXd dAct = MatrixXd::Zero(mOutput.rows(), mOutput.cols());
-    NNActivations::derivative()[mActivation](mOutput, dAct);
-    MatrixXd actGrad = dAct.array() * outGrad.array();
-    double   norm = 1.0 / mInput.rows();
-    mWeightsGrad = norm * (mInput.transpose() * actGrad);
-    inGrad = actGrad * mWeights.transpose();
-    mBiasesGrad = actGrad.colwise().mean();
+  // Adds the gradients for the batch in, last passed forward with ws, to those
+  // in ws. With propagate set, returns the gradient with respect to in, for
+  // the layer before.
+  const MatrixXd& backward(const Eigen::Ref<const MatrixXd>& in,
+                           const Eigen::Ref<const MatrixXd>& outGrad,
+                           Workspace& ws, bool propagate = true) const
+  {
+    ws.actGrad.resize(ws.output.rows(), ws.output.cols());
+    visitActivation(mActivation, [&](auto act) {
+      act.derivative(ws.output.array(), ws.actGrad.array());
+    });
+    ws.actGrad.array() *= outGrad.array();
+    if (ws.rows == 0) clearGrads(ws);
+    ws.weightsGrad.noalias() += in.transpose() * ws.actGrad;
+    ws.biasesGrad += ws.actGrad.colwise().sum().transpose();
+    ws.rows += in.rows();
+    if (propagate)
+    {
+      ws.inputGrad.resize(in.rows(), inputSize());
+      ws.inputGrad.noalias() = ws.actGrad * mWeights.transpose();
+    }
+    return ws.inputGrad;
   }
 
-  void update(double learningRate, double momentum)
+  // Adds the gradients summed in from to those in to, and clears from
+  static void reduceGrads(Workspace& from, Workspace& to)
   {
-    MatrixXd wUpdate = (momentum * mPrevWeightsUpdate) +
-                       ((1 - momentum) * learningRate * mWeightsGrad);
-    VectorXd bUpdate = (momentum * mPrevBiasesUpdate) +
-                       ((1 - momentum) * learningRate * mBiasesGrad);
-    mWeights = mWeights - wUpdate;
-    mBiases = mBiases - bUpdate;
-    mPrevWeightsUpdate = wUpdate;
-    mPrevBiasesUpdate = bUpdate;
+    if (from.rows == 0) return;
+    if (to.rows == 0)
+    {
+      std::swap(from.weightsGrad, to.weightsGrad);
+      std::swap(from.biasesGrad, to.biasesGrad);
+    }
+    else
+    {
+      to.weightsGrad += from.weightsGrad;
+      to.biasesGrad += from.biasesGrad;
+    }
+    to.rows += from.rows;
+    from.rows = 0;
+  }
+
+  // Steps down the mean gradient summed in ws, and clears it. SGD and
+  // Nesterov keep the previous update as velocity; RMSProp and Adam keep
+  // running means of the gradient there and of its square alongside.
+  void update(Workspace& ws, const NNOptimizer& opt)
+  {
+    if (ws.rows == 0) return;
+    double scale = 1.0 / ws.rows;
+    ws.rows = 0;
+    switch (opt.type)
+    {
+    case NNOptimizer::Type::kNesterov:
+    {
+      double rate = (1 - opt.momentum) * opt.learningRate * scale;
+      mPrevWeightsUpdate =
+          opt.momentum * mPrevWeightsUpdate + rate * ws.weightsGrad;
+      mPrevBiasesUpdate =
+          opt.momentum * mPrevBiasesUpdate + rate * ws.biasesGrad;
+      // steps from where the velocity is about to take the weights
+      mWeights -= opt.momentum * mPrevWeightsUpdate + rate * ws.weightsGrad;
+      mBiases -= opt.momentum * mPrevBiasesUpdate + rate * ws.biasesGrad;
+      break;
+    }
+    case NNOptimizer::Type::kRMSProp:
+      adaptiveStep(ws, scale, opt, 0, opt.learningRate);
+      break;
+    case NNOptimizer::Type::kAdam:
+    {
+      mSteps++;
+      double correction1 = 1 - std::pow(opt.momentum, mSteps);
+      double correction2 = 1 - std::pow(opt.decay, mSteps);
+      adaptiveStep(ws, scale, opt, opt.momentum,
+                   opt.learningRate * std::sqrt(correction2) / correction1);
+      break;
+    }
+    default:
+      mPrevWeightsUpdate =
+          (opt.momentum * mPrevWeightsUpdate) +
+          ((1 - opt.momentum) * opt.learningRate * scale * ws.weightsGrad);
+      mPrevBiasesUpdate =
+          (opt.momentum * mPrevBiasesUpdate) +
+          ((1 - opt.momentum) * opt.learningRate * scale * ws.biasesGrad);
+      mWeights -= mPrevWeightsUpdate;
+      mBiases -= mPrevBiasesUpdate;
+    }
   }
 
 private:
+  // RMSProp, or Adam with momentum > 0, taking steps of rate / rms gradient
+  void adaptiveStep(const Workspace& ws, double scale, const NNOptimizer& opt,
+                    double momentum, double rate)
+  {
+    mWeightsMeanSquare = opt.decay * mWeightsMeanSquare +
+                         (1 - opt.decay) * (scale * ws.weightsGrad).cwiseAbs2();
+    mBiasesMeanSquare = opt.decay * mBiasesMeanSquare +
+                        (1 - opt.decay) * (scale * ws.biasesGrad).cwiseAbs2();
+    mPrevWeightsUpdate = momentum * mPrevWeightsUpdate +
+                         (1 - momentum) * scale * ws.weightsGrad;
+    mPrevBiasesUpdate =
+        momentum * mPrevBiasesUpdate + (1 - momentum) * scale * ws.biasesGrad;
+    mWeights.array() -= rate * mPrevWeightsUpdate.array() /
+                        (mWeightsMeanSquare.array().sqrt() + opt.epsilon);
+    mBiases.array() -= rate * mPrevBiasesUpdate.array() /
+                       (mBiasesMeanSquare.array().sqrt() + opt.epsilon);
+  }
+
+  void clearGrads(Workspace& ws) const
+  {
+    ws.weightsGrad.setZero(mWeights.rows(), mWeights.cols());
+    ws.biasesGrad.setZero(mWeights.cols());
+  }
+
   MatrixXd   mWeights;
   VectorXd   mBiases;
   index      mActType;
   Activation mActivation;
 
-  MatrixXd mWeightsGrad;
-  VectorXd mBiasesGrad;
-
   MatrixXd mPrevWeightsUpdate;
   VectorXd mPrevBiasesUpdate;
-
-  MatrixXd mInput;
-  MatrixXd mOutput;
+  MatrixXd mWeightsMeanSquare;
+  VectorXd mBiasesMeanSquare;
+  index    mSteps{0};
 };
 } // namespace algorithm
 } // namespace fluid
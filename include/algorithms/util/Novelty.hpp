@@ -69,8 +69,8 @@ private:
     mKernel = mKernelStorage.block(0, 0, mKernelSize, mKernelSize);
     index   h = (mKernelSize - 1) / 2;
     ArrayXd gaussian = ArrayXd::Zero(mKernelSize);
-    WindowFuncs::map()[WindowFuncs::WindowTypes::kGaussian](mKernelSize,
-                                                            gaussian);
+    WindowFuncs::make(WindowFuncs::WindowTypes::kGaussian, mKernelSize,
+                      gaussian);
     MatrixXd tmp = gaussian.matrix() * gaussian.matrix().transpose();
     tmp.block(h, 0, h + 1, h) *= -1;
     tmp.block(0, h, h, h + 1) *= -1;
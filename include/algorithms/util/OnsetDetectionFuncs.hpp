@@ -11,11 +11,12 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "AlgorithmUtils.hpp"
+#include "KernelDispatch.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
 #include <cassert>
 #include <cmath>
-#include <map>
+#include <utility>
 
 namespace fluid {
 namespace algorithm {
@@ -39,10 +40,8 @@ public:
 
   using ArrayXcd = Eigen::ArrayXcd;
   using ArrayXd = Eigen::ArrayXd;
-  using ODFMap =
-      std::map<ODF, std::function<double(ArrayXcd, ArrayXcd, ArrayXcd)>>;
 
-  static ArrayXd wrapPhase(ArrayXd phase)
+  static ArrayXd wrapPhase(const ArrayXd& phase)
   {
     return phase.unaryExpr([=](const double p) {
       return p > (-pi) && p > pi
@@ -50,85 +49,140 @@ public:
                  : p + (twoPi) * (1.0 + floor((-pi - p) / twoPi));
     });
   }
+};
+
+// Kernels for each ODF, for visitODF(). Each takes the spectra of the current
+// frame and the two before it.
+struct EnergyODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd&,
+                      const Eigen::ArrayXcd&)
+  {
+    return cur.abs().real().square().mean();
+  }
+};
+
+struct HFCODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd&,
+                      const Eigen::ArrayXcd&)
+  {
+    index n = cur.size();
+    return (Eigen::ArrayXd::LinSpaced(n, 0, n) * cur.abs().real().square())
+        .mean();
+  }
+};
 
-  static ODFMap& map()
+struct SpectralFluxODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd&)
+  {
+    return (cur.abs().real() - prev.abs().real()).max(0.0).mean();
+  }
+};
+
+struct MKLODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd&)
+  {
+    auto mag1 = cur.abs().real().max(epsilon);
+    auto mag2 = prev.abs().real().max(epsilon);
+    return (mag1 / mag2).max(epsilon).log().mean();
+  }
+};
+
+struct ISODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd&)
+  {
+    auto           mag1 = cur.abs().real().max(epsilon);
+    auto           mag2 = prev.abs().real().max(epsilon);
+    Eigen::ArrayXd ratio = (mag1 / mag2).square().max(epsilon);
+    return (ratio - ratio.log() - 1).mean();
+  }
+};
+
+struct CosineODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd&)
   {
-    static ODFMap _funcs = {
-
-        {ODF::kEnergy,
-         [](ArrayXcd cur, ArrayXcd /*prev*/, ArrayXcd /*prevprev*/) {
-           return cur.abs().real().square().mean();
-         }},
-        {ODF::kHFC,
-         [](ArrayXcd cur, ArrayXcd /*prev*/, ArrayXcd /*prevprev*/) {
-           index   n = cur.size();
-           ArrayXd space = ArrayXd(n);
-           space.setLinSpaced(0, n);
-           return (space * cur.abs().real().square()).mean();
-         }},
-        {ODF::kSpectralFlux,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           return (cur.abs().real() - prev.abs().real()).max(0.0).mean();
-         }},
-        {ODF::kMKL,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           return (mag1 / mag2).max(epsilon).log().mean();
-         }},
-        {ODF::kIS,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           ArrayXd ratio = (mag1 / mag2).square().max(epsilon);
-           return (ratio - ratio.log() - 1).mean();
-         }},
-        {ODF::kCosine,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           double  norm = mag1.matrix().norm() * mag2.matrix().norm();
-           double  dot = mag1.matrix().dot(mag2.matrix());
-           return 1 - dot / norm;
-         }},
-        {ODF::kPhaseDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
+    auto   mag1 = cur.abs().real().max(epsilon);
+    auto   mag2 = prev.abs().real().max(epsilon);
+    double norm = mag1.matrix().norm() * mag2.matrix().norm();
+    double dot = mag1.matrix().dot(mag2.matrix());
+    return 1 - dot / norm;
+  }
+};
+
+struct PhaseDevODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd& prevprev)
+  {
+    Eigen::ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
                               (prev.atan().real() - prevprev.atan().real());
-           return wrapPhase(phaseAcc).mean();
-         }},
-        {ODF::kWPhaseDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
+    return OnsetDetectionFuncs::wrapPhase(phaseAcc).mean();
+  }
+};
+
+struct WPhaseDevODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd& prevprev)
+  {
+    auto           mag1 = cur.abs().real().max(epsilon);
+    Eigen::ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
                               (prev.atan().real() - prevprev.atan().real());
-           return wrapPhase(mag1 * phaseAcc).mean();
-         }},
-        {ODF::kComplexDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXcd target(cur.size());
-           ArrayXd  prevMag = prev.abs().real().max(epsilon);
-           ArrayXd  prevPhase = prev.atan().real();
-           ArrayXd  phaseEst = wrapPhase(
-               prevPhase + (prev.atan().real() - prevprev.atan().real()));
-           target.real() = prevMag * phaseEst.cos();
-           target.imag() = prevMag * phaseEst.sin();
-           return (target - cur).abs().real().mean();
-         }},
-        {ODF::kRComplexDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXcd target(cur.size());
-           ArrayXd  prevMag = prev.abs().real().max(epsilon);
-           ArrayXd  prevPhase = prev.atan().real();
-           ArrayXd  phaseEst = wrapPhase(
-               prevPhase + (prev.atan().real() - prevprev.atan().real()));
-           target.real() = prevMag * phaseEst.cos();
-           target.imag() = prevMag * phaseEst.sin();
-           return (target - cur).abs().real().max(0.0).mean();
-         }},
-    };
-    return _funcs;
+    return OnsetDetectionFuncs::wrapPhase(mag1 * phaseAcc).mean();
+  }
+};
+
+struct ComplexDevODF
+{
+  // The deviation of cur from where prev would be if it had carried on from
+  // prevprev at the same rate
+  static Eigen::ArrayXd deviation(const Eigen::ArrayXcd& cur,
+                                  const Eigen::ArrayXcd& prev,
+                                  const Eigen::ArrayXcd& prevprev)
+  {
+    Eigen::ArrayXcd target(cur.size());
+    Eigen::ArrayXd  prevMag = prev.abs().real().max(epsilon);
+    Eigen::ArrayXd  prevPhase = prev.atan().real();
+    Eigen::ArrayXd  phaseEst = OnsetDetectionFuncs::wrapPhase(
+        prevPhase + (prevPhase - prevprev.atan().real()));
+    target.real() = prevMag * phaseEst.cos();
+    target.imag() = prevMag * phaseEst.sin();
+    return (target - cur).abs().real();
+  }
+
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd& prevprev)
+  {
+    return deviation(cur, prev, prevprev).mean();
   }
 };
+
+struct RComplexDevODF
+{
+  static double apply(const Eigen::ArrayXcd& cur, const Eigen::ArrayXcd& prev,
+                      const Eigen::ArrayXcd& prevprev)
+  {
+    return ComplexDevODF::deviation(cur, prev, prevprev).max(0.0).mean();
+  }
+};
+
+using ODFKernels =
+    KernelList<EnergyODF, HFCODF, SpectralFluxODF, MKLODF, ISODF, CosineODF,
+               PhaseDevODF, WPhaseDevODF, ComplexDevODF, RComplexDevODF>;
+
+template <typename F>
+decltype(auto) visitODF(OnsetDetectionFuncs::ODF odf, F&& f)
+{
+  return visitKernel<ODFKernels>(odf, std::forward<F>(f));
+}
 } // namespace algorithm
 } // namespace fluid
@@ -0,0 +1,67 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// Most threads parallelFor may use, or 0, by default, for one per hardware
+// thread. Hosts can lower it to leave cores free; tests raise it to exercise
+// the split on any machine. Not to be changed while a job is running.
+inline std::atomic<index>& workerLimit()
+{
+  static std::atomic<index> limit{0};
+  return limit;
+}
+
+// Number of worker threads to use for a job of n items, where each thread
+// should get at least minChunk of them
+inline index numWorkers(index n, index minChunk = 1)
+{
+  index limit = workerLimit();
+  index hardware =
+      limit > 0 ? limit
+                : std::max<index>(1, std::thread::hardware_concurrency());
+  index maxUseful = n / std::max<index>(1, minChunk);
+  return std::max<index>(1, std::min(hardware, maxUseful));
+}
+
+// Splits [0, n) into contiguous chunks and calls f(start, end) for each on its
+// own thread, blocking until all are done. The calling thread takes the last
+// chunk. Intended for NRT jobs only: never call this from the audio thread.
+template <typename F>
+void parallelFor(index n, F&& f, index minChunk = 1)
+{
+  if (n <= 0) return;
+  index nThreads = numWorkers(n, minChunk);
+  if (nThreads == 1)
+  {
+    f(index(0), n);
+    return;
+  }
+  index                    chunk = (n + nThreads - 1) / nThreads;
+  std::vector<std::thread> workers;
+  workers.reserve(asUnsigned(nThreads - 1));
+  index start = 0;
+  for (index i = 0; i < nThreads - 1 && start + chunk < n; i++, start += chunk)
+    workers.emplace_back([&f, start, chunk]() { f(start, start + chunk); });
+  f(start, n);
+  for (auto& w : workers) w.join();
+}
+
+} // namespace algorithm
+} // namespace fluid
@@ -0,0 +1,64 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// Hands immutable snapshots of an object from the NRT side, which makes and
+// replaces them, to any number of RT readers, through std::atomic_load and
+// std::atomic_exchange of a shared pointer. A reader holds the snapshot it
+// read for as long as it needs it, and sees a whole state however the
+// publisher moves on. Snapshots replaced while readers may still hold them are
+// kept here until they let go, and only freed by a later publish() or
+// withdraw(), so that the audio thread never frees one.
+template <typename T>
+class PublishedSnapshot
+{
+public:
+  using Pointer = std::shared_ptr<const T>;
+
+  // For the RT side: the snapshot last published, or null if none is
+  Pointer read() const { return std::atomic_load(&mCurrent); }
+
+  void publish(Pointer snapshot)
+  {
+    retire(std::atomic_exchange(&mCurrent, std::move(snapshot)));
+  }
+
+  // Takes back the snapshot, e.g. for the length of a change to what it
+  // shares. Once this returns, no reader can get at it other than those still
+  // holding it, which are counted by its use_count().
+  void withdraw() { publish(nullptr); }
+
+private:
+  void retire(Pointer snapshot)
+  {
+    mRetired.erase(std::remove_if(mRetired.begin(), mRetired.end(),
+                                  [](const Pointer& p) {
+                                    return p.use_count() == 1;
+                                  }),
+                   mRetired.end());
+    if (snapshot && snapshot.use_count() > 1)
+      mRetired.push_back(std::move(snapshot));
+  }
+
+  Pointer              mCurrent;
+  std::vector<Pointer> mRetired;
+};
+
+} // namespace algorithm
+} // namespace fluid
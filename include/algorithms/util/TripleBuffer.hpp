@@ -0,0 +1,65 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include <atomic>
+
+namespace fluid {
+namespace algorithm {
+
+// Hands the latest of a series of values from a writer to a reader without
+// either waiting for the other: one slot is the writer's, one the reader's,
+// and the third holds the value last published, which each side takes by
+// swapping its own slot for it. Nothing allocates once the slots hold values
+// of the size being written, so the writer can be on the audio thread. A
+// writer that finds another one busy skips publishing rather than waits;
+// there must be only one reader.
+template <typename T>
+class TripleBuffer
+{
+public:
+  // Calls fill(T&) on the writer's slot and publishes it. Returns false,
+  // without calling fill, if another writer is busy.
+  template <typename F>
+  bool write(F&& fill)
+  {
+    if (mWriting.test_and_set(std::memory_order_acquire)) return false;
+    fill(mSlots[mBack]);
+    mBack = mMiddle.exchange(mBack | kFresh, std::memory_order_acq_rel) & kSlot;
+    mWriting.clear(std::memory_order_release);
+    return true;
+  }
+
+  // Takes the value last published into front(), if it hasn't been taken
+  // already. Returns whether it was.
+  bool read()
+  {
+    if (!(mMiddle.load(std::memory_order_acquire) & kFresh)) return false;
+    mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & kSlot;
+    return true;
+  }
+
+  // The reader's slot, unchanged by writers
+  const T& front() const { return mSlots[mFront]; }
+
+private:
+  static constexpr int kSlot = 3;
+  static constexpr int kFresh = 4;
+
+  T                mSlots[3];
+  int              mBack{0};
+  int              mFront{1};
+  std::atomic<int> mMiddle{2};
+  std::atomic_flag mWriting = ATOMIC_FLAG_INIT;
+};
+
+} // namespace algorithm
+} // namespace fluid
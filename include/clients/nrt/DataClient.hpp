@@ -11,11 +11,14 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 #include "NRTClient.hpp"
 #include "../common/SharedClientUtils.hpp"
+#include "../../data/FluidBinary.hpp"
 #include "../../data/FluidDataSet.hpp"
 #include "../../data/FluidJSON.hpp"
+#include "../../data/FluidJSONStream.hpp"
 #include <nlohmann/json.hpp>
 #include <sstream>
 #include <string>
+#include <type_traits>
 
 namespace fluid {
 namespace client {
@@ -39,13 +42,55 @@ public:
 
 
   MessageResult<void> write(string fileName)
+  {
+    if (binary::isBinaryFileName(fileName))
+      return writeBinary(fileName,
+                         std::integral_constant<bool, binary::isSupported<T>()>());
+    return writeJSON(fileName, std::integral_constant<bool, streamable>());
+  }
+
+  MessageResult<void> read(string fileName)
+  {
+    if (binary::isBinaryFileName(fileName))
+      return readBinary(fileName,
+                        std::integral_constant<bool, binary::isSupported<T>()>());
+    return readJSON(fileName, std::integral_constant<bool, streamable>());
+  }
+
+  MessageResult<string> dump()
+  {
+    if (!mAlgorithm.initialized()) return string();
+    return dumpJSON(std::integral_constant<bool, streamable>());
+  }
+
+  MessageResult<void> load(string s)
+  {
+    return loadJSON(s, "Parse error",
+                    std::integral_constant<bool, streamable>());
+  }
+  
+  bool initialized() { return mAlgorithm.initialized(); }
+  T& algorithm() { return mAlgorithm; }
+protected:
+  // Large objects are streamed to and from JSON text without building a DOM
+  static constexpr bool streamable = jsonstream::isSupported<T>();
+
+  MessageResult<void> writeJSON(string fileName, std::false_type)
   {
     auto file = JSONFile(fileName, "w");
     file.write(mAlgorithm);
     return file.ok() ? OK() : Error(file.error());
   }
 
-  MessageResult<void> read(string fileName)
+  MessageResult<void> writeJSON(string fileName, std::true_type)
+  {
+    auto file = JSONFile(fileName, "w");
+    if (!file.ok()) return Error(file.error());
+    jsonstream::dump(file.stream(), mAlgorithm);
+    return file.stream().good() ? OK() : Error(FileWrite);
+  }
+
+  MessageResult<void> readJSON(string fileName, std::false_type)
   {
     auto           file = JSONFile(fileName, "r");
     nlohmann::json j = file.read();
@@ -58,20 +103,32 @@ public:
     return OK();
   }
 
-  MessageResult<string> dump()
+  MessageResult<void> readJSON(string fileName, std::true_type)
+  {
+    auto file = JSONFile(fileName, "r");
+    if (!file.ok()) return Error(file.error());
+    return loadJSON(file.stream(), "Error parsing JSON", std::true_type());
+  }
+
+  string dumpJSON(std::false_type)
   {
-    using namespace nlohmann;
-    if (!mAlgorithm.initialized()) return string();
     nlohmann::json j = mAlgorithm;
     return j.dump();
   }
 
-  MessageResult<void> load(string s)
+  string dumpJSON(std::true_type)
+  {
+    std::ostringstream s;
+    jsonstream::dump(s, mAlgorithm);
+    return s.str();
+  }
+
+  MessageResult<void> loadJSON(string s, string parseError, std::false_type)
   {
     using namespace std;
     using namespace nlohmann;
     json j = json::parse(s, nullptr, false);
-    if (j.is_discarded()) { return Error("Parse error"); }
+    if (j.is_discarded()) { return Error(parseError); }
     else
     {
       if (!check_json(j, mAlgorithm)) return Error("Invalid JSON format");
@@ -79,10 +136,45 @@ public:
       return OK();
     }
   }
-  
-  bool initialized() { return mAlgorithm.initialized(); }
-  T& algorithm() { return mAlgorithm; }
-protected:
+
+  template <typename Input>
+  MessageResult<void> loadJSON(Input& input, string parseError, std::true_type)
+  {
+    switch (jsonstream::load(input, mAlgorithm))
+    {
+    case jsonstream::Status::kParseError: return Error(parseError);
+    case jsonstream::Status::kInvalid: return Error("Invalid JSON format");
+    default: return OK();
+    }
+  }
+
+  // Objects without a binary layout only support JSON
+  MessageResult<void> writeBinary(string, std::false_type)
+  {
+    return Error(NotImplemented);
+  }
+
+  MessageResult<void> readBinary(string, std::false_type)
+  {
+    return Error(NotImplemented);
+  }
+
+  MessageResult<void> writeBinary(string fileName, std::true_type)
+  {
+    BinaryWriter file(fileName);
+    to_binary(file, mAlgorithm);
+    return file.close() ? OK() : Error(file.error());
+  }
+
+  MessageResult<void> readBinary(string fileName, std::true_type)
+  {
+    BinaryReader file(fileName);
+    if (!file.ok()) return Error(file.error());
+    if (!check_binary(file, mAlgorithm)) return Error("Invalid binary format");
+    from_binary(file, mAlgorithm);
+    return OK();
+  }
+
   T mAlgorithm;
 };
 
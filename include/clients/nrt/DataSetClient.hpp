@@ -14,9 +14,13 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "NRTClient.hpp"
 #include "../common/SharedClientUtils.hpp"
 #include "../../algorithms/public/DataSetIdSequence.hpp"
+#include "../../algorithms/util/PublishedSnapshot.hpp"
 #include "../../data/FluidDataSet.hpp"
+#include <algorithm>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace fluid {
 namespace client {
@@ -59,10 +63,11 @@ public:
 
   static constexpr auto& getParameterDescriptors() { return DataSetParams; }
 
-  DataSetClient(ParamSetViewType& p) : mParams(p) {}
+  DataSetClient(ParamSetViewType& p) : mParams(p) { publish(); }
 
   MessageResult<void> addPoint(string id, BufferPtr data)
   {
+    Change change(*this);
     DataSet& dataset = mAlgorithm;
     if (!data) return Error(NoBuffer);
     BufferAdaptor::Access buf(data.get());
@@ -103,6 +108,7 @@ public:
 
   MessageResult<void> updatePoint(string id, BufferPtr data)
   {
+    Change change(*this);
     if (!data) return Error(NoBuffer);
     BufferAdaptor::Access buf(data.get());
     if (!buf.exists()) return Error(InvalidBuffer);
@@ -114,6 +120,7 @@ public:
 
   MessageResult<void> setPoint(string id, BufferPtr data)
   {
+    Change change(*this);
     if (!data) return Error(NoBuffer);
 
     { // restrict buffer lock to this scope in case addPoint is called
@@ -130,26 +137,44 @@ public:
 
   MessageResult<void> deletePoint(string id)
   {
+    Change change(*this);
     return mAlgorithm.remove(id) ? OK() : Error(PointNotFound);
   }
 
   MessageResult<void> merge(SharedClientRef<DataSetClient> datasetClient,
                             bool                           overwrite)
   {
+    Change change(*this);
     auto datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error(NoDataSet);
-    auto srcDataSet = datasetClientPtr->getDataSet();
+    const auto srcDataSet = datasetClientPtr->getDataSet();
     if (srcDataSet.size() == 0) return Error(EmptyDataSet);
     if (srcDataSet.pointSize() != mAlgorithm.pointSize())
       return Error(WrongPointSize);
-    auto       ids = srcDataSet.getIds();
-    RealVector point(srcDataSet.pointSize());
+    auto               ids = srcDataSet.getIds();
+    auto               data = srcDataSet.getData();
+    std::vector<index> newPoints;
     for (index i = 0; i < srcDataSet.size(); i++)
     {
-      srcDataSet.get(ids(i), point);
-      bool added = mAlgorithm.add(ids(i), point);
-      if (!added && overwrite) mAlgorithm.update(ids(i), point);
+      if (mAlgorithm.getIndex(ids(i)) == -1)
+        newPoints.push_back(i);
+      else if (overwrite)
+        mAlgorithm.update(ids(i), data.row(i));
     }
+    if (asSigned(newPoints.size()) == srcDataSet.size())
+    {
+      mAlgorithm.addRange(ids, data);
+      return OK();
+    }
+    index                  numNew = asSigned(newPoints.size());
+    FluidTensor<string, 1> newIds(numNew);
+    RealMatrix             newData(numNew, srcDataSet.pointSize());
+    for (index i = 0; i < numNew; i++)
+    {
+      newIds(i) = ids(newPoints[asUnsigned(i)]);
+      newData.row(i) = data.row(newPoints[asUnsigned(i)]);
+    }
+    mAlgorithm.addRange(newIds, newData);
     return OK();
   }
 
@@ -157,6 +182,7 @@ public:
   fromBuffer(BufferPtr data, bool transpose,
              SharedClientRef<labelset::LabelSetClient> labels)
   {
+    Change change(*this);
     if (!data) return Error(NoBuffer);
     BufferAdaptor::Access buf(data.get());
     if (!buf.exists()) return Error(InvalidBuffer);
@@ -189,10 +215,9 @@ public:
     index  nChannels = transpose ? mAlgorithm.size() : mAlgorithm.dims();
     Result resizeResult = buf.resize(nFrames, nChannels, buf.sampleRate());
     if (!resizeResult.ok()) return Error(resizeResult.message());
-    buf.allFrames() =
-        transpose ? mAlgorithm.getData()
-                  : FluidTensorView<const double, 2>(mAlgorithm.getData())
-                        .transpose();
+    const DataSet& dataset = mAlgorithm;
+    buf.allFrames() = transpose ? dataset.getData()
+                                : dataset.getData().transpose();
     auto labelsPtr = labels.get().lock();
     if (labelsPtr) labelsPtr->setLabelSet(getIdsLabelSet());
     return OK();
@@ -206,18 +231,57 @@ public:
     return OK();
   }
 
+  // Sorted index of a column, which speeds up range queries on it by
+  // DataSetQuery. It is kept up to date as points change, until the dataset
+  // is cleared or replaced.
+  MessageResult<void> indexColumn(index column)
+  {
+    if (column < 0 || column >= mAlgorithm.dims())
+      return Error("invalid index");
+    Change change(*this);
+    mAlgorithm.indexColumn(column);
+    return OK();
+  }
+
   MessageResult<void> clear()
   {
+    Change change(*this);
     mAlgorithm = DataSet(0);
     return OK();
   }
+
+  MessageResult<void> read(string fileName)
+  {
+    Change change(*this);
+    return DataClient::read(fileName);
+  }
+
+  MessageResult<void> load(string s)
+  {
+    Change change(*this);
+    return DataClient::load(s);
+  }
+
   MessageResult<string> print()
   {
     return "DataSet " + get<kName>() + ": " + mAlgorithm.print();
   }
 
   const DataSet getDataSet() const { return mAlgorithm; }
-  void          setDataSet(DataSet ds) { mAlgorithm = ds; }
+
+  // For RT queries, which read points from this without copying it, instead
+  // of getDataSet(): the dataset as of the end of the last message to change
+  // it, or null while one does
+  std::shared_ptr<const DataSet> realTimeDataSet() const
+  {
+    return mSnapshot.read();
+  }
+
+  void          setDataSet(DataSet ds)
+  {
+    Change change(*this);
+    mAlgorithm = std::move(ds);
+  }
 
   static auto getMessageDescriptors()
   {
@@ -238,10 +302,33 @@ public:
         makeMessage("read", &DataSetClient::read),
         makeMessage("fromBuffer", &DataSetClient::fromBuffer),
         makeMessage("toBuffer", &DataSetClient::toBuffer),
-        makeMessage("getIds", &DataSetClient::getIds));
+        makeMessage("getIds", &DataSetClient::getIds),
+        makeMessage("indexColumn", &DataSetClient::indexColumn));
   }
 
 private:
+  // The snapshot for RT queries shares the dataset's storage. A change
+  // withdraws it for as long as it lasts, so that the storage is only changed
+  // in place if no query still holds it, and is otherwise copied on write,
+  // then publishes the new state.
+  class Change
+  {
+  public:
+    explicit Change(DataSetClient& client) : mClient(client)
+    {
+      mClient.mSnapshot.withdraw();
+    }
+    ~Change() { mClient.publish(); }
+
+  private:
+    DataSetClient& mClient;
+  };
+
+  void publish()
+  {
+    mSnapshot.publish(std::make_shared<const DataSet>(mAlgorithm));
+  }
+
   LabelSet getIdsLabelSet()
   {
     algorithm::DataSetIdSequence seq("", 0, 0);
@@ -251,6 +338,8 @@ private:
     seq.generate(newIds);
     return LabelSet(newIds, labels);
   };
+
+  algorithm::PublishedSnapshot<DataSet> mSnapshot;
 };
 
 } // namespace dataset
@@ -107,7 +107,7 @@ public:
     auto srcPtr = sourceClient.get().lock();
     auto destPtr = destClient.get().lock();
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
     if (src.size() == 0) return Error(EmptyDataSet);
     if (src.pointSize() <= mAlgorithm.maxColumn()) return Error(WrongPointSize);
     index   resultSize = mAlgorithm.numColumns();
@@ -126,11 +126,11 @@ public:
     auto src2Ptr = source2Client.get().lock();
     auto destPtr = destClient.get().lock();
     if (!src1Ptr || !src2Ptr || !destPtr) return Error(NoDataSet);
-    auto src1 = src1Ptr->getDataSet();
+    const auto src1 = src1Ptr->getDataSet();
     if (src1.size() == 0) return Error(EmptyDataSet);
     if (src1.pointSize() <= mAlgorithm.maxColumn())
       return Error(WrongPointSize);
-    DataSet src2 = src2Ptr->getDataSet();
+    const DataSet src2 = src2Ptr->getDataSet();
     if (src2.size() == 0) return Error(EmptyDataSet);
     DataSet result(mAlgorithm.numColumns() + src2.pointSize());
     mAlgorithm.process(src1, src2, result);
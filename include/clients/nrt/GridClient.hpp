@@ -62,8 +62,8 @@ public:
     auto srcPtr = sourceClient.get().lock();
     auto destPtr = destClient.get().lock();
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
-    auto dest = destPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
+    const auto dest = destPtr->getDataSet();
     if (src.dims() != 2) return Error("Dataset should be 2D");
     if (src.size() == 0) return Error(EmptyDataSet);
     FluidDataSet<string, double, 1> result;
@@ -0,0 +1,244 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "DataSetClient.hpp"
+#include "NRTClient.hpp"
+#include "NearestNeighboursClient.hpp"
+#include "../../algorithms/public/HNSW.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace fluid {
+namespace client {
+namespace hnsw {
+
+constexpr auto HNSWParams = defineParameters(
+    StringParam<Fixed<true>>("name", "Name"),
+    LongParam("numNeighbours", "Number of Nearest Neighbours", 1),
+    FloatParam("radius", "Maximum distance", 0, Min(0)),
+    EnumParam("distanceMetric", "Distance Metric", 1, "Manhattan", "Euclidean",
+              "Max Distance", "Cosine", "Jensen-Shannon"),
+    LongParam("maxLinks", "Maximum Links per Point", 16, Min(2)),
+    LongParam("buildWidth", "Search Width when Fitting", 200, Min(1)),
+    LongParam("searchWidth", "Search Width", 50, Min(1)));
+
+// The graph as searched by RT queries, with workspaces made alongside it on
+// the NRT side, as wide as the graph so that they serve any search width.
+// Each search claims a free one for its length, so a query on an audio thread
+// never allocates or waits; one that finds all of them busy, with more
+// queries of the graph running at once than there are workspaces, finds
+// nothing.
+class RealTimeGraph : public algorithm::HNSW
+{
+public:
+  explicit RealTimeGraph(const algorithm::HNSW& graph) : HNSW(graph)
+  {
+    for (index i = 0; i < kWorkspaces; i++)
+      mWorkspaces.emplace_back(size(), std::max<index>(size(), 1));
+  }
+
+  index kNearest(RealVectorView point, index k, double radius,
+                 index searchWidth, FluidTensorView<index, 1> nearest,
+                 RealVectorView distances) const
+  {
+    for (index i = 0; i < kWorkspaces; i++)
+    {
+      auto& busy = mBusy[asUnsigned(i)];
+      if (busy.exchange(true, std::memory_order_acquire)) continue;
+      auto& ws = mWorkspaces[asUnsigned(i)];
+      ws.setWidth(std::min(std::max(searchWidth, k), ws.size()));
+      index numFound =
+          HNSW::kNearest(point, k, radius, nearest, distances, ws);
+      busy.store(false, std::memory_order_release);
+      return numFound;
+    }
+    return 0;
+  }
+
+private:
+  static constexpr index kWorkspaces = 4;
+
+  mutable std::vector<Workspace>                      mWorkspaces;
+  mutable std::array<std::atomic<bool>, kWorkspaces> mBusy{};
+};
+
+class HNSWClient
+    : public FluidBaseClient,
+      OfflineIn,
+      OfflineOut,
+      ModelObject,
+      public NearestNeighboursClient<HNSWClient, algorithm::HNSW, RealTimeGraph>
+{
+  enum {
+    kName,
+    kNumNeighbors,
+    kRadius,
+    kDistance,
+    kMaxLinks,
+    kBuildWidth,
+    kSearchWidth
+  };
+
+
+  friend NearestNeighboursClient;
+
+public:
+  using string = std::string;
+  using ParamDescType = decltype(HNSWParams);
+
+  using ParamSetViewType = ParameterSetView<ParamDescType>;
+  std::reference_wrapper<ParamSetViewType> mParams;
+
+  void setParams(ParamSetViewType& p) { mParams = p; }
+
+  template <size_t N>
+  auto& get() const
+  {
+    return mParams.get().template get<N>();
+  }
+
+  static constexpr auto& getParameterDescriptors() { return HNSWParams; }
+
+  HNSWClient(ParamSetViewType& p) : mParams(p)
+  {
+    audioChannelsIn(1);
+    controlChannelsOut({1, 1});
+  }
+
+  template <typename T>
+  Result process(FluidContext&)
+  {
+    return {};
+  }
+
+  static auto getMessageDescriptors()
+  {
+    return defineMessages(
+        makeMessage("fit", &HNSWClient::fit),
+        makeMessage("kNearest", &HNSWClient::kNearest),
+        makeMessage("kNearestDist", &HNSWClient::kNearestDist),
+        makeMessage("cols", &HNSWClient::dims),
+        makeMessage("clear", &HNSWClient::clear),
+        makeMessage("size", &HNSWClient::size),
+        makeMessage("load", &HNSWClient::load),
+        makeMessage("dump", &HNSWClient::dump),
+        makeMessage("write", &HNSWClient::write),
+        makeMessage("read", &HNSWClient::read));
+  }
+
+private:
+  algorithm::HNSW build(const FluidDataSet<string, double, 1>& dataset) const
+  {
+    return algorithm::HNSW(dataset, metric(), get<kMaxLinks>(),
+                           get<kBuildWidth>());
+  }
+
+  FluidDataSet<string, double, 1> search(RealVectorView point, index k) const
+  {
+    return mAlgorithm.kNearest(point, k, get<kRadius>(), get<kSearchWidth>());
+  }
+
+  index numNeighbours() const { return get<kNumNeighbors>(); }
+
+  algorithm::HNSW::Distance metric() const
+  {
+    using Distance = algorithm::HNSW::Distance;
+    constexpr Distance metrics[] = {Distance::kManhattan, Distance::kEuclidean,
+                                    Distance::kMax, Distance::kCosine,
+                                    Distance::kJS};
+    return metrics[get<kDistance>()];
+  }
+};
+
+using HNSWRef = SharedClientRef<HNSWClient>;
+
+constexpr auto HNSWQueryParams = defineParameters(
+    HNSWRef::makeParam("graph", "HNSW Graph"),
+    LongParam("numNeighbours", "Number of Nearest Neighbours", 1),
+    FloatParam("radius", "Maximum distance", 0, Min(0)),
+    LongParam("searchWidth", "Search Width", 50, Min(1)),
+    DataSetClientRef::makeParam("dataSet", "DataSet Name"),
+    BufferParam("inputPointBuffer", "Input Point Buffer"),
+    BufferParam("predictionBuffer", "Prediction Buffer"));
+
+class HNSWQuery : public FluidBaseClient, ControlIn, ControlOut
+{
+  enum {
+    kGraph,
+    kNumNeighbors,
+    kRadius,
+    kSearchWidth,
+    kDataSet,
+    kInputBuffer,
+    kOutputBuffer
+  };
+
+public:
+  using ParamDescType = decltype(HNSWQueryParams);
+  using ParamSetViewType = ParameterSetView<ParamDescType>;
+
+  std::reference_wrapper<ParamSetViewType> mParams;
+
+  void setParams(ParamSetViewType& p) { mParams = p; }
+
+  template <size_t N>
+  auto& get() const
+  {
+    return mParams.get().template get<N>();
+  }
+
+  static constexpr auto& getParameterDescriptors() { return HNSWQueryParams; }
+
+  HNSWQuery(ParamSetViewType& p) : mParams(p)
+  {
+    controlChannelsIn(1);
+    controlChannelsOut({1, 1});
+  }
+
+  index latency() { return 0; }
+
+  template <typename T>
+  void process(std::vector<FluidTensorView<T, 1>>& input,
+               std::vector<FluidTensorView<T, 1>>& output, FluidContext&)
+  {
+    output[0] = input[0];
+
+    if (input[0](0) > 0)
+    {
+      auto hnswPtr = get<kGraph>().get().lock();
+      mLookup.process(hnswPtr, get<kNumNeighbors>(), get<kDataSet>(),
+                      get<kInputBuffer>().get(), get<kOutputBuffer>().get(),
+                      [this](const RealTimeGraph& graph, RealVectorView point,
+                             index k, FluidTensorView<index, 1> nearest,
+                             RealVectorView distances) {
+                        return graph.kNearest(point, k, get<kRadius>(),
+                                              get<kSearchWidth>(), nearest,
+                                              distances);
+                      });
+    }
+  }
+
+private:
+  NearestNeighboursLookup mLookup;
+};
+
+} // namespace hnsw
+
+using NRTThreadedHNSWClient =
+    NRTThreadingAdaptor<typename hnsw::HNSWRef::SharedType>;
+using RTHNSWQueryClient = ClientWrapper<hnsw::HNSWQuery>;
+
+} // namespace client
+} // namespace fluid
@@ -12,6 +12,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #include "DataSetClient.hpp"
 #include "NRTClient.hpp"
+#include "NearestNeighboursClient.hpp"
 #include "../../algorithms/public/KDTree.hpp"
 #include <string>
 
@@ -22,20 +23,23 @@ namespace kdtree {
 constexpr auto KDTreeParams = defineParameters(
     StringParam<Fixed<true>>("name", "Name"),
     LongParam("numNeighbours", "Number of Nearest Neighbours", 1),
-    FloatParam("radius", "Maximum distance", 0, Min(0)));
-
-class KDTreeClient : public FluidBaseClient,
-                     OfflineIn,
-                     OfflineOut,
-                     ModelObject,
-                     public DataClient<algorithm::KDTree>
+    FloatParam("radius", "Maximum distance", 0, Min(0)),
+    EnumParam("distanceMetric", "Distance Metric", 1, "Manhattan", "Euclidean",
+              "Max Distance"));
+
+class KDTreeClient
+    : public FluidBaseClient,
+      OfflineIn,
+      OfflineOut,
+      ModelObject,
+      public NearestNeighboursClient<KDTreeClient, algorithm::KDTree>
 {
-  enum { kName, kNumNeighbors, kRadius };
+  enum { kName, kNumNeighbors, kRadius, kDistance };
+
+  friend NearestNeighboursClient;
 
 public:
   using string = std::string;
-  using BufferPtr = std::shared_ptr<BufferAdaptor>;
-  using StringVector = FluidTensor<string, 1>;
   using ParamDescType = decltype(KDTreeParams);
 
   using ParamSetViewType = ParameterSetView<ParamDescType>;
@@ -63,52 +67,42 @@ public:
     return {};
   }
 
-  MessageResult<void> fit(DataSetClientRef datasetClient)
+  // Points added, updated or deleted here should be mirrored in the DataSet
+  // the tree was fitted to, and are cheaper than fitting it again, though
+  // each still copies the tree for RT queries
+  MessageResult<void> addPoint(string id, BufferPtr data)
   {
-    mDataSetClient = datasetClient;
-    auto datasetClientPtr = mDataSetClient.get().lock();
-    if (!datasetClientPtr) return Error(NoDataSet);
-    auto dataset = datasetClientPtr->getDataSet();
-    if (dataset.size() == 0) return Error(EmptyDataSet);
-    mAlgorithm = algorithm::KDTree(dataset);
+    if (!data) return Error(NoBuffer);
+    BufferAdaptor::ReadAccess buf(data.get());
+    if (!buf.exists()) return Error(InvalidBuffer);
+    if (buf.numFrames() == 0) return Error(EmptyBuffer);
+    index dims = mAlgorithm.size() > 0 ? mAlgorithm.dims() : buf.numFrames();
+    if (buf.numFrames() < dims) return Error(WrongPointSize);
+    RealVector point(dims);
+    point = buf.samps(0, dims, 0);
+    if (!mAlgorithm.addNode(id, point)) return Error(DuplicateLabel);
+    publish();
     return OK();
   }
 
-  MessageResult<StringVector> kNearest(BufferPtr data) const
+  MessageResult<void> updatePoint(string id, BufferPtr data)
   {
-    index k = get<kNumNeighbors>();
-    if (k > mAlgorithm.size()) return Error<StringVector>(SmallDataSet);
-    // if (k <= 0 && get<kRadius>() <= 0) return Error<StringVector>(SmallK);
-    if (!mAlgorithm.initialized()) return Error<StringVector>(NoDataFitted);
-    InBufferCheck bufCheck(mAlgorithm.dims());
-    if (!bufCheck.checkInputs(data.get()))
-      return Error<StringVector>(bufCheck.error());
+    if (!data) return Error(NoBuffer);
+    BufferAdaptor::ReadAccess buf(data.get());
+    if (!buf.exists()) return Error(InvalidBuffer);
+    if (buf.numFrames() < mAlgorithm.dims()) return Error(WrongPointSize);
     RealVector point(mAlgorithm.dims());
-    point =
-        BufferAdaptor::ReadAccess(data.get()).samps(0, mAlgorithm.dims(), 0);
-    FluidDataSet<std::string, double, 1> nearest =
-        mAlgorithm.kNearest(point, k, get<kRadius>());
-    StringVector result{nearest.getIds()};
-    return result;
+    point = buf.samps(0, mAlgorithm.dims(), 0);
+    if (!mAlgorithm.updateNode(id, point)) return Error(PointNotFound);
+    publish();
+    return OK();
   }
 
-  MessageResult<RealVector> kNearestDist(BufferPtr data) const
+  MessageResult<void> deletePoint(string id)
   {
-    // TODO: refactor with kNearest
-    index k = get<kNumNeighbors>();
-    if (k > mAlgorithm.size()) return Error<RealVector>(SmallDataSet);
-    // if (k <= 0 && get<kRadius>() <= 0) return Error<RealVector>(SmallK);
-    if (!mAlgorithm.initialized()) return Error<RealVector>(NoDataFitted);
-    InBufferCheck bufCheck(mAlgorithm.dims());
-    if (!bufCheck.checkInputs(data.get()))
-      return Error<RealVector>(bufCheck.error());
-    RealVector point(mAlgorithm.dims());
-    point =
-        BufferAdaptor::ReadAccess(data.get()).samps(0, mAlgorithm.dims(), 0);
-    FluidDataSet<std::string, double, 1> nearest =
-        mAlgorithm.kNearest(point, k, get<kRadius>());
-    RealVector result{nearest.getData().col(0)};
-    return result;
+    if (!mAlgorithm.removeNode(id)) return Error(PointNotFound);
+    publish();
+    return OK();
   }
 
   static auto getMessageDescriptors()
@@ -117,6 +111,9 @@ public:
         makeMessage("fit", &KDTreeClient::fit),
         makeMessage("kNearest", &KDTreeClient::kNearest),
         makeMessage("kNearestDist", &KDTreeClient::kNearestDist),
+        makeMessage("addPoint", &KDTreeClient::addPoint),
+        makeMessage("updatePoint", &KDTreeClient::updatePoint),
+        makeMessage("deletePoint", &KDTreeClient::deletePoint),
         makeMessage("cols", &KDTreeClient::dims),
         makeMessage("clear", &KDTreeClient::clear),
         makeMessage("size", &KDTreeClient::size),
@@ -126,12 +123,26 @@ public:
         makeMessage("read", &KDTreeClient::read));
   }
 
-  DataSetClientRef getDataSet() { return mDataSetClient; }
+private:
+  algorithm::KDTree build(const FluidDataSet<string, double, 1>& dataset) const
+  {
+    return algorithm::KDTree(dataset, metric());
+  }
+
+  FluidDataSet<string, double, 1> search(RealVectorView point, index k) const
+  {
+    return mAlgorithm.kNearest(point, k, get<kRadius>());
+  }
 
-  const algorithm::KDTree& algorithm() { return mAlgorithm; }
+  index numNeighbours() const { return get<kNumNeighbors>(); }
 
-private:
-  DataSetClientRef mDataSetClient;
+  algorithm::KDTree::Distance metric() const
+  {
+    using Distance = algorithm::KDTree::Distance;
+    constexpr Distance metrics[] = {Distance::kManhattan, Distance::kEuclidean,
+                                    Distance::kMax};
+    return metrics[get<kDistance>()];
+  }
 };
 
 using KDTreeRef = SharedClientRef<KDTreeClient>;
@@ -174,71 +185,27 @@ public:
 
   template <typename T>
   void process(std::vector<FluidTensorView<T, 1>>& input,
-               std::vector<FluidTensorView<T, 1>>& output, FluidContext& c)
+               std::vector<FluidTensorView<T, 1>>& output, FluidContext&)
   {
     output[0] = input[0];
 
     if (input[0](0) > 0)
     {
-      auto kdtreeptr = get<kTree>().get().lock();
-      if (!kdtreeptr)
-      {
-        // c.reportError("No FluidKDTree found");
-        return;
-      }
-
-      if (!kdtreeptr->initialized())
-      {
-        // c.reportError("FluidKDTree not fitted");
-        return;
-      }
-
-      index k = get<kNumNeighbors>();
-      if (k > kdtreeptr->size() || k <= 0) return;
-      index             dims = kdtreeptr->dims();
-      InOutBuffersCheck bufCheck(dims);
-      if (!bufCheck.checkInputs(get<kInputBuffer>().get(),
-                                get<kOutputBuffer>().get()))
-        return;
-      auto datasetClientPtr = get<kDataSet>().get().lock();
-      // if (!datasetClientPtr) datasetClientPtr = mDataSetClient.get().lock();
-      if (!datasetClientPtr)
-        datasetClientPtr = kdtreeptr->getDataSet().get().lock();
-
-      if (!datasetClientPtr)
-      {
-        // c.reportError("Could not obtain reference FluidDataSet");
-        return;
-      }
-
-      auto  dataset = datasetClientPtr->getDataSet();
-      index pointSize = dataset.pointSize();
-      auto  outBuf = BufferAdaptor::Access(get<kOutputBuffer>().get());
-      index outputSize = k * pointSize;
-      if (outBuf.samps(0).size() < outputSize) return;
-
-      RealVector point(dims);
-      point = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
-                  .samps(0, dims, 0);
-      if (mRTBuffer.size() != outputSize)
-      {
-        mRTBuffer = RealVector(outputSize);
-        mRTBuffer.fill(0);
-      }
-      auto nearest = kdtreeptr->algorithm().kNearest(point, k);
-      auto ids = nearest.getIds();
-      for (index i = 0; i < k; i++)
-      {
-        dataset.get(ids(i), mRTBuffer(Slice(i * pointSize, pointSize)));
-      }
-      outBuf.samps(0, outputSize, 0) = mRTBuffer;
+      auto kdtreePtr = get<kTree>().get().lock();
+      mLookup.process(kdtreePtr, get<kNumNeighbors>(), get<kDataSet>(),
+                      get<kInputBuffer>().get(), get<kOutputBuffer>().get(),
+                      [this](const algorithm::KDTree& tree,
+                             RealVectorView point, index k,
+                             FluidTensorView<index, 1> nearest,
+                             RealVectorView distances) {
+                        return tree.kNearest(point, k, get<kRadius>(), nearest,
+                                             distances);
+                      });
     }
   }
 
-
 private:
-  RealVector       mRTBuffer;
-  DataSetClientRef mDataSetClient;
+  NearestNeighboursLookup mLookup;
 };
 
 } // namespace kdtree
@@ -14,6 +14,10 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "LabelSetClient.hpp"
 #include "NRTClient.hpp"
 #include "../../algorithms/public/KMeans.hpp"
+#include "../../algorithms/public/OnlineKMeans.hpp"
+#include "../../algorithms/util/PublishedSnapshot.hpp"
+#include "../../algorithms/util/TripleBuffer.hpp"
+#include <memory>
 #include <string>
 
 namespace fluid {
@@ -23,7 +27,11 @@ namespace kmeans {
 constexpr auto KMeansParams = defineParameters(
     StringParam<Fixed<true>>("name", "Name"),
     LongParam("numClusters", "Number of Clusters", 4, Min(1)),
-    LongParam("maxIter", "Max number of Iterations", 100, Min(1)));
+    LongParam("maxIter", "Max number of Iterations", 100, Min(1)),
+    LongParam("batchSize", "Mini-Batch Size", 0, Min(0)),
+    EnumParam("init", "Initialisation", 1, "Random Partition", "K-Means++",
+              "K-Means||"),
+    LongParam("numInit", "Number of Initialisations", 1, Min(1)));
 
 class KMeansClient : public FluidBaseClient,
                      OfflineIn,
@@ -31,7 +39,7 @@ class KMeansClient : public FluidBaseClient,
                      ModelObject,
                      public DataClient<algorithm::KMeans>
 {
-  enum { kName, kNumClusters, kMaxIter };
+  enum { kName, kNumClusters, kMaxIter, kBatchSize, kInit, kNumInit };
 
 public:
   using string = std::string;
@@ -74,10 +82,14 @@ public:
     index maxIter = get<kMaxIter>();
     auto  datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error<IndexVector>(NoDataSet);
-    auto dataSet = datasetClientPtr->getDataSet();
+    const auto dataSet = datasetClientPtr->getDataSet();
     if (dataSet.size() == 0) return Error<IndexVector>(EmptyDataSet);
     if (k <= 1) return Error<IndexVector>(SmallK);
-    mAlgorithm.train(dataSet, k, maxIter);
+    applyOnline();
+    mAlgorithm.train(dataSet, k, maxIter, get<kBatchSize>(),
+                     static_cast<algorithm::KMeans::Init>(get<kInit>()),
+                     get<kNumInit>());
+    publishMeans();
     IndexVector assignments(dataSet.size());
     mAlgorithm.getAssignments(assignments);
     return getCounts(assignments, k);
@@ -90,33 +102,38 @@ public:
     index maxIter = get<kMaxIter>();
     auto  datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error<IndexVector>(NoDataSet);
-    auto dataSet = datasetClientPtr->getDataSet();
+    const auto dataSet = datasetClientPtr->getDataSet();
     if (dataSet.size() == 0) return Error<IndexVector>(EmptyDataSet);
     auto labelsetClientPtr = labelsetClient.get().lock();
     if (!labelsetClientPtr) return Error<IndexVector>(NoLabelSet);
     if (k <= 1) return Error<IndexVector>(SmallK);
     if (maxIter <= 0) maxIter = 100;
-    mAlgorithm.train(dataSet, k, maxIter);
+    applyOnline();
+    mAlgorithm.train(dataSet, k, maxIter, get<kBatchSize>(),
+                     static_cast<algorithm::KMeans::Init>(get<kInit>()),
+                     get<kNumInit>());
+    publishMeans();
     IndexVector assignments(dataSet.size());
     mAlgorithm.getAssignments(assignments);
-    StringVectorView ids = dataSet.getIds();
+    auto ids = dataSet.getIds();
     labelsetClientPtr->setLabelSet(getLabels(ids, assignments));
     return getCounts(assignments, k);
   }
 
   MessageResult<IndexVector> predict(DataSetClientRef  datasetClient,
-                                     LabelSetClientRef labelClient) const
+                                     LabelSetClientRef labelClient)
   {
+    applyOnline();
     auto dataPtr = datasetClient.get().lock();
     if (!dataPtr) return Error<IndexVector>(NoDataSet);
     auto labelsetClientPtr = labelClient.get().lock();
     if (!labelsetClientPtr) return Error<IndexVector>(NoLabelSet);
-    auto dataSet = dataPtr->getDataSet();
+    const auto dataSet = dataPtr->getDataSet();
     if (dataSet.size() == 0) return Error<IndexVector>(EmptyDataSet);
     if (!mAlgorithm.initialized()) return Error<IndexVector>(NoDataFitted);
     if (dataSet.dims() != mAlgorithm.dims())
       return Error<IndexVector>(WrongPointSize);
-    StringVectorView ids = dataSet.getIds();
+    auto ids = dataSet.getIds();
     IndexVector      assignments(dataSet.size());
     RealVector       query(mAlgorithm.dims());
     for (index i = 0; i < dataSet.size(); i++)
@@ -130,20 +147,21 @@ public:
 
 
   MessageResult<void> transform(DataSetClientRef srcClient,
-                                DataSetClientRef dstClient) const
+                                DataSetClientRef dstClient)
   {
+    applyOnline();
     auto srcPtr = srcClient.get().lock();
     if (!srcPtr) return Error<void>(NoDataSet);
     auto destPtr = dstClient.get().lock();
     if (!destPtr) return Error<void>(NoDataSet);
 
-    auto srcDataSet = srcPtr->getDataSet();
+    const auto srcDataSet = srcPtr->getDataSet();
     if (srcDataSet.size() == 0) return Error<void>(EmptyDataSet);
     if (!mAlgorithm.initialized()) return Error<void>(NoDataFitted);
     if (srcDataSet.dims() != mAlgorithm.dims())
       return Error<void>(WrongPointSize);
 
-    StringVectorView ids = srcDataSet.getIds();
+    auto ids = srcDataSet.getIds();
     RealMatrix       output(srcDataSet.size(), mAlgorithm.size());
     mAlgorithm.getDistances(srcDataSet.getData(), output);
     FluidDataSet<string, double, 1> result(ids, output);
@@ -160,19 +178,24 @@ public:
     if (!srcPtr) return Error<IndexVector>(NoDataSet);
     auto destPtr = dstClient.get().lock();
     if (!destPtr) return Error<IndexVector>(NoDataSet);
-    auto dataSet = srcPtr->getDataSet();
+    const auto dataSet = srcPtr->getDataSet();
     if (dataSet.size() == 0) return Error<IndexVector>(EmptyDataSet);
     if (k <= 1) return Error<IndexVector>(SmallK);
     if (maxIter <= 0) maxIter = 100;
-    mAlgorithm.train(dataSet, k, maxIter);
+    applyOnline();
+    mAlgorithm.train(dataSet, k, maxIter, get<kBatchSize>(),
+                     static_cast<algorithm::KMeans::Init>(get<kInit>()),
+                     get<kNumInit>());
+    publishMeans();
     IndexVector assignments(dataSet.size());
     mAlgorithm.getAssignments(assignments);
     transform(srcClient, dstClient);
     return getCounts(assignments, k);
   }
 
-  MessageResult<index> predictPoint(BufferPtr data) const
+  MessageResult<index> predictPoint(BufferPtr data)
   {
+    applyOnline();
     if (!mAlgorithm.initialized()) return Error<index>(NoDataFitted);
     InBufferCheck bufCheck(mAlgorithm.dims());
     if (!bufCheck.checkInputs(data.get()))
@@ -183,8 +206,9 @@ public:
     return mAlgorithm.vq(point);
   }
 
-  MessageResult<void> getMeans(DataSetClientRef dstClient) const
+  MessageResult<void> getMeans(DataSetClientRef dstClient)
   {
+    applyOnline();
     auto destPtr = dstClient.get().lock();
     if (!destPtr) return Error<void>(NoDataSet);
     if (!mAlgorithm.initialized()) return Error<void>(NoDataFitted);
@@ -202,16 +226,18 @@ public:
   {
     auto srcPtr = srcClient.get().lock();
     if (!srcPtr) return Error(NoDataSet);
-    auto dataSet = srcPtr->getDataSet();
+    const auto dataSet = srcPtr->getDataSet();
     if (dataSet.size() == 0) return Error(EmptyDataSet);
     if (dataSet.size() != get<kNumClusters>()) return Error(WrongNumInitial);
     mAlgorithm.setMeans(dataSet.getData());
+    publishMeans();
     return OK();
   }
 
 
-  MessageResult<void> transformPoint(BufferPtr in, BufferPtr out) const
+  MessageResult<void> transformPoint(BufferPtr in, BufferPtr out)
   {
+    applyOnline();
     if (!mAlgorithm.initialized()) return Error(NoDataFitted);
     InBufferCheck bufCheck(mAlgorithm.dims());
     if (!bufCheck.checkInputs(in.get())) return Error(bufCheck.error());
@@ -228,6 +254,51 @@ public:
     return OK();
   }
 
+  MessageResult<string> dump()
+  {
+    applyOnline();
+    return DataClient::dump();
+  }
+
+  MessageResult<void> write(string fileName)
+  {
+    applyOnline();
+    return DataClient::write(fileName);
+  }
+
+  MessageResult<void> clear()
+  {
+    DataClient::clear();
+    publishMeans();
+    return OK();
+  }
+
+  MessageResult<void> read(string fileName)
+  {
+    return publishOnSuccess(DataClient::read(fileName));
+  }
+
+  MessageResult<void> load(string s)
+  {
+    return publishOnSuccess(DataClient::load(s));
+  }
+
+  // Called by a KMeansQuery that's learning, from the audio thread: hands
+  // over a copy of its means, to be written to the model by the next message
+  // that uses it. Copies without allocating once the slots are sized.
+  void publish(const algorithm::OnlineKMeans& online)
+  {
+    mOnline.write([&](algorithm::OnlineKMeans& slot) { slot = online; });
+  }
+
+  // For KMeansQuery: a copy of the means as of the end of the last message to
+  // change them, or null if there are none, so that the audio thread never
+  // reads the model itself
+  std::shared_ptr<const algorithm::OnlineKMeans> realTimeMeans() const
+  {
+    return mSnapshot.read();
+  }
+
   static auto getMessageDescriptors()
   {
     return defineMessages(
@@ -251,6 +322,32 @@ public:
 
 
 private:
+  // Brings the model up to date with the means last published by a query,
+  // unless they were copied from means it has since replaced
+  void applyOnline()
+  {
+    if (mOnline.read() && mOnline.front().apply(mAlgorithm)) publishMeans();
+  }
+
+  // Copies the means for RT queries, once a message has changed them
+  void publishMeans()
+  {
+    if (mAlgorithm.initialized())
+    {
+      auto means = std::make_shared<algorithm::OnlineKMeans>();
+      means->init(mAlgorithm);
+      mSnapshot.publish(std::move(means));
+    }
+    else
+      mSnapshot.withdraw();
+  }
+
+  MessageResult<void> publishOnSuccess(MessageResult<void> result)
+  {
+    if (result.ok()) publishMeans();
+    return result;
+  }
+
   IndexVector getCounts(IndexVector assignments, index k) const
   {
     IndexVector counts(k);
@@ -259,7 +356,8 @@ private:
     return counts;
   }
 
-  LabelSet getLabels(StringVectorView& ids, IndexVector assignments) const
+  LabelSet getLabels(FluidTensorView<const string, 1> ids,
+                     IndexVector assignments) const
   {
     LabelSet result(1);
     for (index i = 0; i < ids.size(); i++)
@@ -269,6 +367,9 @@ private:
     }
     return result;
   }
+
+  algorithm::TripleBuffer<algorithm::OnlineKMeans>      mOnline;
+  algorithm::PublishedSnapshot<algorithm::OnlineKMeans> mSnapshot;
 };
 
 using KMeansRef = SharedClientRef<KMeansClient>;
@@ -276,11 +377,14 @@ using KMeansRef = SharedClientRef<KMeansClient>;
 constexpr auto KMeansQueryParams =
     defineParameters(KMeansRef::makeParam("kmeans", "Source KMeans model"),
                      BufferParam("inputPointBuffer", "Input Point Buffer"),
-                     BufferParam("predictionBuffer", "Prediction Buffer"));
+                     BufferParam("predictionBuffer", "Prediction Buffer"),
+                     EnumParam("learn", "Update Means", 0, "Off", "On"),
+                     FloatParam("learnRate", "Minimum Learning Rate", 0, Min(0),
+                                Max(1)));
 
 class KMeansQuery : public FluidBaseClient, ControlIn, ControlOut
 {
-  enum { kModel, kInputBuffer, kOutputBuffer };
+  enum { kModel, kInputBuffer, kOutputBuffer, kLearn, kLearnRate };
 
 public:
   using ParamDescType = decltype(KMeansQueryParams);
@@ -317,22 +421,40 @@ public:
         // report error?
         return;
       }
-      if (!kmeansPtr->initialized()) return;
-      index             dims = kmeansPtr->dims();
+      auto means = kmeansPtr->realTimeMeans();
+      if (!means) return;
+      index             dims = means->dims();
       InOutBuffersCheck bufCheck(dims);
       if (!bufCheck.checkInputs(get<kInputBuffer>().get(),
                                 get<kOutputBuffer>().get()))
         return;
       auto outBuf = BufferAdaptor::Access(get<kOutputBuffer>().get());
       if (outBuf.samps(0).size() < 1) return;
-      RealVector point(dims);
-      point = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
-                  .samps(0, dims, 0);
-      outBuf.samps(0)[0] = kmeansPtr->algorithm().vq(point);
+      if (mPoint.size() != dims) mPoint = RealVector(dims);
+      mPoint = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
+                   .samps(0, dims, 0);
+      // with learning on, the point also moves its cluster's mean in the
+      // query's own copy of the means, which is handed to the model to be
+      // applied in NRT, so the model follows the input without refitting.
+      // The copy is only replaced by the published means once they're of
+      // another lineage, i.e. no longer the model's means with its updates.
+      if (get<kLearn>())
+      {
+        if (!mOnline.matches(*means)) mOnline = *means;
+        outBuf.samps(0)[0] = mOnline.update(mPoint, get<kLearnRate>());
+        kmeansPtr->publish(mOnline);
+      }
+      else
+        outBuf.samps(0)[0] =
+            mOnline.matches(*means) ? mOnline.vq(mPoint) : means->vq(mPoint);
     }
   }
 
   index latency() { return 0; }
+
+private:
+  RealVector              mPoint;
+  algorithm::OnlineKMeans mOnline;
 };
 
 
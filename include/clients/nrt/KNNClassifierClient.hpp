@@ -52,6 +52,24 @@ void from_json(const nlohmann::json& j, KNNClassifierData& data)
   data.labels = j.at("labels").get<FluidDataSet<std::string, std::string, 1>>();
 }
 
+void to_binary(BinaryWriter& w, const KNNClassifierData& data)
+{
+  to_binary(w, data.tree, "tree/");
+  to_binary(w, data.labels, "labels/");
+}
+
+bool check_binary(const BinaryReader& r, const KNNClassifierData& data)
+{
+  return check_binary(r, data.tree, "tree/") &&
+         check_binary(r, data.labels, "labels/");
+}
+
+void from_binary(const BinaryReader& r, KNNClassifierData& data)
+{
+  from_binary(r, data.tree, "tree/");
+  from_binary(r, data.labels, "labels/");
+}
+
 constexpr auto KNNClassifierParams = defineParameters(
     StringParam<Fixed<true>>("name", "Name"),
     LongParam("numNeighbours", "Number of Nearest Neighbours", 3, Min(1)),
@@ -104,11 +122,11 @@ public:
   {
     auto datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error(NoDataSet);
-    auto dataset = datasetClientPtr->getDataSet();
+    const auto dataset = datasetClientPtr->getDataSet();
     if (dataset.size() == 0) return Error(EmptyDataSet);
     auto labelsetPtr = labelsetClient.get().lock();
     if (!labelsetPtr) return Error(NoLabelSet);
-    auto labelSet = labelsetPtr->getLabelSet();
+    const auto labelSet = labelsetPtr->getLabelSet();
     if (labelSet.size() == 0) return Error(EmptyLabelSet);
     if (dataset.size() != labelSet.size()) return Error(SizesDontMatch);
     mAlgorithm.tree = algorithm::KDTree{dataset};
@@ -144,7 +162,7 @@ public:
     bool  weight = get<kWeight>() != 0;
     auto  sourcePtr = source.get().lock();
     if (!sourcePtr) return Error(NoDataSet);
-    auto dataSet = sourcePtr->getDataSet();
+    const auto dataSet = sourcePtr->getDataSet();
     if (dataSet.size() == 0) return Error(EmptyDataSet);
     auto destPtr = dest.get().lock();
     if (!destPtr) return Error(NoLabelSet);
@@ -155,16 +173,10 @@ public:
     if (mAlgorithm.tree.size() < k) return Error(NotEnoughData);
 
     algorithm::KNNClassifier classifier;
-    auto                     ids = dataSet.getIds();
-    auto                     data = dataSet.getData();
-    LabelSet                 result(1);
-    for (index i = 0; i < dataSet.size(); i++)
-    {
-      RealVectorView point = data.row(i);
-      StringVector   label = {classifier.predict(mAlgorithm.tree, point,
-                                               mAlgorithm.labels, k, weight)};
-      result.add(ids(i), label);
-    }
+    FluidTensor<string, 2>   labels(dataSet.size(), 1);
+    classifier.predict(mAlgorithm.tree, dataSet.getData(), mAlgorithm.labels,
+                       k, weight, labels.col(0));
+    LabelSet result(dataSet.getIds(), labels);
     destPtr->setLabelSet(result);
     return OK();
   }
@@ -50,6 +50,23 @@ void from_json(const nlohmann::json& j, KNNRegressorData& data)
   data.target = j["target"].get<FluidDataSet<std::string, double, 1>>();
 }
 
+void to_binary(BinaryWriter& w, const KNNRegressorData& data)
+{
+  to_binary(w, data.tree, "tree/");
+  to_binary(w, data.target, "target/");
+}
+
+bool check_binary(const BinaryReader& r, const KNNRegressorData& data)
+{
+  return check_binary(r, data.tree, "tree/") &&
+         check_binary(r, data.target, "target/");
+}
+
+void from_binary(const BinaryReader& r, KNNRegressorData& data)
+{
+  from_binary(r, data.tree, "tree/");
+  from_binary(r, data.target, "target/");
+}
 
 constexpr auto KNNRegressorParams = defineParameters(
     StringParam<Fixed<true>>("name", "Name"),
@@ -105,11 +122,11 @@ public:
   {
     auto datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error<string>(NoDataSet);
-    auto dataSet = datasetClientPtr->getDataSet();
+    const auto dataSet = datasetClientPtr->getDataSet();
     if (dataSet.size() == 0) return Error<string>(EmptyDataSet);
     auto targetClientPtr = targetClient.get().lock();
     if (!targetClientPtr) return Error<string>(NoDataSet);
-    auto target = targetClientPtr->getDataSet();
+    const auto target = targetClientPtr->getDataSet();
     if (target.size() == 0) return Error<string>(EmptyDataSet);
     if (dataSet.size() != target.size()) return Error<string>(SizesDontMatch);
     mAlgorithm.tree = algorithm::KDTree{dataSet};
@@ -144,7 +161,7 @@ public:
     bool  weight = get<kWeight>() != 0;
     auto  sourcePtr = source.get().lock();
     if (!sourcePtr) return Error(NoDataSet);
-    auto dataSet = sourcePtr->getDataSet();
+    const auto dataSet = sourcePtr->getDataSet();
     if (dataSet.size() == 0) return Error(EmptyDataSet);
     auto destPtr = dest.get().lock();
     if (!destPtr) return Error(NoDataSet);
@@ -155,16 +172,10 @@ public:
     if (mAlgorithm.tree.size() < k) return Error(NotEnoughData);
 
     algorithm::KNNRegressor regressor;
-    auto                    ids = dataSet.getIds();
-    auto                    data = dataSet.getData();
-    DataSet                 result(1);
-    for (index i = 0; i < dataSet.size(); i++)
-    {
-      RealVectorView point = data.row(i);
-      RealVector     prediction = {regressor.predict(
-          mAlgorithm.tree, mAlgorithm.target, point, k, weight)};
-      result.add(ids(i), prediction);
-    }
+    RealMatrix              predictions(dataSet.size(), 1);
+    regressor.predict(mAlgorithm.tree, mAlgorithm.target, dataSet.getData(),
+                      k, weight, predictions.col(0));
+    DataSet result(dataSet.getIds(), predictions);
     destPtr->setDataSet(result);
     return OK();
   }
@@ -145,7 +145,7 @@ public:
   }
 
   const LabelSet getLabelSet() const { return mAlgorithm; }
-  void           setLabelSet(LabelSet ls) { mAlgorithm = ls; }
+  void           setLabelSet(LabelSet ls) { mAlgorithm = std::move(ls); }
   
 private: 
   LabelSet getIdsLabelSet()
@@ -65,8 +65,8 @@ public:
     auto  srcPtr = sourceClient.get().lock();
     auto  destPtr = destClient.get().lock();
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
-    auto dest = destPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
+    const auto dest = destPtr->getDataSet();
     if (src.size() == 0) return Error(EmptyDataSet);
     if (k <= 0) return Error(SmallK);
     if (dist < 0 || dist > 6) return Error("dist should be  between 0 and 6");
@@ -15,6 +15,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "NRTClient.hpp"
 #include "../../algorithms/public/LabelSetEncoder.hpp"
 #include "../../algorithms/public/MLP.hpp"
+#include "../../algorithms/public/MLPInference.hpp"
 #include "../../algorithms/public/SGD.hpp"
 #include <string>
 
@@ -65,7 +66,18 @@ constexpr auto MLPClassifierParams = defineParameters(
     FloatParam("learnRate", "Learning Rate", 0.01, Min(0.0), Max(1.0)),
     FloatParam("momentum", "Momentum", 0.5, Min(0.0), Max(0.99)),
     LongParam("batchSize", "Batch Size", 50, Min(1)),
-    FloatParam("validation", "Validation Amount", 0.2, Min(0), Max(0.9)));
+    FloatParam("validation", "Validation Amount", 0.2, Min(0), Max(0.9)),
+    EnumParam("asynchronous", "Asynchronous Updates, Locked One at a Time",
+              0, "Off", "On"),
+    EnumParam("optimizer", "Optimiser", 0, "SGD", "Nesterov", "RMSProp",
+              "Adam"),
+    EnumParam("schedule", "Learning Rate Schedule", 0, "Constant", "Step",
+              "Cosine", "Plateau"),
+    LongParam("scheduleStep", "Learning Rate Schedule Step", 100, Min(1)),
+    FloatParam("scheduleFactor", "Learning Rate Schedule Factor", 0.5, Min(0),
+               Max(1)),
+    LongParam("patience", "Early Stopping Patience", 10, Min(1)),
+    LongParam("plateauPatience", "Learning Rate Plateau Patience", 5, Min(1)));
 
 
 class MLPClassifierClient : public FluidBaseClient,
@@ -82,7 +94,14 @@ class MLPClassifierClient : public FluidBaseClient,
     kRate,
     kMomentum,
     kBatchSize,
-    kVal
+    kVal,
+    kAsynchronous,
+    kOptimizer,
+    kSchedule,
+    kScheduleStep,
+    kScheduleFactor,
+    kPatience,
+    kPlateauPatience
   };
 
 public:
@@ -139,14 +158,14 @@ public:
   {
     auto sourceClientPtr = source.get().lock();
     if (!sourceClientPtr) return Error<double>(NoDataSet);
-    auto sourceDataSet = sourceClientPtr->getDataSet();
+    const auto sourceDataSet = sourceClientPtr->getDataSet();
     if (sourceDataSet.size() == 0) return Error<double>(EmptyDataSet);
     if (mAlgorithm.initialized() && sourceDataSet.dims() != mAlgorithm.dims())
       return Error<double>(DimensionsDontMatch);
 
     auto targetClientPtr = target.get().lock();
     if (!targetClientPtr) return Error<double>(NoLabelSet);
-    auto targetDataSet = targetClientPtr->getLabelSet();
+    const auto targetDataSet = targetClientPtr->getLabelSet();
     if (targetDataSet.size() == 0) return Error<double>(EmptyLabelSet);
     if (sourceDataSet.size() != targetDataSet.size())
       return Error<double>(SizesDontMatch);
@@ -174,9 +193,16 @@ public:
     }
 
     algorithm::SGD sgd;
-    double         error =
+    sgd.setOptimizer(
+        static_cast<algorithm::NNOptimizer::Type>(get<kOptimizer>()));
+    sgd.setSchedule(static_cast<algorithm::SGD::Schedule>(get<kSchedule>()),
+                    get<kScheduleStep>(), get<kScheduleFactor>());
+    sgd.setPatience(get<kPatience>());
+    sgd.setPlateauPatience(get<kPlateauPatience>());
+    double error =
         sgd.train(mAlgorithm.mlp, data, oneHot, get<kIter>(), get<kBatchSize>(),
-                  get<kRate>(), get<kMomentum>(), get<kVal>());
+                  get<kRate>(), get<kMomentum>(), get<kVal>(),
+                  get<kAsynchronous>() == 1);
 
     return error;
   }
@@ -188,7 +214,7 @@ public:
     auto destPtr = destClient.get().lock();
     if (!srcPtr) return Error(NoDataSet);
     if (!destPtr) return Error(NoLabelSet);
-    auto srcDataSet = srcPtr->getDataSet();
+    const auto srcDataSet = srcPtr->getDataSet();
     if (srcDataSet.size() == 0) return Error(EmptyDataSet);
     if (!mAlgorithm.mlp.trained()) return Error(NoDataFitted);
     if (srcDataSet.dims() != mAlgorithm.dims()) return Error(WrongPointSize);
@@ -324,18 +350,26 @@ public:
       auto outBuf = BufferAdaptor::Access(get<kOutputBuffer>().get());
       if (outBuf.samps(0).size() != 1) return;
 
-      RealVector src(dims);
-      RealVector dest(algorithm.mlp.outputSize(layer));
-      src = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
-                .samps(0, dims, 0);
-      algorithm.mlp.processFrame(src, dest, 0, layer);
-      auto label = algorithm.encoder.decodeOneHot(dest);
+      // copying the model only allocates if its layers have changed size
+      if (!mPlan.matches(algorithm.mlp, 0, layer))
+        mPlan.init(algorithm.mlp, 0, layer);
+      index outputSize = algorithm.mlp.outputSize(layer);
+      if (mSrc.size() != dims) mSrc = RealVector(dims);
+      if (mDest.size() != outputSize) mDest = RealVector(outputSize);
+      mSrc = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
+                 .samps(0, dims, 0);
+      mPlan.processFrame(mSrc, mDest);
       outBuf.samps(0)[0] =
-          static_cast<double>(algorithm.encoder.encodeIndex(label));
+          static_cast<double>(algorithm.encoder.decodeOneHotIndex(mDest));
     }
   }
 
   index latency() { return 0; }
+
+private:
+  algorithm::MLPInference mPlan;
+  RealVector              mSrc;
+  RealVector              mDest;
 };
 
 
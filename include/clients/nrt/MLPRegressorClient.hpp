@@ -13,6 +13,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "DataSetClient.hpp"
 #include "NRTClient.hpp"
 #include "../../algorithms/public/MLP.hpp"
+#include "../../algorithms/public/MLPInference.hpp"
 #include "../../algorithms/public/SGD.hpp"
 #include <string>
 
@@ -35,7 +36,18 @@ constexpr auto MLPRegressorParams = defineParameters(
     FloatParam("learnRate", "Learning Rate", 0.01, Min(0.0), Max(1.0)),
     FloatParam("momentum", "Momentum", 0.9, Min(0.0), Max(0.99)),
     LongParam("batchSize", "Batch Size", 50, Min(1)),
-    FloatParam("validation", "Validation Amount", 0.2, Min(0), Max(0.9)));
+    FloatParam("validation", "Validation Amount", 0.2, Min(0), Max(0.9)),
+    EnumParam("asynchronous", "Asynchronous Updates, Locked One at a Time",
+              0, "Off", "On"),
+    EnumParam("optimizer", "Optimiser", 0, "SGD", "Nesterov", "RMSProp",
+              "Adam"),
+    EnumParam("schedule", "Learning Rate Schedule", 0, "Constant", "Step",
+              "Cosine", "Plateau"),
+    LongParam("scheduleStep", "Learning Rate Schedule Step", 100, Min(1)),
+    FloatParam("scheduleFactor", "Learning Rate Schedule Factor", 0.5, Min(0),
+               Max(1)),
+    LongParam("patience", "Early Stopping Patience", 10, Min(1)),
+    LongParam("plateauPatience", "Learning Rate Plateau Patience", 5, Min(1)));
 
 class MLPRegressorClient : public FluidBaseClient,
                            OfflineIn,
@@ -55,7 +67,14 @@ class MLPRegressorClient : public FluidBaseClient,
     kRate,
     kMomentum,
     kBatchSize,
-    kVal
+    kVal,
+    kAsynchronous,
+    kOptimizer,
+    kSchedule,
+    kScheduleStep,
+    kScheduleFactor,
+    kPatience,
+    kPlateauPatience
   };
 
 public:
@@ -97,14 +116,14 @@ public:
   {
     auto sourceClientPtr = source.get().lock();
     if (!sourceClientPtr) return Error<double>(NoDataSet);
-    auto sourceDataSet = sourceClientPtr->getDataSet();
+    const auto sourceDataSet = sourceClientPtr->getDataSet();
     if (sourceDataSet.size() == 0) return Error<double>(EmptyDataSet);
     if (mAlgorithm.initialized() && sourceDataSet.dims() != mAlgorithm.dims())
       return Error<double>(DimensionsDontMatch);
 
     auto targetClientPtr = target.get().lock();
     if (!targetClientPtr) return Error<double>(NoDataSet);
-    auto targetDataSet = targetClientPtr->getDataSet();
+    const auto targetDataSet = targetClientPtr->getDataSet();
     if (targetDataSet.size() == 0) return Error<double>(EmptyDataSet);
     if (sourceDataSet.size() != targetDataSet.size())
       return Error<double>(SizesDontMatch);
@@ -124,9 +143,16 @@ public:
     auto           data = sourceDataSet.getData();
     auto           tgt = targetDataSet.getData();
     algorithm::SGD sgd;
-    double         error =
+    sgd.setOptimizer(
+        static_cast<algorithm::NNOptimizer::Type>(get<kOptimizer>()));
+    sgd.setSchedule(static_cast<algorithm::SGD::Schedule>(get<kSchedule>()),
+                    get<kScheduleStep>(), get<kScheduleFactor>());
+    sgd.setPatience(get<kPatience>());
+    sgd.setPlateauPatience(get<kPlateauPatience>());
+    double error =
         sgd.train(mAlgorithm, data, tgt, get<kIter>(), get<kBatchSize>(),
-                  get<kRate>(), get<kMomentum>(), get<kVal>());
+                  get<kRate>(), get<kMomentum>(), get<kVal>(),
+                  get<kAsynchronous>() == 1);
     return error;
   }
 
@@ -147,7 +173,7 @@ public:
     auto  destPtr = destClient.get().lock();
 
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto srcDataSet = srcPtr->getDataSet();
+    const auto srcDataSet = srcPtr->getDataSet();
     if (srcDataSet.size() == 0) return Error(EmptyDataSet);
     if (!mAlgorithm.trained()) return Error(NoDataFitted);
     if (srcDataSet.dims() != inputSize) return Error(WrongPointSize);
@@ -160,6 +186,41 @@ public:
     return OK();
   }
 
+  // Root mean square and largest absolute difference, over the points of
+  // srcClient, between predictions at the given precision, numbered as in
+  // MLPRegressorQuery, and those of the model itself
+  MessageResult<RealVector> precisionError(DataSetClientRef srcClient,
+                                           index            precision)
+  {
+    index inputTap = get<kInputTap>();
+    index outputTap = get<kOutputTap>();
+    if (inputTap >= mAlgorithm.size())
+      return Error<RealVector>("Input tap too large");
+    if (outputTap > mAlgorithm.size())
+      return Error<RealVector>("Ouput tap too large");
+    if (outputTap == 0) return Error<RealVector>("Ouput tap cannot be 0");
+    if (outputTap == -1) outputTap = mAlgorithm.size();
+    if (outputTap - inputTap <= 0)
+      return Error<RealVector>("Output Tap must be > Input Tap");
+    if (precision < 0 || precision > 2)
+      return Error<RealVector>("Precision must be 0, 1 or 2");
+
+    auto srcPtr = srcClient.get().lock();
+    if (!srcPtr) return Error<RealVector>(NoDataSet);
+    const auto srcDataSet = srcPtr->getDataSet();
+    if (srcDataSet.size() == 0) return Error<RealVector>(EmptyDataSet);
+    if (!mAlgorithm.trained()) return Error<RealVector>(NoDataFitted);
+    if (srcDataSet.dims() != mAlgorithm.inputSize(inputTap))
+      return Error<RealVector>(WrongPointSize);
+
+    algorithm::MLPInference plan;
+    plan.init(mAlgorithm, inputTap, outputTap,
+              static_cast<algorithm::MLPInference::Precision>(precision));
+    RealVector result(2);
+    plan.deviation(mAlgorithm, srcDataSet.getData(), result(0), result(1));
+    return result;
+  }
+
   MessageResult<void> predictPoint(BufferPtr in, BufferPtr out)
   {
     index inputTap = get<kInputTap>();
@@ -211,6 +272,7 @@ public:
         makeMessage("fit", &MLPRegressorClient::fit),
         makeMessage("predict", &MLPRegressorClient::predict),
         makeMessage("predictPoint", &MLPRegressorClient::predictPoint),
+        makeMessage("precisionError", &MLPRegressorClient::precisionError),
         makeMessage("clear", &MLPRegressorClient::clear),
         makeMessage("cols", &MLPRegressorClient::dims),
         makeMessage("size", &MLPRegressorClient::size),
@@ -252,11 +314,20 @@ constexpr auto MLPRegressorQueryParams =
                      LongParam("tapIn", "Input Tap Index", 0, Min(0)),
                      LongParam("tapOut", "Output Tap Index", -1, Min(-1)),
                      BufferParam("inputPointBuffer", "Input Point Buffer"),
-                     BufferParam("predictionBuffer", "Prediction Buffer"));
+                     BufferParam("predictionBuffer", "Prediction Buffer"),
+                     EnumParam("precision", "Inference Precision", 0, "Double",
+                               "Float", "Int8"));
 
 class MLPRegressorQuery : public FluidBaseClient, ControlIn, ControlOut
 {
-  enum { kModel, kInputTap, kOutputTap, kInputBuffer, kOutputBuffer };
+  enum {
+    kModel,
+    kInputTap,
+    kOutputTap,
+    kInputBuffer,
+    kOutputBuffer,
+    kPrecision
+  };
 
 public:
   using ParamDescType = decltype(MLPRegressorQueryParams);
@@ -317,16 +388,26 @@ public:
       auto outBuf = BufferAdaptor::Access(get<kOutputBuffer>().get());
       if (outBuf.samps(0).size() < outputSize) return;
 
-      RealVector src(inputSize);
-      RealVector dest(outputSize);
-      src = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
-                .samps(0, inputSize, 0);
-      algorithm.processFrame(src, dest, inputTap, outputTap);
-      outBuf.samps(0, outputSize, 0) = dest;
+      // copying the model only allocates if its layers have changed size
+      auto precision =
+          static_cast<algorithm::MLPInference::Precision>(get<kPrecision>());
+      if (!mPlan.matches(algorithm, inputTap, outputTap, precision))
+        mPlan.init(algorithm, inputTap, outputTap, precision);
+      if (mSrc.size() != inputSize) mSrc = RealVector(inputSize);
+      if (mDest.size() != outputSize) mDest = RealVector(outputSize);
+      mSrc = BufferAdaptor::ReadAccess(get<kInputBuffer>().get())
+                 .samps(0, inputSize, 0);
+      mPlan.processFrame(mSrc, mDest);
+      outBuf.samps(0, outputSize, 0) = mDest;
     }
   }
 
   index latency() { return 0; }
+
+private:
+  algorithm::MLPInference mPlan;
+  RealVector              mSrc;
+  RealVector              mDest;
 };
 
 } // namespace mlpregressor
@@ -0,0 +1,210 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "DataSetClient.hpp"
+#include "NRTClient.hpp"
+#include "../../algorithms/util/PublishedSnapshot.hpp"
+#include <memory>
+#include <string>
+
+namespace fluid {
+namespace client {
+
+// Messages shared by the clients of nearest neighbour indexes: KDTree, VPTree
+// and HNSW. Client provides, for this class only:
+//   Index build(const FluidDataSet<std::string, double, 1>&) const
+//   FluidDataSet<std::string, double, 1> search(RealVectorView, index k) const
+//   index numNeighbours() const
+// RT queries search a snapshot of the model, a RealTimeIndex made from it
+// whenever a message changes it, rather than the model itself.
+template <typename Client, typename Index, typename RealTimeIndex = Index>
+class NearestNeighboursClient : public DataClient<Index>
+{
+public:
+  using BufferPtr = std::shared_ptr<BufferAdaptor>;
+  using StringVector = FluidTensor<std::string, 1>;
+  using DataSetClientPtr = std::weak_ptr<dataset::DataSetClient>;
+
+  // What RT queries search: the model, and the dataset it was fitted to
+  struct Snapshot
+  {
+    Snapshot(const Index& index, DataSetClientPtr fitted)
+        : model(index), dataset(std::move(fitted))
+    {}
+
+    RealTimeIndex    model;
+    DataSetClientPtr dataset;
+  };
+
+  MessageResult<void> fit(DataSetClientRef datasetClient)
+  {
+    mDataSetClient = datasetClient;
+    auto datasetClientPtr = mDataSetClient.get().lock();
+    if (!datasetClientPtr) return Error(NoDataSet);
+    const auto dataset = datasetClientPtr->getDataSet();
+    if (dataset.size() == 0) return Error(EmptyDataSet);
+    this->mAlgorithm = client().build(dataset);
+    publish();
+    return OK();
+  }
+
+  MessageResult<void> clear()
+  {
+    this->mAlgorithm.clear();
+    publish();
+    return OK();
+  }
+
+  MessageResult<void> read(std::string fileName)
+  {
+    return publishOnSuccess(DataClient<Index>::read(fileName));
+  }
+
+  MessageResult<void> load(std::string s)
+  {
+    return publishOnSuccess(DataClient<Index>::load(s));
+  }
+
+  MessageResult<StringVector> kNearest(BufferPtr data) const
+  {
+    return search<StringVector>(data, [](const auto& nearest) {
+      return StringVector{nearest.getIds()};
+    });
+  }
+
+  MessageResult<RealVector> kNearestDist(BufferPtr data) const
+  {
+    return search<RealVector>(data, [](const auto& nearest) {
+      return RealVector{nearest.getData().col(0)};
+    });
+  }
+
+  DataSetClientRef& getDataSet() { return mDataSetClient; }
+
+  const Index& algorithm() { return this->mAlgorithm; }
+
+  // For RT queries: the model as of the end of the last message to change it,
+  // or null if it has never been fitted or loaded
+  std::shared_ptr<const Snapshot> realTimeModel() const
+  {
+    return mSnapshot.read();
+  }
+
+protected:
+  // Copies the model for RT queries, once a message has changed it
+  void publish()
+  {
+    if (this->mAlgorithm.initialized())
+    {
+      mSnapshot.publish(std::make_shared<const Snapshot>(
+          this->mAlgorithm, mDataSetClient.get()));
+    }
+    else
+      mSnapshot.withdraw();
+  }
+
+  DataSetClientRef mDataSetClient;
+
+private:
+  const Client& client() const { return static_cast<const Client&>(*this); }
+
+  MessageResult<void> publishOnSuccess(MessageResult<void> result)
+  {
+    if (result.ok()) publish();
+    return result;
+  }
+
+  // The nearest to the point in data, passed to result for the reply
+  template <typename T, typename F>
+  MessageResult<T> search(BufferPtr data, F&& result) const
+  {
+    const Index& model = this->mAlgorithm;
+    index        k = client().numNeighbours();
+    if (k > model.size()) return Error<T>(SmallDataSet);
+    if (!model.initialized()) return Error<T>(NoDataFitted);
+    InBufferCheck bufCheck(model.dims());
+    if (!bufCheck.checkInputs(data.get())) return Error<T>(bufCheck.error());
+    RealVector point(model.dims());
+    point = BufferAdaptor::ReadAccess(data.get()).samps(0, model.dims(), 0);
+    const FluidDataSet<std::string, double, 1> nearest =
+        client().search(point, k);
+    return result(nearest);
+  }
+
+  algorithm::PublishedSnapshot<Snapshot> mSnapshot;
+};
+
+// What the RT queries of those clients share: on a trigger, the k nearest to
+// the point in the input buffer are found by search(model, point, k, nearest,
+// distances), which returns how many there were, and their points are copied
+// one after another to the output buffer from the query's DataSet, or else the
+// one the model was fitted to. Both are read from the snapshots their clients
+// publish, so nothing is copied here. Buffers are kept from one trigger to the
+// next, so only allocate when k or the size of the points changes.
+class NearestNeighboursLookup
+{
+public:
+  template <typename ClientPtr, typename Search>
+  void process(ClientPtr& clientPtr, index k, DataSetClientRef& datasetClient,
+               BufferAdaptor* inBuffer, BufferAdaptor* outBuffer,
+               Search&& search)
+  {
+    if (!clientPtr) return;
+    auto snapshot = clientPtr->realTimeModel();
+    if (!snapshot) return;
+    const auto& model = snapshot->model;
+    if (k > model.size() || k <= 0) return;
+    index             dims = model.dims();
+    InOutBuffersCheck bufCheck(dims);
+    if (!bufCheck.checkInputs(inBuffer, outBuffer)) return;
+    auto datasetClientPtr = datasetClient.get().lock();
+    if (!datasetClientPtr) datasetClientPtr = snapshot->dataset.lock();
+    if (!datasetClientPtr) return;
+
+    auto dataset = datasetClientPtr->realTimeDataSet();
+    if (!dataset) return;
+    index pointSize = dataset->pointSize();
+    auto  outBuf = BufferAdaptor::Access(outBuffer);
+    index outputSize = k * pointSize;
+    if (outBuf.samps(0).size() < outputSize) return;
+
+    if (mRTBuffer.size() != outputSize)
+    {
+      mRTBuffer = RealVector(outputSize);
+      mRTBuffer.fill(0);
+    }
+    if (mNearest.size() != k)
+    {
+      mNearest = FluidTensor<index, 1>(k);
+      mNearestDist = RealVector(k);
+    }
+    if (mPoint.size() != dims) mPoint = RealVector(dims);
+    mPoint = BufferAdaptor::ReadAccess(inBuffer).samps(0, dims, 0);
+    index numFound = search(model, mPoint, k, mNearest, mNearestDist);
+    auto  ids = model.getIds();
+    for (index i = 0; i < numFound; i++)
+    {
+      dataset->get(ids(mNearest(i)),
+                   mRTBuffer(Slice(i * pointSize, pointSize)));
+    }
+    outBuf.samps(0, outputSize, 0) = mRTBuffer;
+  }
+
+private:
+  RealVector            mRTBuffer;
+  RealVector            mPoint;
+  FluidTensor<index, 1> mNearest;
+  RealVector            mNearestDist;
+};
+
+} // namespace client
+} // namespace fluid
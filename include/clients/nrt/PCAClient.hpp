@@ -61,7 +61,7 @@ public:
   {
     auto datasetClientPtr = datasetClient.get().lock();
     if (!datasetClientPtr) return Error(NoDataSet);
-    auto dataSet = datasetClientPtr->getDataSet();
+    const auto dataSet = datasetClientPtr->getDataSet();
     if (dataSet.size() == 0) return Error(EmptyDataSet);
     mAlgorithm.init(dataSet.getData());
     return OK();
@@ -89,7 +89,7 @@ public:
     double result = 0;
     if (srcPtr && destPtr)
     {
-      auto srcDataSet = srcPtr->getDataSet();
+      const auto srcDataSet = srcPtr->getDataSet();
       if (srcDataSet.size() == 0) return Error<double>(EmptyDataSet);
       if (!mAlgorithm.initialized()) return Error<double>(NoDataFitted);
       if (srcDataSet.pointSize() != mAlgorithm.dims())
@@ -63,7 +63,7 @@ public:
     auto weakPtr = datasetClient.get();
     if (auto datasetClientPtr = weakPtr.lock())
     {
-      auto dataset = datasetClientPtr->getDataSet();
+      const auto dataset = datasetClientPtr->getDataSet();
       if (dataset.size() == 0) return Error(EmptyDataSet);
       mAlgorithm.init(dataset.getData());
     }
@@ -132,7 +132,7 @@ private:
     auto destPtr = destClient.get().lock();
     if (srcPtr && destPtr)
     {
-      auto srcDataSet = srcPtr->getDataSet();
+      const auto srcDataSet = srcPtr->getDataSet();
       if (srcDataSet.size() == 0) return Error(EmptyDataSet);
       StringVector ids{srcDataSet.getIds()};
       RealMatrix   data(srcDataSet.size(), srcDataSet.pointSize());
@@ -75,8 +75,8 @@ public:
     auto srcPtr = sourceClient.get().lock();
     auto destPtr = destClient.get().lock();
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
-    auto dest = destPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
+    const auto dest = destPtr->getDataSet();
     if (src.size() == 0) return Error(EmptyDataSet);
     if (get<kNumNeighbors>() > src.size())
       return Error("Number of Neighbours is larger than dataset");
@@ -92,7 +92,7 @@ public:
   {
     auto srcPtr = sourceClient.get().lock();
     if (!srcPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
     if (src.size() == 0) return Error(EmptyDataSet);
     if (get<kNumNeighbors>() > src.size())
       return Error("Number of Neighbours is larger than dataset");
@@ -110,8 +110,8 @@ public:
     auto srcPtr = sourceClient.get().lock();
     auto destPtr = destClient.get().lock();
     if (!srcPtr || !destPtr) return Error(NoDataSet);
-    auto src = srcPtr->getDataSet();
-    auto dest = destPtr->getDataSet();
+    const auto src = srcPtr->getDataSet();
+    const auto dest = destPtr->getDataSet();
     if (src.size() == 0) return Error(EmptyDataSet);
     if (!mAlgorithm.initialized()) return Error(NoDataFitted);
     if (get<kNumDimensions>() != mAlgorithm.dims())
@@ -0,0 +1,179 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "DataSetClient.hpp"
+#include "NRTClient.hpp"
+#include "NearestNeighboursClient.hpp"
+#include "../../algorithms/public/VPTree.hpp"
+#include <string>
+
+namespace fluid {
+namespace client {
+namespace vptree {
+
+constexpr auto VPTreeParams = defineParameters(
+    StringParam<Fixed<true>>("name", "Name"),
+    LongParam("numNeighbours", "Number of Nearest Neighbours", 1),
+    FloatParam("radius", "Maximum distance", 0, Min(0)),
+    EnumParam("distanceMetric", "Distance Metric", 1, "Manhattan", "Euclidean",
+              "Max Distance", "Cosine", "Jensen-Shannon"));
+
+class VPTreeClient
+    : public FluidBaseClient,
+      OfflineIn,
+      OfflineOut,
+      ModelObject,
+      public NearestNeighboursClient<VPTreeClient, algorithm::VPTree>
+{
+  enum { kName, kNumNeighbors, kRadius, kDistance };
+
+
+  friend NearestNeighboursClient;
+
+public:
+  using string = std::string;
+  using ParamDescType = decltype(VPTreeParams);
+
+  using ParamSetViewType = ParameterSetView<ParamDescType>;
+  std::reference_wrapper<ParamSetViewType> mParams;
+
+  void setParams(ParamSetViewType& p) { mParams = p; }
+
+  template <size_t N>
+  auto& get() const
+  {
+    return mParams.get().template get<N>();
+  }
+
+  static constexpr auto& getParameterDescriptors() { return VPTreeParams; }
+
+  VPTreeClient(ParamSetViewType& p) : mParams(p)
+  {
+    audioChannelsIn(1);
+    controlChannelsOut({1, 1});
+  }
+
+  template <typename T>
+  Result process(FluidContext&)
+  {
+    return {};
+  }
+
+  static auto getMessageDescriptors()
+  {
+    return defineMessages(
+        makeMessage("fit", &VPTreeClient::fit),
+        makeMessage("kNearest", &VPTreeClient::kNearest),
+        makeMessage("kNearestDist", &VPTreeClient::kNearestDist),
+        makeMessage("cols", &VPTreeClient::dims),
+        makeMessage("clear", &VPTreeClient::clear),
+        makeMessage("size", &VPTreeClient::size),
+        makeMessage("load", &VPTreeClient::load),
+        makeMessage("dump", &VPTreeClient::dump),
+        makeMessage("write", &VPTreeClient::write),
+        makeMessage("read", &VPTreeClient::read));
+  }
+
+private:
+  algorithm::VPTree build(const FluidDataSet<string, double, 1>& dataset) const
+  {
+    return algorithm::VPTree(dataset, metric());
+  }
+
+  FluidDataSet<string, double, 1> search(RealVectorView point, index k) const
+  {
+    return mAlgorithm.kNearest(point, k, get<kRadius>());
+  }
+
+  index numNeighbours() const { return get<kNumNeighbors>(); }
+
+  algorithm::VPTree::Distance metric() const
+  {
+    using Distance = algorithm::VPTree::Distance;
+    constexpr Distance metrics[] = {Distance::kManhattan, Distance::kEuclidean,
+                                    Distance::kMax, Distance::kCosine,
+                                    Distance::kJS};
+    return metrics[get<kDistance>()];
+  }
+};
+
+using VPTreeRef = SharedClientRef<VPTreeClient>;
+
+constexpr auto VPTreeQueryParams = defineParameters(
+    VPTreeRef::makeParam("tree", "VPTree"),
+    LongParam("numNeighbours", "Number of Nearest Neighbours", 1),
+    FloatParam("radius", "Maximum distance", 0, Min(0)),
+    DataSetClientRef::makeParam("dataSet", "DataSet Name"),
+    BufferParam("inputPointBuffer", "Input Point Buffer"),
+    BufferParam("predictionBuffer", "Prediction Buffer"));
+
+class VPTreeQuery : public FluidBaseClient, ControlIn, ControlOut
+{
+  enum { kTree, kNumNeighbors, kRadius, kDataSet, kInputBuffer, kOutputBuffer };
+
+public:
+  using ParamDescType = decltype(VPTreeQueryParams);
+  using ParamSetViewType = ParameterSetView<ParamDescType>;
+
+  std::reference_wrapper<ParamSetViewType> mParams;
+
+  void setParams(ParamSetViewType& p) { mParams = p; }
+
+  template <size_t N>
+  auto& get() const
+  {
+    return mParams.get().template get<N>();
+  }
+
+  static constexpr auto& getParameterDescriptors() { return VPTreeQueryParams; }
+
+  VPTreeQuery(ParamSetViewType& p) : mParams(p)
+  {
+    controlChannelsIn(1);
+    controlChannelsOut({1, 1});
+  }
+
+  index latency() { return 0; }
+
+  template <typename T>
+  void process(std::vector<FluidTensorView<T, 1>>& input,
+               std::vector<FluidTensorView<T, 1>>& output, FluidContext&)
+  {
+    output[0] = input[0];
+
+    if (input[0](0) > 0)
+    {
+      auto vptreePtr = get<kTree>().get().lock();
+      mLookup.process(vptreePtr, get<kNumNeighbors>(), get<kDataSet>(),
+                      get<kInputBuffer>().get(), get<kOutputBuffer>().get(),
+                      [this](const algorithm::VPTree& tree,
+                             RealVectorView point, index k,
+                             FluidTensorView<index, 1> nearest,
+                             RealVectorView distances) {
+                        return tree.kNearest(point, k, get<kRadius>(), nearest,
+                                             distances);
+                      });
+    }
+  }
+
+private:
+  NearestNeighboursLookup mLookup;
+};
+
+} // namespace vptree
+
+using NRTThreadedVPTreeClient =
+    NRTThreadingAdaptor<typename vptree::VPTreeRef::SharedType>;
+using RTVPTreeQueryClient = ClientWrapper<vptree::VPTreeQuery>;
+
+} // namespace client
+} // namespace fluid
@@ -0,0 +1,816 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "FluidDataSet.hpp"
+#include "FluidIndex.hpp"
+#include "FluidTensor.hpp"
+#include "TensorTypes.hpp"
+#include "../algorithms/public/KDTree.hpp"
+#include "../algorithms/public/MLP.hpp"
+#include "../algorithms/public/PCA.hpp"
+#include "../algorithms/public/UMAP.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fluid {
+
+// Binary container for datasets and models, as a faster alternative to JSON
+// for large objects. Layout:
+//   header:  8 byte magic, uint32 version, uint32 entry count,
+//            uint64 offset of the entry table, 8 bytes reserved
+//   blocks:  the contents of each entry, each starting on a 64 byte boundary
+//   table:   per entry: uint32 name length, name, uint32 type, uint32 rank,
+//            int64 extents[2], uint64 offset, uint64 size in bytes
+// Numeric entries are raw, row-major int64, float64 or float32 arrays in the
+// byte order of the machine that wrote them, so that readers can use them
+// straight out of a memory mapped file. String entries are stored as an int64
+// length per string followed by all the characters. Nested objects use
+// prefixed entry names, e.g. "tree/data".
+namespace binary {
+
+constexpr char          magic[8] = {'F', 'L', 'U', 'C', 'O', 'M', 'A', 0x1A};
+constexpr std::uint32_t version = 1;
+constexpr std::uint64_t alignment = 64;
+constexpr std::uint64_t headerSize = 32;
+
+enum class EntryType : std::uint32_t { kInteger, kReal, kString, kFloat };
+
+// The type of the entries holding tensors of T
+template <typename T>
+constexpr EntryType entryType()
+{
+  return std::is_same<T, float>::value    ? EntryType::kFloat
+         : std::is_same<T, double>::value ? EntryType::kReal
+                                          : EntryType::kInteger;
+}
+
+struct Entry
+{
+  EntryType     type;
+  std::uint32_t rank;
+  index         extents[2];
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+// Files with this extension are read and written in the binary format
+inline bool isBinaryFileName(const std::string& fileName)
+{
+  const std::string ext{".flbin"};
+  return fileName.size() > ext.size() &&
+         fileName.compare(fileName.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+} // namespace binary
+
+class BinaryWriter
+{
+public:
+  using string = std::string;
+
+  BinaryWriter(const string& fileName)
+  {
+    if (fileName.empty())
+    {
+      mError = "Filename not specified";
+      return;
+    }
+    mFile.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (mFile.fail())
+    {
+      mError = "Could not open file for writing";
+      return;
+    }
+    char header[binary::headerSize] = {};
+    mFile.write(header, binary::headerSize);
+    mPosition = binary::headerSize;
+  }
+
+  bool   ok() const { return mError.empty(); }
+  string error() const { return mError; }
+
+  void add(const string& name, index value)
+  {
+    std::int64_t x = value;
+    addBlock(name, binary::EntryType::kInteger, 0, {0, 0}, &x, sizeof(x));
+  }
+
+  void add(const string& name, double value)
+  {
+    addBlock(name, binary::EntryType::kReal, 0, {0, 0}, &value, sizeof(value));
+  }
+
+  // Real and index vectors and matrices
+  template <typename T, size_t N>
+  void add(const string& name, FluidTensorView<T, N> t)
+  {
+    using U = std::remove_const_t<T>;
+    static_assert(std::is_same<U, double>::value ||
+                      std::is_same<U, float>::value ||
+                      std::is_same<U, index>::value,
+                  "Only double, float and index tensors are supported");
+    addTensor(name, binary::entryType<U>(), t);
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_same<std::remove_const_t<T>, string>::value>
+  add(const string& name, FluidTensorView<T, 1> t)
+  {
+    if (!ok()) return;
+    std::vector<std::int64_t> lengths(asUnsigned(t.size()));
+    std::uint64_t             size = lengths.size() * sizeof(std::int64_t);
+    for (index i = 0; i < t.size(); i++)
+    {
+      lengths[asUnsigned(i)] = asSigned(t(i).size());
+      size += t(i).size();
+    }
+    begin(name, binary::EntryType::kString, 1, {t.size(), 0}, size);
+    write(lengths.data(), lengths.size() * sizeof(std::int64_t));
+    for (index i = 0; i < t.size(); i++) write(t(i).data(), t(i).size());
+  }
+
+  // Writes the entry table and header. The file is incomplete until then
+  bool close()
+  {
+    if (!ok()) return false;
+    std::uint64_t tableOffset = mPosition;
+    for (auto& e : mEntries)
+    {
+      std::uint32_t nameSize = static_cast<std::uint32_t>(e.first.size());
+      std::int64_t  extents[2] = {e.second.extents[0], e.second.extents[1]};
+      write(&nameSize, sizeof(nameSize));
+      write(e.first.data(), nameSize);
+      write(&e.second.type, sizeof(e.second.type));
+      write(&e.second.rank, sizeof(e.second.rank));
+      write(extents, sizeof(extents));
+      write(&e.second.offset, sizeof(e.second.offset));
+      write(&e.second.size, sizeof(e.second.size));
+    }
+    std::uint32_t count = static_cast<std::uint32_t>(mEntries.size());
+    mFile.seekp(0);
+    mFile.write(binary::magic, sizeof(binary::magic));
+    mFile.write(reinterpret_cast<const char*>(&binary::version),
+                sizeof(binary::version));
+    mFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    mFile.write(reinterpret_cast<const char*>(&tableOffset),
+                sizeof(tableOffset));
+    mFile.close();
+    if (mFile.fail()) mError = "Error writing file";
+    return ok();
+  }
+
+private:
+  template <typename T, size_t N>
+  void addTensor(const string& name, binary::EntryType type,
+                 FluidTensorView<T, N> t)
+  {
+    static_assert(N == 1 || N == 2, "Only vectors and matrices are supported");
+    if (!ok()) return;
+    index cols = N == 2 ? t.descriptor().extents[N - 1] : 0;
+    begin(name, type, N, {t.descriptor().extents[0], cols},
+          asUnsigned(t.size()) * sizeof(T));
+    // views of whole tensors are contiguous and go out in one write
+    const auto& desc = t.descriptor();
+    if (desc.strides[N - 1] == 1 &&
+        (N == 1 || desc.strides[0] == desc.extents[N - 1]))
+      write(t.data(), asUnsigned(t.size()) * sizeof(T));
+    else
+      for (auto&& x : t) write(&x, sizeof(T));
+  }
+
+  void addBlock(const string& name, binary::EntryType type, std::uint32_t rank,
+                std::pair<index, index> extents, const void* data,
+                std::uint64_t size)
+  {
+    if (!ok()) return;
+    begin(name, type, rank, extents, size);
+    write(data, size);
+  }
+
+  void begin(const string& name, binary::EntryType type, std::uint32_t rank,
+             std::pair<index, index> extents, std::uint64_t size)
+  {
+    std::uint64_t padding = (binary::alignment - mPosition % binary::alignment) %
+                            binary::alignment;
+    const char zeros[binary::alignment] = {};
+    write(zeros, padding);
+    mEntries.emplace_back(
+        name, binary::Entry{type, rank, {extents.first, extents.second},
+                            mPosition, size});
+  }
+
+  void write(const void* data, std::uint64_t size)
+  {
+    mFile.write(static_cast<const char*>(data),
+                static_cast<std::streamsize>(size));
+    mPosition += size;
+    if (mFile.fail()) mError = "Error writing file";
+  }
+
+  std::ofstream                                    mFile;
+  std::uint64_t                                    mPosition{0};
+  std::vector<std::pair<string, binary::Entry>> mEntries;
+  string                                           mError;
+};
+
+// Maps a binary file into memory, so numeric entries can be viewed without
+// copying or parsing. Views are valid for the lifetime of the reader
+class BinaryReader
+{
+public:
+  using string = std::string;
+
+  BinaryReader(const string& fileName)
+  {
+    if (fileName.empty())
+    {
+      mError = "Filename not specified";
+      return;
+    }
+    if (!map(fileName)) return;
+    if (mSize < binary::headerSize ||
+        std::memcmp(mData, binary::magic, sizeof(binary::magic)) != 0)
+    {
+      mError = "Not a binary FluCoMa file";
+      return;
+    }
+    std::uint32_t fileVersion, count;
+    std::uint64_t tableOffset;
+    std::memcpy(&fileVersion, mData + 8, sizeof(fileVersion));
+    std::memcpy(&count, mData + 12, sizeof(count));
+    std::memcpy(&tableOffset, mData + 16, sizeof(tableOffset));
+    if (fileVersion > binary::version)
+    {
+      mError = "Unsupported file version";
+      return;
+    }
+    readTable(tableOffset, count);
+  }
+
+  ~BinaryReader() { unmap(); }
+
+  BinaryReader(const BinaryReader&) = delete;
+  BinaryReader& operator=(const BinaryReader&) = delete;
+
+  bool   ok() const { return mError.empty(); }
+  string error() const { return mError; }
+
+  bool has(const string& name) const
+  {
+    return mEntries.find(name) != mEntries.end();
+  }
+
+  // Checks that an entry exists with the given type and rank, so that the
+  // accessors below can be used on it
+  bool check(const string& name, binary::EntryType type,
+             std::uint32_t rank) const
+  {
+    auto e = mEntries.find(name);
+    return e != mEntries.end() && e->second.type == type &&
+           e->second.rank == rank;
+  }
+
+  index extent(const string& name, index dim) const
+  {
+    return mEntries.at(name).extents[dim];
+  }
+
+  index getIndex(const string& name) const
+  {
+    std::int64_t x;
+    std::memcpy(&x, mData + mEntries.at(name).offset, sizeof(x));
+    return x;
+  }
+
+  double getReal(const string& name) const
+  {
+    double x;
+    std::memcpy(&x, mData + mEntries.at(name).offset, sizeof(x));
+    return x;
+  }
+
+  template <size_t N>
+  FluidTensorView<const double, N> realView(const string& name) const
+  {
+    return view<double, N>(mEntries.at(name));
+  }
+
+  template <size_t N>
+  FluidTensorView<const index, N> indexView(const string& name) const
+  {
+    return view<index, N>(mEntries.at(name));
+  }
+
+  // For an entry checked to have entryType<T>()
+  template <typename T, size_t N>
+  FluidTensorView<const T, N> tensorView(const string& name) const
+  {
+    return view<T, N>(mEntries.at(name));
+  }
+
+  // Lengths and characters were checked to fill the entry when it was read
+  void getStrings(const string& name, FluidTensorView<string, 1> out) const
+  {
+    const binary::Entry& e = mEntries.at(name);
+    assert(out.size() <= e.extents[0]);
+    const char*          lengths = mData + e.offset;
+    const char*          chars = lengths + asUnsigned(e.extents[0]) * 8;
+    for (index i = 0; i < out.size(); i++)
+    {
+      std::int64_t length;
+      std::memcpy(&length, lengths + i * 8, sizeof(length));
+      out(i).assign(chars, asUnsigned(length));
+      chars += length;
+    }
+  }
+
+private:
+  template <typename T, size_t N>
+  FluidTensorView<const T, N> view(const binary::Entry& e) const
+  {
+    const T* data = reinterpret_cast<const T*>(mData + e.offset);
+    return viewImpl(data, e, std::integral_constant<size_t, N>());
+  }
+
+  template <typename T>
+  static FluidTensorView<const T, 1>
+  viewImpl(const T* data, const binary::Entry& e,
+           std::integral_constant<size_t, 1>)
+  {
+    return {data, 0, e.extents[0]};
+  }
+
+  template <typename T>
+  static FluidTensorView<const T, 2>
+  viewImpl(const T* data, const binary::Entry& e,
+           std::integral_constant<size_t, 2>)
+  {
+    return {data, 0, e.extents[0], e.extents[1]};
+  }
+
+  void readTable(std::uint64_t offset, std::uint32_t count)
+  {
+    const char* p = mData + offset;
+    const char* end = mData + mSize;
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+      std::uint32_t nameSize;
+      if (offset > mSize || !read(p, end, &nameSize, sizeof(nameSize)) ||
+          static_cast<std::uint64_t>(end - p) < nameSize)
+        break;
+      string        name(p, nameSize);
+      binary::Entry e;
+      std::int64_t  extents[2];
+      p += nameSize;
+      if (!read(p, end, &e.type, sizeof(e.type)) ||
+          !read(p, end, &e.rank, sizeof(e.rank)) ||
+          !read(p, end, extents, sizeof(extents)) ||
+          !read(p, end, &e.offset, sizeof(e.offset)) ||
+          !read(p, end, &e.size, sizeof(e.size)))
+        break;
+      e.extents[0] = extents[0];
+      e.extents[1] = extents[1];
+      if (!valid(e)) break;
+      mEntries.emplace(std::move(name), e);
+    }
+    if (mEntries.size() != count) mError = "Corrupt binary file";
+  }
+
+  // Rejects entries whose contents would fall outside the file, or that
+  // don't account for exactly the bytes they're given
+  bool valid(const binary::Entry& e) const
+  {
+    if (e.offset > mSize || e.size > mSize - e.offset) return false;
+    if (e.extents[0] < 0 || e.extents[1] < 0) return false;
+    std::uint64_t rows = asUnsigned(e.extents[0]);
+    std::uint64_t cols = asUnsigned(e.rank == 2 ? e.extents[1] : 1);
+    // every element takes at least 4 bytes, so more than size can't fit
+    if (cols > 0 && rows > e.size / cols) return false;
+    std::uint64_t n = rows * cols;
+    switch (e.type)
+    {
+    case binary::EntryType::kInteger:
+    case binary::EntryType::kReal:
+      return e.offset % binary::alignment == 0 &&
+             (e.rank == 0 ? e.size == 8 : e.size == n * 8);
+    case binary::EntryType::kFloat:
+      return e.offset % binary::alignment == 0 && e.rank > 0 &&
+             e.size == n * 4;
+    case binary::EntryType::kString:
+      return e.rank == 1 && n <= e.size / 8 && validStrings(e, n);
+    default: return false;
+    }
+  }
+
+  // The n lengths of a string entry, then its characters, must fill it
+  bool validStrings(const binary::Entry& e, std::uint64_t n) const
+  {
+    const char*   lengths = mData + e.offset;
+    std::uint64_t remaining = e.size - n * 8;
+    for (std::uint64_t i = 0; i < n; i++)
+    {
+      std::int64_t length;
+      std::memcpy(&length, lengths + i * 8, sizeof(length));
+      if (length < 0 || asUnsigned(length) > remaining) return false;
+      remaining -= asUnsigned(length);
+    }
+    return remaining == 0;
+  }
+
+  static bool read(const char*& p, const char* end, void* out, size_t size)
+  {
+    if (static_cast<size_t>(end - p) < size) return false;
+    std::memcpy(out, p, size);
+    p += size;
+    return true;
+  }
+
+#ifdef _WIN32
+  bool map(const string& fileName)
+  {
+    mFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFile, &size))
+    {
+      mError = "File not found";
+      return false;
+    }
+    mSize = static_cast<std::uint64_t>(size.QuadPart);
+    if (mSize == 0) return true;
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping)
+      mData = static_cast<const char*>(
+          MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!mData) mError = "Could not map file";
+    return ok();
+  }
+
+  void unmap()
+  {
+    if (mData) UnmapViewOfFile(mData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+  }
+
+  HANDLE mFile{INVALID_HANDLE_VALUE};
+  HANDLE mMapping{nullptr};
+#else
+  bool map(const string& fileName)
+  {
+    int         fd = open(fileName.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+      if (fd >= 0) close(fd);
+      mError = "File not found";
+      return false;
+    }
+    mSize = static_cast<std::uint64_t>(info.st_size);
+    if (mSize > 0)
+    {
+      void* p = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+        mError = "Could not map file";
+      else
+        mData = static_cast<const char*>(p);
+    }
+    close(fd);
+    return ok();
+  }
+
+  void unmap()
+  {
+    if (mData) munmap(const_cast<char*>(mData), mSize);
+  }
+#endif
+
+  const char*                               mData{nullptr};
+  std::uint64_t                             mSize{0};
+  std::unordered_map<string, binary::Entry> mEntries;
+  string                                    mError;
+};
+
+// FluidDataSet
+template <typename T>
+void to_binary(BinaryWriter& w, const FluidDataSet<std::string, T, 1>& ds,
+               const std::string& prefix = "")
+{
+  w.add(prefix + "cols", ds.pointSize());
+  w.add(prefix + "ids", ds.getIds());
+  w.add(prefix + "data", ds.getData());
+}
+
+template <typename T>
+bool check_binary(const BinaryReader& r, const FluidDataSet<std::string, T, 1>&,
+                  const std::string& prefix = "")
+{
+  using namespace binary;
+  return r.check(prefix + "cols", EntryType::kInteger, 0) &&
+         r.check(prefix + "ids", EntryType::kString, 1) &&
+         r.check(prefix + "data", entryType<T>(), 2) &&
+         r.extent(prefix + "data", 0) == r.extent(prefix + "ids", 0) &&
+         r.extent(prefix + "data", 1) == r.getIndex(prefix + "cols");
+}
+
+template <typename T>
+void from_binary(const BinaryReader& r, FluidDataSet<std::string, T, 1>& ds,
+                 const std::string& prefix = "")
+{
+  FluidTensor<std::string, 1> ids(r.extent(prefix + "ids", 0));
+  r.getStrings(prefix + "ids", ids);
+  ds = FluidDataSet<std::string, T, 1>(
+      ids, r.tensorView<T, 2>(prefix + "data"));
+}
+
+// LabelSets have string data, which is stored as one flat string table
+inline void to_binary(BinaryWriter&                                     w,
+                      const FluidDataSet<std::string, std::string, 1>& ls,
+                      const std::string& prefix = "")
+{
+  auto data = ls.getData();
+  w.add(prefix + "cols", ls.pointSize());
+  w.add(prefix + "ids", ls.getIds());
+  w.add(prefix + "data", FluidTensorView<const std::string, 1>(
+                             data.data(), 0, data.size()));
+}
+
+inline bool check_binary(const BinaryReader& r,
+                         const FluidDataSet<std::string, std::string, 1>&,
+                         const std::string& prefix = "")
+{
+  using namespace binary;
+  return r.check(prefix + "cols", EntryType::kInteger, 0) &&
+         r.check(prefix + "ids", EntryType::kString, 1) &&
+         r.check(prefix + "data", EntryType::kString, 1) &&
+         r.getIndex(prefix + "cols") >= 0 &&
+         r.extent(prefix + "data", 0) ==
+             r.extent(prefix + "ids", 0) * r.getIndex(prefix + "cols");
+}
+
+inline void from_binary(const BinaryReader&                         r,
+                        FluidDataSet<std::string, std::string, 1>& ls,
+                        const std::string&                         prefix = "")
+{
+  index                       rows = r.extent(prefix + "ids", 0);
+  index                       cols = r.getIndex(prefix + "cols");
+  FluidTensor<std::string, 1> ids(rows);
+  FluidTensor<std::string, 2> data(rows, cols);
+  r.getStrings(prefix + "ids", ids);
+  r.getStrings(prefix + "data",
+               FluidTensorView<std::string, 1>(data.data(), 0, data.size()));
+  ls = FluidDataSet<std::string, std::string, 1>(ids, data);
+}
+
+namespace algorithm {
+
+// Whether a saved metric is a Distance that Index supports
+template <typename Index>
+bool check_metric(const BinaryReader& r, const std::string& name)
+{
+  if (!r.check(name, binary::EntryType::kInteger, 0)) return false;
+  index value = r.getIndex(name);
+  return DistanceFuncs::valid(value) &&
+         Index::supports(static_cast<DistanceFuncs::Distance>(value));
+}
+
+// KDTree, and FloatKDTree, whose data is stored as float32
+template <typename T>
+void to_binary(BinaryWriter& w, const BasicKDTree<T>& tree,
+               const std::string& prefix = "")
+{
+  const auto& treeData = tree.toFlat();
+  w.add(prefix + "tree", FluidTensorView<const index, 2>(treeData.tree));
+  w.add(prefix + "ids", FluidTensorView<const std::string, 1>(treeData.ids));
+  w.add(prefix + "data", FluidTensorView<const T, 2>(treeData.data));
+  w.add(prefix + "metric", static_cast<index>(tree.metric()));
+}
+
+template <typename T>
+bool check_binary(const BinaryReader& r, const BasicKDTree<T>&,
+                  const std::string& prefix = "")
+{
+  using namespace binary;
+  return r.check(prefix + "tree", EntryType::kInteger, 2) &&
+         r.check(prefix + "ids", EntryType::kString, 1) &&
+         r.check(prefix + "data", entryType<T>(), 2) &&
+         check_metric<BasicKDTree<T>>(r, prefix + "metric") &&
+         r.extent(prefix + "tree", 0) == r.extent(prefix + "data", 0) &&
+         r.extent(prefix + "tree", 1) == 2 &&
+         r.extent(prefix + "ids", 0) == r.extent(prefix + "data", 0) &&
+         BasicKDTree<T>::valid(r.indexView<2>(prefix + "tree"));
+}
+
+template <typename T>
+void from_binary(const BinaryReader& r, BasicKDTree<T>& tree,
+                 const std::string& prefix = "")
+{
+  using Tree = BasicKDTree<T>;
+  auto                    data = r.tensorView<T, 2>(prefix + "data");
+  typename Tree::FlatData treeData(data.rows(), data.cols());
+  treeData.tree = r.indexView<2>(prefix + "tree");
+  treeData.data = data;
+  r.getStrings(prefix + "ids", treeData.ids);
+  tree.fromFlat(std::move(treeData),
+                static_cast<DistanceFuncs::Distance>(
+                    r.getIndex(prefix + "metric")));
+}
+
+// PCA
+inline void to_binary(BinaryWriter& w, const PCA& pca,
+                      const std::string& prefix = "")
+{
+  RealMatrix bases(pca.dims(), pca.size());
+  RealVector values(pca.size());
+  RealVector mean(pca.dims());
+  pca.getBases(bases);
+  pca.getValues(values);
+  pca.getMean(mean);
+  w.add(prefix + "bases", FluidTensorView<const double, 2>(bases));
+  w.add(prefix + "values", FluidTensorView<const double, 1>(values));
+  w.add(prefix + "mean", FluidTensorView<const double, 1>(mean));
+}
+
+inline bool check_binary(const BinaryReader& r, const PCA&,
+                         const std::string& prefix = "")
+{
+  using namespace binary;
+  return r.check(prefix + "bases", EntryType::kReal, 2) &&
+         r.check(prefix + "values", EntryType::kReal, 1) &&
+         r.check(prefix + "mean", EntryType::kReal, 1) &&
+         r.extent(prefix + "mean", 0) == r.extent(prefix + "bases", 0) &&
+         r.extent(prefix + "values", 0) == r.extent(prefix + "bases", 1);
+}
+
+inline void from_binary(const BinaryReader& r, PCA& pca,
+                        const std::string& prefix = "")
+{
+  RealMatrix bases(r.realView<2>(prefix + "bases"));
+  RealVector values(r.realView<1>(prefix + "values"));
+  RealVector mean(r.realView<1>(prefix + "mean"));
+  pca.init(bases, values, mean);
+}
+
+// MLP
+inline void to_binary(BinaryWriter& w, const MLP& mlp,
+                      const std::string& prefix = "")
+{
+  w.add(prefix + "layers", mlp.size());
+  for (index i = 0; i < mlp.size(); i++)
+  {
+    std::string layer = prefix + "layers/" + std::to_string(i) + "/";
+    RealMatrix  W(mlp.inputSize(i), mlp.outputSize(i + 1));
+    RealVector  b(mlp.outputSize(i + 1));
+    index       a;
+    mlp.getParameters(i, W, b, a);
+    w.add(layer + "weights", FluidTensorView<const double, 2>(W));
+    w.add(layer + "biases", FluidTensorView<const double, 1>(b));
+    w.add(layer + "activation", a);
+  }
+}
+
+inline bool check_binary(const BinaryReader& r, const MLP&,
+                         const std::string& prefix = "")
+{
+  using namespace binary;
+  if (!r.check(prefix + "layers", EntryType::kInteger, 0)) return false;
+  index nLayers = r.getIndex(prefix + "layers");
+  if (nLayers < 1) return false;
+  index inputSize = -1;
+  for (index i = 0; i < nLayers; i++)
+  {
+    std::string layer = prefix + "layers/" + std::to_string(i) + "/";
+    if (!r.check(layer + "weights", EntryType::kReal, 2) ||
+        !r.check(layer + "biases", EntryType::kReal, 1) ||
+        !r.check(layer + "activation", EntryType::kInteger, 0) ||
+        !NNActivations::valid(r.getIndex(layer + "activation")))
+      return false;
+    if (inputSize >= 0 && r.extent(layer + "weights", 0) != inputSize)
+      return false;
+    inputSize = r.extent(layer + "weights", 1);
+    if (r.extent(layer + "biases", 0) != inputSize) return false;
+  }
+  return true;
+}
+
+inline void from_binary(const BinaryReader& r, MLP& mlp,
+                        const std::string& prefix = "")
+{
+  index nLayers = r.getIndex(prefix + "layers");
+  if (nLayers <= 0) return;
+  auto layer = [&prefix](index i) {
+    return prefix + "layers/" + std::to_string(i) + "/";
+  };
+  FluidTensor<index, 1> hiddenSizes(nLayers - 1);
+  for (index i = 0; i < nLayers - 1; i++)
+    hiddenSizes(i) = r.extent(layer(i) + "weights", 1);
+  mlp.init(r.extent(layer(0) + "weights", 0),
+           r.extent(layer(nLayers - 1) + "weights", 1), hiddenSizes,
+           r.getIndex(layer(0) + "activation"),
+           r.getIndex(layer(nLayers - 1) + "activation"));
+  for (index i = 0; i < nLayers; i++)
+  {
+    RealMatrix W(r.realView<2>(layer(i) + "weights"));
+    RealVector b(r.realView<1>(layer(i) + "biases"));
+    mlp.setParameters(i, W, b, r.getIndex(layer(i) + "activation"));
+  }
+  mlp.setTrained(true);
+}
+
+// UMAP
+inline void to_binary(BinaryWriter& w, const UMAP& umap,
+                      const std::string& prefix = "")
+{
+  RealMatrix embedding(umap.size(), umap.dims());
+  umap.getEmbedding(embedding);
+  w.add(prefix + "embedding", FluidTensorView<const double, 2>(embedding));
+  to_binary(w, umap.getTree(), prefix + "tree/");
+  w.add(prefix + "a", umap.getA());
+  w.add(prefix + "b", umap.getB());
+  w.add(prefix + "k", umap.getK());
+}
+
+// The tree's ids must be the rows of the embedding, see UMAP::init
+inline bool validTreeIds(const BinaryReader& r, const std::string& prefix)
+{
+  FluidTensor<std::string, 1> ids(r.extent(prefix + "tree/ids", 0));
+  r.getStrings(prefix + "tree/ids", ids);
+  return UMAP::idsAreRows(ids, r.extent(prefix + "embedding", 0));
+}
+
+inline bool check_binary(const BinaryReader& r, const UMAP&,
+                         const std::string& prefix = "")
+{
+  using namespace binary;
+  return r.check(prefix + "embedding", EntryType::kReal, 2) &&
+         r.check(prefix + "a", EntryType::kReal, 0) &&
+         r.check(prefix + "b", EntryType::kReal, 0) &&
+         r.check(prefix + "k", EntryType::kInteger, 0) &&
+         check_binary(r, KDTree(), prefix + "tree/") && validTreeIds(r, prefix);
+}
+
+inline void from_binary(const BinaryReader& r, UMAP& umap,
+                        const std::string& prefix = "")
+{
+  RealMatrix embedding(r.realView<2>(prefix + "embedding"));
+  KDTree     tree;
+  from_binary(r, tree, prefix + "tree/");
+  umap.init(embedding, std::move(tree), r.getIndex(prefix + "k"),
+            r.getReal(prefix + "a"), r.getReal(prefix + "b"));
+}
+
+} // namespace algorithm
+
+namespace binary {
+namespace impl {
+template <typename T, typename = void>
+struct Supported : std::false_type
+{};
+
+template <typename T>
+struct Supported<T, decltype(to_binary(std::declval<BinaryWriter&>(),
+                                       std::declval<const T&>()))>
+    : std::true_type
+{};
+} // namespace impl
+
+// Whether T can be saved to and loaded from the binary format
+template <typename T>
+constexpr bool isSupported()
+{
+  return impl::Supported<T>::value;
+}
+} // namespace binary
+
+} // namespace fluid
@@ -0,0 +1,209 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "FluidIndex.hpp"
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fluid {
+
+// The values of one column of a dataset in ascending order, each with the row
+// it's in, so that range conditions on the column can be answered by binary
+// search. NaNs are left out, as no range contains them.
+//
+// Entries are kept in a sorted sequence of blocks, as in a B-tree of depth
+// two. Bulk additions fill blocks of mBlockSize (512); a block is split in two
+// once it holds more than 2 * mBlockSize, and merged with the next once it
+// holds fewer than mBlockSize / 4. A single change then finds its block by
+// binary search and moves at most 2 * mBlockSize entries within it, plus one
+// slot per block when a block is split or merged.
+template <typename T, bool = std::is_arithmetic<T>::value>
+class ColumnIndex
+{
+public:
+  using Entry = std::pair<T, index>;
+
+  explicit ColumnIndex(index column) : mColumn(column) {}
+
+  index column() const { return mColumn; }
+  index size() const { return mSize; }
+
+  // Adds rows [from, to) of data, whose rows are rowSize values apart
+  void add(const T* data, index rowSize, index from, index to)
+  {
+    std::vector<Entry> entries;
+    entries.reserve(asUnsigned(mSize + to - from));
+    for (auto& b : mBlocks) entries.insert(entries.end(), b.begin(), b.end());
+    auto middle = asSigned(entries.size());
+    for (index row = from; row < to; row++)
+    {
+      T value = data[row * rowSize + mColumn];
+      if (value == value) entries.emplace_back(value, row);
+    }
+    std::sort(entries.begin() + middle, entries.end(), less);
+    std::inplace_merge(entries.begin(), entries.begin() + middle,
+                       entries.end(), less);
+    mBlocks.clear();
+    for (index i = 0; i < asSigned(entries.size()); i += mBlockSize)
+    {
+      index end = std::min(i + mBlockSize, asSigned(entries.size()));
+      mBlocks.emplace_back(entries.begin() + i, entries.begin() + end);
+    }
+    mSize = asSigned(entries.size());
+  }
+
+  void insert(T value, index row)
+  {
+    if (value != value) return;
+    Entry entry{value, row};
+    mSize++;
+    if (mBlocks.empty())
+    {
+      mBlocks.push_back({entry});
+      return;
+    }
+    // the first block ending above value, or else the last
+    auto b = std::upper_bound(
+        mBlocks.begin(), mBlocks.end(), value,
+        [](T v, const Block& block) { return v < block.back().first; });
+    if (b == mBlocks.end()) --b;
+    b->insert(std::upper_bound(b->begin(), b->end(), entry, less), entry);
+    if (asSigned(b->size()) > 2 * mBlockSize)
+    {
+      Block upper(b->begin() + mBlockSize, b->end());
+      b->resize(asUnsigned(mBlockSize));
+      mBlocks.insert(b + 1, std::move(upper));
+    }
+  }
+
+  void erase(T value, index row)
+  {
+    auto pos = find(value, row);
+    if (pos.first == mBlocks.end()) return;
+    auto b = pos.first;
+    b->erase(pos.second);
+    mSize--;
+    if (b->empty())
+      mBlocks.erase(b);
+    else if (asSigned(b->size()) < mBlockSize / 4 && b + 1 != mBlocks.end() &&
+             asSigned(b->size() + (b + 1)->size()) <= 2 * mBlockSize)
+    {
+      b->insert(b->end(), (b + 1)->begin(), (b + 1)->end());
+      mBlocks.erase(b + 1);
+    }
+  }
+
+  // For when the point holding value moves from one row to another
+  void relocate(T value, index from, index to)
+  {
+    auto pos = find(value, from);
+    if (pos.first != mBlocks.end()) pos.second->second = to;
+  }
+
+  // Number of entries with values between lo and hi, each bound inclusive or
+  // not
+  index count(T lo, bool loInclusive, T hi, bool hiInclusive) const
+  {
+    index result = 0;
+    visitRange(lo, loInclusive, hi, hiInclusive,
+               [&](BlockIterator first, BlockIterator last) {
+                 result += std::distance(first, last);
+               });
+    return result;
+  }
+
+  // Calls f with the row of each entry in the range, in order of value
+  template <typename F>
+  void forEach(T lo, bool loInclusive, T hi, bool hiInclusive, F&& f) const
+  {
+    visitRange(lo, loInclusive, hi, hiInclusive,
+               [&](BlockIterator first, BlockIterator last) {
+                 for (; first != last; ++first) f(first->second);
+               });
+  }
+
+private:
+  using Block = std::vector<Entry>;
+  using BlockIterator = typename Block::const_iterator;
+
+  // values only: the order of rows holding the same value doesn't matter
+  static bool less(const Entry& a, const Entry& b) { return a.first < b.first; }
+
+  template <typename F>
+  void visitRange(T lo, bool loInclusive, T hi, bool hiInclusive, F&& f) const
+  {
+    auto tooLow = [&](const Entry& e) {
+      return loInclusive ? e.first < lo : !(lo < e.first);
+    };
+    auto notTooHigh = [&](const Entry& e) {
+      return hiInclusive ? !(hi < e.first) : e.first < hi;
+    };
+    auto b = std::partition_point(
+        mBlocks.begin(), mBlocks.end(),
+        [&](const Block& block) { return tooLow(block.back()); });
+    for (; b != mBlocks.end(); ++b)
+    {
+      auto first = std::partition_point(b->begin(), b->end(), tooLow);
+      auto last = std::partition_point(first, b->end(), notTooHigh);
+      if (first != last) f(first, last);
+      if (last != b->end()) break;
+    }
+  }
+
+  std::pair<typename std::vector<Block>::iterator, typename Block::iterator>
+  find(T value, index row)
+  {
+    auto b = std::lower_bound(
+        mBlocks.begin(), mBlocks.end(), value,
+        [](const Block& block, T v) { return block.back().first < v; });
+    for (; b != mBlocks.end() && !(value < b->front().first); ++b)
+    {
+      auto range = std::equal_range(b->begin(), b->end(), Entry{value, row},
+                                    less);
+      auto pos = std::find_if(range.first, range.second, [row](const Entry& e) {
+        return e.second == row;
+      });
+      if (pos != range.second) return {b, pos};
+    }
+    return {mBlocks.end(), {}};
+  }
+
+  static constexpr index mBlockSize{512};
+
+  index              mColumn;
+  index              mSize{0};
+  std::vector<Block> mBlocks;
+};
+
+// Values that aren't ordered can't be indexed, so datasets of them keep no
+// column indexes and the changes they pass on are ignored
+template <typename T>
+class ColumnIndex<T, false>
+{
+public:
+  explicit ColumnIndex(index column) : mColumn(column) {}
+  index column() const { return mColumn; }
+  index size() const { return 0; }
+  index count(const T&, bool, const T&, bool) const { return 0; }
+  void  add(const T*, index, index, index) {}
+  void  insert(const T&, index) {}
+  void  erase(const T&, index) {}
+  void  relocate(const T&, index, index) {}
+
+private:
+  index mColumn;
+};
+
+} // namespace fluid
@@ -1,12 +1,16 @@
 #pragma once
 
+#include "data/FluidColumnIndex.hpp"
+#include "data/FluidIdIndex.hpp"
 #include "data/FluidIndex.hpp"
 #include "data/FluidTensor.hpp"
 #include "data/TensorTypes.hpp"
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <type_traits>
+#include <vector>
 
 namespace fluid {
 
@@ -22,7 +26,10 @@ public:
   // e.g. FluidDataSet(2, 3) is a dataset of 2x3 tensors
   template <typename... Dims,
             typename = std::enable_if_t<isIndexSequence<Dims...>()>>
-  FluidDataSet(Dims... dims) : mData(0, dims...), mDim(dims...)
+  FluidDataSet(Dims... dims)
+      : mStorage(std::make_shared<Storage>(FluidTensor<dataType, N + 1>(
+            0, dims...))),
+        mDim(dims...)
   {
     static_assert(sizeof...(dims) == N, "Number of dimensions doesn't match");
   }
@@ -30,7 +37,15 @@ public:
   // Construct from existing tensors of ids and data points
   FluidDataSet(FluidTensorView<const idType, 1>       ids,
                FluidTensorView<const dataType, N + 1> points)
-      : mIds(ids), mData(points)
+      : mStorage(std::make_shared<Storage>(ids, points))
+  {
+    initFromData();
+  }
+
+  // Construct by taking over tensors of ids and data points
+  FluidDataSet(FluidTensor<idType, 1>&&       ids,
+               FluidTensor<dataType, N + 1>&& points)
+      : mStorage(std::make_shared<Storage>(std::move(ids), std::move(points)))
   {
     initFromData();
   }
@@ -41,7 +56,7 @@ public:
   FluidDataSet(FluidTensorView<const idType, 1> ids,
                FluidTensorView<const U, N + 1>  points,
                std::enable_if_t<std::is_convertible<U, T>::value>* = nullptr)
-      : mIds(ids), mData(points)
+      : mStorage(std::make_shared<Storage>(ids, FluidTensor<T, N + 1>(points)))
   {
     initFromData();
   }
@@ -54,7 +69,8 @@ public:
     static_assert(sizeof...(dims) == N, "Number of dimensions doesn't match");
     if (size() == 0)
     {
-      mData = FluidTensor<dataType, N + 1>(0, dims...);
+      mStorage = std::make_shared<Storage>(FluidTensor<dataType, N + 1>(
+          0, dims...));
       mDim = FluidTensorSlice<N>(dims...);
       return true;
     }
@@ -64,70 +80,170 @@ public:
     }
   }
 
-  bool add(idType id, FluidTensorView<dataType, N> point)
+  bool add(idType id, FluidTensorView<const dataType, N> point)
   {
     assert(sameExtents(mDim, point.descriptor()));
-    index pos = mData.rows();
-    auto  result = mIndex.insert({id, pos});
-    if (!result.second) return false;
-    mData.resizeDim(0, 1);
-    mData.row(mData.rows() - 1) = point;
-    mIds.resizeDim(0, 1);
-    mIds(mIds.rows() - 1) = id;
+    Storage& storage = mutableStorage();
+    index    pos = storage.data.rows();
+    if (!storage.positions.insert(storage.ids, id, pos)) return false;
+    storage.data.resizeDim(0, 1);
+    storage.data.row(pos) = point;
+    storage.ids.resizeDim(0, 1);
+    storage.ids(pos) = id;
+    for (auto& c : storage.columnIndexes)
+      c.insert(valueAt(storage, pos, c.column()), pos);
     return true;
   }
 
-  bool get(idType id, FluidTensorView<dataType, N> point) const
+  // Adds many points with a single resize of the storage. If any id is already
+  // present, or repeated, nothing is added.
+  bool addRange(FluidTensorView<const idType, 1>       ids,
+                FluidTensorView<const dataType, N + 1> points)
   {
-    auto pos = mIndex.find(id);
-    if (pos == mIndex.end()) return false;
-    point = mData.row(pos->second);
+    assert(ids.size() == points.rows());
+    Storage& storage = mutableStorage();
+    index    start = size();
+    storage.ids.resizeDim(0, ids.size());
+    storage.ids(Slice(start)) = ids;
+    storage.positions.reserve(start + ids.size());
+    for (index i = 0; i < ids.size(); i++)
+    {
+      if (!storage.positions.insert(storage.ids, ids(i), start + i))
+      {
+        for (index j = 0; j < i; j++)
+          storage.positions.erase(storage.ids, ids(j));
+        storage.ids.resizeDim(0, -ids.size());
+        return false;
+      }
+    }
+    storage.data.resizeDim(0, points.rows());
+    for (index i = 0; i < ids.size(); i++)
+    {
+      assert(sameExtents(mDim, points.row(i).descriptor()));
+      storage.data.row(start + i) = points.row(i);
+    }
+    for (auto& c : storage.columnIndexes)
+      c.add(storage.data.data(), pointSize(), start, size());
     return true;
   }
 
-  index getIndex(idType id) const
+  bool get(const idType& id, FluidTensorView<dataType, N> point) const
   {
-    auto pos = mIndex.find(id);
-    if (pos == mIndex.end())
-      return -1;
-    else
-      return pos->second;
+    index pos = getIndex(id);
+    if (pos == -1) return false;
+    point = mStorage->data.row(pos);
+    return true;
   }
 
-  bool update(idType id, FluidTensorView<dataType, N> point)
+  index getIndex(const idType& id) const
   {
-    auto pos = mIndex.find(id);
-    if (pos == mIndex.end())
-      return false;
-    else
-      mData.row(pos->second) = point;
+    return mStorage->positions.find(mStorage->ids, id);
+  }
+
+  bool update(idType id, FluidTensorView<const dataType, N> point)
+  {
+    index pos = getIndex(id);
+    if (pos == -1) return false;
+    Storage& storage = mutableStorage();
+    for (auto& c : storage.columnIndexes)
+      c.erase(valueAt(storage, pos, c.column()), pos);
+    storage.data.row(pos) = point;
+    for (auto& c : storage.columnIndexes)
+      c.insert(valueAt(storage, pos, c.column()), pos);
     return true;
   }
 
-  bool remove(idType id)
+  // Constant time: the last point is moved into the place of the removed one,
+  // so the order of points is not preserved
+  bool remove(const idType& id)
   {
-    auto pos = mIndex.find(id);
-    if (pos == mIndex.end()) { return false; }
-    else
+    index current = getIndex(id);
+    if (current == -1) return false;
+    Storage& storage = mutableStorage();
+    index    last = size() - 1;
+    storage.positions.erase(storage.ids, id);
+    for (auto& c : storage.columnIndexes)
+      c.erase(valueAt(storage, current, c.column()), current);
+    if (current != last)
     {
-      auto current = pos->second;
-      mData.deleteRow(current);
-      mIds.deleteRow(current);
-      mIndex.erase(id);
-      for (auto& point : mIndex)
-        if (point.second > current) point.second--;
+      storage.positions.relocate(storage.ids, storage.ids(last), current);
+      for (auto& c : storage.columnIndexes)
+        c.relocate(valueAt(storage, last, c.column()), last, current);
+      storage.data.row(current) = storage.data.row(last);
+      storage.ids(current) = std::move(storage.ids(last));
     }
+    storage.data.resizeDim(0, -1);
+    storage.ids.resizeDim(0, -1);
     return true;
   }
 
-  FluidTensorView<dataType, N + 1> getData() const { return mData; }
-  FluidTensorView<idType, 1>       getIds() const { return mIds; }
-  index                            pointSize() const { return mDim.size; }
-  index                            dims() const { return mDim.size; }
-  index                            size() const { return mIds.size(); }
-  bool                             initialized() { return (size() > 0); }
+  // Keeps a sorted index of the values in a column of the flattened points,
+  // which DataSetQuery uses to answer range conditions without a full scan.
+  // Indexes are kept up to date as points are added, updated and removed, at
+  // a cost per change of a binary search and moving at most 1024 entries, plus
+  // size / 512 block slots when a block is split or merged (see ColumnIndex),
+  // and are dropped if the dataset is resized or written through getData().
+  void indexColumn(index column)
+  {
+    static_assert(std::is_arithmetic<dataType>::value,
+                  "Only numeric columns can be indexed");
+    assert(column >= 0 && column < pointSize());
+    if (getColumnIndex(column)) return;
+    Storage& storage = mutableStorage();
+    storage.columnIndexes.emplace_back(column);
+    storage.columnIndexes.back().add(storage.data.data(), pointSize(), 0,
+                                     size());
+  }
+
+  // The index of a column, or nullptr if it has none
+  const ColumnIndex<dataType>* getColumnIndex(index column) const
+  {
+    for (auto& c : mStorage->columnIndexes)
+      if (c.column() == column) return &c;
+    return nullptr;
+  }
+
+  void clearColumnIndexes()
+  {
+    if (!mStorage->columnIndexes.empty())
+      mutableStorage().columnIndexes.clear();
+  }
+
+  // Views of storage that may be shared with copies of this dataset
+  FluidTensorView<const dataType, N + 1> getData() const
+  {
+    return mStorage->data;
+  }
+  FluidTensorView<const idType, 1> getIds() const { return mStorage->ids; }
+
+  // A view to change points in place. Storage is unshared first, so this
+  // copies it if there are other copies of the dataset: prefer the const
+  // view for reading. Column indexes are dropped, as writes through the view
+  // would leave them out of date. Ids are only changed by add and remove, so
+  // that they stay in step with the index of their positions.
+  FluidTensorView<dataType, N + 1> getData()
+  {
+    Storage& storage = mutableStorage();
+    storage.columnIndexes.clear();
+    return storage.data;
+  }
+
+  index pointSize() const { return mDim.size; }
+  index dims() const { return mDim.size; }
+  index size() const { return mStorage->ids.size(); }
+  bool  initialized() { return (size() > 0); }
+
+  // Whether this is the only copy of the dataset holding its storage, so that
+  // destroying or changing it would free that storage
+  bool unique() const { return mStorage.use_count() == 1; }
 
-  std::string printRow(FluidTensorView<dataType, N> row, index maxCols) const
+  bool sharesStorage(const FluidDataSet& other) const
+  {
+    return mStorage == other.mStorage;
+  }
+
+  std::string printRow(FluidTensorView<const dataType, N> row,
+                       index                              maxCols) const
   {
     using namespace std;
     ostringstream result;
@@ -157,7 +273,7 @@ public:
     {
       for (index r = 0; r < size(); r++)
       {
-        result << mIds(r) << " " << printRow(mData.row(r), maxCols)
+        result << getIds()(r) << " " << printRow(getData().row(r), maxCols)
                << std::endl;
       }
     }
@@ -165,30 +281,65 @@ public:
     {
       for (index r = 0; r < maxRows / 2; r++)
       {
-        result << mIds(r) << " " << printRow(mData.row(r), maxCols)
+        result << getIds()(r) << " " << printRow(getData().row(r), maxCols)
                << std::endl;
       }
       result << setw(10) << "..." << std::endl;
       for (index r = maxRows / 2; r > 0; r--)
       {
-        result << mIds(size() - r) << " "
-               << printRow(mData.row(size() - r), maxCols) << std::endl;
+        result << getIds()(size() - r) << " "
+               << printRow(getData().row(size() - r), maxCols) << std::endl;
       }
     }
     return result.str();
   }
 
 private:
+  struct Storage
+  {
+    Storage() = default;
+    Storage(FluidTensor<dataType, N + 1> points) : data(std::move(points)) {}
+    Storage(FluidTensorView<const idType, 1>       ids,
+            FluidTensorView<const dataType, N + 1> points)
+        : ids(ids), data(points)
+    {}
+    Storage(FluidTensor<idType, 1>&& ids, FluidTensor<dataType, N + 1>&& points)
+        : ids(std::move(ids)), data(std::move(points))
+    {}
+
+    IdIndex<idType>                    positions;
+    FluidTensor<idType, 1>             ids;
+    FluidTensor<dataType, N + 1>       data;
+    std::vector<ColumnIndex<dataType>> columnIndexes;
+  };
+
+  // Copies of a dataset share storage until one of them is modified, so that
+  // clients can take a snapshot of a dataset without copying it
+  Storage& mutableStorage()
+  {
+    if (mStorage.use_count() > 1)
+      mStorage = std::make_shared<Storage>(*mStorage);
+    return *mStorage;
+  }
+
+  // Element of a point, counting through its values in storage order
+  const dataType& valueAt(const Storage& storage, index row,
+                          index column) const
+  {
+    return storage.data.data()[row * pointSize() + column];
+  }
+
   void initFromData()
   {
-    assert(mIds.rows() == mData.rows());
-    mDim = mData.cols();
-    for (index i = 0; i < mIds.size(); i++) { mIndex.insert({mIds[i], i}); }
+    Storage& storage = *mStorage;
+    assert(storage.ids.rows() == storage.data.rows());
+    mDim = storage.data.cols();
+    storage.positions.reserve(storage.ids.size());
+    for (index i = 0; i < storage.ids.size(); i++)
+      storage.positions.insert(storage.ids, storage.ids(i), i);
   }
 
-  mutable std::unordered_map<idType, index> mIndex;
-  mutable FluidTensor<idType, 1>            mIds;
-  mutable FluidTensor<dataType, N + 1>      mData;
-  FluidTensorSlice<N>                       mDim;
+  std::shared_ptr<Storage> mStorage{std::make_shared<Storage>()};
+  FluidTensorSlice<N>      mDim;
 };
 } // namespace fluid
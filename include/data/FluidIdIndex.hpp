@@ -0,0 +1,150 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "FluidIndex.hpp"
+#include "FluidTensor.hpp"
+#include <functional>
+#include <vector>
+
+namespace fluid {
+
+// Hash index from ids to rows of a column of ids, which stays the only copy of
+// each id: slots hold just a row number and the id's hash, in one flat table
+// with linear probing. Compared to a std::unordered_map keyed on the ids, this
+// saves a string copy and a node allocation per row.
+//
+// The index doesn't own the ids, so the column is passed to every call that
+// needs to compare them, and must be kept in step by the caller: erase or
+// relocate an id while it is still in its old row.
+template <typename idType>
+class IdIndex
+{
+public:
+  using Ids = FluidTensorView<const idType, 1>;
+
+  index size() const { return mSize; }
+
+  void clear()
+  {
+    mSlots.clear();
+    mSize = 0;
+  }
+
+  void reserve(index n)
+  {
+    if (tableSizeFor(n) > mSlots.size()) rehash(tableSizeFor(n));
+  }
+
+  // Returns the row of id, or -1 if it isn't present
+  index find(Ids ids, const idType& id) const
+  {
+    if (mSize == 0) return -1;
+    index slot = slotOf(ids, id, hash(id));
+    return slot == -1 ? -1 : mSlots[asUnsigned(slot)].row;
+  }
+
+  // Adds id at row, unless id is already present. Only existing entries are
+  // compared against, so row itself needn't hold id yet.
+  bool insert(Ids ids, const idType& id, index row)
+  {
+    reserve(mSize + 1);
+    size_t h = hash(id);
+    size_t i = h & mask();
+    for (; mSlots[i].row != -1; i = (i + 1) & mask())
+    {
+      if (mSlots[i].hash == h && ids(mSlots[i].row) == id) return false;
+    }
+    mSlots[i] = {row, h};
+    mSize++;
+    return true;
+  }
+
+  bool erase(Ids ids, const idType& id)
+  {
+    if (mSize == 0) return false;
+    index slot = slotOf(ids, id, hash(id));
+    if (slot == -1) return false;
+    // backward shift deletion: pull later entries of the probe sequence into
+    // the gap, so that lookups never need tombstones
+    size_t i = asUnsigned(slot);
+    for (size_t j = (i + 1) & mask(); mSlots[j].row != -1;
+         j = (j + 1) & mask())
+    {
+      size_t home = mSlots[j].hash & mask();
+      bool   movable = i <= j ? (home <= i || home > j) : (home <= i && home > j);
+      if (movable)
+      {
+        mSlots[i] = mSlots[j];
+        i = j;
+      }
+    }
+    mSlots[i].row = -1;
+    mSize--;
+    return true;
+  }
+
+  // Points id at a new row, for when the caller moves it there
+  bool relocate(Ids ids, const idType& id, index row)
+  {
+    if (mSize == 0) return false;
+    index slot = slotOf(ids, id, hash(id));
+    if (slot == -1) return false;
+    mSlots[asUnsigned(slot)].row = row;
+    return true;
+  }
+
+private:
+  struct Slot
+  {
+    index  row{-1};
+    size_t hash{0};
+  };
+
+  static size_t hash(const idType& id) { return std::hash<idType>{}(id); }
+
+  // at most half full, so probe sequences stay short
+  static size_t tableSizeFor(index n)
+  {
+    size_t size = 8;
+    while (size < 2 * asUnsigned(n)) size *= 2;
+    return size;
+  }
+
+  size_t mask() const { return mSlots.size() - 1; }
+
+  index slotOf(Ids ids, const idType& id, size_t h) const
+  {
+    for (size_t i = h & mask(); mSlots[i].row != -1; i = (i + 1) & mask())
+    {
+      if (mSlots[i].hash == h && ids(mSlots[i].row) == id) return asSigned(i);
+    }
+    return -1;
+  }
+
+  void rehash(size_t size)
+  {
+    std::vector<Slot> old(size);
+    std::swap(old, mSlots);
+    for (const Slot& s : old)
+    {
+      if (s.row == -1) continue;
+      size_t i = s.hash & mask();
+      while (mSlots[i].row != -1) i = (i + 1) & mask();
+      mSlots[i] = s;
+    }
+  }
+
+  std::vector<Slot> mSlots;
+  index             mSize{0};
+};
+
+} // namespace fluid
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithms/public/KDTree.hpp>
+#include <algorithms/public/VPTree.hpp>
+#include <algorithms/public/HNSW.hpp>
 #include <algorithms/public/KMeans.hpp>
 #include <algorithms/public/Normalization.hpp>
 #include <algorithms/public/RobustScaling.hpp>
@@ -133,23 +135,35 @@ void from_json(const nlohmann::json &j, FluidDataSet<std::string, T, 1> &ds) {
 }
 
 namespace algorithm {
+// Whether a saved metric is a Distance that Index supports
+template <typename Index>
+bool check_metric(const nlohmann::json &metric) {
+  if (!metric.is_number_integer()) return false;
+  index value = metric.get<index>();
+  return DistanceFuncs::valid(value) &&
+         Index::supports(static_cast<DistanceFuncs::Distance>(value));
+}
+
 // KDTree
 void to_json(nlohmann::json &j, const KDTree &tree) {
-  KDTree::FlatData treeData = tree.toFlat();
-  j["tree"] = FluidTensorView<index, 2>(treeData.tree);
+  const KDTree::FlatData& treeData = tree.toFlat();
+  j["tree"] = FluidTensorView<const index, 2>(treeData.tree);
   j["rows"] = treeData.data.rows();
   j["cols"] = treeData.data.cols();
-  j["data"] = FluidTensorView<double, 2>(treeData.data);
-  j["ids"] = FluidTensorView<std::string, 1>(treeData.ids);
+  j["data"] = FluidTensorView<const double, 2>(treeData.data);
+  j["ids"] = FluidTensorView<const std::string, 1>(treeData.ids);
+  j["metric"] = static_cast<index>(tree.metric());
 }
 
 bool check_json(const nlohmann::json &j, const KDTree &) {
-  return fluid::check_json(j,
+  if (!fluid::check_json(j,
     {"rows", "cols", "data", "tree", "ids"},
     {JSONTypes::NUMBER, JSONTypes::NUMBER,
       JSONTypes::ARRAY, JSONTypes::ARRAY, JSONTypes::ARRAY
     }
-  );
+  )) return false;
+  // trees saved before metrics were configurable have none
+  return !j.contains("metric") || check_metric<KDTree>(j.at("metric"));
 }
 
 void from_json(const nlohmann::json &j, KDTree &tree) {
@@ -159,7 +173,111 @@ void from_json(const nlohmann::json &j, KDTree &tree) {
   j.at("tree").get_to(treeData.tree);
   j.at("data").get_to(treeData.data);
   j.at("ids").get_to(treeData.ids);
-  tree.fromFlat(treeData);
+  // trees saved before metrics were configurable are Euclidean
+  index euclidean = static_cast<index>(KDTree::Distance::kEuclidean);
+  auto  metric = static_cast<KDTree::Distance>(j.value("metric", euclidean));
+  tree.fromFlat(std::move(treeData), metric);
+}
+
+// VPTree
+void to_json(nlohmann::json &j, const VPTree &tree) {
+  const VPTree::FlatData& treeData = tree.toFlat();
+  j["tree"] = FluidTensorView<const index, 2>(treeData.tree);
+  j["radii"] = FluidTensorView<const double, 1>(treeData.radii);
+  j["rows"] = treeData.data.rows();
+  j["cols"] = treeData.data.cols();
+  j["data"] = FluidTensorView<const double, 2>(treeData.data);
+  j["ids"] = FluidTensorView<const std::string, 1>(treeData.ids);
+  j["metric"] = static_cast<index>(tree.metric());
+}
+
+bool check_json(const nlohmann::json &j, const VPTree &) {
+  return fluid::check_json(j,
+    {"rows", "cols", "data", "tree", "radii", "ids", "metric"},
+    {JSONTypes::NUMBER, JSONTypes::NUMBER, JSONTypes::ARRAY,
+      JSONTypes::ARRAY, JSONTypes::ARRAY, JSONTypes::ARRAY, JSONTypes::NUMBER
+    }
+  ) && check_metric<VPTree>(j.at("metric"));
+}
+
+void from_json(const nlohmann::json &j, VPTree &tree) {
+  index rows = j.at("rows");
+  index cols = j.at("cols");
+  VPTree::FlatData treeData(rows, cols);
+  j.at("tree").get_to(treeData.tree);
+  j.at("radii").get_to(treeData.radii);
+  j.at("data").get_to(treeData.data);
+  j.at("ids").get_to(treeData.ids);
+  auto metric = static_cast<VPTree::Distance>(j.at("metric").get<index>());
+  tree.fromFlat(std::move(treeData), metric);
+}
+
+// HNSW
+void to_json(nlohmann::json &j, const HNSW &hnsw) {
+  const HNSW::FlatData& graph = hnsw.toFlat();
+  j["rows"] = graph.data.rows();
+  j["cols"] = graph.data.cols();
+  j["maxLinks"] = hnsw.maxLinks();
+  j["entryPoint"] = hnsw.entryPoint();
+  j["metric"] = static_cast<index>(hnsw.metric());
+  j["levels"] = FluidTensorView<const index, 1>(graph.levels);
+  j["upperOffsets"] = FluidTensorView<const index, 1>(graph.upperOffsets);
+  // small graphs may have no upper layers, and empty ones no nodes, but these
+  // should still be arrays
+  for (auto key : {"links", "upperLinks", "data"})
+    j[key] = nlohmann::json::array();
+  for (index i = 0; i < graph.links.rows(); i++)
+    j["links"].push_back(graph.links.row(i));
+  for (index i = 0; i < graph.upperLinks.rows(); i++)
+    j["upperLinks"].push_back(graph.upperLinks.row(i));
+  for (index i = 0; i < graph.data.rows(); i++)
+    j["data"].push_back(graph.data.row(i));
+  j["ids"] = FluidTensorView<const std::string, 1>(graph.ids);
+}
+
+// The graph's tables, each sized as in the file
+HNSW::FlatData read_graph(const nlohmann::json &j) {
+  index rows = j.at("rows");
+  index cols = j.at("cols");
+  index maxLinks = j.at("maxLinks");
+  index upperRows = asSigned(j.at("upperLinks").size());
+  HNSW::FlatData graph(rows, cols, maxLinks, upperRows);
+  j.at("levels").get_to(graph.levels);
+  j.at("links").get_to(graph.links);
+  j.at("upperOffsets").get_to(graph.upperOffsets);
+  j.at("upperLinks").get_to(graph.upperLinks);
+  j.at("data").get_to(graph.data);
+  j.at("ids").get_to(graph.ids);
+  return graph;
+}
+
+bool check_json(const nlohmann::json &j, const HNSW &) {
+  if (!fluid::check_json(j,
+    {"rows", "cols", "maxLinks", "entryPoint", "metric", "levels", "links",
+      "upperOffsets", "upperLinks", "data", "ids"},
+    {JSONTypes::NUMBER, JSONTypes::NUMBER, JSONTypes::NUMBER,
+      JSONTypes::NUMBER, JSONTypes::NUMBER, JSONTypes::ARRAY, JSONTypes::ARRAY,
+      JSONTypes::ARRAY, JSONTypes::ARRAY, JSONTypes::ARRAY, JSONTypes::ARRAY
+    }
+  ) || !check_metric<HNSW>(j.at("metric"))) return false;
+  for (auto key : {"rows", "cols", "maxLinks", "entryPoint"})
+    if (!j.at(key).is_number_integer() || j.at(key).get<index>() < 0)
+      return false;
+  // sizes are checked before any tables are made from them
+  index rows = j.at("rows");
+  index maxLinks = j.at("maxLinks");
+  for (auto key : {"levels", "links", "upperOffsets", "data", "ids"})
+    if (asSigned(j.at(key).size()) != rows) return false;
+  if (maxLinks < 1 ||
+      (rows > 0 && asSigned(j.at("links")[0].size()) != 2 * maxLinks))
+    return false;
+  // a graph that would send a search out of bounds is as bad as a missing key
+  return HNSW::valid(read_graph(j), j.at("entryPoint").get<index>());
+}
+
+void from_json(const nlohmann::json &j, HNSW &hnsw) {
+  auto metric = static_cast<HNSW::Distance>(j.at("metric").get<index>());
+  hnsw.fromFlat(read_graph(j), j.at("entryPoint"), metric);
 }
 
 // KMeans
@@ -420,11 +538,20 @@ void to_json(nlohmann::json &j, const UMAP &umap) {
 }
 
 bool check_json(const nlohmann::json &j, const UMAP &) {
-  return fluid::check_json(j,
-    {"rows", "cols", "embedding", "a", "b", "k"},
+  if (!fluid::check_json(j,
+    {"rows", "cols", "embedding", "a", "b", "k", "tree"},
     {JSONTypes::NUMBER, JSONTypes::NUMBER,JSONTypes::ARRAY,
-      JSONTypes::NUMBER, JSONTypes::NUMBER, JSONTypes::NUMBER}
-  );
+      JSONTypes::NUMBER, JSONTypes::NUMBER, JSONTypes::NUMBER,
+      JSONTypes::OBJECT}
+  )) return false;
+  const nlohmann::json &tree = j.at("tree");
+  if (!check_json(tree, KDTree())) return false;
+  // the tree's ids must be the rows of the embedding, see UMAP::init
+  for (auto &id : tree.at("ids"))
+    if (!id.is_string()) return false;
+  FluidTensor<std::string, 1> ids(tree.at("ids").size());
+  tree.at("ids").get_to(ids);
+  return UMAP::idsAreRows(ids, j.at("rows").get<index>());
 }
 
 void from_json(const nlohmann::json &j, UMAP &umap) {
@@ -478,6 +605,9 @@ public:
 
   bool ok() { return mError.empty(); }
 
+  // For writing and parsing without going through a json object
+  fstream& stream() { return mFile; }
+
   bool write(json data) {
     if (ok()) {
       mFile << data.dump(2) << std::endl;
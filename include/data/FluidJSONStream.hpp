@@ -0,0 +1,806 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "FluidJSON.hpp"
+#include "FluidDataSet.hpp"
+#include "FluidIndex.hpp"
+#include "FluidTensor.hpp"
+#include "TensorTypes.hpp"
+#include "../algorithms/public/KDTree.hpp"
+#include "../algorithms/public/MLP.hpp"
+#include "../algorithms/public/UMAP.hpp"
+#include <nlohmann/json.hpp>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Streaming alternatives to to_json / from_json for objects that can get
+// large. Writers send values straight to an output stream, and loaders are
+// driven by nlohmann's SAX parser and fill the object's own storage as the
+// input is parsed, so neither side builds a json DOM. The output parses to
+// the same json as to_json gives, but isn't indented, and keeps the points of
+// datasets in row order where the DOM sorts them by id.
+
+namespace fluid {
+
+class JSONStreamWriter
+{
+public:
+  JSONStreamWriter(std::ostream& out) : mOut(out)
+  {
+    mBuffer.reserve(mChunkSize);
+  }
+
+  ~JSONStreamWriter() { flush(); }
+
+  JSONStreamWriter(const JSONStreamWriter&) = delete;
+  JSONStreamWriter& operator=(const JSONStreamWriter&) = delete;
+
+  // Output is collected in chunks, and sent to the stream when a chunk fills
+  // up or on flush
+  void flush()
+  {
+    mOut.write(mBuffer.data(), asSigned(mBuffer.size()));
+    mBuffer.clear();
+  }
+
+  void beginObject()
+  {
+    separate();
+    put('{');
+    mFirst.push_back(true);
+  }
+
+  void endObject()
+  {
+    put('}');
+    mFirst.pop_back();
+  }
+
+  void beginArray()
+  {
+    separate();
+    put('[');
+    mFirst.push_back(true);
+  }
+
+  void endArray()
+  {
+    put(']');
+    mFirst.pop_back();
+  }
+
+  void key(const std::string& k)
+  {
+    separate();
+    writeString(k);
+    put(':');
+    mAfterKey = true;
+  }
+
+  void value(index x)
+  {
+    separate();
+    write(std::to_string(x));
+  }
+
+  void value(double x) { writeReal(x); }
+  void value(float x) { writeReal(x); }
+
+  void value(const std::string& x)
+  {
+    separate();
+    writeString(x);
+  }
+
+  template <typename T>
+  void value(FluidTensorView<T, 1> t)
+  {
+    beginArray();
+    for (auto&& x : t) value(x);
+    endArray();
+  }
+
+  template <typename T>
+  void value(FluidTensorView<T, 2> t)
+  {
+    beginArray();
+    for (index i = 0; i < t.rows(); i++) value(t.row(i));
+    endArray();
+  }
+
+  template <typename T>
+  void member(const std::string& k, T&& x)
+  {
+    key(k);
+    value(std::forward<T>(x));
+  }
+
+private:
+  void separate()
+  {
+    if (mAfterKey)
+      mAfterKey = false;
+    else if (!mFirst.empty())
+    {
+      if (!mFirst.back()) put(',');
+      mFirst.back() = false;
+    }
+  }
+
+  // Uses nlohmann's shortest round trip formatting, and writes non-finite
+  // values as null, as dump() does
+  template <typename T>
+  void writeReal(T x)
+  {
+    separate();
+    if (!std::isfinite(x))
+    {
+      write("null");
+      return;
+    }
+    char  buffer[64];
+    char* end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), x);
+    mBuffer.append(buffer, end);
+  }
+
+  void writeString(const std::string& s)
+  {
+    static const char* hex = "0123456789abcdef";
+    put('"');
+    for (char c : s)
+    {
+      switch (c)
+      {
+      case '"': write("\\\""); break;
+      case '\\': write("\\\\"); break;
+      case '\n': write("\\n"); break;
+      case '\r': write("\\r"); break;
+      case '\t': write("\\t"); break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20)
+        {
+          char escaped[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF],
+                             hex[c & 0xF]};
+          mBuffer.append(escaped, 6);
+        }
+        else
+          put(c);
+      }
+    }
+    put('"');
+  }
+
+  void put(char c)
+  {
+    mBuffer.push_back(c);
+    if (mBuffer.size() >= mChunkSize) flush();
+  }
+
+  void write(const std::string& s)
+  {
+    mBuffer.append(s);
+    if (mBuffer.size() >= mChunkSize) flush();
+  }
+
+  static constexpr size_t mChunkSize{1 << 16};
+
+  std::ostream&     mOut;
+  std::string       mBuffer;
+  std::vector<bool> mFirst;
+  bool              mAfterKey{false};
+};
+
+namespace jsonstream {
+
+// One entry per open object or array: the current key of an object, or the
+// position of the current element of an array
+struct Frame
+{
+  std::string key;
+  index       position;
+  bool        array;
+};
+
+using Path = std::vector<Frame>;
+
+// Loaders are handed the path to each value, and the level of the path at
+// which their own object sits, so they can be nested inside each other. The
+// number of levels below that tells them where they are:
+//   1: a member of the object, 2: an element of an array member,
+//   3: an element of an array of arrays, and so on
+inline index depth(const Path& p, index level)
+{
+  return asSigned(p.size()) - level;
+}
+
+inline bool isMember(const Path& p, index level, index d, const char* key)
+{
+  return depth(p, level) == d && p[asUnsigned(level)].key == key;
+}
+
+// Converts parsed values to the element type of the tensor being filled,
+// rejecting strings where numbers are expected and vice versa
+inline bool assign(double& out, double x)
+{
+  out = x;
+  return true;
+}
+
+inline bool assign(float& out, double x)
+{
+  out = static_cast<float>(x);
+  return true;
+}
+
+inline bool assign(index& out, double x)
+{
+  out = static_cast<index>(x);
+  return out == x;
+}
+
+inline bool assign(std::string& out, const std::string& x)
+{
+  out = x;
+  return true;
+}
+
+template <typename T, typename U>
+bool assign(T&, const U&)
+{
+  return false;
+}
+
+// Fills a matrix row by row from an array of arrays, growing it one row at a
+// time. The width is given by a hint or the first row, and all rows must match
+template <typename T>
+class MatrixLoader
+{
+public:
+  void setCols(index cols)
+  {
+    if (mWidth >= 0 || cols < 0) return;
+    mWidth = cols;
+    mMatrix = FluidTensor<T, 2>(0, cols);
+  }
+
+  void beginRow()
+  {
+    if (mWidth >= 0)
+      mMatrix.resizeDim(0, 1);
+    else
+      mFirst.clear();
+    mColumn = 0;
+  }
+
+  template <typename U>
+  bool add(const U& x)
+  {
+    if (mWidth < 0)
+    {
+      mFirst.emplace_back();
+      mColumn++;
+      return assign(mFirst.back(), x);
+    }
+    if (mColumn >= mWidth) return false;
+    return assign(mMatrix(mMatrix.rows() - 1, mColumn++), x);
+  }
+
+  bool endRow()
+  {
+    if (mWidth < 0)
+    {
+      setCols(mColumn);
+      mMatrix.resizeDim(0, 1);
+      for (index i = 0; i < mWidth; i++) mMatrix(0, i) = mFirst[asUnsigned(i)];
+      mFirst.clear();
+    }
+    return mColumn == mWidth;
+  }
+
+  index              rows() const { return mMatrix.rows(); }
+  index              cols() const { return std::max<index>(mWidth, 0); }
+  FluidTensor<T, 2>& matrix() { return mMatrix; }
+
+private:
+  FluidTensor<T, 2> mMatrix;
+  std::vector<T>    mFirst;
+  index             mWidth{-1};
+  index             mColumn{0};
+};
+
+// Adapts a loader to nlohmann's SAX interface, keeping track of the path
+template <typename Loader>
+class SAXHandler
+{
+public:
+  using json = nlohmann::json;
+
+  SAXHandler(Loader& loader) : mLoader(loader) {}
+
+  bool null() { return next(); }
+  bool boolean(bool) { return next(); }
+
+  bool number_integer(json::number_integer_t x)
+  {
+    return number(static_cast<double>(x));
+  }
+
+  bool number_unsigned(json::number_unsigned_t x)
+  {
+    return number(static_cast<double>(x));
+  }
+
+  bool number_float(json::number_float_t x, const json::string_t&)
+  {
+    return number(x);
+  }
+
+  bool string(json::string_t& x) { return mLoader.value(mPath, 0, x) && next(); }
+
+  bool start_object(std::size_t)
+  {
+    mPath.push_back({"", 0, false});
+    return true;
+  }
+
+  bool key(json::string_t& k)
+  {
+    mPath.back().key = k;
+    return true;
+  }
+
+  bool end_object()
+  {
+    mPath.pop_back();
+    return next();
+  }
+
+  bool start_array(std::size_t)
+  {
+    mPath.push_back({"", 0, true});
+    return mLoader.beginArray(mPath, 0);
+  }
+
+  bool end_array()
+  {
+    bool ok = mLoader.endArray(mPath, 0);
+    mPath.pop_back();
+    return ok && next();
+  }
+
+  bool parse_error(std::size_t, const std::string&,
+                   const nlohmann::detail::exception&)
+  {
+    mParseError = true;
+    return false;
+  }
+
+  bool parseError() const { return mParseError; }
+
+private:
+  bool number(double x) { return mLoader.value(mPath, 0, x) && next(); }
+
+  bool next()
+  {
+    if (!mPath.empty() && mPath.back().array) mPath.back().position++;
+    return true;
+  }
+
+  Loader& mLoader;
+  Path    mPath;
+  bool    mParseError{false};
+};
+
+} // namespace jsonstream
+
+// Loaders are specialised for each type that can be streamed, below
+template <typename T>
+class JSONStreamLoader;
+
+// FluidDataSet
+template <typename T>
+void stream_json(JSONStreamWriter& w, const FluidDataSet<std::string, T, 1>& ds)
+{
+  auto ids = ds.getIds();
+  auto data = ds.getData();
+  w.beginObject();
+  w.member("cols", ds.pointSize());
+  w.key("data");
+  w.beginObject();
+  for (index r = 0; r < ds.size(); r++) w.member(ids(r), data.row(r));
+  w.endObject();
+  w.endObject();
+}
+
+template <typename T>
+class JSONStreamLoader<FluidDataSet<std::string, T, 1>>
+{
+  using DataSet = FluidDataSet<std::string, T, 1>;
+
+public:
+  template <typename U>
+  bool value(const jsonstream::Path& p, index level, const U& x)
+  {
+    using namespace jsonstream;
+    if (isMember(p, level, 1, "cols")) return assign(mCols, x);
+    if (!isMember(p, level, 3, "data")) return true;
+    mRow.emplace_back();
+    return assign(mRow.back(), x);
+  }
+
+  bool beginArray(const jsonstream::Path& p, index level)
+  {
+    if (jsonstream::isMember(p, level, 3, "data")) mRow.clear();
+    return true;
+  }
+
+  bool endArray(const jsonstream::Path& p, index level)
+  {
+    if (!jsonstream::isMember(p, level, 3, "data")) return true;
+    index size = asSigned(mRow.size());
+    if (mDataSet.size() == 0) mDataSet.resize(mCols >= 0 ? mCols : size);
+    return size == mDataSet.pointSize() &&
+           mDataSet.add(p[asUnsigned(level + 1)].key,
+                        FluidTensorView<T, 1>(mRow.data(), 0, size));
+  }
+
+  bool finish(DataSet& ds)
+  {
+    if (mDataSet.size() == 0) mDataSet.resize(std::max<index>(mCols, 0));
+    if (mCols >= 0 && mCols != mDataSet.pointSize()) return false;
+    ds = std::move(mDataSet);
+    return true;
+  }
+
+private:
+  DataSet        mDataSet;
+  std::vector<T> mRow;
+  index          mCols{-1};
+};
+
+namespace algorithm {
+
+// KDTree, and FloatKDTree
+template <typename T>
+void stream_json(JSONStreamWriter& w, const BasicKDTree<T>& tree)
+{
+  const auto& treeData = tree.toFlat();
+  w.beginObject();
+  w.member("cols", treeData.data.cols());
+  w.member("data", FluidTensorView<const T, 2>(treeData.data));
+  w.member("ids", FluidTensorView<const std::string, 1>(treeData.ids));
+  w.member("metric", static_cast<index>(tree.metric()));
+  w.member("rows", treeData.data.rows());
+  w.member("tree", FluidTensorView<const index, 2>(treeData.tree));
+  w.endObject();
+}
+
+// MLP
+inline void stream_json(JSONStreamWriter& w, const MLP& mlp)
+{
+  w.beginObject();
+  w.key("layers");
+  w.beginArray();
+  for (index i = 0; i < mlp.size(); i++)
+  {
+    index      rows = mlp.inputSize(i);
+    index      cols = mlp.outputSize(i + 1);
+    RealMatrix W(rows, cols);
+    RealVector b(cols);
+    index      a;
+    mlp.getParameters(i, W, b, a);
+    w.beginObject();
+    w.member("activation", a);
+    w.member("biases", RealVectorView(b));
+    w.member("cols", cols);
+    w.member("rows", rows);
+    w.member("weights", RealMatrixView(W));
+    w.endObject();
+  }
+  w.endArray();
+  w.endObject();
+}
+
+// UMAP
+inline void stream_json(JSONStreamWriter& w, const UMAP& umap)
+{
+  RealMatrix embedding(umap.size(), umap.dims());
+  umap.getEmbedding(embedding);
+  w.beginObject();
+  w.member("a", umap.getA());
+  w.member("b", umap.getB());
+  w.member("cols", embedding.cols());
+  w.member("embedding", RealMatrixView(embedding));
+  w.member("k", umap.getK());
+  w.member("rows", embedding.rows());
+  w.key("tree");
+  stream_json(w, umap.getTree());
+  w.endObject();
+}
+
+} // namespace algorithm
+
+template <typename T>
+class JSONStreamLoader<algorithm::BasicKDTree<T>>
+{
+  using KDTree = algorithm::BasicKDTree<T>;
+
+public:
+  template <typename U>
+  bool value(const jsonstream::Path& p, index level, const U& x)
+  {
+    using namespace jsonstream;
+    if (isMember(p, level, 1, "cols"))
+    {
+      if (!assign(mCols, x)) return false;
+      mData.setCols(mCols);
+      return true;
+    }
+    if (isMember(p, level, 1, "rows")) return assign(mRows, x);
+    if (isMember(p, level, 1, "metric")) return assign(mMetric, x);
+    if (isMember(p, level, 3, "data")) return mData.add(x);
+    if (isMember(p, level, 3, "tree")) return mTree.add(x);
+    if (isMember(p, level, 2, "ids"))
+    {
+      mIds.resizeDim(0, 1);
+      return assign(mIds(mIds.size() - 1), x);
+    }
+    return true;
+  }
+
+  bool beginArray(const jsonstream::Path& p, index level)
+  {
+    using namespace jsonstream;
+    if (isMember(p, level, 3, "data")) mData.beginRow();
+    if (isMember(p, level, 3, "tree")) mTree.beginRow();
+    return true;
+  }
+
+  bool endArray(const jsonstream::Path& p, index level)
+  {
+    using namespace jsonstream;
+    if (isMember(p, level, 3, "data")) return mData.endRow();
+    if (isMember(p, level, 3, "tree")) return mTree.endRow();
+    return true;
+  }
+
+  bool finish(KDTree& tree)
+  {
+    index rows = mData.rows();
+    if (mRows != rows || mCols != mData.cols() || mTree.rows() != rows ||
+        mIds.size() != rows || (rows > 0 && mTree.cols() != 2))
+      return false;
+    if (!algorithm::DistanceFuncs::valid(mMetric)) return false;
+    auto metric = static_cast<algorithm::DistanceFuncs::Distance>(mMetric);
+    if (!KDTree::supports(metric)) return false;
+    typename KDTree::FlatData treeData(0, 0);
+    treeData.tree = rows > 0 ? std::move(mTree.matrix())
+                             : FluidTensor<index, 2>(0, 2);
+    if (!KDTree::valid(treeData.tree)) return false;
+    treeData.data = std::move(mData.matrix());
+    treeData.ids = std::move(mIds);
+    tree = KDTree();
+    tree.fromFlat(std::move(treeData), metric);
+    return true;
+  }
+
+private:
+  jsonstream::MatrixLoader<T>     mData;
+  jsonstream::MatrixLoader<index> mTree;
+  FluidTensor<std::string, 1>     mIds;
+  index                           mRows{-1};
+  index                           mCols{-1};
+  // trees saved before metrics were configurable are Euclidean
+  index mMetric{static_cast<index>(KDTree::Distance::kEuclidean)};
+};
+
+template <>
+class JSONStreamLoader<algorithm::MLP>
+{
+  using MLP = algorithm::MLP;
+
+public:
+  template <typename U>
+  bool value(const jsonstream::Path& p, index level, const U& x)
+  {
+    using namespace jsonstream;
+    if (depth(p, level) < 3 || p[asUnsigned(level)].key != "layers")
+      return true;
+    Layer&             l = layer(p, level);
+    const std::string& key = p[asUnsigned(level + 2)].key;
+    index              d = depth(p, level);
+    if (d == 3 && key == "activation") return assign(l.activation, x);
+    if (d == 4 && key == "biases")
+    {
+      l.biases.emplace_back();
+      return assign(l.biases.back(), x);
+    }
+    if (d == 5 && key == "weights") return l.weights.add(x);
+    return true;
+  }
+
+  bool beginArray(const jsonstream::Path& p, index level)
+  {
+    if (isWeightsRow(p, level)) layer(p, level).weights.beginRow();
+    return true;
+  }
+
+  bool endArray(const jsonstream::Path& p, index level)
+  {
+    return isWeightsRow(p, level) ? layer(p, level).weights.endRow() : true;
+  }
+
+  bool finish(MLP& mlp)
+  {
+    index nLayers = asSigned(mLayers.size());
+    for (index i = 0; i < nLayers; i++)
+    {
+      Layer& l = mLayers[asUnsigned(i)];
+      if (l.weights.cols() != asSigned(l.biases.size())) return false;
+      if (!algorithm::NNActivations::valid(l.activation)) return false;
+      if (i > 0 && l.weights.rows() != mLayers[asUnsigned(i - 1)].weights.cols())
+        return false;
+    }
+    mlp = MLP();
+    if (nLayers == 0) return true;
+    FluidTensor<index, 1> hiddenSizes(nLayers - 1);
+    for (index i = 0; i < nLayers - 1; i++)
+      hiddenSizes(i) = mLayers[asUnsigned(i)].weights.cols();
+    mlp.init(mLayers.front().weights.rows(), mLayers.back().weights.cols(),
+             hiddenSizes, mLayers.front().activation,
+             mLayers.back().activation);
+    for (index i = 0; i < nLayers; i++)
+    {
+      Layer& l = mLayers[asUnsigned(i)];
+      mlp.setParameters(
+          i, l.weights.matrix(),
+          RealVectorView(l.biases.data(), 0, asSigned(l.biases.size())),
+          l.activation);
+    }
+    mlp.setTrained(true);
+    return true;
+  }
+
+private:
+  struct Layer
+  {
+    jsonstream::MatrixLoader<double> weights;
+    std::vector<double>              biases;
+    index                            activation{0};
+  };
+
+  static bool isWeightsRow(const jsonstream::Path& p, index level)
+  {
+    return jsonstream::isMember(p, level, 5, "layers") &&
+           p[asUnsigned(level + 2)].key == "weights";
+  }
+
+  Layer& layer(const jsonstream::Path& p, index level)
+  {
+    index i = p[asUnsigned(level + 1)].position;
+    if (i >= asSigned(mLayers.size())) mLayers.resize(asUnsigned(i + 1));
+    return mLayers[asUnsigned(i)];
+  }
+
+  std::vector<Layer> mLayers;
+};
+
+template <>
+class JSONStreamLoader<algorithm::UMAP>
+{
+  using UMAP = algorithm::UMAP;
+
+public:
+  template <typename U>
+  bool value(const jsonstream::Path& p, index level, const U& x)
+  {
+    using namespace jsonstream;
+    if (inTree(p, level)) return mTree.value(p, level + 1, x);
+    if (isMember(p, level, 1, "a")) return assign(mA, x);
+    if (isMember(p, level, 1, "b")) return assign(mB, x);
+    if (isMember(p, level, 1, "k")) return assign(mK, x);
+    if (isMember(p, level, 1, "cols"))
+    {
+      index cols;
+      if (!assign(cols, x)) return false;
+      mEmbedding.setCols(cols);
+      return true;
+    }
+    if (isMember(p, level, 3, "embedding")) return mEmbedding.add(x);
+    return true;
+  }
+
+  bool beginArray(const jsonstream::Path& p, index level)
+  {
+    if (inTree(p, level)) return mTree.beginArray(p, level + 1);
+    if (jsonstream::isMember(p, level, 3, "embedding")) mEmbedding.beginRow();
+    return true;
+  }
+
+  bool endArray(const jsonstream::Path& p, index level)
+  {
+    if (inTree(p, level)) return mTree.endArray(p, level + 1);
+    if (jsonstream::isMember(p, level, 3, "embedding"))
+      return mEmbedding.endRow();
+    return true;
+  }
+
+  bool finish(UMAP& umap)
+  {
+    algorithm::KDTree tree;
+    if (!mTree.finish(tree)) return false;
+    umap = UMAP();
+    return umap.init(mEmbedding.matrix(), std::move(tree), mK, mA, mB);
+  }
+
+private:
+  static bool inTree(const jsonstream::Path& p, index level)
+  {
+    return jsonstream::depth(p, level) > 1 &&
+           p[asUnsigned(level)].key == "tree";
+  }
+
+  JSONStreamLoader<algorithm::KDTree> mTree;
+  jsonstream::MatrixLoader<double>    mEmbedding;
+  double                              mA{0};
+  double                              mB{0};
+  index                               mK{0};
+};
+
+namespace jsonstream {
+
+enum class Status { kOk, kParseError, kInvalid };
+
+namespace impl {
+template <typename T, typename = void>
+struct Supported : std::false_type
+{};
+
+template <typename T>
+struct Supported<T, decltype(stream_json(std::declval<JSONStreamWriter&>(),
+                                         std::declval<const T&>()))>
+    : std::true_type
+{};
+} // namespace impl
+
+// Whether T can be written and loaded without building a DOM
+template <typename T>
+constexpr bool isSupported()
+{
+  return impl::Supported<T>::value;
+}
+
+template <typename T>
+void dump(std::ostream& out, const T& obj)
+{
+  JSONStreamWriter w(out);
+  stream_json(w, obj);
+}
+
+// Input is anything nlohmann::json::sax_parse accepts: a stream, a string...
+// obj is only modified if the input is valid
+template <typename Input, typename T>
+Status load(Input&& input, T& obj)
+{
+  JSONStreamLoader<T>             loader;
+  SAXHandler<JSONStreamLoader<T>> handler(loader);
+  if (!nlohmann::json::sax_parse(std::forward<Input>(input), &handler))
+    return handler.parseError() ? Status::kParseError : Status::kInvalid;
+  return loader.finish(obj) ? Status::kOk : Status::kInvalid;
+}
+
+} // namespace jsonstream
+} // namespace fluid
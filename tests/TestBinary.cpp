@@ -0,0 +1,229 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Saves datasets and models in the binary format and checks that what's
+// loaded back is the same, and that truncated or corrupted files are rejected
+
+#include "TestUtils.hpp"
+#include <data/FluidBinary.hpp>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::KDTree;
+using algorithm::MLP;
+using DataSet = FluidDataSet<std::string, double, 1>;
+
+template <typename T>
+bool roundTrip(const T& in, T& out, const std::string& fileName)
+{
+  BinaryWriter w(fileName);
+  to_binary(w, in);
+  if (!w.close()) return false;
+  BinaryReader r(fileName);
+  if (!r.ok() || !check_binary(r, out)) return false;
+  from_binary(r, out);
+  return true;
+}
+
+void testDataSet(std::mt19937& rng)
+{
+  DataSet in = randomDataSet(100, 7, rng);
+  DataSet out;
+  check(roundTrip(in, out, "TestBinary_dataset.flbin"), "dataset loads");
+  check(out.size() == in.size() && out.pointSize() == in.pointSize(),
+        "dataset shape");
+  check(std::equal(in.getIds().begin(), in.getIds().end(),
+                   out.getIds().begin()),
+        "dataset ids");
+  check(near(in.getData(), out.getData(), 0), "dataset data");
+  std::remove("TestBinary_dataset.flbin");
+}
+
+void testKDTree(std::mt19937& rng)
+{
+  DataSet data = randomDataSet(200, 3, rng);
+  KDTree  in(data, KDTree::Distance::kManhattan);
+  KDTree  out;
+  check(roundTrip(in, out, "TestBinary_kdtree.flbin"), "kdtree loads");
+  check(out.metric() == in.metric(), "kdtree metric");
+  DataSet queries = randomDataSet(20, 3, rng);
+  for (fluid::index i = 0; i < queries.size(); i++)
+  {
+    DataSet expected = in.kNearest(queries.getData().row(i), 5);
+    DataSet actual = out.kNearest(queries.getData().row(i), 5);
+    check(std::equal(expected.getIds().begin(), expected.getIds().end(),
+                     actual.getIds().begin()) &&
+              near(expected.getData(), actual.getData(), 0),
+          "kdtree neighbours of query " + std::to_string(i));
+  }
+  std::remove("TestBinary_kdtree.flbin");
+}
+
+void testMLP(std::mt19937& rng)
+{
+  MLP in;
+  in.init(4, 2, FluidTensor<fluid::index, 1>{8, 5}, 2, 0);
+  MLP out;
+  check(roundTrip(in, out, "TestBinary_mlp.flbin"), "mlp loads");
+  check(out.size() == in.size(), "mlp layers");
+  DataSet    inputs = randomDataSet(20, 4, rng);
+  RealVector expected(2), actual(2);
+  for (fluid::index i = 0; i < inputs.size(); i++)
+  {
+    RealVector point(inputs.getData().row(i));
+    in.processFrame(point, expected, 0, in.size());
+    out.processFrame(point, actual, 0, out.size());
+    check(near(expected, actual, 0),
+          "mlp prediction for input " + std::to_string(i));
+  }
+  std::remove("TestBinary_mlp.flbin");
+}
+
+// Every prefix of a valid file must fail to load rather than read past the
+// end of what was mapped
+void testTruncated(std::mt19937& rng)
+{
+  DataSet      data = randomDataSet(10, 2, rng);
+  BinaryWriter w("TestBinary_whole.flbin");
+  to_binary(w, data);
+  check(w.close(), "truncation source saves");
+  std::ifstream     file("TestBinary_whole.flbin", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  file.close();
+  for (size_t size = 0; size < bytes.size(); size += 7)
+  {
+    {
+      std::ofstream part("TestBinary_part.flbin", std::ios::binary);
+      part.write(bytes.data(), asSigned(size));
+    }
+    BinaryReader r("TestBinary_part.flbin");
+    check(!r.ok() || !check_binary(r, data),
+          "file truncated to " + std::to_string(size) + " bytes is rejected");
+  }
+  std::remove("TestBinary_whole.flbin");
+  std::remove("TestBinary_part.flbin");
+}
+
+// Whether what write() saves passes check_binary for obj
+template <typename Write, typename T>
+bool passesCheck(Write write, const T& obj)
+{
+  const std::string fileName = "TestBinary_check.flbin";
+  {
+    BinaryWriter w(fileName);
+    write(w);
+    if (!w.close()) return false;
+  }
+  BinaryReader r(fileName);
+  bool         passes = r.ok() && check_binary(r, obj);
+  std::remove(fileName.c_str());
+  return passes;
+}
+
+// A KDTree whose links would send a search out of bounds, or round a loop,
+// and an MLP with no layers or an unknown activation, must fail check_binary
+void testInvalid(std::mt19937& rng)
+{
+  KDTree tree(randomDataSet(20, 2, rng));
+  auto   saved = tree.toFlat();
+  auto   links = [&](FluidTensorView<const fluid::index, 2> t) {
+    return [&saved, &tree, t](BinaryWriter& w) {
+      w.add("tree", t);
+      w.add("ids", FluidTensorView<const std::string, 1>(saved.ids));
+      w.add("data", FluidTensorView<const double, 2>(saved.data));
+      w.add("metric", static_cast<fluid::index>(tree.metric()));
+    };
+  };
+  check(passesCheck(links(saved.tree), tree), "saved kdtree is valid");
+  // two leaves and their parents
+  fluid::index n = tree.size();
+  fluid::index a = -1, b = -1, parentA = -1, parentB = -1;
+  for (fluid::index i = 0; i < n; i++)
+  {
+    if (saved.tree(i, 0) != -1 || saved.tree(i, 1) != -1) continue;
+    if (a == -1)
+      a = i;
+    else if (b == -1)
+      b = i;
+  }
+  for (fluid::index i = 0; i < n; i++)
+  {
+    for (fluid::index side = 0; side < 2; side++)
+    {
+      if (saved.tree(i, side) == a) parentA = i;
+      if (saved.tree(i, side) == b) parentB = i;
+    }
+  }
+  using Links = FluidTensor<fluid::index, 2>;
+  using Corruption = std::function<void(Links&)>;
+  std::vector<std::pair<std::string, Corruption>> corruptions{
+      {"child past the end", [&](Links& t) { t(a, 0) = n; }},
+      {"child below -1", [&](Links& t) { t(a, 1) = -2; }},
+      {"root as a child", [&](Links& t) { t(a, 0) = 0; }},
+      {"node with two parents", [&](Links& t) { t(a, 0) = b; }},
+      {"node as its own child", [&](Links& t) { t(a, 0) = a; }},
+      {"loop out of reach",
+       [&](Links& t) {
+         for (fluid::index side = 0; side < 2; side++)
+         {
+           if (t(parentA, side) == a) t(parentA, side) = -1;
+           if (t(parentB, side) == b) t(parentB, side) = -1;
+         }
+         t(a, 0) = b;
+         t(b, 0) = a;
+       }},
+  };
+  for (auto& c : corruptions)
+  {
+    Links corrupted(saved.tree);
+    c.second(corrupted);
+    check(!passesCheck(links(corrupted), tree),
+          "rejects kdtree with " + c.first);
+  }
+
+  MLP mlp;
+  mlp.init(2, 1, FluidTensor<fluid::index, 1>{3}, 0, 0);
+  check(passesCheck([&](BinaryWriter& w) { to_binary(w, mlp); }, mlp),
+        "saved mlp is valid");
+  RealMatrix weights(2, 1);
+  RealVector biases(1);
+  for (fluid::index activation : {-1, 4, 7})
+  {
+    auto layer = [&](BinaryWriter& w) {
+      w.add("layers", fluid::index(1));
+      w.add("layers/0/weights", FluidTensorView<const double, 2>(weights));
+      w.add("layers/0/biases", FluidTensorView<const double, 1>(biases));
+      w.add("layers/0/activation", activation);
+    };
+    check(!passesCheck(layer, mlp),
+          "rejects mlp activation " + std::to_string(activation));
+  }
+  check(!passesCheck([](BinaryWriter& w) { w.add("layers", fluid::index(0)); },
+                     mlp),
+        "rejects mlp with no layers");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  testDataSet(rng);
+  testKDTree(rng);
+  testMLP(rng);
+  testTruncated(rng);
+  testInvalid(rng);
+  return result();
+}
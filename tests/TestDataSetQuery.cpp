@@ -0,0 +1,173 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks DataSetQuery against a row by row evaluation of its conditions, both
+// scanning and through column indexes, including after the indexed dataset
+// has been changed point by point
+
+#include "TestUtils.hpp"
+#include <algorithms/public/DataSetQuery.hpp>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::DataSetQuery;
+using DataSet = FluidDataSet<std::string, double, 1>;
+
+struct Condition
+{
+  fluid::index column;
+  std::string  comparison;
+  double       value;
+  bool         conjunction;
+};
+
+bool holds(const Condition& c, double x)
+{
+  if (c.comparison == "==") return x == c.value;
+  if (c.comparison == "!=") return x != c.value;
+  if (c.comparison == "<") return x < c.value;
+  if (c.comparison == "<=") return x <= c.value;
+  if (c.comparison == ">") return x > c.value;
+  return x >= c.value;
+}
+
+// Rows match if every AND condition holds, or any OR condition does, and are
+// taken in order up to limit
+DataSet reference(const DataSet& input, const std::vector<Condition>& query,
+                  fluid::index limit)
+{
+  DataSet      output(input.pointSize());
+  fluid::index count = 0;
+  auto         data = input.getData();
+  for (fluid::index i = 0; i < input.size(); i++)
+  {
+    if (limit > 0 && count >= limit) break;
+    bool all = true, any = false;
+    for (auto& c : query)
+    {
+      if (c.conjunction)
+        all = all && holds(c, data(i, c.column));
+      else
+        any = any || holds(c, data(i, c.column));
+    }
+    if (all || any)
+    {
+      output.add(input.getIds()(i), data.row(i));
+      count++;
+    }
+  }
+  return output;
+}
+
+DataSet run(const DataSet& input, const std::vector<Condition>& query,
+            fluid::index limit)
+{
+  DataSetQuery q;
+  q.addRange(0, input.pointSize());
+  for (auto& c : query)
+    q.addCondition(c.column, c.comparison, c.value, c.conjunction);
+  q.limit(limit);
+  DataSet output;
+  q.process(input, DataSet(), output);
+  return output;
+}
+
+bool same(const DataSet& a, const DataSet& b)
+{
+  return a.size() == b.size() &&
+         std::equal(a.getIds().begin(), a.getIds().end(),
+                    b.getIds().begin()) &&
+         near(a.getData(), b.getData(), 0);
+}
+
+// Values on a coarse grid, so that == and the bounds of ranges are hit, with
+// some NaNs, which no condition but != holds for
+RealVector randomPoint(fluid::index dims, std::mt19937& rng)
+{
+  std::uniform_int_distribution<int> grid(0, 99);
+  RealVector                         point(dims);
+  for (fluid::index j = 0; j < dims; j++)
+  {
+    int x = grid(rng);
+    point(j) = x == 0 ? std::numeric_limits<double>::quiet_NaN() : x / 10.0;
+  }
+  return point;
+}
+
+void compareAll(const DataSet& scanned, const DataSet& indexed,
+                const std::string& when)
+{
+  std::vector<std::vector<Condition>> queries = {
+      {{0, "==", 4.2, true}},
+      {{0, ">=", 3.0, true}, {0, "<", 3.5, true}},
+      {{1, ">", 9.5, true}, {2, "<=", 5.0, true}},
+      {{0, ">", 2.0, true}, {0, "<=", 2.3, true}, {1, "!=", 5.0, true}},
+      {{1, "<", 0.5, true}, {1, ">", 9.0, true}},
+      {{2, "!=", 1.0, true}},
+      {{0, "<", 0.3, true}, {2, "==", 7.7, false}},
+      {{0, "<", 5.0, true}},
+      {}};
+  for (fluid::index limit : {0, 3})
+  {
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      DataSet expected = reference(scanned, queries[i], limit);
+      std::string what = "query " + std::to_string(i) + " with limit " +
+                         std::to_string(limit) + " " + when;
+      check(same(run(scanned, queries[i], limit), expected), what + " scanned");
+      check(same(run(indexed, queries[i], limit), expected), what + " indexed");
+    }
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  fluid::index dims = 3;
+  DataSet      scanned(dims);
+  for (fluid::index i = 0; i < 3000; i++)
+    scanned.add(std::to_string(i), randomPoint(dims, rng));
+  DataSet indexed = scanned;
+  indexed.indexColumn(0);
+  indexed.indexColumn(1);
+  compareAll(scanned, indexed, "after indexing");
+
+  // enough changes to split and merge the blocks of the indexes
+  std::uniform_int_distribution<int> pick(0, 2999);
+  for (fluid::index i = 0; i < 2000; i++)
+  {
+    RealVector  point = randomPoint(dims, rng);
+    std::string id = std::to_string(pick(rng));
+    std::string newId = "new" + std::to_string(i);
+    switch (i % 3)
+    {
+    case 0:
+      scanned.update(id, point);
+      indexed.update(id, point);
+      break;
+    case 1:
+      scanned.remove(id);
+      indexed.remove(id);
+      break;
+    default:
+      scanned.add(newId, point);
+      indexed.add(newId, point);
+    }
+  }
+  check(indexed.getColumnIndex(0) && indexed.getColumnIndex(1),
+        "changes keep the indexes");
+  compareAll(scanned, indexed, "after changes");
+  return result();
+}
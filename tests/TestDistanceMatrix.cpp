@@ -0,0 +1,87 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks DistanceMatrix, for every metric, against its kernel applied to each
+// pair of points in turn, for sizes that don't fill whole tiles and for points
+// far from the origin
+
+#include "TestUtils.hpp"
+#include <algorithms/util/DistanceFuncs.hpp>
+#include <Eigen/Core>
+#include <cmath>
+#include <string>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::DistanceFuncs;
+
+// Points in (offset, offset + 1], positive as KL and JS need
+Eigen::ArrayXXd randomPoints(fluid::index n, fluid::index dims, double offset,
+                             std::mt19937& rng)
+{
+  std::uniform_real_distribution<double> noise(0.0, 1.0);
+  Eigen::ArrayXXd                        points(n, dims);
+  for (fluid::index i = 0; i < n; i++)
+    for (fluid::index j = 0; j < dims; j++)
+      points(i, j) = offset + 1.0 - noise(rng);
+  return points;
+}
+
+Eigen::MatrixXd reference(const Eigen::ArrayXXd& X, const Eigen::ArrayXXd& Y,
+                          fluid::index distance)
+{
+  Eigen::MatrixXd D(X.rows(), Y.rows());
+  algorithm::visitDistance(static_cast<DistanceFuncs::Distance>(distance),
+                           [&](auto kernel) {
+                             for (fluid::index i = 0; i < X.rows(); i++)
+                               for (fluid::index j = 0; j < Y.rows(); j++)
+                                 D(i, j) = kernel.apply(X.row(i), Y.row(j));
+                           });
+  return D;
+}
+
+bool near(const Eigen::MatrixXd& a, const Eigen::MatrixXd& b, double tolerance)
+{
+  return a.rows() == b.rows() && a.cols() == b.cols() &&
+         ((a - b).array().abs() <= tolerance * (1 + b.array().abs())).all();
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  fluid::index numMetrics =
+      static_cast<fluid::index>(DistanceFuncs::Distance::kJS) + 1;
+  // the larger sizes are enough pairs to be split between threads
+  for (fluid::index rows : {1, 5, 150})
+  {
+    for (double offset : {0.0, 1000.0})
+    {
+      Eigen::ArrayXXd X = randomPoints(rows, 7, offset, rng);
+      Eigen::ArrayXXd Y = randomPoints(rows == 1 ? 3 : 131, 7, offset, rng);
+      // the expansion used for Euclidean distances loses a little precision
+      double tolerance = offset > 0 ? 1e-7 : 1e-10;
+      for (fluid::index d = 0; d < numMetrics; d++)
+      {
+        std::string what = "metric " + std::to_string(d) + " for " +
+                           std::to_string(rows) + " rows at offset " +
+                           std::to_string(offset);
+        check(near(algorithm::DistanceMatrix(X, Y, d), reference(X, Y, d),
+                   tolerance),
+              what);
+        Eigen::MatrixXd D = algorithm::DistanceMatrix(X, d);
+        Eigen::MatrixXd expected = reference(X, X, d);
+        expected.diagonal().setZero();
+        check(near(D, expected, tolerance), what + ", symmetric");
+        check((D.diagonal().array() == 0).all(), what + ", zero diagonal");
+      }
+    }
+  }
+  return result();
+}
@@ -0,0 +1,239 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Runs a float dataset through the float path: saving and loading it, in the
+// binary format and as streamed JSON; fitting and applying Normalization,
+// Standardization, RobustScaling and PCA; and searching a FloatKDTree of the
+// result, also once saved and loaded. Each step is checked against the double
+// path on the same data widened to double, to within single precision.
+
+#include "TestUtils.hpp"
+#include <algorithms/public/KDTree.hpp>
+#include <algorithms/public/Normalization.hpp>
+#include <algorithms/public/PCA.hpp>
+#include <algorithms/public/RobustScaling.hpp>
+#include <algorithms/public/Standardization.hpp>
+#include <data/FluidBinary.hpp>
+#include <data/FluidJSONStream.hpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::FloatKDTree;
+using algorithm::KDTree;
+using DataSet = FluidDataSet<std::string, double, 1>;
+using FloatDataSet = FluidDataSet<std::string, float, 1>;
+using FloatMatrix = FluidTensor<float, 2>;
+
+// Single precision keeps about 7 significant digits
+constexpr double tolerance = 1e-5;
+
+FloatDataSet narrow(const DataSet& ds)
+{
+  FloatMatrix data(ds.size(), ds.pointSize());
+  std::copy(ds.getData().begin(), ds.getData().end(), data.begin());
+  return {FluidTensor<std::string, 1>(ds.getIds()), std::move(data)};
+}
+
+DataSet widen(const FloatDataSet& ds)
+{
+  RealMatrix data(ds.size(), ds.pointSize());
+  std::copy(ds.getData().begin(), ds.getData().end(), data.begin());
+  return {FluidTensor<std::string, 1>(ds.getIds()), std::move(data)};
+}
+
+bool sameDataSet(const FloatDataSet& a, const FloatDataSet& b)
+{
+  return a.size() == b.size() && a.pointSize() == b.pointSize() &&
+         std::equal(a.getIds().begin(), a.getIds().end(),
+                    b.getIds().begin()) &&
+         near(a.getData(), b.getData(), 0);
+}
+
+template <typename T>
+std::size_t savedSize(const T& obj, const std::string& fileName)
+{
+  BinaryWriter w(fileName);
+  to_binary(w, obj);
+  if (!w.close()) return 0;
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  return static_cast<std::size_t>(file.tellg());
+}
+
+template <typename T>
+bool loadBinary(const std::string& fileName, T& out)
+{
+  BinaryReader r(fileName);
+  if (!r.ok() || !check_binary(r, out)) return false;
+  from_binary(r, out);
+  return true;
+}
+
+template <typename T>
+bool loadJSON(const T& in, T& out)
+{
+  std::ostringstream s;
+  jsonstream::dump(s, in);
+  return jsonstream::load(s.str(), out) == jsonstream::Status::kOk;
+}
+
+void testStorage(const FloatDataSet& data)
+{
+  static_assert(
+      std::is_same<decltype(data.getData()),
+                   FluidTensorView<const float, 2>>::value,
+      "a float dataset stores floats");
+  FloatDataSet loaded;
+  std::size_t  floatSize = savedSize(data, "TestFloat_data.flbin");
+  check(loadBinary("TestFloat_data.flbin", loaded) && sameDataSet(data, loaded),
+        "float dataset binary round trip");
+  DataSet wide;
+  check(!loadBinary("TestFloat_data.flbin", wide),
+        "float entries don't load as a double dataset");
+  std::size_t doubleSize = savedSize(widen(data), "TestFloat_data.flbin");
+  check(floatSize < doubleSize * 0.6,
+        "float dataset files are about half the size");
+  std::remove("TestFloat_data.flbin");
+  FloatDataSet streamed;
+  check(loadJSON(data, streamed) && sameDataSet(data, streamed),
+        "float dataset JSON round trip");
+}
+
+// Fits a scaler to both, then checks the float one scales, and scales back,
+// the float data as the double one does the wide data
+template <typename Scaler, typename Fit>
+void testScaler(const FloatDataSet& data, Fit fit, const std::string& what)
+{
+  Scaler single, wide;
+  fit(single, data.getData());
+  DataSet wideData = widen(data);
+  fit(wide, wideData.getData());
+  fluid::index n = data.size(), dims = data.pointSize();
+  FloatMatrix  scaled(n, dims), restored(n, dims);
+  RealMatrix   expected(n, dims);
+  single.process(data.getData(), scaled);
+  wide.process(wideData.getData(), expected);
+  check(near(scaled, expected, tolerance), what + " transform");
+  single.process(scaled, restored, true);
+  check(near(restored, data.getData(), tolerance), what + " inverse");
+}
+
+void testPCA(const FloatDataSet& data, fluid::index k)
+{
+  algorithm::PCA single, wide;
+  DataSet        wideData = widen(data);
+  single.init(data.getData());
+  wide.init(wideData.getData());
+  fluid::index dims = data.pointSize();
+  RealVector   values(dims), expectedValues(dims);
+  single.getValues(values);
+  wide.getValues(expectedValues);
+  check(near(values, expectedValues, tolerance * expectedValues(0)),
+        "pca singular values");
+  FloatMatrix projected(data.size(), k);
+  RealMatrix  expected(data.size(), k);
+  double      variance = single.process(data.getData(), projected, k);
+  double      expectedVariance = wide.process(wideData.getData(), expected, k);
+  // each basis is only found up to its sign
+  for (fluid::index j = 0; j < k; j++)
+  {
+    double dot = 0;
+    for (fluid::index i = 0; i < data.size(); i++)
+      dot += projected(i, j) * expected(i, j);
+    if (dot < 0)
+      for (fluid::index i = 0; i < data.size(); i++) expected(i, j) *= -1;
+  }
+  check(near(projected, expected, tolerance * 10) &&
+            std::abs(variance - expectedVariance) < tolerance,
+        "pca transform");
+}
+
+void testKDTree(const FloatDataSet& data, std::mt19937& rng)
+{
+  DataSet     wideData = widen(data);
+  FloatKDTree tree(data);
+  FloatKDTree loadedBinary, loadedJSON;
+  savedSize(tree, "TestFloat_tree.flbin");
+  check(loadBinary("TestFloat_tree.flbin", loadedBinary), "kdtree loads");
+  KDTree wide;
+  check(!loadBinary("TestFloat_tree.flbin", wide),
+        "a float kdtree doesn't load as a double one");
+  std::remove("TestFloat_tree.flbin");
+  check(loadJSON(tree, loadedJSON), "kdtree streams");
+  std::uniform_real_distribution<float> noise(-2, 2);
+  FluidTensor<float, 1>                 query(data.pointSize());
+  RealVector                            wideQuery(data.pointSize());
+  for (fluid::index q = 0; q < 50; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    std::copy(query.begin(), query.end(), wideQuery.begin());
+    for (double radius : {0.0, 1.0})
+    {
+      auto        expected = bruteForce(wideData, wideQuery, 5, radius);
+      std::string what = "query " + std::to_string(q) + ", radius " +
+                         std::to_string(radius);
+      check(sameNeighbours(tree.kNearest(query, 5, radius), expected,
+                           tolerance),
+            "kdtree " + what);
+      check(sameNeighbours(loadedBinary.kNearest(query, 5, radius), expected,
+                           tolerance) &&
+                sameNeighbours(loadedJSON.kNearest(query, 5, radius),
+                               expected, tolerance),
+            "loaded kdtree " + what);
+    }
+  }
+  FloatMatrix queries(20, data.pointSize());
+  for (auto& x : queries) x = noise(rng);
+  auto found = tree.kNearestBatch(queries, 3);
+  bool ok = true;
+  for (fluid::index i = 0; ok && i < queries.rows(); i++)
+  {
+    auto single = tree.kNearest(queries.row(i), 3);
+    for (fluid::index j = 0; ok && j < 3; j++)
+      ok = tree.getIds()(found.indices(i, j)) == single.getIds()(j);
+  }
+  check(ok, "kdtree batch");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  // dimensions of different spread, so the principal components are distinct
+  DataSet wide = randomDataSet(500, 6, rng);
+  for (fluid::index i = 0; i < wide.size(); i++)
+    for (fluid::index j = 0; j < wide.pointSize(); j++)
+      wide.getData()(i, j) = wide.getData()(i, j) * (j + 1) + j;
+  FloatDataSet data = narrow(wide);
+  testStorage(data);
+  testScaler<algorithm::Normalization>(
+      data, [](auto& s, auto in) { s.init(-1, 1, in); }, "normalization");
+  testScaler<algorithm::Standardization>(
+      data, [](auto& s, auto in) { s.init(in); }, "standardization");
+  testScaler<algorithm::RobustScaling>(
+      data, [](auto& s, auto in) { s.init(25, 75, in); }, "robust scaling");
+  testPCA(data, 3);
+
+  // the whole pipeline: standardize, reduce to 3 dimensions and search
+  algorithm::Standardization standardize;
+  algorithm::PCA             pca;
+  standardize.init(data.getData());
+  FloatMatrix scaled(data.size(), data.pointSize());
+  standardize.process(data.getData(), scaled);
+  pca.init(scaled);
+  FloatMatrix reduced(data.size(), 3);
+  pca.process(scaled, reduced, 3);
+  testKDTree(FloatDataSet(FluidTensor<std::string, 1>(data.getIds()), reduced),
+             rng);
+  return result();
+}
@@ -0,0 +1,246 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks HNSW's recall against a brute force search, for single queries, with
+// and without a radius, and for batches split between threads, also after a
+// round trip through JSON; that a workspace narrowed for a search finds the
+// same as one made for it; and that graphs which would send a search out of
+// bounds are rejected when loaded.
+
+#include "TestUtils.hpp"
+#include <algorithms/public/HNSW.hpp>
+#include <algorithms/util/ParallelFor.hpp>
+#include <data/FluidJSON.hpp>
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::HNSW;
+using DataSet = HNSW::DataSet;
+using Distance = algorithm::DistanceFuncs::Distance;
+using JSON = nlohmann::json;
+
+// The search is approximate, but with a width of 50 nearly all of the 10
+// nearest should be found
+constexpr double minRecall = 0.9;
+
+// The share of the brute force neighbours found, and whether all of those
+// found are at their true distances, in order, and within the radius
+struct Recall
+{
+  fluid::index found{0};
+  fluid::index expected{0};
+  bool         exact{true};
+  double       ratio() const { return expected ? double(found) / expected : 1; }
+};
+
+void compare(const DataSet& result, const DataSet& dataset,
+             FluidTensorView<const double, 1> query, fluid::index k,
+             double radius, Distance metric, Recall& recall)
+{
+  auto expected = bruteForce(dataset, query, k, radius, metric);
+  auto all = bruteForce(dataset, query, 0, 0, metric);
+  std::set<std::string> ids;
+  for (auto& e : expected) ids.insert(e.second);
+  recall.expected += asSigned(expected.size());
+  double last = 0;
+  for (fluid::index i = 0; i < result.size(); i++)
+  {
+    const std::string& id = result.getIds()(i);
+    double             distance = result.getData()(i, 0);
+    if (ids.count(id)) recall.found++;
+    auto truth = std::find_if(all.begin(), all.end(),
+                              [&](auto& e) { return e.second == id; });
+    recall.exact = recall.exact && truth != all.end() &&
+                   std::abs(truth->first - distance) < 1e-9 &&
+                   distance >= last && (radius <= 0 || distance < radius);
+    last = distance;
+  }
+  recall.exact = recall.exact && result.size() <= asSigned(expected.size());
+}
+
+void testRecall(const HNSW& graph, const DataSet& dataset, Distance metric,
+                std::mt19937& rng, const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  RealVector                             query(dataset.pointSize());
+  for (double radius : {0.0, 0.8})
+  {
+    Recall recall;
+    for (fluid::index q = 0; q < 100; q++)
+    {
+      for (auto& x : query) x = noise(rng);
+      compare(graph.kNearest(query, 10, radius), dataset, query, 10, radius,
+              metric, recall);
+    }
+    std::string r = what + ", radius " + std::to_string(radius);
+    check(recall.exact, r + ", distances");
+    check(recall.ratio() >= minRecall,
+          r + ", recall " + std::to_string(recall.ratio()));
+  }
+}
+
+// A batch finds the same as single queries of the same width, whether or not
+// it is split between threads
+void testBatch(const HNSW& graph, const DataSet& dataset, std::mt19937& rng,
+               const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  FluidTensor<double, 2> queries(300, dataset.pointSize());
+  for (auto& x : queries) x = noise(rng);
+  const fluid::index k = 5;
+  for (fluid::index workers : {1, 4})
+  {
+    algorithm::workerLimit() = workers;
+    auto found = graph.kNearestBatch(queries, k);
+    bool ok = true;
+    for (fluid::index i = 0; ok && i < queries.rows(); i++)
+    {
+      auto single = graph.kNearest(queries.row(i), k);
+      ok = single.size() == k;
+      for (fluid::index j = 0; ok && j < k; j++)
+      {
+        fluid::index node = found.indices(i, j);
+        ok = node >= 0 && graph.getIds()(node) == single.getIds()(j) &&
+             found.distances(i, j) == single.getData()(j, 0);
+      }
+    }
+    check(ok, what + ", batch on " + std::to_string(workers) + " threads");
+  }
+  algorithm::workerLimit() = 0;
+}
+
+// A workspace as wide as the graph, as RT queries are given, serves searches
+// of any narrower width, finding what a workspace made for that width would
+void testWorkspace(const HNSW& graph, std::mt19937& rng,
+                   const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  RealVector                             query(graph.dims());
+  HNSW::Workspace                        ws(graph.size(), graph.size());
+  FluidTensor<fluid::index, 1>           nodes(5);
+  RealVector                             distances(5);
+  bool                                   ok = true;
+  for (fluid::index q = 0; q < 20; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    for (fluid::index width : {50, 5, 200})
+    {
+      for (double radius : {0.0, 0.3})
+      {
+        ws.setWidth(width);
+        fluid::index found =
+            graph.kNearest(query, 5, radius, nodes, distances, ws);
+        auto expected = graph.kNearest(query, 5, radius, width);
+        ok = ok && found == expected.size();
+        for (fluid::index i = 0; ok && i < found; i++)
+        {
+          ok = graph.getIds()(nodes(i)) == expected.getIds()(i) &&
+               distances(i) == expected.getData()(i, 0);
+        }
+      }
+    }
+  }
+  check(ok, what + ", narrowed workspace");
+}
+
+// Each corruption of a saved graph must fail check_json, rather than load a
+// graph whose search reads out of bounds
+void testInvalid(const HNSW& graph, const std::string& what)
+{
+  JSON saved = graph;
+  check(check_json(saved, graph), what + ", saved graph is valid");
+  fluid::index n = graph.size();
+  fluid::index top = graph.entryPoint();
+  fluid::index bottom = 0;
+  while (graph.toFlat().levels(bottom) > 0) bottom++;
+  using Corruption = std::function<void(JSON&)>;
+  std::vector<std::pair<std::string, Corruption>> corruptions{
+      {"entry point past the end", [&](JSON& j) { j["entryPoint"] = n; }},
+      {"negative entry point", [&](JSON& j) { j["entryPoint"] = -1; }},
+      {"fractional entry point", [&](JSON& j) { j["entryPoint"] = 0.5; }},
+      {"link past the end", [&](JSON& j) { j["links"][0][0] = n; }},
+      {"link below -1", [&](JSON& j) { j["links"][1][0] = -2; }},
+      {"upper link past the end", [&](JSON& j) { j["upperLinks"][0][0] = n; }},
+      {"upper link to a node not on its layer",
+       [&](JSON& j) { j["upperLinks"][0][0] = bottom; }},
+      {"levels past upperLinks",
+       [&](JSON& j) { j["levels"][top] = j["upperLinks"].size() + 1; }},
+      {"negative level", [&](JSON& j) { j["levels"][0] = -1; }},
+      {"offset past upperLinks",
+       [&](JSON& j) { j["upperOffsets"][top] = j["upperLinks"].size(); }},
+      {"negative offset", [&](JSON& j) { j["upperOffsets"][top] = -1; }},
+      {"missing levels", [&](JSON& j) { j["levels"].erase(0); }},
+      {"missing ids", [&](JSON& j) { j["ids"].erase(0); }},
+      {"links narrower than maxLinks",
+       [&](JSON& j) { j["maxLinks"] = j["maxLinks"].get<fluid::index>() + 1; }},
+      {"no links", [&](JSON& j) { j["maxLinks"] = 0; }},
+      {"more rows than points",
+       [&](JSON& j) { j["rows"] = j["rows"].get<fluid::index>() + 1; }},
+      {"negative rows", [&](JSON& j) { j["rows"] = -1; }},
+  };
+  for (auto& c : corruptions)
+  {
+    JSON j = saved;
+    c.second(j);
+    check(!check_json(j, graph), what + ", rejects " + c.first);
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  for (Distance metric : {Distance::kEuclidean, Distance::kManhattan})
+  {
+    for (fluid::index dims : {2, 8})
+    {
+      std::string what = "metric " +
+                         std::to_string(static_cast<int>(metric)) + ", " +
+                         std::to_string(dims) + "d";
+      DataSet dataset = randomDataSet(1000, dims, rng);
+      HNSW    graph(dataset, metric);
+      check(graph.size() == dataset.size() && graph.dims() == dims,
+            what + ", size");
+      check(HNSW::valid(graph.toFlat(), graph.entryPoint()),
+            what + ", built graph is valid");
+      testRecall(graph, dataset, metric, rng, what);
+      testBatch(graph, dataset, rng, what);
+      testWorkspace(graph, rng, what);
+      JSON j = graph;
+      HNSW loaded;
+      if (check_json(j, loaded))
+      {
+        loaded = j.get<HNSW>();
+        testRecall(loaded, dataset, metric, rng, what + " after loading");
+      }
+      else
+        check(false, what + ", saved graph loads");
+      testInvalid(graph, what);
+    }
+  }
+  // the few points of a small graph are all found
+  DataSet small = randomDataSet(7, 3, rng);
+  HNSW    graph(small);
+  RealVector query(3);
+  check(sameNeighbours(graph.kNearest(query, 10),
+                       bruteForce(small, query, 10, 0)),
+        "small graph finds every point");
+  HNSW empty{DataSet(3)};
+  check(empty.size() == 0 && empty.kNearest(query, 4).size() == 0,
+        "empty graph finds nothing");
+  JSON j = empty;
+  check(check_json(j, empty), "empty graph is valid");
+  return result();
+}
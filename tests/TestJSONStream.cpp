@@ -0,0 +1,135 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks that streamed JSON parses to the same json as to_json gives, and that
+// loading it back, without a DOM, gives the same datasets and models
+
+#include "TestUtils.hpp"
+#include <data/FluidJSONStream.hpp>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::KDTree;
+using algorithm::MLP;
+using DataSet = FluidDataSet<std::string, double, 1>;
+
+template <typename T>
+std::string streamed(const T& obj)
+{
+  std::ostringstream out;
+  jsonstream::dump(out, obj);
+  return out.str();
+}
+
+template <typename T>
+void checkSameAsDOM(const T& obj, const std::string& what)
+{
+  nlohmann::json j = obj;
+  check(nlohmann::json::parse(streamed(obj)) == j,
+        what + " streams the same json as to_json");
+}
+
+void testDataSet(std::mt19937& rng)
+{
+  DataSet in = randomDataSet(50, 3, rng);
+  checkSameAsDOM(in, "dataset");
+  DataSet out;
+  check(jsonstream::load(streamed(in), out) == jsonstream::Status::kOk,
+        "dataset loads");
+  check(std::equal(in.getIds().begin(), in.getIds().end(),
+                   out.getIds().begin()) &&
+            near(in.getData(), out.getData(), 0),
+        "dataset round trip");
+}
+
+void testKDTree(std::mt19937& rng)
+{
+  KDTree in(randomDataSet(100, 2, rng), KDTree::Distance::kMax);
+  checkSameAsDOM(in, "kdtree");
+  KDTree out;
+  check(jsonstream::load(streamed(in), out) == jsonstream::Status::kOk,
+        "kdtree loads");
+  check(out.metric() == in.metric(), "kdtree metric");
+  DataSet queries = randomDataSet(10, 2, rng);
+  for (fluid::index i = 0; i < queries.size(); i++)
+  {
+    DataSet expected = in.kNearest(queries.getData().row(i), 3);
+    DataSet actual = out.kNearest(queries.getData().row(i), 3);
+    check(std::equal(expected.getIds().begin(), expected.getIds().end(),
+                     actual.getIds().begin()) &&
+              near(expected.getData(), actual.getData(), 0),
+          "kdtree neighbours of query " + std::to_string(i));
+  }
+}
+
+void testMLP(std::mt19937& rng)
+{
+  MLP in;
+  in.init(3, 2, FluidTensor<fluid::index, 1>{6}, 1, 3);
+  checkSameAsDOM(in, "mlp");
+  MLP out;
+  check(jsonstream::load(streamed(in), out) == jsonstream::Status::kOk,
+        "mlp loads");
+  DataSet    inputs = randomDataSet(10, 3, rng);
+  RealVector expected(2), actual(2);
+  for (fluid::index i = 0; i < inputs.size(); i++)
+  {
+    RealVector point(inputs.getData().row(i));
+    in.processFrame(point, expected, 0, in.size());
+    out.processFrame(point, actual, 0, out.size());
+    check(near(expected, actual, 0),
+          "mlp prediction for input " + std::to_string(i));
+  }
+}
+
+// Bad input leaves the object as it was
+void testInvalid(std::mt19937& rng)
+{
+  DataSet ds = randomDataSet(5, 2, rng);
+  check(jsonstream::load(std::string("{\"cols\": 2, \"data\": "), ds) ==
+            jsonstream::Status::kParseError,
+        "truncated json is a parse error");
+  check(jsonstream::load(
+            std::string("{\"cols\": 3, \"data\": {\"a\": [1, 2]}}"), ds) ==
+            jsonstream::Status::kInvalid,
+        "point of the wrong size is invalid");
+  check(ds.size() == 5 && ds.pointSize() == 2, "failed loads keep the dataset");
+
+  // links that would send a search out of bounds, and unknown activations
+  KDTree         tree(randomDataSet(20, 2, rng));
+  nlohmann::json j = tree;
+  j["tree"][1][0] = tree.size();
+  check(jsonstream::load(j.dump(), tree) == jsonstream::Status::kInvalid,
+        "kdtree child past the end is invalid");
+  j = tree;
+  j["tree"][1][0] = 0;
+  check(jsonstream::load(j.dump(), tree) == jsonstream::Status::kInvalid,
+        "kdtree root as a child is invalid");
+  check(tree.size() == 20, "failed loads keep the kdtree");
+  MLP mlp;
+  mlp.init(3, 2, FluidTensor<fluid::index, 1>{6}, 1, 3);
+  j = mlp;
+  j["layers"][0]["activation"] = 7;
+  check(jsonstream::load(j.dump(), mlp) == jsonstream::Status::kInvalid,
+        "mlp activation out of range is invalid");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  testDataSet(rng);
+  testKDTree(rng);
+  testMLP(rng);
+  testInvalid(rng);
+  return result();
+}
@@ -0,0 +1,380 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks KDTree against the tree it replaced and against a brute force
+// search. A tree built from a dataset must have the same preorder layout as
+// the old node graph flattened, and its nearest neighbours, with and without
+// a radius, must be those found by comparing the query with every point, also
+// after a round trip through toFlat() and fromFlat(), and for batches of
+// queries split between threads, and for a tree whose build is split between
+// threads. So must a tree changed a point at a time, kept within the
+// scapegoat depth bound. The query for the audio thread must find the same
+// into the caller's storage without allocating.
+
+#include "TestUtils.hpp"
+#include <algorithms/public/KDTree.hpp>
+#include <algorithms/util/ParallelFor.hpp>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::KDTree;
+using DataSet = KDTree::DataSet;
+
+// Counts allocations, to check the real-time query makes none
+std::atomic<long> allocations{0};
+
+void* operator new(std::size_t size)
+{
+  allocations++;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// The old tree's build: sort the points along the splitting dimension, make
+// the median the node and recurse on each side, flattened in preorder
+fluid::index baselineBuild(const DataSet& dataset,
+                           std::vector<fluid::index>::iterator from,
+                           std::vector<fluid::index>::iterator to,
+                           fluid::index depth, fluid::index node,
+                           KDTree::FlatData& flat)
+{
+  if (from == to) return node;
+  fluid::index d = depth % dataset.pointSize();
+  auto         data = dataset.getData();
+  std::sort(from, to, [&](fluid::index a, fluid::index b) {
+    return data(a, d) < data(b, d);
+  });
+  fluid::index median = std::distance(from, to) / 2;
+  fluid::index point = *(from + median);
+  flat.ids(node) = dataset.getIds()(point);
+  flat.data.row(node) = data.row(point);
+  fluid::index next = node + 1;
+  flat.tree(node, 0) = median > 0 ? next : -1;
+  next = baselineBuild(dataset, from, from + median, depth + 1, next, flat);
+  flat.tree(node, 1) = from + median + 1 < to ? next : -1;
+  return baselineBuild(dataset, from + median + 1, to, depth + 1, next, flat);
+}
+
+KDTree::FlatData baseline(const DataSet& dataset)
+{
+  KDTree::FlatData          flat(dataset.size(), dataset.pointSize());
+  std::vector<fluid::index> points(asUnsigned(dataset.size()));
+  std::iota(points.begin(), points.end(), 0);
+  baselineBuild(dataset, points.begin(), points.end(), 0, 0, flat);
+  return flat;
+}
+
+bool sameLayout(const KDTree::FlatData& a, const KDTree::FlatData& b)
+{
+  if (a.ids.size() != b.ids.size()) return false;
+  for (fluid::index i = 0; i < a.ids.size(); i++)
+    if (a.ids(i) != b.ids(i)) return false;
+  return std::equal(a.tree.begin(), a.tree.end(), b.tree.begin()) &&
+         near(a.data, b.data, 0);
+}
+
+// Random queries for k from one to more than there are points, each with no
+// radius and with one around a few points' worth
+void testQueries(const KDTree& tree, const DataSet& dataset,
+                 std::mt19937& rng, const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.2, 1.2);
+  RealVector                             query(dataset.pointSize());
+  const fluid::index                     n = dataset.size();
+  for (fluid::index q = 0; q < 20; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    for (fluid::index k : {fluid::index(1), fluid::index(5), n + 3})
+    {
+      for (double radius : {0.0, 0.5})
+      {
+        check(sameNeighbours(tree.kNearest(query, k, radius),
+                             bruteForce(dataset, query, k, radius)),
+              what + ", k " + std::to_string(k) + ", radius " +
+                  std::to_string(radius));
+      }
+    }
+  }
+}
+
+// The real-time query into preallocated storage: the same neighbours, none
+// past the storage or k, all of those within radius when k is 0, and not one
+// allocation
+void testRealTime(const KDTree& tree, const DataSet& dataset,
+                  std::mt19937& rng, const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.2, 1.2);
+  RealVector                             query(dataset.pointSize());
+  FluidTensor<fluid::index, 1>           nodes(8);
+  RealVector                             distances(8);
+  for (fluid::index q = 0; q < 20; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    for (fluid::index k : {0, 1, 5, 20})
+    {
+      for (double radius : {0.0, 0.5})
+      {
+        std::string rt = what + ", real-time k " + std::to_string(k) +
+                         ", radius " + std::to_string(radius);
+        long         before = allocations;
+        fluid::index found =
+            tree.kNearest(query, k, radius, nodes, distances);
+        bool allocated = allocations != before;
+        check(!allocated, rt + " doesn't allocate");
+        // with no k or radius, any of the points, as many as fit
+        auto expected = bruteForce(dataset, query, k, radius);
+        if (asSigned(expected.size()) > nodes.size())
+          expected.resize(asUnsigned(nodes.size()));
+        bool ok = found == asSigned(expected.size());
+        for (fluid::index i = 0; ok && i < found; i++)
+        {
+          ok = nodes(i) == tree.find(expected[asUnsigned(i)].second) &&
+               std::abs(distances(i) - expected[asUnsigned(i)].first) < 1e-9;
+        }
+        check(ok, rt);
+      }
+    }
+  }
+}
+
+// Enough queries to be split between threads, each row of the batch result
+// holding the brute force neighbours' slots and distances, padded
+void testBatch(const KDTree& tree, const DataSet& dataset, std::mt19937& rng,
+               const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(-1.2, 1.2);
+  FluidTensor<double, 2> queries(300, dataset.pointSize());
+  for (auto& x : queries) x = noise(rng);
+  for (fluid::index k : {1, 5})
+  {
+    for (double radius : {0.0, 0.2})
+    {
+      std::string batch = what + ", batch of k " + std::to_string(k) +
+                          ", radius " + std::to_string(radius);
+      auto found = tree.kNearestBatch(queries, k, radius);
+      bool ok = found.indices.rows() == queries.rows() &&
+                found.indices.cols() == k;
+      for (fluid::index i = 0; ok && i < queries.rows(); i++)
+      {
+        auto expected = bruteForce(dataset, queries.row(i), k, radius);
+        for (fluid::index j = 0; j < k; j++)
+        {
+          if (j < asSigned(expected.size()))
+          {
+            const auto& e = expected[asUnsigned(j)];
+            ok = ok && found.indices(i, j) == tree.find(e.second) &&
+                 std::abs(found.distances(i, j) - e.first) < 1e-9;
+          }
+          else
+          {
+            ok = ok && found.indices(i, j) == -1 &&
+                 found.distances(i, j) ==
+                     std::numeric_limits<double>::infinity();
+          }
+        }
+      }
+      check(ok, batch);
+    }
+  }
+}
+
+// How deep the tree goes below node, which for a median split is the least
+// possible for its size
+fluid::index depth(const KDTree::FlatData& flat, fluid::index node)
+{
+  if (node < 0) return 0;
+  return 1 + std::max(depth(flat, flat.tree(node, 0)),
+                      depth(flat, flat.tree(node, 1)));
+}
+
+// A dataset large enough that the build spawns threads for the upper levels'
+// subtrees must give the same tree as one built on a single thread, and as
+// the old tree, as balanced as it can be
+void testParallelBuild(std::mt19937& rng)
+{
+  const fluid::index n = 4 * (1 << 16) + 123;
+  DataSet            dataset = randomDataSet(n, 3, rng);
+  algorithm::workerLimit() = 1;
+  KDTree single(dataset);
+  algorithm::workerLimit() = 4;
+  KDTree parallel(dataset);
+  algorithm::workerLimit() = 0;
+  check(sameLayout(parallel.toFlat(), single.toFlat()),
+        "parallel build, layout as on one thread");
+  check(sameLayout(parallel.toFlat(), baseline(dataset)),
+        "parallel build, layout as the old tree's");
+  auto minDepth = static_cast<fluid::index>(std::ceil(std::log2(n + 1)));
+  check(depth(parallel.toFlat(), 0) == minDepth, "parallel build, depth");
+  std::uniform_real_distribution<double> noise(-1.2, 1.2);
+  RealVector                             query(3);
+  for (fluid::index q = 0; q < 10; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    check(sameNeighbours(parallel.kNearest(query, 5, 0.1),
+                         bruteForce(dataset, query, 5, 0.1)),
+          "parallel build, query " + std::to_string(q));
+  }
+}
+
+// Whether the tree matches the reference dataset: every point found by its
+// id, queries as a brute force search, and no deeper than the scapegoat bound
+// allows, which is log(size) / log(1 / 0.7) edges below the root for a tree
+// just grown, plus one for the removals since it last was
+void checkTree(const KDTree& tree, const DataSet& reference,
+               std::mt19937& rng, const std::string& what)
+{
+  const fluid::index n = reference.size();
+  check(tree.size() == n, what + ", size");
+  bool found = true;
+  for (fluid::index i = 0; i < n; i++)
+    found = found && tree.find(reference.getIds()(i)) != -1;
+  check(found, what + ", finds every point");
+  check(KDTree::valid(tree.toFlat().tree), what + ", links are valid");
+  if (n == 0) return;
+  double bound = std::log(n) / std::log(1 / 0.7) + 1;
+  check(depth(tree.toFlat(), 0) - 1 <= bound, what + ", depth");
+  std::uniform_real_distribution<double> noise(-1.2, 1.2);
+  RealVector                             query(reference.pointSize());
+  for (fluid::index q = 0; q < 10; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    for (fluid::index k : {1, 5})
+    {
+      for (double radius : {0.0, 0.3})
+      {
+        check(sameNeighbours(tree.kNearest(query, k, radius),
+                             bruteForce(reference, query, k, radius)),
+              what + ", k " + std::to_string(k) + ", radius " +
+                  std::to_string(radius));
+      }
+    }
+  }
+}
+
+// Points added in order along the first splitting dimension, which would
+// make a list of a tree that wasn't rebalanced, then adds, updates and
+// removals interleaved at random, and finally removal of every point
+void testIncremental(std::mt19937& rng)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  DataSet                                reference(3);
+  KDTree                                 tree(reference);
+  RealVector                             point(3);
+  fluid::index                           nextId = 0;
+
+  auto add = [&](const RealVector& p) {
+    std::string id = std::to_string(nextId++);
+    bool        added = tree.addNode(id, p);
+    reference.add(id, p);
+    return added;
+  };
+  for (fluid::index i = 0; i < 1500; i++)
+  {
+    point(0) = -1 + i / 1000.0;
+    point(1) = noise(rng);
+    point(2) = noise(rng);
+    check(add(point), "sorted add " + std::to_string(i));
+  }
+  checkTree(tree, reference, rng, "after sorted adds");
+  check(!tree.addNode("0", point), "rejects a duplicate id");
+  check(!tree.removeNode("missing"), "rejects removing a missing id");
+  check(!tree.updateNode("missing", point), "rejects updating a missing id");
+
+  std::uniform_int_distribution<int> operation(0, 3);
+  for (fluid::index i = 1; i <= 3000; i++)
+  {
+    for (auto& x : point) x = noise(rng);
+    int  op = reference.size() > 0 ? operation(rng) : 0;
+    bool ok = true;
+    if (op < 2)
+      ok = add(point);
+    else
+    {
+      std::uniform_int_distribution<fluid::index> pick(0, reference.size() - 1);
+      std::string id = reference.getIds()(pick(rng));
+      if (op == 2)
+        ok = tree.removeNode(id) && reference.remove(id);
+      else
+        ok = tree.updateNode(id, point) && reference.update(id, point);
+    }
+    check(ok, "operation " + std::to_string(i));
+    if (i % 500 == 0)
+      checkTree(tree, reference, rng,
+                "after " + std::to_string(i) + " interleaved operations");
+  }
+
+  while (reference.size() > 1)
+  {
+    std::string id = reference.getIds()(0);
+    check(tree.removeNode(id) && reference.remove(id), "removing " + id);
+    if (reference.size() % 250 == 0)
+      checkTree(tree, reference, rng,
+                "removed down to " + std::to_string(reference.size()));
+  }
+  std::string last = reference.getIds()(0);
+  check(tree.removeNode(last) && tree.size() == 0, "removes the last point");
+  reference.remove(last);
+  for (auto& x : point) x = noise(rng);
+  check(add(point), "adds to the emptied tree");
+  checkTree(tree, reference, rng, "refilled");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  for (fluid::index n : {1, 2, 7, 500})
+  {
+    for (fluid::index dims : {1, 3, 8})
+    {
+      std::string what =
+          std::to_string(n) + " points in " + std::to_string(dims) + "d";
+      DataSet dataset = randomDataSet(n, dims, rng);
+      KDTree  tree(dataset);
+      check(tree.size() == n && tree.dims() == dims, what + ", size");
+      check(sameLayout(tree.toFlat(), baseline(dataset)),
+            what + ", layout as the old tree's");
+      testQueries(tree, dataset, rng, what);
+      testRealTime(tree, dataset, rng, what);
+      KDTree loaded;
+      loaded.fromFlat(tree.toFlat());
+      check(sameLayout(loaded.toFlat(), tree.toFlat()),
+            what + ", layout after loading");
+      testQueries(loaded, dataset, rng, what + " after loading");
+      for (fluid::index i = 0; i < n; i++)
+        check(loaded.find(dataset.getIds()(i)) != -1,
+              what + ", finds point " + std::to_string(i));
+      // whatever the machine, so that batches are split between threads
+      for (fluid::index workers : {1, 4})
+      {
+        algorithm::workerLimit() = workers;
+        testBatch(tree, dataset, rng,
+                  what + ", " + std::to_string(workers) + " threads");
+      }
+      algorithm::workerLimit() = 0;
+    }
+  }
+  testParallelBuild(rng);
+  testIncremental(rng);
+  KDTree     empty{DataSet(3)};
+  RealVector query(3);
+  check(empty.size() == 0 && empty.kNearest(query, 4).size() == 0,
+        "empty tree finds nothing");
+  return result();
+}
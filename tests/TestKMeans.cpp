@@ -0,0 +1,233 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks that full batch KMeans training, which skips distances by Hamerly's
+// bounds, ends with the same means and assignments as plain Lloyd iterations
+// from the same starting means; and that OnlineKMeans, handed between threads
+// as KMeansClient and KMeansQuery do, keeps learning across its own updates
+// being applied to the model, but starts again once the model's means are
+// replaced
+
+#include "TestUtils.hpp"
+#include <algorithms/public/KMeans.hpp>
+#include <algorithms/public/OnlineKMeans.hpp>
+#include <algorithms/util/PublishedSnapshot.hpp>
+#include <algorithms/util/TripleBuffer.hpp>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::KMeans;
+using algorithm::OnlineKMeans;
+using DataSet = FluidDataSet<std::string, double, 1>;
+
+fluid::index nearestMean(const RealMatrix&               means,
+                         FluidTensorView<const double, 1> point)
+{
+  fluid::index nearest = 0;
+  double       minDistance = std::numeric_limits<double>::infinity();
+  for (fluid::index k = 0; k < means.rows(); k++)
+  {
+    double distance = 0;
+    for (fluid::index j = 0; j < point.size(); j++)
+      distance += (point(j) - means(k, j)) * (point(j) - means(k, j));
+    if (distance < minDistance)
+    {
+      nearest = k;
+      minDistance = distance;
+    }
+  }
+  return nearest;
+}
+
+// Assigns every point, then alternates moving each mean to the centroid of its
+// points and reassigning them, until no point changes cluster
+void lloyd(const DataSet& dataset, RealMatrix& means,
+           FluidTensor<fluid::index, 1>& assignments, fluid::index maxIter)
+{
+  auto data = dataset.getData();
+  for (fluid::index i = 0; i < data.rows(); i++)
+    assignments(i) = nearestMean(means, data.row(i));
+  while (maxIter-- > 0)
+  {
+    RealMatrix                   sums(means.rows(), means.cols());
+    FluidTensor<fluid::index, 1> counts(means.rows());
+    sums.fill(0);
+    counts.fill(0);
+    for (fluid::index i = 0; i < data.rows(); i++)
+    {
+      sums.row(assignments(i)).apply(data.row(i),
+                                     [](double& s, double x) { s += x; });
+      counts(assignments(i))++;
+    }
+    for (fluid::index k = 0; k < means.rows(); k++)
+      if (counts(k) > 0)
+        for (fluid::index j = 0; j < means.cols(); j++)
+          means(k, j) = sums(k, j) / counts(k);
+    fluid::index changes = 0;
+    for (fluid::index i = 0; i < data.rows(); i++)
+    {
+      fluid::index nearest = nearestMean(means, data.row(i));
+      if (nearest != assignments(i)) changes++;
+      assignments(i) = nearest;
+    }
+    if (changes == 0) break;
+  }
+}
+
+// Overlapping clusters around k random centres, so that points change
+// cluster over several iterations
+DataSet clusteredDataSet(fluid::index n, fluid::index dims, fluid::index k,
+                         std::mt19937& rng)
+{
+  DataSet centres = randomDataSet(k, dims, rng);
+  std::normal_distribution<double>            spread(0, 0.3);
+  std::uniform_int_distribution<fluid::index> pick(0, k - 1);
+  DataSet                                     dataset(dims);
+  RealVector                                  point(dims);
+  for (fluid::index i = 0; i < n; i++)
+  {
+    auto centre = centres.getData().row(pick(rng));
+    for (fluid::index j = 0; j < dims; j++) point(j) = centre(j) + spread(rng);
+    dataset.add(std::to_string(i), point);
+  }
+  return dataset;
+}
+
+template <typename Model>
+RealMatrix meansOf(const Model& model)
+{
+  RealMatrix means(model.size(), model.dims());
+  model.getMeans(means);
+  return means;
+}
+
+void testVersions(const DataSet& dataset, const RealMatrix& start)
+{
+  KMeans model;
+  model.setMeans(start);
+  OnlineKMeans online;
+  check(!online.matches(model), "an empty copy is stale");
+  online.init(model);
+  check(online.matches(model), "a copy matches its model");
+  for (fluid::index i = 0; i < 100; i++)
+    online.update(dataset.getData().row(i));
+  fluid::index version = model.version();
+  check(online.apply(model) && model.version() != version,
+        "applying a copy gives the model a new version");
+  check(online.matches(model) && near(meansOf(model), meansOf(online), 0),
+        "the applied copy still matches, with the model's means");
+  OnlineKMeans snapshot;
+  snapshot.init(model);
+  check(snapshot.matches(online), "a copy of the applied means matches");
+  KMeans copy = model;
+  check(!online.matches(copy), "a copy of the model is another lineage");
+  model.setMeans(start);
+  version = model.version();
+  check(!online.matches(model) && !online.apply(model) &&
+            model.version() == version && near(meansOf(model), start, 0),
+        "means set over a copy's leave it stale, and unapplied");
+  online.init(model);
+  model.train(dataset, start.rows(), 10);
+  check(!online.matches(model), "training leaves copies stale");
+}
+
+// A learner on one thread, taking the published means as KMeansQuery does,
+// and the model's owner on another, applying the learner's copies as
+// KMeansClient does, then replacing the means halfway through. The learner
+// should only need to start again from the published means twice.
+void testHandOff(const DataSet& dataset, const RealMatrix& start)
+{
+  KMeans model;
+  model.setMeans(start);
+  algorithm::PublishedSnapshot<OnlineKMeans> published;
+  algorithm::TripleBuffer<OnlineKMeans>      handed;
+  auto                                       publish = [&]() {
+    auto means = std::make_shared<OnlineKMeans>();
+    means->init(model);
+    published.publish(std::move(means));
+  };
+  publish();
+
+  std::atomic<bool>         done{false};
+  std::atomic<fluid::index> updates{0};
+  std::atomic<fluid::index> restarts{0};
+  OnlineKMeans              online;
+  std::thread               learner([&]() {
+    for (fluid::index i = 0; !done; i = (i + 1) % dataset.size())
+    {
+      auto means = published.read();
+      if (!online.matches(*means))
+      {
+        online = *means;
+        restarts++;
+      }
+      online.update(dataset.getData().row(i), 0.01);
+      handed.write([&](OnlineKMeans& slot) { slot = online; });
+      updates++;
+    }
+  });
+  auto applyHanded = [&]() {
+    if (handed.read() && handed.front().apply(model)) publish();
+  };
+  while (updates < 2000) applyHanded();
+  model.setMeans(start);
+  publish();
+  while (restarts < 2) applyHanded();
+  fluid::index later = updates + 2000;
+  while (updates < later) applyHanded();
+  done = true;
+  learner.join();
+  applyHanded();
+  check(restarts == 2, "the learner starts again only once replaced, not " +
+                           std::to_string(restarts - 1) + " times");
+  check(online.matches(model) && near(meansOf(model), meansOf(online), 0),
+        "the model ends with the learner's means");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  fluid::index k = 8;
+  // enough points to be split between threads
+  for (fluid::index n : {500, 5000})
+  {
+    DataSet    dataset = clusteredDataSet(n, 4, k, rng);
+    RealMatrix start(k, 4);
+    for (fluid::index c = 0; c < k; c++)
+      start.row(c) = dataset.getData().row(c * (n / k));
+
+    KMeans model;
+    model.setMeans(start);
+    model.train(dataset, k, 100);
+    RealMatrix                   means(k, 4);
+    FluidTensor<fluid::index, 1> assignments(n);
+    model.getMeans(means);
+    model.getAssignments(assignments);
+
+    RealMatrix                   expectedMeans(start);
+    FluidTensor<fluid::index, 1> expectedAssignments(n);
+    lloyd(dataset, expectedMeans, expectedAssignments, 100);
+
+    std::string what = " for " + std::to_string(n) + " points";
+    check(std::equal(assignments.begin(), assignments.end(),
+                     expectedAssignments.begin()),
+          "assignments" + what);
+    check(near(means, expectedMeans, 1e-9), "means" + what);
+    testVersions(dataset, start);
+    testHandOff(dataset, start);
+  }
+  return result();
+}
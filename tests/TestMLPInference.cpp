@@ -0,0 +1,125 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks MLPInference's predictions against MLP::processFrame, for every
+// activation, for taps between any two layers and at each precision, and that
+// plans know when they're stale. The int8 dot product is checked against
+// plain integer sums.
+
+#include "TestUtils.hpp"
+#include <algorithms/public/MLP.hpp>
+#include <algorithms/public/MLPInference.hpp>
+#include <algorithms/util/Int8Dot.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::MLP;
+using algorithm::MLPInference;
+using Precision = MLPInference::Precision;
+
+// Differences allowed from MLP's own predictions: those of kFloat are from
+// rounding, and those of kInt8 from quantising the weights and activations of
+// each layer to 8 bits
+double tolerance(Precision precision)
+{
+  switch (precision)
+  {
+  case Precision::kFloat: return 1e-5;
+  case Precision::kInt8: return 0.05;
+  default: return 1e-12;
+  }
+}
+
+void compare(MLP& mlp, fluid::index start, fluid::index end,
+             Precision precision, std::mt19937& rng, const std::string& what)
+{
+  MLPInference plan;
+  plan.init(mlp, start, end, precision);
+  check(plan.matches(mlp, start, end, precision), what + " matches");
+  auto       inputs = randomDataSet(20, mlp.inputSize(start), rng);
+  RealVector expected(mlp.outputSize(end));
+  RealVector actual(mlp.outputSize(end));
+  for (fluid::index i = 0; i < inputs.size(); i++)
+  {
+    RealVector point(inputs.getData().row(i));
+    mlp.processFrame(point, expected, start, end);
+    plan.processFrame(inputs.getData().row(i), actual);
+    check(near(actual, expected, tolerance(precision)),
+          what + ", input " + std::to_string(i));
+  }
+}
+
+void testDotInt8(std::mt19937& rng)
+{
+  std::uniform_int_distribution<int> value(-127, 127);
+  // lengths either side of the SIMD widths, and a long run of the largest
+  // products to check that the sums don't saturate
+  for (fluid::index n : {0, 1, 15, 16, 17, 31, 32, 33, 100, 5000})
+  {
+    std::vector<std::int8_t> a(asUnsigned(n)), b(asUnsigned(n));
+    std::int32_t             expected = 0;
+    for (fluid::index i = 0; i < n; i++)
+    {
+      int x = n == 5000 ? -127 : value(rng);
+      int y = n == 5000 ? -127 : value(rng);
+      a[asUnsigned(i)] = static_cast<std::int8_t>(x);
+      b[asUnsigned(i)] = static_cast<std::int8_t>(y);
+      expected += x * y;
+    }
+    check(algorithm::_impl::dotInt8(a.data(), b.data(), n) == expected,
+          "dotInt8 of " + std::to_string(n) + " pairs");
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  testDotInt8(rng);
+  for (fluid::index hidden = 0; hidden < 4; hidden++)
+  {
+    for (fluid::index output = 0; output < 4; output++)
+    {
+      MLP mlp;
+      mlp.init(5, 3, FluidTensor<fluid::index, 1>{16, 9}, hidden, output);
+      std::string what = "activations " + std::to_string(hidden) + "/" +
+                         std::to_string(output);
+      for (auto precision :
+           {Precision::kDouble, Precision::kFloat, Precision::kInt8})
+        for (fluid::index start = 0; start < mlp.size(); start++)
+          for (fluid::index end = start + 1; end <= mlp.size(); end++)
+            compare(mlp, start, end, precision, rng,
+                    what + ", precision " +
+                        std::to_string(static_cast<int>(precision)) +
+                        ", layers " + std::to_string(start) + " to " +
+                        std::to_string(end));
+    }
+  }
+
+  MLP mlp;
+  mlp.init(2, 2, FluidTensor<fluid::index, 1>{4}, 1, 0);
+  MLPInference plan;
+  plan.init(mlp, 0, mlp.size());
+  check(plan.matches(mlp, 0, mlp.size()), "fresh plan matches");
+  check(!plan.matches(mlp, 1, mlp.size()), "plan for other taps is stale");
+  check(!plan.matches(mlp, 0, mlp.size(), Precision::kInt8),
+        "plan at another precision is stale");
+  MLP copy = mlp;
+  check(!plan.matches(copy, 0, mlp.size()), "plan of an original is stale");
+  RealMatrix weights(2, 4);
+  RealVector biases(4);
+  weights.fill(0.5);
+  biases.fill(0);
+  mlp.setParameters(0, weights, biases, 1);
+  check(!plan.matches(mlp, 0, mlp.size()), "new parameters make plan stale");
+  return result();
+}
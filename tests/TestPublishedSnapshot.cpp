@@ -0,0 +1,99 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Publishes snapshots of a dataset, as DataSetClient does for RT queries,
+// while reader threads look through them: a snapshot shares the dataset's
+// storage, so the writer withdraws it before each change, changing the
+// storage in place only if no reader still holds it. Every snapshot read must
+// hold a whole state, never one being changed, and none may be freed by a
+// reader; once none is held, changes are made in place again.
+
+#include "TestUtils.hpp"
+#include <algorithms/util/PublishedSnapshot.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using DataSet = FluidDataSet<std::string, double, 1>;
+
+std::thread::id   writer;
+std::atomic<long> freedByReaders{0};
+
+struct Snapshot
+{
+  explicit Snapshot(const DataSet& d) : dataset(d) {}
+  ~Snapshot()
+  {
+    if (std::this_thread::get_id() != writer) freedByReaders++;
+  }
+  DataSet dataset;
+};
+
+int main()
+{
+  std::mt19937                           rng(42);
+  DataSet                                dataset = randomDataSet(200, 4, rng);
+  algorithm::PublishedSnapshot<Snapshot> published;
+  for (auto& x : dataset.getData()) x = 0;
+  writer = std::this_thread::get_id();
+  published.publish(std::make_shared<const Snapshot>(dataset));
+
+  std::atomic<bool> done{false};
+  std::atomic<long> reads{0};
+  std::atomic<long> torn{0};
+  auto              read = [&]() {
+    while (!done)
+    {
+      auto snapshot = published.read();
+      if (!snapshot) continue;
+      // every value of a whole state is the same
+      auto   data = snapshot->dataset.getData();
+      double first = data(0, 0);
+      for (double x : data)
+        if (x != first) torn++;
+      reads++;
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; i++) readers.emplace_back(read);
+
+  RealVector point(4);
+  for (fluid::index version = 1; version <= 2000; version++)
+  {
+    published.withdraw();
+    point.fill(static_cast<double>(version));
+    for (fluid::index i = 0; i < dataset.size(); i++)
+      dataset.update(dataset.getIds()(i), point);
+    published.publish(std::make_shared<const Snapshot>(dataset));
+    if (version % 100 == 0) std::this_thread::yield();
+  }
+  while (reads < 1000) std::this_thread::yield();
+  done = true;
+  for (auto& t : readers) t.join();
+
+  check(torn == 0, "no reader sees a state being changed");
+  check(freedByReaders == 0, "no reader frees a snapshot");
+  auto last = published.read();
+  check(last && last->dataset.getData()(0, 0) == 2000 &&
+            last->dataset.sharesStorage(dataset),
+        "the last state is published, sharing the dataset's storage");
+  last.reset();
+  published.withdraw();
+  check(dataset.unique(), "withdrawn snapshots are let go");
+  // with no readers left, a change doesn't copy the storage
+  const double* storage = dataset.getData().data();
+  dataset.update(dataset.getIds()(0), point);
+  check(dataset.getData().data() == storage, "changes in place when unshared");
+  return result();
+}
@@ -0,0 +1,371 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks SGD::train against a single-threaded loop over the same shuffled
+// batches: from the same weights and seed, the loss after each number of
+// epochs must be the same, whichever way train() splits the work, on one
+// thread or four, with each optimiser and learning rate schedule and with
+// early stopping. Each optimiser's step is checked by hand, too. Also built
+// unoptimised, as TestSGD_O0.
+
+#include "TestUtils.hpp"
+#include <algorithms/public/MLP.hpp>
+#include <algorithms/public/SGD.hpp>
+#include <algorithms/util/FluidEigenMappings.hpp>
+#include <algorithms/util/NNFuncs.hpp>
+#include <algorithms/util/NNLayer.hpp>
+#include <algorithms/util/ParallelFor.hpp>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::MLP;
+using algorithm::NNLayer;
+using algorithm::NNOptimizer;
+using algorithm::SGD;
+
+using Schedule = SGD::Schedule;
+
+struct Settings
+{
+  fluid::index      batchSize;
+  double            learningRate;
+  double            momentum;
+  double            valFrac;
+  NNOptimizer::Type optimizer{NNOptimizer::Type::kSGD};
+  Schedule          schedule{Schedule::kConstant};
+  fluid::index      step{1};
+  double            factor{1};
+  fluid::index      patience{10};
+  fluid::index      plateauPatience{5};
+};
+
+// Where a reference run ended up
+struct Trajectory
+{
+  double       loss;
+  fluid::index epochs;
+  double       learningRate;
+};
+
+// Mean squared error of the examples at rows
+double evaluate(MLP& model, const Eigen::MatrixXd& in,
+                const Eigen::MatrixXd& out, const fluid::index* rows,
+                fluid::index n)
+{
+  Eigen::MatrixXd batchIn(n, in.cols()), batchOut(n, out.cols());
+  for (fluid::index i = 0; i < n; i++)
+  {
+    batchIn.row(i) = in.row(rows[i]);
+    batchOut.row(i) = out.row(rows[i]);
+  }
+  return (model.forward(batchIn) - batchOut).squaredNorm() / n;
+}
+
+// Minibatch training with the same shuffles and schedule as SGD::train, one
+// batch at a time through the model's own workspace
+Trajectory reference(MLP& model, const Eigen::MatrixXd& in,
+                     const Eigen::MatrixXd& out, fluid::index nIter,
+                     const Settings& s, unsigned seed)
+{
+  using namespace std;
+  fluid::index         nExamples = in.rows();
+  mt19937              rng{seed};
+  vector<fluid::index> order(asUnsigned(nExamples));
+  iota(order.begin(), order.end(), 0);
+  shuffle(order.begin(), order.end(), rng);
+  fluid::index nVal = lround(nExamples * s.valFrac);
+  fluid::index nTrain = nExamples - nVal;
+  fluid::index batchSize = max<fluid::index>(1, min(s.batchSize, nTrain));
+  NNOptimizer  opt;
+  opt.type = s.optimizer;
+  opt.momentum = s.momentum;
+  fluid::index patience = s.patience;
+  double       prevValLoss = numeric_limits<double>::max();
+  double       bestLoss = prevValLoss;
+  fluid::index sinceBest = 0;
+  double       plateauRate = s.learningRate;
+  fluid::index epoch = 0;
+  while (epoch < nIter)
+  {
+    switch (s.schedule)
+    {
+    case Schedule::kStep:
+      opt.learningRate = s.learningRate * pow(s.factor, epoch / s.step);
+      break;
+    case Schedule::kCosine:
+      opt.learningRate =
+          0.5 * s.learningRate * (1 + cos(acos(-1.0) * epoch / nIter));
+      break;
+    case Schedule::kPlateau: opt.learningRate = plateauRate; break;
+    default: opt.learningRate = s.learningRate;
+    }
+    epoch++;
+    shuffle(order.begin(), order.begin() + nTrain, rng);
+    for (fluid::index start = 0; start < nTrain; start += batchSize)
+    {
+      fluid::index    n = min(batchSize, nTrain - start);
+      Eigen::MatrixXd batchIn(n, in.cols()), batchOut(n, out.cols());
+      for (fluid::index i = 0; i < n; i++)
+      {
+        batchIn.row(i) = in.row(order[asUnsigned(start + i)]);
+        batchOut.row(i) = out.row(order[asUnsigned(start + i)]);
+      }
+      Eigen::MatrixXd diff = model.forward(batchIn) - batchOut;
+      model.backward(batchIn, diff);
+      model.update(opt);
+    }
+    double valLoss =
+        nVal > 0 ? evaluate(model, in, out, order.data() + nTrain, nVal) : 0;
+    if (s.schedule == Schedule::kPlateau)
+    {
+      double loss =
+          nVal > 0 ? valLoss : evaluate(model, in, out, order.data(), nTrain);
+      if (loss < bestLoss)
+      {
+        bestLoss = loss;
+        sinceBest = 0;
+      }
+      else if (++sinceBest >= s.plateauPatience)
+      {
+        plateauRate *= s.factor;
+        sinceBest = 0;
+      }
+    }
+    if (nVal > 0)
+    {
+      patience = valLoss < prevValLoss ? s.patience : patience - 1;
+      if (patience <= 0) break;
+      prevValLoss = valLoss;
+    }
+  }
+  return {evaluate(model, in, out, order.data(), nExamples), epoch,
+          s.schedule == Schedule::kPlateau ? plateauRate : opt.learningRate};
+}
+
+bool close(double a, double b) { return std::abs(a - b) <= 1e-9 * std::abs(b); }
+
+// Outputs that are a smooth function of the inputs
+void makeData(fluid::index n, RealMatrix& in, RealMatrix& out,
+              std::mt19937& rng)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  in = RealMatrix(n, 3);
+  out = RealMatrix(n, 2);
+  for (fluid::index i = 0; i < n; i++)
+  {
+    for (fluid::index j = 0; j < 3; j++) in(i, j) = noise(rng);
+    out(i, 0) = std::sin(in(i, 0) + in(i, 1));
+    out(i, 1) = in(i, 1) * in(i, 2);
+  }
+}
+
+// Trains for up to nEpochs, checking the loss after each number of them, and
+// returns the reference's last trajectory
+Trajectory compare(const MLP& start, const RealMatrix& in,
+                   const RealMatrix& out, const Settings& s, SGD& sgd,
+                   const std::string& what, fluid::index nEpochs = 6)
+{
+  auto inMap = algorithm::_impl::asEigen<Eigen::Matrix>(in);
+  auto outMap = algorithm::_impl::asEigen<Eigen::Matrix>(out);
+  Eigen::MatrixXd inputs = inMap, outputs = outMap;
+  sgd.setOptimizer(s.optimizer);
+  sgd.setSchedule(s.schedule, s.step, s.factor);
+  sgd.setPatience(s.patience);
+  sgd.setPlateauPatience(s.plateauPatience);
+  sgd.setSeed(7);
+  double     first = 0, last = 0;
+  Trajectory expected{};
+  for (fluid::index epochs = 1; epochs <= nEpochs; epochs++)
+  {
+    MLP    trained = start, reached = start;
+    double loss = sgd.train(trained, in, out, epochs, s.batchSize,
+                            s.learningRate, s.momentum, s.valFrac);
+    expected = reference(reached, inputs, outputs, epochs, s, 7);
+    check(close(loss, expected.loss),
+          what + ", loss after " + std::to_string(epochs) + " epochs");
+    if (epochs == 1) first = loss;
+    last = loss;
+  }
+  check(last < first, what + ", loss goes down");
+  return expected;
+}
+
+// Three steps of a linear layer with two inputs, against the optimiser's
+// update written out for each parameter: weights, then bias
+void testSteps(NNOptimizer::Type type, const std::string& name)
+{
+  NNOptimizer opt;
+  opt.type = type;
+  opt.learningRate = 0.1;
+  opt.momentum = 0.8;
+  opt.decay = 0.9;
+  opt.epsilon = 0; // so that Adam's bias corrections can be applied exactly
+  Eigen::MatrixXd weights(2, 1);
+  Eigen::VectorXd biases(1);
+  weights << 0.5, -0.3;
+  biases << 0.1;
+  NNLayer layer(2, 1, 0);
+  layer.init(weights, biases, 0);
+  NNLayer::Workspace  ws;
+  std::vector<double> p{0.5, -0.3, 0.1}, v(3, 0), ms(3, 0);
+  std::mt19937        rng(3);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  for (fluid::index t = 1; t <= 3; t++)
+  {
+    fluid::index    n = t + 1;
+    Eigen::MatrixXd x(n, 2), target(n, 1);
+    for (fluid::index i = 0; i < n; i++)
+    {
+      x(i, 0) = uniform(rng);
+      x(i, 1) = uniform(rng);
+      target(i, 0) = uniform(rng);
+    }
+    std::vector<double> g(3, 0);
+    for (fluid::index i = 0; i < n; i++)
+    {
+      double d = p[0] * x(i, 0) + p[1] * x(i, 1) + p[2] - target(i, 0);
+      g[0] += d * x(i, 0) / n;
+      g[1] += d * x(i, 1) / n;
+      g[2] += d / n;
+    }
+    double mu = opt.momentum, lr = opt.learningRate, decay = opt.decay;
+    for (size_t j = 0; j < 3; j++)
+    {
+      ms[j] = decay * ms[j] + (1 - decay) * g[j] * g[j];
+      switch (type)
+      {
+      case NNOptimizer::Type::kSGD:
+        v[j] = mu * v[j] + (1 - mu) * lr * g[j];
+        p[j] -= v[j];
+        break;
+      case NNOptimizer::Type::kNesterov:
+        v[j] = mu * v[j] + (1 - mu) * lr * g[j];
+        p[j] -= mu * v[j] + (1 - mu) * lr * g[j];
+        break;
+      case NNOptimizer::Type::kRMSProp:
+        p[j] -= lr * g[j] / std::sqrt(ms[j]);
+        break;
+      case NNOptimizer::Type::kAdam:
+        v[j] = mu * v[j] + (1 - mu) * g[j];
+        p[j] -= lr * (v[j] / (1 - std::pow(mu, t))) /
+                std::sqrt(ms[j] / (1 - std::pow(decay, t)));
+        break;
+      }
+    }
+    Eigen::MatrixXd diff = layer.forward(x, ws) - target;
+    layer.backward(x, diff, ws, false);
+    layer.update(ws, opt);
+    std::vector<double> stepped{layer.getWeights()(0, 0),
+                                layer.getWeights()(1, 0),
+                                layer.getBiases()(0)};
+    check(near(stepped, p, 1e-12),
+          name + ", step " + std::to_string(t) + " by hand");
+  }
+}
+
+// Asynchronous runs can't be repeated, but must still learn
+void testAsynchronous(const MLP& start, const RealMatrix& in,
+                      const RealMatrix& out, const Settings& s, SGD& sgd,
+                      const std::string& what)
+{
+  auto inMap = algorithm::_impl::asEigen<Eigen::Matrix>(in);
+  auto outMap = algorithm::_impl::asEigen<Eigen::Matrix>(out);
+  Eigen::MatrixXd inputs = inMap, outputs = outMap;
+  MLP             untrained = start, trained = start;
+  double initialLoss = reference(untrained, inputs, outputs, 0, s, 7).loss;
+  sgd.setOptimizer(s.optimizer);
+  sgd.setSchedule(s.schedule, s.step, s.factor);
+  double loss = sgd.train(trained, in, out, 20, s.batchSize, s.learningRate,
+                          s.momentum, s.valFrac, true);
+  check(std::isfinite(loss) && loss < initialLoss,
+        what + ", asynchronous training learns");
+}
+
+int main()
+{
+  using Type = NNOptimizer::Type;
+  const std::vector<std::pair<Type, std::string>> optimizers{
+      {Type::kSGD, "SGD"},
+      {Type::kNesterov, "Nesterov"},
+      {Type::kRMSProp, "RMSProp"},
+      {Type::kAdam, "Adam"}};
+  for (auto& o : optimizers) testSteps(o.first, o.second);
+
+  std::mt19937 rng(42);
+  RealMatrix   in, out;
+  makeData(400, in, out, rng);
+  MLP start;
+  start.init(3, 2, FluidTensor<fluid::index, 1>{8}, 1, 0);
+  SGD sgd;
+  // whatever the machine, so that batches are split between threads
+  for (fluid::index workers : {1, 4})
+  {
+    algorithm::workerLimit() = workers;
+    std::string threads = std::to_string(workers) + " threads, ";
+    // batches large enough to be split, and small ones
+    for (fluid::index batchSize : {1, 10, 128})
+    {
+      for (double valFrac : {0.0, 0.2})
+      {
+        Settings    s{batchSize, 0.05, 0.9, valFrac};
+        std::string what = threads + "batch " + std::to_string(batchSize) +
+                           ", validation " + std::to_string(valFrac);
+        compare(start, in, out, s, sgd, what);
+      }
+    }
+    for (auto& o : optimizers)
+    {
+      // the adaptive optimisers take steps of about the learning rate
+      bool     adaptive = o.first == Type::kRMSProp || o.first == Type::kAdam;
+      Settings s{32, adaptive ? 0.005 : 0.05, 0.9, 0.2, o.first};
+      compare(start, in, out, s, sgd, threads + o.second);
+      testAsynchronous(start, in, out, s, sgd, threads + o.second);
+    }
+
+    Settings s{32, 0.1, 0.9, 0.2};
+    s.schedule = Schedule::kStep;
+    s.step = 2;
+    s.factor = 0.5;
+    compare(start, in, out, s, sgd, threads + "step schedule");
+    s.schedule = Schedule::kCosine;
+    compare(start, in, out, s, sgd, threads + "cosine schedule");
+
+    // a rate too high to keep improving on, so that the plateau lowers it
+    s = Settings{32, 0.5, 0.9, 0.0};
+    s.schedule = Schedule::kPlateau;
+    s.factor = 0.5;
+    s.plateauPatience = 1;
+    Trajectory plateau =
+        compare(start, in, out, s, sgd, threads + "plateau schedule", 10);
+    check(plateau.learningRate < s.learningRate,
+          threads + "plateau lowers the learning rate");
+
+    // and too high for the validation loss, so that training stops early
+    for (fluid::index patience : {1, 2})
+    {
+      s = Settings{10, 0.5, 0.9, 0.2};
+      s.patience = patience;
+      std::string what =
+          threads + "patience " + std::to_string(patience) + ", ";
+      Trajectory stopped =
+          compare(start, in, out, s, sgd, what + "early stopping", 20);
+      check(stopped.epochs < 20, what + "training stops early");
+    }
+  }
+  return result();
+}
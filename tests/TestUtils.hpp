@@ -0,0 +1,120 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include <algorithms/util/DistanceFuncs.hpp>
+#include <algorithms/util/FluidEigenMappings.hpp>
+#include <data/FluidDataSet.hpp>
+#include <data/FluidIndex.hpp>
+#include <data/FluidTensor.hpp>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Helpers for the test programs, which compare the fast paths against
+// straightforward references and return nonzero from main if any check fails
+namespace fluid {
+namespace test {
+
+inline index& failures()
+{
+  static index count = 0;
+  return count;
+}
+
+inline void check(bool ok, const std::string& what)
+{
+  if (ok) return;
+  std::cerr << "FAILED: " << what << std::endl;
+  failures()++;
+}
+
+inline int result() { return failures() == 0 ? 0 : 1; }
+
+// Whether two tensors or views hold the same values, to within tolerance
+template <typename A, typename B>
+bool near(const A& a, const B& b, double tolerance = 1e-9)
+{
+  if (a.size() != b.size()) return false;
+  auto x = a.begin();
+  for (auto y = b.begin(); y != b.end(); ++x, ++y)
+    if (std::abs(*x - *y) > tolerance) return false;
+  return true;
+}
+
+// n points of uniform noise in [-1, 1), with ids "0" to "n - 1"
+inline FluidDataSet<std::string, double, 1>
+randomDataSet(index n, index dims, std::mt19937& rng)
+{
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  FluidTensor<std::string, 1>            ids(n);
+  FluidTensor<double, 2>                 data(n, dims);
+  for (index i = 0; i < n; i++)
+  {
+    ids(i) = std::to_string(i);
+    for (index j = 0; j < dims; j++) data(i, j) = noise(rng);
+  }
+  return {std::move(ids), std::move(data)};
+}
+
+// The k points of a dataset nearest to query by the given metric, or all of
+// them if k is 0, that are within radius if that's positive: (distance, id)
+// pairs in ascending order, found by comparing query with every point
+inline std::vector<std::pair<double, std::string>>
+bruteForce(const FluidDataSet<std::string, double, 1>& dataset,
+           FluidTensorView<const double, 1> query, index k, double radius,
+           algorithm::DistanceFuncs::Distance metric =
+               algorithm::DistanceFuncs::Distance::kEuclidean)
+{
+  using namespace Eigen;
+  std::vector<std::pair<double, std::string>> found;
+  auto points = algorithm::_impl::asEigen<Array>(dataset.getData());
+  auto q = algorithm::_impl::asEigen<Array>(query);
+  algorithm::visitDistance(metric, [&](auto kernel) {
+    for (index i = 0; i < dataset.size(); i++)
+    {
+      ArrayXd point = points.row(i).transpose();
+      ArrayXd target = q.col(0);
+      double  distance = kernel.apply(point, target);
+      if (radius <= 0 || distance < radius)
+        found.emplace_back(distance, dataset.getIds()(i));
+    }
+  });
+  std::sort(found.begin(), found.end());
+  if (k > 0 && asSigned(found.size()) > k) found.resize(asUnsigned(k));
+  return found;
+}
+
+// Whether a search's results, as a DataSet of distances keyed by id, are the
+// expected ones in the same order
+inline bool
+sameNeighbours(const FluidDataSet<std::string, double, 1>&        result,
+               const std::vector<std::pair<double, std::string>>& expected,
+               double tolerance = 1e-9)
+{
+  if (result.size() != asSigned(expected.size())) return false;
+  for (index i = 0; i < result.size(); i++)
+  {
+    if (result.getIds()(i) != expected[asUnsigned(i)].second ||
+        std::abs(result.getData()(i, 0) - expected[asUnsigned(i)].first) >
+            tolerance)
+      return false;
+  }
+  return true;
+}
+
+} // namespace test
+} // namespace fluid
@@ -0,0 +1,138 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+// Checks VPTree for every metric it supports, and KDTree for the Minkowski
+// ones, against a brute force search by the same metric: single queries, with
+// and without a radius, and batches split between threads, also after a
+// round trip through toFlat() and fromFlat().
+
+#include "TestUtils.hpp"
+#include <algorithms/public/KDTree.hpp>
+#include <algorithms/public/VPTree.hpp>
+#include <algorithms/util/ParallelFor.hpp>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace fluid;
+using namespace fluid::test;
+using algorithm::KDTree;
+using algorithm::VPTree;
+using DataSet = VPTree::DataSet;
+using Distance = algorithm::DistanceFuncs::Distance;
+
+// Points in (0, 2], as Jensen-Shannon distance treats points as distributions
+DataSet positiveDataSet(fluid::index n, fluid::index dims, std::mt19937& rng)
+{
+  DataSet dataset = randomDataSet(n, dims, rng);
+  for (auto& x : dataset.getData()) x = 1 - x;
+  return dataset;
+}
+
+template <typename Tree>
+void testQueries(const Tree& tree, const DataSet& dataset, Distance metric,
+                 std::mt19937& rng, const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(0.0, 2.0);
+  RealVector                             query(dataset.pointSize());
+  const fluid::index                     n = dataset.size();
+  // radii of a few points' worth, for the ranges of the metrics' distances
+  const double radius = metric == Distance::kCosine ? 0.05
+                        : metric == Distance::kJS   ? 0.1
+                                                    : 0.5;
+  for (fluid::index q = 0; q < 20; q++)
+  {
+    for (auto& x : query) x = noise(rng);
+    for (fluid::index k : {fluid::index(1), fluid::index(5), n + 3})
+    {
+      for (double r : {0.0, radius})
+      {
+        check(sameNeighbours(tree.kNearest(query, k, r),
+                             bruteForce(dataset, query, k, r, metric)),
+              what + ", k " + std::to_string(k) + ", radius " +
+                  std::to_string(r));
+      }
+    }
+  }
+}
+
+template <typename Tree>
+void testBatch(const Tree& tree, const DataSet& dataset, Distance metric,
+               std::mt19937& rng, const std::string& what)
+{
+  std::uniform_real_distribution<double> noise(0.0, 2.0);
+  FluidTensor<double, 2> queries(200, dataset.pointSize());
+  for (auto& x : queries) x = noise(rng);
+  const fluid::index k = 4;
+  auto               found = tree.kNearestBatch(queries, k);
+  bool               ok = true;
+  for (fluid::index i = 0; ok && i < queries.rows(); i++)
+  {
+    auto expected = bruteForce(dataset, queries.row(i), k, 0, metric);
+    for (fluid::index j = 0; j < k; j++)
+    {
+      if (j < asSigned(expected.size()))
+      {
+        fluid::index node = found.indices(i, j);
+        ok = ok && node >= 0 &&
+             tree.getIds()(node) == expected[asUnsigned(j)].second &&
+             std::abs(found.distances(i, j) - expected[asUnsigned(j)].first) <
+                 1e-9;
+      }
+      else
+        ok = ok && found.indices(i, j) == -1;
+    }
+  }
+  check(ok, what + ", batch");
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  for (Distance metric : {Distance::kManhattan, Distance::kEuclidean,
+                          Distance::kMax, Distance::kCosine, Distance::kJS})
+  {
+    // in one dimension all angles, and all distributions, are the same
+    bool minkowski = KDTree::supports(metric);
+    for (fluid::index dims : {1, 3, 8})
+    {
+      if (dims == 1 && !minkowski) continue;
+      for (fluid::index n : {1, 2, 7, 500})
+      {
+        std::string what = "metric " +
+                           std::to_string(static_cast<int>(metric)) + ", " +
+                           std::to_string(n) + " points in " +
+                           std::to_string(dims) + "d";
+        DataSet dataset = positiveDataSet(n, dims, rng);
+        VPTree  tree(dataset, metric);
+        check(tree.size() == n && tree.metric() == metric, what + ", size");
+        testQueries(tree, dataset, metric, rng, what);
+        VPTree loaded;
+        loaded.fromFlat(tree.toFlat(), metric);
+        testQueries(loaded, dataset, metric, rng, what + " after loading");
+        for (fluid::index workers : {1, 4})
+        {
+          algorithm::workerLimit() = workers;
+          testBatch(tree, dataset, metric, rng,
+                    what + ", " + std::to_string(workers) + " threads");
+        }
+        algorithm::workerLimit() = 0;
+        if (minkowski)
+        {
+          KDTree kdtree(dataset, metric);
+          testQueries(kdtree, dataset, metric, rng, what + ", KDTree");
+          testBatch(kdtree, dataset, metric, rng, what + ", KDTree");
+        }
+      }
+    }
+  }
+  return result();
+}